@@ -0,0 +1,217 @@
+#include "include/ansi.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+#define ANSI_INITIAL_CAP 4096
+
+#define FG_SET 1
+#define BG_SET 2
+
+static const char *upper_half = "\xE2\x96\x80";
+static const char *lower_half = "\xE2\x96\x84";
+
+char fami_ansi_init(fami_ansi_t *ansi) {
+    memset(ansi, 0, sizeof(fami_ansi_t));
+    ansi->data = my_malloc(ANSI_INITIAL_CAP);
+    ansi->cap = ANSI_INITIAL_CAP;
+    ansi->row = -1;
+    return ansi->data != NULL;
+}
+
+static void put(fami_ansi_t *ansi, const char *s, size_t n) {
+    if (ansi->error) {
+        return;
+    }
+    if (ansi->len+n > ansi->cap) {
+        size_t cap = ansi->cap*2 > ansi->len+n ? ansi->cap*2 : ansi->len+n;
+        char *grown = realloc(ansi->data, cap);
+        if (!grown) {
+            ansi->error = 1;
+            return;
+        }
+        ansi->data = grown;
+        ansi->cap = cap;
+    }
+    memcpy(ansi->data+ansi->len, s, n);
+    ansi->len += n;
+}
+
+static void put_number(fami_ansi_t *ansi, unsigned int v) {
+    char digits[10];
+    int n = 0;
+    do {
+        digits[sizeof(digits)-1-n++] = '0'+v%10;
+        v /= 10;
+    } while (v);
+    put(ansi, digits+sizeof(digits)-n, n);
+}
+
+static uint32_t normalize(uint32_t color) {
+    uint8_t bytes[4];
+    memcpy(bytes, &color, 4);
+    return bytes[3] == 0 ? FAMI_ANSI_DEFAULT : color;
+}
+
+// 38 or 48 followed by the color, or the default background
+static void put_color(fami_ansi_t *ansi, const char *kind, uint32_t color) {
+    if (color == FAMI_ANSI_DEFAULT) {
+        put(ansi, "49", 2);
+        return;
+    }
+    uint8_t bytes[4];
+    memcpy(bytes, &color, 4);
+    put(ansi, kind, 2);
+    put(ansi, ";2", 2);
+    for (int i = 0; i < 3; i++) {
+        put(ansi, ";", 1);
+        put_number(ansi, bytes[i]);
+    }
+}
+
+// sets the colors that differ, fg is only set if set_fg is
+static void set_colors(fami_ansi_t *ansi, char set_fg, uint32_t fg, uint32_t bg) {
+    char fg_changed = set_fg && (!(ansi->colors_set & FG_SET) || ansi->fg != fg);
+    char bg_changed = !(ansi->colors_set & BG_SET) || ansi->bg != bg;
+    if (!fg_changed && !bg_changed) {
+        return;
+    }
+    put(ansi, "\x1B[", 2);
+    if (fg_changed) {
+        put_color(ansi, "38", fg);
+        ansi->fg = fg;
+        ansi->colors_set |= FG_SET;
+    }
+    if (bg_changed) {
+        if (fg_changed) {
+            put(ansi, ";", 1);
+        }
+        put_color(ansi, "48", bg);
+        ansi->bg = bg;
+        ansi->colors_set |= BG_SET;
+    }
+    put(ansi, "m", 1);
+}
+
+static void move_to(fami_ansi_t *ansi, int row, int col) {
+    if (row == ansi->row && col == ansi->col) {
+        return;
+    }
+    put(ansi, "\x1B[", 2);
+    if (row == ansi->row && col > ansi->col) {
+        // skipping forward on the same line is shorter
+        if (col-ansi->col > 1) {
+            put_number(ansi, col-ansi->col);
+        }
+        put(ansi, "C", 1);
+    } else {
+        put_number(ansi, row+1);
+        put(ansi, ";", 1);
+        put_number(ansi, col+1);
+        put(ansi, "H", 1);
+    }
+    ansi->row = row;
+    ansi->col = col;
+}
+
+static void put_cell(fami_ansi_t *ansi, int row, int col, uint32_t top, uint32_t bottom) {
+    move_to(ansi, row, col);
+    top = normalize(top);
+    bottom = normalize(bottom);
+
+    if (top == bottom) {
+        // a space only needs the background
+        set_colors(ansi, 0, 0, top);
+        put(ansi, " ", 1);
+    } else if (top == FAMI_ANSI_DEFAULT) {
+        set_colors(ansi, 1, bottom, top);
+        put(ansi, lower_half, 3);
+    } else if (bottom == FAMI_ANSI_DEFAULT) {
+        set_colors(ansi, 1, top, bottom);
+        put(ansi, upper_half, 3);
+    } else {
+        // either half block works, pick the one needing fewer color changes
+        char fg_known = ansi->colors_set & FG_SET;
+        char bg_known = ansi->colors_set & BG_SET;
+        int upper_cost = !(fg_known && ansi->fg == top) + !(bg_known && ansi->bg == bottom);
+        int lower_cost = !(fg_known && ansi->fg == bottom) + !(bg_known && ansi->bg == top);
+        if (lower_cost < upper_cost) {
+            set_colors(ansi, 1, bottom, top);
+            put(ansi, lower_half, 3);
+        } else {
+            set_colors(ansi, 1, top, bottom);
+            put(ansi, upper_half, 3);
+        }
+    }
+    ansi->col++;
+}
+
+size_t fami_ansi_frame(fami_ansi_t *ansi, const uint32_t *pixels, uint32_t *shown,
+        int width, int height, int row, int col, char full) {
+    size_t start = ansi->len;
+    if (start == 0) {
+        // nothing is known about the terminal before the first cell
+        put(ansi, "\x1B" "7", 2);
+        ansi->row = -1;
+        ansi->colors_set = 0;
+    }
+
+    size_t cells = 0;
+    for (int y = 0; y < height; y += 2) {
+        const uint32_t *top = pixels+(size_t)y*width;
+        const uint32_t *bottom = y+1 < height ? top+width : NULL;
+        const uint32_t *shown_top = shown+(size_t)y*width;
+        for (int x = 0; x < width; x++) {
+            uint32_t lower = bottom ? bottom[x] : FAMI_ANSI_DEFAULT;
+            if (!full && shown_top[x] == top[x] && (!bottom || shown_top[width+x] == lower)) {
+                continue;
+            }
+            put_cell(ansi, row+y/2, col+x, top[x], lower);
+            cells++;
+        }
+    }
+    memcpy(shown, pixels, (size_t)width*height*sizeof(uint32_t));
+
+    if (cells == 0 && start == 0) {
+        ansi->len = 0;
+    }
+    return cells;
+}
+
+size_t fami_ansi_flush(fami_ansi_t *ansi, int fd) {
+    if (ansi->len == 0) {
+        return 0;
+    }
+    put(ansi, "\x1B[0m\x1B" "8", 6);
+    if (ansi->error) {
+        ansi->len = 0;
+        ansi->error = 0;
+        return 0;
+    }
+
+    size_t written = 0;
+    while (written < ansi->len) {
+        ssize_t n = write(fd, ansi->data+written, ansi->len-written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    ansi->len = 0;
+    return written;
+}
+
+void fami_ansi_free(fami_ansi_t *ansi) {
+    my_free(ansi->data);
+    ansi->data = NULL;
+    ansi->len = 0;
+    ansi->cap = 0;
+}
@@ -0,0 +1,559 @@
+/**
+ * Codec microbenchmarks
+ * Runs every kernel over synthetic banks of growing size and prints the results
+ * as json on stdout, progress goes to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "include/famisprite.h"
+#include "include/utility.h"
+#include "include/simd.h"
+#include "include/lut.h"
+#include "include/packed.h"
+#include "include/image.h"
+#include "include/parallel.h"
+#include "include/stream.h"
+#include "include/dedup.h"
+#include "include/flip.h"
+#include "include/chrz.h"
+#include "include/codec.h"
+#include "include/palette.h"
+#include "include/tilestore.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_CYCLES 1
+static uint64_t cycles() {
+    return __rdtsc();
+}
+#else
+#define HAS_CYCLES 0
+static uint64_t cycles() {
+    return 0;
+}
+#endif
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+#define MIN_BANK (8*1024)
+#define MAX_BANK (256*1024*1024)
+// pixels rendered per call, the framebuffer stays in cache
+#define RENDER_PIXELS (64*1024)
+// the optimal parse of the nes codecs is too slow for the largest banks
+#define CODEC_MAX_BANK (4*1024*1024)
+// every noise tile takes an entry of the persistent tile cache
+#define STORE_MAX_BANK (4*1024*1024)
+
+typedef struct bench_settings {
+    size_t min_bank;
+    size_t max_bank;
+    double min_seconds; // each measurement repeats at least this long
+    unsigned int threads;
+} bench_settings_t;
+
+/**
+ * Buffers shared by all benchmarks of one bank size
+ */
+typedef struct bank {
+    char *chr;
+    char *decoded;
+    fami_packed_row *packed;
+    char *chrz; // compressed chr
+    size_t chrz_len;
+    fami_codec_t codec;
+    char *encoded; // chr compressed with codec
+    size_t encoded_len;
+    size_t chr_len;
+    size_t tiles;
+    fami_tile_store_t store;
+} bank_t;
+
+typedef void (*bench_fn)(bank_t *bank);
+
+typedef struct result {
+    double seconds; // best run
+    uint64_t cycles; // of the best run
+} result_t;
+
+static bench_settings_t settings;
+static char first_result = 1;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+// fills a buffer with reproducible noise
+static void fill_noise(char *data, size_t len, uint32_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+}
+
+static result_t measure(bench_fn fn, bank_t *bank) {
+    result_t best = {1e30, 0};
+    double total = 0;
+    int runs = 0;
+    // at least 3 runs, the first one warms up caches and lazy tables
+    while (runs < 3 || total < settings.min_seconds) {
+        uint64_t c = cycles();
+        double start = now_seconds();
+        fn(bank);
+        double seconds = now_seconds()-start;
+        c = cycles()-c;
+        if (runs > 0 && seconds < best.seconds) {
+            best.seconds = seconds;
+            best.cycles = c;
+        }
+        total += seconds;
+        runs++;
+    }
+    return best;
+}
+
+static void report(const char *name, bank_t *bank, result_t r) {
+    double ns_per_tile = r.seconds*1e9 / bank->tiles;
+    double gb_per_s = bank->chr_len / r.seconds / 1e9;
+
+    printf("%s\n    {\"name\": \"%s\", \"bank_bytes\": %zu, \"tiles\": %zu, "
+            "\"seconds\": %.9f, \"ns_per_tile\": %.4f, \"gb_per_s\": %.4f, ",
+            first_result ? "" : ",", name, bank->chr_len, bank->tiles,
+            r.seconds, ns_per_tile, gb_per_s);
+    if (HAS_CYCLES) {
+        printf("\"cycles_per_pixel\": %.4f}", (double)r.cycles / (bank->tiles*FAMI_TILE_PIXELS));
+    } else {
+        printf("\"cycles_per_pixel\": null}");
+    }
+    first_result = 0;
+    fprintf(stderr, "%-24s %10zu bytes %10.3f ns/tile %8.3f GB/s\n",
+            name, bank->chr_len, ns_per_tile, gb_per_s);
+}
+
+static result_t run(const char *name, bench_fn fn, bank_t *bank) {
+    result_t r = measure(fn, bank);
+    report(name, bank, r);
+    return r;
+}
+
+/**
+ * Benchmarks
+ */
+
+static void bench_decode_tile(bank_t *bank) {
+    for (size_t i = 0; i < bank->tiles; i++) {
+        unsigned int len = 0;
+        fami_decode_tile(bank->chr+i*FAMI_TILE_SIZE, bank->decoded+i*FAMI_TILE_PIXELS, &len);
+    }
+}
+
+static void bench_encode_tile(bank_t *bank) {
+    for (size_t i = 0; i < bank->tiles; i++) {
+        unsigned int len = 0;
+        fami_encode_tile(bank->decoded+i*FAMI_TILE_PIXELS, bank->chr+i*FAMI_TILE_SIZE, &len);
+    }
+}
+
+static void bench_decode(bank_t *bank) {
+    unsigned int len = bank->chr_len;
+    fami_decode(bank->chr, &len, bank->decoded);
+}
+
+static void bench_encode(bank_t *bank) {
+    unsigned int len = bank->tiles*FAMI_TILE_PIXELS;
+    fami_encode(bank->decoded, &len, bank->chr);
+}
+
+static void bench_decode_lut_full(bank_t *bank) {
+    unsigned int len = bank->chr_len;
+    fami_decode_lut(bank->chr, &len, bank->decoded, FAMI_LUT_FULL);
+}
+
+static void bench_decode_lut_split(bank_t *bank) {
+    unsigned int len = bank->chr_len;
+    fami_decode_lut(bank->chr, &len, bank->decoded, FAMI_LUT_SPLIT);
+}
+
+static void bench_decode_mt(bank_t *bank) {
+    unsigned int len = bank->chr_len;
+    fami_decode_mt(bank->chr, &len, bank->decoded, settings.threads);
+}
+
+static void bench_encode_mt(bank_t *bank) {
+    unsigned int len = bank->tiles*FAMI_TILE_PIXELS;
+    fami_encode_mt(bank->decoded, &len, bank->chr, settings.threads);
+}
+
+// touches every pixel of the bank once, 8 pixels wide like the editor buffer
+static void bench_get_pixel(bank_t *bank) {
+    unsigned int rows = bank->tiles*FAMI_TILE_LEN;
+    unsigned int sum = 0;
+    for (unsigned int y = 0; y < rows; y++) {
+        for (unsigned int x = 0; x < FAMI_TILE_LEN; x++) {
+            sum += fami_get_pixel(bank->decoded, x, y);
+        }
+    }
+    // keep the loop from being optimized away
+    bank->decoded[0] = sum & FAMI_MAX_COLOR_INDEX;
+}
+
+static void bench_set_pixel(bank_t *bank) {
+    unsigned int rows = bank->tiles*FAMI_TILE_LEN;
+    for (unsigned int y = 0; y < rows; y++) {
+        for (unsigned int x = 0; x < FAMI_TILE_LEN; x++) {
+            fami_set_pixel(bank->decoded, x, y, x+y);
+        }
+    }
+}
+
+static void bench_pack_chr(bank_t *bank) {
+    unsigned int len = bank->chr_len;
+    fami_pack_chr(bank->chr, &len, bank->packed);
+}
+
+static void bench_unpack_chr(bank_t *bank) {
+    unsigned int len = bank->tiles*FAMI_PACKED_TILE_ROWS;
+    fami_unpack_chr(bank->packed, &len, bank->chr);
+}
+
+static void bench_stream_decode(bank_t *bank) {
+    static fami_stream_t stream;
+    fami_stream_init(&stream, FAMI_STREAM_DECODE);
+    size_t in = 0;
+    size_t out = 0;
+    while (in < bank->chr_len) {
+        in += fami_stream_feed(&stream, bank->chr+in, bank->chr_len-in);
+        out += fami_stream_drain(&stream, bank->decoded+out, bank->tiles*FAMI_TILE_PIXELS-out);
+    }
+    fami_stream_finish(&stream);
+}
+
+static void write_sheet(bank_t *bank, fami_image_format_t format) {
+    FILE *f = fopen("/dev/null", "wb");
+    if (!f) {
+        return;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    fami_state_t state;
+    fami_image_init_state(&state);
+    fami_write_sheet(f, bank->chr, bank->chr_len, &state, FAMI_SHEET_WIDTH, format);
+    fclose(f);
+}
+
+static void render(bank_t *bank, char rgba) {
+    static uint8_t out[RENDER_PIXELS*4];
+    uint32_t colors[FAMI_MAX_COLORS];
+    fami_state_t state;
+    fami_image_init_state(&state);
+    fami_palette_pack(&state, 0, colors);
+
+    size_t pixels = bank->tiles*FAMI_TILE_PIXELS;
+    for (size_t i = 0; i < pixels; i += RENDER_PIXELS) {
+        size_t count = pixels-i < RENDER_PIXELS ? pixels-i : RENDER_PIXELS;
+        if (rgba) {
+            fami_render_rgba(bank->decoded+i, count, colors, out);
+        } else {
+            fami_render_rgb(bank->decoded+i, count, colors, out);
+        }
+    }
+}
+
+static void bench_render_rgba(bank_t *bank) {
+    render(bank, 1);
+}
+
+static void bench_render_rgb(bank_t *bank) {
+    render(bank, 0);
+}
+
+// the planes of every tile start at its decoded pixels and run into the next two
+static void bench_nearest(bank_t *bank) {
+    char indices[FAMI_TILE_PIXELS];
+    uint32_t colors[FAMI_MAX_COLORS];
+    fami_state_t state;
+    fami_image_init_state(&state);
+    fami_palette_pack(&state, 0, colors);
+
+    size_t last = bank->tiles > 2 ? bank->tiles-2 : 1;
+    for (size_t t = 0; t < bank->tiles; t++) {
+        fami_nearest_tile((uint8_t*)bank->decoded+t%last*FAMI_TILE_PIXELS, colors, indices);
+    }
+}
+
+// every tile is already in the store
+static void bench_store_warm(bank_t *bank) {
+    fami_tile_store_decode(&bank->store, bank->chr, bank->tiles, bank->decoded, NULL);
+}
+
+static void bench_sheet_ppm(bank_t *bank) {
+    write_sheet(bank, FAMI_IMAGE_PPM);
+}
+
+static void bench_sheet_png(bank_t *bank) {
+    write_sheet(bank, FAMI_IMAGE_PNG);
+}
+
+static void bench_dedup(bank_t *bank) {
+    fami_dedup_t dedup;
+    if (fami_dedup(bank->chr, bank->chr_len, &dedup)) {
+        fami_dedup_free(&dedup);
+    }
+}
+
+static void bench_dedup_flip(bank_t *bank) {
+    fami_dedup_t dedup;
+    if (fami_dedup_flip(bank->chr, bank->chr_len, &dedup)) {
+        fami_dedup_free(&dedup);
+    }
+}
+
+static void bench_tile_canonical(bank_t *bank) {
+    for (size_t i = 0; i < bank->tiles; i++) {
+        fami_tile_canonical(bank->chr+i*FAMI_TILE_SIZE, bank->chr+i*FAMI_TILE_SIZE);
+    }
+}
+
+// redundant like real banks, a quarter blank and the rest from 64 distinct tiles
+static void fill_tiled(bank_t *bank) {
+    char distinct[64*FAMI_TILE_SIZE];
+    fill_noise(distinct, sizeof(distinct), 64);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < bank->tiles; i++) {
+        seed = seed * 1103515245 + 12345;
+        char *tile = bank->chr+i*FAMI_TILE_SIZE;
+        if ((seed >> 16) % 4 == 0) {
+            memset(tile, 0, FAMI_TILE_SIZE);
+        } else {
+            memcpy(tile, distinct+(seed >> 18) % 64*FAMI_TILE_SIZE, FAMI_TILE_SIZE);
+        }
+    }
+}
+
+static void bench_chrz_compress(bank_t *bank) {
+    size_t len = 0;
+    my_free(fami_chrz_compress(bank->chr, bank->chr_len, &len));
+}
+
+static void bench_chrz_decompress(bank_t *bank) {
+    fami_chrz_read(bank->chrz, bank->chrz_len, 0, bank->chr_len, bank->decoded);
+}
+
+static void bench_codec_encode(bank_t *bank) {
+    size_t len = 0;
+    my_free(fami_codec_encode(bank->codec, bank->chr, bank->chr_len, &len, settings.threads));
+}
+
+static void bench_codec_decode(bank_t *bank) {
+    size_t len = 0;
+    my_free(fami_codec_decode(bank->codec, bank->encoded, bank->encoded_len, &len));
+}
+
+/**
+ * Driver
+ */
+
+static void print_cpu() {
+    char model[256] = "unknown";
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f) {
+        char line[512];
+        while (fgets(line, sizeof(line), f)) {
+            char *colon = strchr(line, ':');
+            if (strncmp(line, "model name", 10) == 0 && colon) {
+                snprintf(model, sizeof(model), "%s", colon+2);
+                model[strcspn(model, "\n")] = '\0';
+                break;
+            }
+        }
+        fclose(f);
+    }
+    // cpu names do not contain quotes or backslashes, but be safe
+    for (char *p = model; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            *p = ' ';
+        }
+    }
+    printf("  \"cpu\": \"%s\",\n", model);
+    printf("  \"simd_level\": \"%s\",\n", fami_simd_level_name(fami_simd_get_level()));
+    printf("  \"threads\": %u,\n", settings.threads ? settings.threads : fami_default_threads());
+}
+
+static void parse_bench_inputs(int argc, char **argv) {
+    settings.min_bank = MIN_BANK;
+    settings.max_bank = MAX_BANK;
+    settings.min_seconds = 0.2;
+    settings.threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (is_arg(argv[i], "-h")) {
+            printf("Usage: bench [options]\n\n");
+            printf("-min<bytes>\tSmallest bank (default %d).\n", MIN_BANK);
+            printf("-max<bytes>\tLargest bank (default %d).\n", MAX_BANK);
+            printf("-t<seconds>\tMinimum time per measurement (default 0.2).\n");
+            printf("-j<number>\tThreads for the parallel kernels (default all cpus).\n");
+            exit(0);
+        } else if (is_arg(argv[i], "-min")) {
+            settings.min_bank = strtoull(parse_arg(argv[i], "-min").value, NULL, 0);
+        } else if (is_arg(argv[i], "-max")) {
+            settings.max_bank = strtoull(parse_arg(argv[i], "-max").value, NULL, 0);
+        } else if (is_arg(argv[i], "-t")) {
+            settings.min_seconds = strtod(parse_arg(argv[i], "-t").value, NULL);
+        } else if (is_arg(argv[i], "-j")) {
+            settings.threads = strtoul(parse_arg(argv[i], "-j").value, NULL, 0);
+        } else {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    if (settings.min_bank < FAMI_TILE_SIZE) {
+        settings.min_bank = FAMI_TILE_SIZE;
+    }
+}
+
+int main(int argc, char **argv) {
+    parse_bench_inputs(argc, argv);
+
+    printf("{\n");
+    print_cpu();
+    printf("  \"results\": [");
+
+    // lut mode wins per bank size
+    char winners[64][8];
+    size_t winner_sizes[64];
+    int winner_count = 0;
+    double full_total = 0;
+    double split_total = 0;
+
+    fami_simd_level_t level = fami_simd_get_level();
+    for (size_t size = settings.min_bank; size <= settings.max_bank && winner_count < 64; size *= 8) {
+        bank_t bank;
+        bank.chr_len = size / FAMI_TILE_SIZE * FAMI_TILE_SIZE;
+        bank.tiles = bank.chr_len / FAMI_TILE_SIZE;
+        bank.chr = my_malloc(bank.chr_len);
+        bank.decoded = my_malloc(bank.tiles*FAMI_TILE_PIXELS);
+        bank.packed = my_malloc(bank.tiles*FAMI_PACKED_TILE_ROWS*sizeof(fami_packed_row));
+        if (!bank.chr || !bank.decoded || !bank.packed) {
+            fprintf(stderr, "Out of memory for a %zu byte bank\n", size);
+            my_free(bank.chr);
+            my_free(bank.decoded);
+            my_free(bank.packed);
+            break;
+        }
+        fill_noise(bank.chr, bank.chr_len, size);
+
+        run("decode_tile", bench_decode_tile, &bank);
+        run("encode_tile", bench_encode_tile, &bank);
+
+        // every supported kernel level, then the active one through the public api
+        char name[64];
+        for (int l = 0; l < FAMI_SIMD_LEVELS; l++) {
+            if (!fami_simd_set_level(l)) {
+                continue;
+            }
+            snprintf(name, sizeof(name), "decode_%s", fami_simd_level_name(l));
+            run(name, bench_decode, &bank);
+            snprintf(name, sizeof(name), "encode_%s", fami_simd_level_name(l));
+            run(name, bench_encode, &bank);
+        }
+        fami_simd_set_level(level);
+        run("decode", bench_decode, &bank);
+        run("encode", bench_encode, &bank);
+
+        // renders the decoded bank left by the decode runs
+        for (int l = 0; l < FAMI_SIMD_LEVELS; l++) {
+            if (!fami_simd_set_level(l)) {
+                continue;
+            }
+            snprintf(name, sizeof(name), "render_rgba_%s", fami_simd_level_name(l));
+            run(name, bench_render_rgba, &bank);
+            snprintf(name, sizeof(name), "render_rgb_%s", fami_simd_level_name(l));
+            run(name, bench_render_rgb, &bank);
+            snprintf(name, sizeof(name), "nearest_%s", fami_simd_level_name(l));
+            run(name, bench_nearest, &bank);
+        }
+        fami_simd_set_level(level);
+
+        result_t full = run("decode_lut_full", bench_decode_lut_full, &bank);
+        result_t split = run("decode_lut_split", bench_decode_lut_split, &bank);
+        full_total += full.seconds / bank.tiles;
+        split_total += split.seconds / bank.tiles;
+        winner_sizes[winner_count] = bank.chr_len;
+        strcpy(winners[winner_count++], fami_lut_mode_name(
+                    full.seconds <= split.seconds ? FAMI_LUT_FULL : FAMI_LUT_SPLIT));
+
+        run("decode_mt", bench_decode_mt, &bank);
+        run("encode_mt", bench_encode_mt, &bank);
+        run("get_pixel", bench_get_pixel, &bank);
+        run("set_pixel", bench_set_pixel, &bank);
+        run("pack_chr", bench_pack_chr, &bank);
+        run("unpack_chr", bench_unpack_chr, &bank);
+        run("stream_decode", bench_stream_decode, &bank);
+        run("sheet_ppm", bench_sheet_ppm, &bank);
+        run("sheet_png", bench_sheet_png, &bank);
+        run("dedup", bench_dedup, &bank);
+        run("dedup_flip", bench_dedup_flip, &bank);
+        run("tile_canonical", bench_tile_canonical, &bank);
+
+        char store_path[] = "/tmp/famisprite_benchXXXXXX";
+        int store_fd = bank.chr_len <= STORE_MAX_BANK ? mkstemp(store_path) : -1;
+        if (store_fd >= 0) {
+            close(store_fd);
+            if (fami_tile_store_open(&bank.store, store_path, bank.tiles*2, 1)) {
+                bench_store_warm(&bank);
+                run("store_warm", bench_store_warm, &bank);
+                fami_tile_store_close(&bank.store);
+            }
+            unlink(store_path);
+        }
+
+        // compression needs data that is not noise
+        fill_tiled(&bank);
+        run("chrz_compress", bench_chrz_compress, &bank);
+        bank.chrz = fami_chrz_compress(bank.chr, bank.chr_len, &bank.chrz_len);
+        if (bank.chrz) {
+            run("chrz_decompress", bench_chrz_decompress, &bank);
+            fprintf(stderr, "chrz ratio %.3f\n", (double)bank.chr_len/bank.chrz_len);
+            my_free(bank.chrz);
+        }
+
+        for (int codec = 0; codec < FAMI_CODECS && bank.chr_len <= CODEC_MAX_BANK; codec++) {
+            bank.codec = codec;
+            bank.encoded = fami_codec_encode(codec, bank.chr, bank.chr_len, &bank.encoded_len, settings.threads);
+            if (!bank.encoded) {
+                continue;
+            }
+            snprintf(name, sizeof(name), "%s_encode", fami_codec_name(codec));
+            run(name, bench_codec_encode, &bank);
+            snprintf(name, sizeof(name), "%s_decode", fami_codec_name(codec));
+            run(name, bench_codec_decode, &bank);
+            fprintf(stderr, "%s ratio %.3f\n", fami_codec_name(codec), (double)bank.chr_len/bank.encoded_len);
+            my_free(bank.encoded);
+        }
+
+        my_free(bank.chr);
+        my_free(bank.decoded);
+        my_free(bank.packed);
+
+        if (size > settings.max_bank/8) {
+            break;
+        }
+    }
+
+    printf("\n  ],\n");
+    printf("  \"lut_winner\": {\n    \"overall\": \"%s\",\n    \"by_bank_bytes\": {",
+            fami_lut_mode_name(full_total <= split_total ? FAMI_LUT_FULL : FAMI_LUT_SPLIT));
+    for (int i = 0; i < winner_count; i++) {
+        printf("%s\"%zu\": \"%s\"", i ? ", " : "", winner_sizes[i], winners[i]);
+    }
+    printf("}\n  }\n}\n");
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "include/bitmap.h"
+
+#define inside(bitmap, x, y) ((x) >= 0 && (y) >= 0 \
+        && (unsigned int)(x) < (bitmap)->width && (unsigned int)(y) < (bitmap)->height)
+
+void fami_bitmap_init(fami_bitmap_t *bitmap, char *data, unsigned int tiles_w,
+        unsigned int tiles_h, unsigned int stride) {
+    bitmap->data = data;
+    bitmap->width = tiles_w*FAMI_TILE_LEN;
+    bitmap->height = tiles_h*FAMI_TILE_LEN;
+    bitmap->stride = stride ? stride : tiles_w;
+}
+
+char *fami_bitmap_tile(fami_bitmap_t *bitmap, unsigned int x, unsigned int y) {
+    size_t tile = (size_t)(y/FAMI_TILE_LEN)*bitmap->stride + x/FAMI_TILE_LEN;
+    return bitmap->data+tile*FAMI_TILE_PIXELS;
+}
+
+fami_color_index fami_bitmap_get(fami_bitmap_t *bitmap, unsigned int x, unsigned int y) {
+    return fami_get_pixel(fami_bitmap_tile(bitmap, x, y), x%FAMI_TILE_LEN, y%FAMI_TILE_LEN);
+}
+
+void fami_bitmap_set(fami_bitmap_t *bitmap, int x, int y, fami_color_index index) {
+    if (!inside(bitmap, x, y)) {
+        return;
+    }
+    fami_set_pixel(fami_bitmap_tile(bitmap, x, y), x%FAMI_TILE_LEN, y%FAMI_TILE_LEN, index);
+}
+
+// pushes the start of every run of target pixels in row y between left and right
+static size_t push_runs(fami_bitmap_t *bitmap, int left, int right, int y,
+        fami_color_index target, uint32_t *stack, size_t top) {
+    if (y < 0 || (unsigned int)y >= bitmap->height) {
+        return top;
+    }
+    char in_run = 0;
+    for (int x = left; x <= right; x++) {
+        char match = fami_bitmap_get(bitmap, x, y) == target;
+        if (match && !in_run) {
+            stack[top++] = (uint32_t)y << 16 | x;
+        }
+        in_run = match;
+    }
+    return top;
+}
+
+size_t fami_bitmap_flood(fami_bitmap_t *bitmap, int x, int y, fami_color_index index,
+        uint32_t *stack) {
+    index &= FAMI_MAX_COLOR_INDEX;
+    if (!inside(bitmap, x, y)) {
+        return 0;
+    }
+    fami_color_index target = fami_bitmap_get(bitmap, x, y);
+    if (target == index) {
+        return 0;
+    }
+
+    // every run is pushed at most once from the row above and once from below
+    size_t filled = 0;
+    size_t top = 0;
+    stack[top++] = (uint32_t)y << 16 | x;
+    while (top > 0) {
+        uint32_t seed = stack[--top];
+        int sx = seed & 0xFFFF;
+        int sy = seed >> 16;
+        if (fami_bitmap_get(bitmap, sx, sy) != target) {
+            // filled through another seed already
+            continue;
+        }
+
+        int left = sx;
+        while (left > 0 && fami_bitmap_get(bitmap, left-1, sy) == target) {
+            left--;
+        }
+        int right = sx;
+        while ((unsigned int)right+1 < bitmap->width && fami_bitmap_get(bitmap, right+1, sy) == target) {
+            right++;
+        }
+        for (int i = left; i <= right; i++) {
+            fami_bitmap_set(bitmap, i, sy, index);
+        }
+        filled += right-left+1;
+
+        top = push_runs(bitmap, left, right, sy-1, target, stack, top);
+        top = push_runs(bitmap, left, right, sy+1, target, stack, top);
+    }
+    return filled;
+}
+
+void fami_bitmap_line(fami_bitmap_t *bitmap, int x0, int y0, int x1, int y1,
+        fami_color_index index) {
+    int dx = x1 > x0 ? x1-x0 : x0-x1;
+    int dy = y1 > y0 ? y0-y1 : y1-y0;
+    int step_x = x0 < x1 ? 1 : -1;
+    int step_y = y0 < y1 ? 1 : -1;
+    int error = dx+dy;
+
+    while (1) {
+        fami_bitmap_set(bitmap, x0, y0, index);
+        if (x0 == x1 && y0 == y1) {
+            break;
+        }
+        int e2 = 2*error;
+        if (e2 >= dy) {
+            error += dy;
+            x0 += step_x;
+        }
+        if (e2 <= dx) {
+            error += dx;
+            y0 += step_y;
+        }
+    }
+}
+
+void fami_bitmap_rect(fami_bitmap_t *bitmap, int x0, int y0, int x1, int y1,
+        fami_color_index index, char filled) {
+    if (x0 > x1) {
+        int t = x0; x0 = x1; x1 = t;
+    }
+    if (y0 > y1) {
+        int t = y0; y0 = y1; y1 = t;
+    }
+    for (int y = y0; y <= y1; y++) {
+        if (filled || y == y0 || y == y1) {
+            for (int x = x0; x <= x1; x++) {
+                fami_bitmap_set(bitmap, x, y, index);
+            }
+        } else {
+            fami_bitmap_set(bitmap, x0, y, index);
+            fami_bitmap_set(bitmap, x1, y, index);
+        }
+    }
+}
+
+void fami_bitmap_copy(fami_bitmap_t *dst, int dx, int dy, fami_bitmap_t *src,
+        int sx, int sy, int w, int h) {
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            if (inside(src, sx+x, sy+y)) {
+                fami_bitmap_set(dst, dx+x, dy+y, fami_bitmap_get(src, sx+x, sy+y));
+            }
+        }
+    }
+}
@@ -0,0 +1,390 @@
+#include "include/chrz.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 0xFFFF
+#define HASH_BITS 12
+#define NIBBLE_MAX 15
+
+typedef struct chrz_header {
+    size_t block_bytes;
+    size_t raw_length;
+    size_t blocks;
+    uint8_t *offsets; // blocks+1 u32 entries
+    uint8_t *block_data;
+    size_t block_data_len;
+} chrz_header_t;
+
+static inline uint32_t load32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/**
+ * Block compression
+ */
+
+// worst case output of a block, every byte a literal
+static size_t block_bound(size_t n) {
+    return n + n/255 + 16;
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *literals, size_t literal_len,
+        size_t offset, size_t match_len) {
+    uint8_t *token = op++;
+    size_t match_code = match_len ? match_len-MIN_MATCH : 0;
+    *token = (literal_len < NIBBLE_MAX ? literal_len : NIBBLE_MAX) << 4
+        | (match_code < NIBBLE_MAX ? match_code : NIBBLE_MAX);
+    if (literal_len >= NIBBLE_MAX) {
+        op = put_length(op, literal_len-NIBBLE_MAX);
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+    if (match_len) {
+        *op++ = offset;
+        *op++ = offset >> 8;
+        if (match_code >= NIBBLE_MAX) {
+            op = put_length(op, match_code-NIBBLE_MAX);
+        }
+    }
+    return op;
+}
+
+static inline uint32_t hash_seq(uint32_t seq) {
+    return (seq*2654435761u) >> (32-HASH_BITS);
+}
+
+// greedy lz77 over one block, returns the compressed size
+static size_t compress_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    // positions + 1, 0 is empty
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    uint8_t *op = dst;
+    size_t ip = 0;
+    size_t anchor = 0;
+    while (ip+MIN_MATCH <= n) {
+        uint32_t seq = load32(src+ip);
+        uint32_t h = hash_seq(seq);
+        size_t candidate = table[h];
+        table[h] = ip+1;
+        if (!candidate || ip-(candidate-1) > MAX_OFFSET || load32(src+candidate-1) != seq) {
+            ip++;
+            continue;
+        }
+
+        size_t ref = candidate-1;
+        size_t len = MIN_MATCH;
+        while (ip+len < n && src[ref+len] == src[ip+len]) {
+            len++;
+        }
+        op = put_sequence(op, src+anchor, ip-anchor, ip-ref, len);
+
+        // index the matched bytes so repeated tiles keep matching
+        for (size_t p = ip+1; p < ip+len && p+MIN_MATCH <= n; p++) {
+            table[hash_seq(load32(src+p))] = p+1;
+        }
+        ip += len;
+        anchor = ip;
+    }
+    op = put_sequence(op, src+anchor, n-anchor, 0, 0);
+    return op-dst;
+}
+
+static char get_length(const uint8_t **ip, const uint8_t *end, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= end) {
+            return 0;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+// returns 1 if the block decompressed to exactly n bytes
+static char decompress_block(const uint8_t *src, size_t src_len, uint8_t *out, size_t n) {
+    const uint8_t *ip = src;
+    const uint8_t *end = src+src_len;
+    size_t op = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == NIBBLE_MAX && !get_length(&ip, end, &literal_len)) {
+            return 0;
+        }
+        if (literal_len > (size_t)(end-ip) || literal_len > n-op) {
+            return 0;
+        }
+        memcpy(out+op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == end) {
+            // last sequence has no match
+            break;
+        }
+
+        if (end-ip < 2) {
+            return 0;
+        }
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t len = token & NIBBLE_MAX;
+        if (len == NIBBLE_MAX && !get_length(&ip, end, &len)) {
+            return 0;
+        }
+        len += MIN_MATCH;
+        if (offset == 0 || offset > op || len > n-op) {
+            return 0;
+        }
+
+        uint8_t *d = out+op;
+        const uint8_t *s = d-offset;
+        if (offset >= len) {
+            memcpy(d, s, len);
+        } else if (offset >= 8) {
+            // overlapping but every chunk only reads bytes already written
+            size_t i = 0;
+            for (; i+8 <= len; i += 8) {
+                memcpy(d+i, s+i, 8);
+            }
+            for (; i < len; i++) {
+                d[i] = s[i];
+            }
+        } else {
+            for (size_t i = 0; i < len; i++) {
+                d[i] = s[i];
+            }
+        }
+        op += len;
+    }
+    return op == n;
+}
+
+/**
+ * Container
+ */
+
+static char parse_header(char *data, size_t length, chrz_header_t *header) {
+    uint8_t *p = (uint8_t*)data;
+    if (!fami_chrz_check(data, length) || p[4] != FAMI_CHRZ_VERSION) {
+        return 0;
+    }
+    size_t block_tiles = p[6] | p[7] << 8;
+    uint64_t raw_length = 0;
+    for (int i = 7; i >= 0; i--) {
+        raw_length = raw_length << 8 | p[8+i];
+    }
+    header->blocks = get_u32(p+16);
+    header->block_bytes = block_tiles*FAMI_TILE_SIZE;
+    header->raw_length = raw_length;
+    if (block_tiles == 0 || raw_length > SIZE_MAX/2
+            || header->blocks != (raw_length+header->block_bytes-1)/header->block_bytes) {
+        return 0;
+    }
+
+    size_t index_len = (header->blocks+1)*4;
+    if (index_len > length-FAMI_CHRZ_HEADER_SIZE) {
+        return 0;
+    }
+    header->offsets = p+FAMI_CHRZ_HEADER_SIZE;
+    header->block_data = header->offsets+index_len;
+    header->block_data_len = length-FAMI_CHRZ_HEADER_SIZE-index_len;
+
+    uint32_t previous = 0;
+    for (size_t i = 0; i <= header->blocks; i++) {
+        uint32_t offset = get_u32(header->offsets+i*4);
+        if (offset < previous || offset > header->block_data_len) {
+            return 0;
+        }
+        previous = offset;
+    }
+    return 1;
+}
+
+// decompresses block i of the container into out, which holds a whole block
+static char read_block(chrz_header_t *header, size_t i, uint8_t *out) {
+    uint32_t start = get_u32(header->offsets+i*4);
+    uint32_t end = get_u32(header->offsets+(i+1)*4);
+    size_t n = header->block_bytes;
+    if (i == header->blocks-1) {
+        n = header->raw_length-i*header->block_bytes;
+    }
+    if (end-start == n) {
+        memcpy(out, header->block_data+start, n);
+        return 1;
+    }
+    return decompress_block(header->block_data+start, end-start, out, n);
+}
+
+char fami_chrz_check(char *data, size_t length) {
+    return length >= FAMI_CHRZ_HEADER_SIZE && memcmp(data, FAMI_CHRZ_MAGIC, 4) == 0;
+}
+
+size_t fami_chrz_length(char *data, size_t length) {
+    chrz_header_t header;
+    if (!parse_header(data, length, &header)) {
+        return 0;
+    }
+    return header.raw_length;
+}
+
+char *fami_chrz_compress(char *data, size_t length, size_t *compressed_length) {
+    size_t block_bytes = FAMI_CHRZ_BLOCK_TILES*FAMI_TILE_SIZE;
+    size_t blocks = (length+block_bytes-1)/block_bytes;
+    size_t index_len = (blocks+1)*4;
+    // blocks never grow, the offsets have to fit in 32 bits
+    if (length > UINT32_MAX-index_len-FAMI_CHRZ_HEADER_SIZE) {
+        return NULL;
+    }
+
+    uint8_t *out = my_malloc(FAMI_CHRZ_HEADER_SIZE+index_len+length);
+    uint8_t *scratch = my_malloc(block_bound(block_bytes));
+    if (!out || !scratch) {
+        my_free(out);
+        my_free(scratch);
+        return NULL;
+    }
+
+    memcpy(out, FAMI_CHRZ_MAGIC, 4);
+    out[4] = FAMI_CHRZ_VERSION;
+    out[5] = 0;
+    out[6] = FAMI_CHRZ_BLOCK_TILES & 0xFF;
+    out[7] = FAMI_CHRZ_BLOCK_TILES >> 8;
+    for (int i = 0; i < 8; i++) {
+        out[8+i] = (uint64_t)length >> (i*8);
+    }
+    put_u32(out+16, blocks);
+
+    uint8_t *offsets = out+FAMI_CHRZ_HEADER_SIZE;
+    uint8_t *block_data = offsets+index_len;
+    size_t pos = 0;
+    for (size_t i = 0; i < blocks; i++) {
+        const uint8_t *src = (uint8_t*)data+i*block_bytes;
+        size_t n = i == blocks-1 ? length-i*block_bytes : block_bytes;
+        size_t packed = compress_block(src, n, scratch);
+        put_u32(offsets+i*4, pos);
+        if (packed < n) {
+            memcpy(block_data+pos, scratch, packed);
+            pos += packed;
+        } else {
+            memcpy(block_data+pos, src, n);
+            pos += n;
+        }
+    }
+    put_u32(offsets+blocks*4, pos);
+    my_free(scratch);
+
+    *compressed_length = FAMI_CHRZ_HEADER_SIZE+index_len+pos;
+    uint8_t *shrunk = realloc(out, *compressed_length);
+    return (char*)(shrunk ? shrunk : out);
+}
+
+char fami_chrz_read(char *data, size_t length, size_t start, size_t count, char *out) {
+    chrz_header_t header;
+    if (!parse_header(data, length, &header) || start > header.raw_length
+            || count > header.raw_length-start) {
+        return 0;
+    }
+    if (count == 0) {
+        return 1;
+    }
+
+    uint8_t *scratch = NULL;
+    char ok = 1;
+    size_t first = start/header.block_bytes;
+    size_t last = (start+count-1)/header.block_bytes;
+    for (size_t i = first; ok && i <= last; i++) {
+        size_t block_start = i*header.block_bytes;
+        size_t block_end = block_start+header.block_bytes;
+        if (block_end > header.raw_length) {
+            block_end = header.raw_length;
+        }
+        size_t from = start > block_start ? start : block_start;
+        size_t to = start+count < block_end ? start+count : block_end;
+
+        if (from == block_start && to == block_end) {
+            // fully covered blocks go straight to the output
+            ok = read_block(&header, i, (uint8_t*)out+(block_start-start));
+            continue;
+        }
+        if (!scratch && !(scratch = my_malloc(header.block_bytes))) {
+            return 0;
+        }
+        ok = read_block(&header, i, scratch);
+        memcpy(out+(from-start), scratch+(from-block_start), to-from);
+    }
+    my_free(scratch);
+    return ok;
+}
+
+char *fami_chrz_decompress(char *data, size_t length, size_t *raw_length) {
+    chrz_header_t header;
+    if (!parse_header(data, length, &header)) {
+        return NULL;
+    }
+    char *out = my_malloc(header.raw_length+1);
+    if (!out) {
+        return NULL;
+    }
+    if (!fami_chrz_read(data, length, 0, header.raw_length, out)) {
+        my_free(out);
+        return NULL;
+    }
+    *raw_length = header.raw_length;
+    return out;
+}
+
+char *fami_chrz_decode(char *data, size_t length, size_t first_tile, unsigned int *decoded_length, char *decoded) {
+    // fami_decode reads a trailing partial tile whole, it gets zeros past the range
+    size_t count = *decoded_length;
+    size_t padded = (count+FAMI_TILE_SIZE-1)/FAMI_TILE_SIZE*FAMI_TILE_SIZE;
+    size_t start = first_tile*FAMI_TILE_SIZE;
+    size_t raw_length = fami_chrz_length(data, length);
+    size_t available = raw_length > start ? raw_length-start : 0;
+    size_t read = padded < available ? padded : available;
+    if (read < count) {
+        return NULL;
+    }
+    char *chr = my_malloc(padded+1);
+    if (!chr) {
+        return NULL;
+    }
+    if (!fami_chrz_read(data, length, start, read, chr)) {
+        my_free(chr);
+        return NULL;
+    }
+    memset(chr+read, 0, padded-read);
+    decoded = fami_decode(chr, decoded_length, decoded);
+    my_free(chr);
+    return decoded;
+}
@@ -0,0 +1,792 @@
+#include "include/codec.h"
+#include "include/famisprite.h"
+#include "include/parallel.h"
+#include "include/simd.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+#define NESLIB_MAX_RUN 255
+#define KONAMI_MAX_RUN 0x80
+#define KONAMI_MAX_LITERAL (0xFE - 0x80)
+#define KONAMI_END 0xFF
+#define PREDICT_BLOCK_TILES 256
+#define PREDICT_BLOCK_SIZE (PREDICT_BLOCK_TILES*FAMI_TILE_SIZE)
+// flag, color table and 8 rows of 3 bits per pixel, rounded up
+#define PREDICT_TILE_BOUND 28
+#define PREDICT_ROWS (FAMI_TILE_PIXELS/FAMI_TILE_LEN)
+
+#define TOKEN_LITERAL 0
+#define TOKEN_RUN 1
+
+/**
+ * One chunk of the input, parsed and emitted on its own
+ */
+typedef struct chunk {
+    fami_codec_t codec;
+    const uint8_t *data; // whole input, a chunk may look at the byte before it
+    size_t start;
+    size_t end;
+    uint8_t tag; // neslib rle
+    uint8_t *out;
+    size_t out_len;
+    char ok;
+} chunk_t;
+
+typedef struct rle_limits {
+    size_t max_literal;
+    size_t min_run;
+    size_t max_run;
+} rle_limits_t;
+
+const char *fami_codec_name(fami_codec_t codec) {
+    switch (codec) {
+        case FAMI_CODEC_NESLIB_RLE:
+            return "neslib";
+        case FAMI_CODEC_KONAMI_RLE:
+            return "konami";
+        case FAMI_CODEC_PREDICT:
+            return "predict";
+        default:
+            return "unknown";
+    }
+}
+
+fami_codec_t fami_codec_from_name(const char *name) {
+    for (int codec = 0; codec < FAMI_CODECS; codec++) {
+        if (strcmp(name, fami_codec_name(codec)) == 0) {
+            return codec;
+        }
+    }
+    return FAMI_CODECS;
+}
+
+// worst case body of a chunk, no header or terminator
+static size_t chunk_bound(fami_codec_t codec, size_t n) {
+    switch (codec) {
+        case FAMI_CODEC_KONAMI_RLE:
+            return n + n/KONAMI_MAX_LITERAL + 1;
+        case FAMI_CODEC_PREDICT:
+            return n/FAMI_TILE_SIZE*PREDICT_TILE_BOUND + n/PREDICT_BLOCK_SIZE + 1;
+        default:
+            return n;
+    }
+}
+
+/**
+ * Shortest parse
+ * cost[i] is the size of the best encoding of the chunk from i on,
+ * filled back to front. len and kind keep the token chosen at i.
+ */
+
+typedef struct parse {
+    uint32_t *cost;
+    uint16_t *len;
+    uint8_t *kind;
+    uint16_t *run; // equal bytes starting at i, capped
+    size_t *window; // literal search, see parse_rle
+} parse_t;
+
+static char parse_init(parse_t *p, const uint8_t *data, size_t n, size_t max_run) {
+    p->cost = my_malloc((n+1)*sizeof(uint32_t));
+    p->len = my_malloc(n*sizeof(uint16_t)+1);
+    p->kind = my_malloc(n+1);
+    p->run = my_malloc(n*sizeof(uint16_t)+1);
+    p->window = my_malloc((n+1)*sizeof(size_t));
+    if (!p->cost || !p->len || !p->kind || !p->run || !p->window) {
+        return 0;
+    }
+    for (size_t i = n; i-- > 0;) {
+        p->run[i] = 1;
+        if (i+1 < n && data[i] == data[i+1] && p->run[i+1] < max_run) {
+            p->run[i] = p->run[i+1]+1;
+        }
+    }
+    p->cost[n] = 0;
+    return 1;
+}
+
+static void parse_free(parse_t *p) {
+    my_free(p->cost);
+    my_free(p->len);
+    my_free(p->kind);
+    my_free(p->run);
+    my_free(p->window);
+}
+
+/**
+ * Konami rle
+ * A literal group from i to j costs 1+j-i+cost[j], so the best one ends at the
+ * smallest j+cost[j] inside the window i+1 .. i+max_literal. The window keeps
+ * its candidates in a queue ordered by that value, the front is the minimum.
+ */
+static inline size_t literal_key(parse_t *p, size_t j) {
+    return j+p->cost[j];
+}
+
+static void parse_rle(parse_t *p, size_t n, rle_limits_t *limits) {
+    size_t *queue = p->window;
+    size_t head = 0; // oldest, largest j
+    size_t tail = 0; // one past the newest, smallest j
+    for (size_t i = n; i-- > 0;) {
+        size_t j = i+1;
+        while (tail > head && literal_key(p, queue[tail-1]) >= literal_key(p, j)) {
+            tail--;
+        }
+        queue[tail++] = j;
+        while (queue[head] > i+limits->max_literal) {
+            head++;
+        }
+
+        size_t end = queue[head];
+        uint32_t best = 1+end-i+p->cost[end];
+        p->len[i] = end-i;
+        p->kind[i] = TOKEN_LITERAL;
+
+        size_t run = p->run[i] < limits->max_run ? p->run[i] : limits->max_run;
+        for (size_t k = limits->min_run; k <= run; k++) {
+            uint32_t c = 2+p->cost[i+k];
+            if (c < best) {
+                best = c;
+                p->len[i] = k;
+                p->kind[i] = TOKEN_RUN;
+            }
+        }
+        p->cost[i] = best;
+    }
+}
+
+// a neslib run repeats the byte before it, which may be in the previous chunk
+static void parse_neslib(parse_t *p, const uint8_t *data, size_t n, char has_prev) {
+    for (size_t i = n; i-- > 0;) {
+        p->cost[i] = 1+p->cost[i+1];
+        p->len[i] = 1;
+        p->kind[i] = TOKEN_LITERAL;
+        if ((i > 0 || has_prev) && data[i] == data[(ptrdiff_t)i-1]) {
+            for (size_t k = 1; k <= p->run[i]; k++) {
+                if (2+p->cost[i+k] < p->cost[i]) {
+                    p->cost[i] = 2+p->cost[i+k];
+                    p->len[i] = k;
+                    p->kind[i] = TOKEN_RUN;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Color prediction, see codec.h
+ * Pixels are coded by the color before them in the row. For every color the
+ * color table lists the colors that follow it, most frequent first, a color
+ * without followers is always followed by itself:
+ *  0 = same color as before
+ *  1 = first follower, with 2 or 3 followers another bit tells which
+ * the first follower is 10, then 110 and 111 with 3 followers.
+ */
+
+typedef struct predict_table {
+    uint8_t count[4]; // followers of each color
+    uint8_t next[4][3];
+} predict_table_t;
+
+// bits of the follower code, by number of followers and position
+static const uint8_t follower_bits[4][3] = {{0}, {1}, {2, 2}, {2, 3, 3}};
+
+// scratch of one block of up to 256 tiles
+typedef struct predict_block {
+    char pixels[PREDICT_BLOCK_TILES*FAMI_TILE_PIXELS];
+    char repeat[PREDICT_BLOCK_TILES*PREDICT_ROWS];
+    uint32_t trans[PREDICT_BLOCK_TILES][16]; // color pairs, before*4+after
+    uint32_t cost[PREDICT_BLOCK_TILES+1];
+    uint16_t from[PREDICT_BLOCK_TILES+1];
+    char table_start[PREDICT_BLOCK_TILES];
+} predict_block_t;
+
+typedef struct bit_writer {
+    uint8_t *out;
+    size_t len;
+    int bits; // used in the last byte
+} bit_writer_t;
+
+static void put_bits(bit_writer_t *w, unsigned int value, int count) {
+    while (count--) {
+        if (w->bits == 0) {
+            w->out[w->len++] = 0;
+        }
+        w->out[w->len-1] |= ((value >> count) & 1) << (7-w->bits);
+        w->bits = (w->bits+1) & 7;
+    }
+}
+
+static void table_build(const uint32_t *trans, predict_table_t *table) {
+    for (int p = 0; p < 4; p++) {
+        table->count[p] = 0;
+        for (int q = 0; q < 4; q++) {
+            if (q == p || trans[p*4+q] == 0) {
+                continue;
+            }
+            int k = table->count[p]++;
+            while (k > 0 && trans[p*4+table->next[p][k-1]] < trans[p*4+q]) {
+                table->next[p][k] = table->next[p][k-1];
+                k--;
+            }
+            table->next[p][k] = q;
+        }
+    }
+}
+
+/**
+ * Bits of the color table table_build makes and the pixels it codes
+ * With the follower counts summed up to s, one follower costs s bits, two 2*s
+ * and three 3*s less one bit for each pixel of the most frequent one.
+ */
+static uint32_t table_cost(const uint32_t *trans) {
+    uint32_t bits = 0;
+    for (int p = 0; p < 4; p++) {
+        uint32_t sum = 0;
+        uint32_t most = 0;
+        int n = 0;
+        for (int q = 0; q < 4; q++) {
+            uint32_t t = trans[p*4+q];
+            if (q != p && t) {
+                sum += t;
+                most = t > most ? t : most;
+                n++;
+            }
+        }
+        // the third follower is the color that is left
+        bits += 2+2*(n < 2 ? n : 2);
+        if (n) {
+            bits += trans[p*4+p] + (n == 3 ? 3*sum-most : n*sum);
+        }
+    }
+    return bits;
+}
+
+/**
+ * Shortest split of a block into runs of tiles sharing a color table
+ * Repeated rows, first pixels and the flag in front of every tile cost the
+ * same for every split, so only the tables and the pixels they code count.
+ */
+static void parse_predict(predict_block_t *b, size_t tiles) {
+    b->cost[0] = 0;
+    for (size_t j = 1; j <= tiles; j++) {
+        b->cost[j] = UINT32_MAX;
+    }
+    for (size_t i = 0; i < tiles; i++) {
+        uint32_t trans[16] = {0};
+        for (size_t j = i+1; j <= tiles; j++) {
+            for (int k = 0; k < 16; k++) {
+                trans[k] += b->trans[j-1][k];
+            }
+            uint32_t c = b->cost[i]+table_cost(trans);
+            if (c < b->cost[j]) {
+                b->cost[j] = c;
+                b->from[j] = i;
+            }
+        }
+    }
+    memset(b->table_start, 0, tiles);
+    for (size_t j = tiles; j > 0; j = b->from[j]) {
+        b->table_start[b->from[j]] = 1;
+    }
+}
+
+static void encode_predict_block(predict_block_t *b, const uint8_t *data, size_t tiles, bit_writer_t *w) {
+    fami_decode_tiles((char*)data, tiles, b->pixels);
+    memset(b->trans, 0, tiles*sizeof(b->trans[0]));
+    // rows continue over tile borders, so row g starts at pixel g*8
+    for (size_t g = 0; g < tiles*PREDICT_ROWS; g++) {
+        char *row = b->pixels+g*FAMI_TILE_LEN;
+        b->repeat[g] = g > 0 && memcmp(row, row-FAMI_TILE_LEN, FAMI_TILE_LEN) == 0;
+        if (!b->repeat[g]) {
+            uint32_t *trans = b->trans[g/PREDICT_ROWS];
+            for (int x = 1; x < FAMI_TILE_LEN; x++) {
+                trans[row[x-1]*4+row[x]]++;
+            }
+        }
+    }
+    parse_predict(b, tiles);
+
+    w->out[w->len++] = tiles & 0xFF;
+    w->bits = 0;
+    predict_table_t table;
+    for (size_t t = 0; t < tiles; t++) {
+        if (t > 0) {
+            put_bits(w, b->table_start[t], 1);
+        }
+        if (b->table_start[t]) {
+            uint32_t trans[16] = {0};
+            for (size_t u = t; u < tiles && (u == t || !b->table_start[u]); u++) {
+                for (int k = 0; k < 16; k++) {
+                    trans[k] += b->trans[u][k];
+                }
+            }
+            table_build(trans, &table);
+            for (int p = 0; p < 4; p++) {
+                put_bits(w, table.count[p], 2);
+                for (int k = 0; k < table.count[p] && k < 2; k++) {
+                    put_bits(w, table.next[p][k], 2);
+                }
+            }
+        }
+
+        for (size_t g = t*PREDICT_ROWS; g < (t+1)*PREDICT_ROWS; g++) {
+            if (g > 0) {
+                put_bits(w, b->repeat[g], 1);
+            }
+            if (b->repeat[g]) {
+                continue;
+            }
+            char *row = b->pixels+g*FAMI_TILE_LEN;
+            put_bits(w, row[0], 2);
+            for (int x = 1; x < FAMI_TILE_LEN; x++) {
+                int p = row[x-1];
+                int n = table.count[p];
+                if (n == 0) {
+                    continue;
+                }
+                if (row[x] == p) {
+                    put_bits(w, 0, 1);
+                    continue;
+                }
+                int k = 0;
+                while (table.next[p][k] != row[x]) {
+                    k++;
+                }
+                // 1, 10, 11 or 10, 110, 111
+                unsigned int code = n == 1 ? 1 : n == 2 ? 2+k : k == 0 ? 2 : 5+k;
+                put_bits(w, code, follower_bits[n][k]);
+            }
+        }
+    }
+}
+
+static char encode_predict(chunk_t *chunk) {
+    predict_block_t *b = my_malloc(sizeof(predict_block_t));
+    if (!b) {
+        return 0;
+    }
+    bit_writer_t w = {chunk->out, 0, 0};
+    for (size_t i = chunk->start; i < chunk->end; i += PREDICT_BLOCK_SIZE) {
+        size_t len = chunk->end-i < PREDICT_BLOCK_SIZE ? chunk->end-i : PREDICT_BLOCK_SIZE;
+        encode_predict_block(b, chunk->data+i, len/FAMI_TILE_SIZE, &w);
+    }
+    chunk->out_len = w.len;
+    my_free(b);
+    return 1;
+}
+
+static void *encode_chunk(void *arg) {
+    chunk_t *chunk = arg;
+    if (chunk->codec == FAMI_CODEC_PREDICT) {
+        chunk->ok = encode_predict(chunk);
+        return NULL;
+    }
+    const uint8_t *data = chunk->data+chunk->start;
+    size_t n = chunk->end-chunk->start;
+
+    rle_limits_t limits = {KONAMI_MAX_LITERAL, 1, KONAMI_MAX_RUN};
+    size_t max_run = chunk->codec == FAMI_CODEC_NESLIB_RLE ? NESLIB_MAX_RUN : limits.max_run;
+
+    parse_t p;
+    chunk->ok = parse_init(&p, data, n, max_run);
+    if (!chunk->ok) {
+        parse_free(&p);
+        return NULL;
+    }
+    if (chunk->codec == FAMI_CODEC_NESLIB_RLE) {
+        parse_neslib(&p, data, n, chunk->start > 0);
+    } else {
+        parse_rle(&p, n, &limits);
+    }
+
+    uint8_t *op = chunk->out;
+    for (size_t i = 0; i < n; i += p.len[i]) {
+        size_t k = p.len[i];
+        if (chunk->codec == FAMI_CODEC_NESLIB_RLE) {
+            if (p.kind[i] == TOKEN_RUN) {
+                *op++ = chunk->tag;
+                *op++ = k;
+            } else {
+                *op++ = data[i];
+            }
+            continue;
+        }
+
+        if (p.kind[i] == TOKEN_RUN) {
+            *op++ = k;
+            *op++ = data[i];
+        } else {
+            *op++ = 0x80+k;
+            memcpy(op, data+i, k);
+            op += k;
+        }
+    }
+    chunk->out_len = op-chunk->out;
+    parse_free(&p);
+    return NULL;
+}
+
+// the tag has to be a byte value that is not used by the data
+static char neslib_tag(const uint8_t *data, size_t length, uint8_t *tag) {
+    size_t counts[256] = {0};
+    for (size_t i = 0; i < length; i++) {
+        counts[data[i]]++;
+    }
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] == 0) {
+            *tag = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+char *fami_codec_encode(fami_codec_t codec, char *data, size_t length,
+        size_t *encoded_length, unsigned int threads) {
+    if (codec >= FAMI_CODECS) {
+        return NULL;
+    }
+    uint8_t tag = 0;
+    if (codec == FAMI_CODEC_NESLIB_RLE && !neslib_tag((uint8_t*)data, length, &tag)) {
+        return NULL;
+    }
+    if (codec == FAMI_CODEC_PREDICT && length%FAMI_TILE_SIZE != 0) {
+        return NULL;
+    }
+    // predict chunks hold whole blocks, which makes the threaded output the same
+    size_t unit = codec == FAMI_CODEC_PREDICT ? PREDICT_BLOCK_SIZE : 1;
+    size_t units = (length+unit-1)/unit;
+
+    if (threads == 0) {
+        threads = fami_default_threads();
+    }
+    if (threads > FAMI_MAX_THREADS) {
+        threads = FAMI_MAX_THREADS;
+    }
+    if (threads > length/FAMI_CODEC_MIN_CHUNK) {
+        threads = length/FAMI_CODEC_MIN_CHUNK;
+    }
+    if (threads > units) {
+        threads = units;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    chunk_t chunks[FAMI_MAX_THREADS];
+    pthread_t workers[FAMI_MAX_THREADS];
+    char started[FAMI_MAX_THREADS];
+    char ok = 1;
+
+    size_t first = 0;
+    for (unsigned int i = 0; i < threads; i++) {
+        size_t count = (units/threads + (i < units%threads))*unit;
+        if (count > length-first) {
+            count = length-first;
+        }
+        chunks[i].codec = codec;
+        chunks[i].data = (uint8_t*)data;
+        chunks[i].start = first;
+        chunks[i].end = first+count;
+        chunks[i].tag = tag;
+        chunks[i].out = my_malloc(chunk_bound(codec, count)+1);
+        chunks[i].out_len = 0;
+        chunks[i].ok = chunks[i].out != NULL;
+        ok = ok && chunks[i].ok;
+        first += count;
+    }
+
+    if (ok) {
+        // the calling thread takes chunk 0, a chunk whose thread fails to start runs here too
+        for (unsigned int i = 1; i < threads; i++) {
+            started[i] = pthread_create(&workers[i], NULL, encode_chunk, &chunks[i]) == 0;
+        }
+        encode_chunk(&chunks[0]);
+        for (unsigned int i = 1; i < threads; i++) {
+            if (started[i]) {
+                pthread_join(workers[i], NULL);
+            } else {
+                encode_chunk(&chunks[i]);
+            }
+        }
+    }
+
+    size_t total = 3; // neslib tag and terminator
+    for (unsigned int i = 0; i < threads; i++) {
+        ok = ok && chunks[i].ok;
+        total += chunks[i].out_len;
+    }
+
+    uint8_t *out = ok ? my_malloc(total) : NULL;
+    if (out) {
+        uint8_t *op = out;
+        if (codec == FAMI_CODEC_NESLIB_RLE) {
+            *op++ = tag;
+        }
+        for (unsigned int i = 0; i < threads; i++) {
+            memcpy(op, chunks[i].out, chunks[i].out_len);
+            op += chunks[i].out_len;
+        }
+        if (codec == FAMI_CODEC_NESLIB_RLE) {
+            *op++ = tag;
+            *op++ = 0;
+        } else if (codec == FAMI_CODEC_KONAMI_RLE) {
+            *op++ = KONAMI_END;
+        }
+        *encoded_length = op-out;
+    }
+
+    for (unsigned int i = 0; i < threads; i++) {
+        my_free(chunks[i].out);
+    }
+    return (char*)out;
+}
+
+/**
+ * Decoders
+ */
+
+typedef struct output {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} output_t;
+
+static char reserve(output_t *out, size_t extra) {
+    if (out->len+extra <= out->cap) {
+        return 1;
+    }
+    size_t cap = out->cap*2;
+    while (cap < out->len+extra) {
+        cap *= 2;
+    }
+    uint8_t *data = realloc(out->data, cap);
+    if (!data) {
+        return 0;
+    }
+    out->data = data;
+    out->cap = cap;
+    return 1;
+}
+
+static char put_run(output_t *out, uint8_t value, size_t count) {
+    if (!reserve(out, count)) {
+        return 0;
+    }
+    memset(out->data+out->len, value, count);
+    out->len += count;
+    return 1;
+}
+
+static char put_literals(output_t *out, const uint8_t *src, size_t count) {
+    if (!reserve(out, count)) {
+        return 0;
+    }
+    memcpy(out->data+out->len, src, count);
+    out->len += count;
+    return 1;
+}
+
+static char decode_neslib(const uint8_t *ip, const uint8_t *end, output_t *out) {
+    if (ip >= end) {
+        return 0;
+    }
+    uint8_t tag = *ip++;
+    while (ip < end) {
+        // everything up to the next tag is literal
+        const uint8_t *next = memchr(ip, tag, end-ip);
+        if (!next) {
+            return 0;
+        }
+        if (!put_literals(out, ip, next-ip)) {
+            return 0;
+        }
+        ip = next+1;
+        if (ip >= end) {
+            return 0;
+        }
+        uint8_t count = *ip++;
+        if (count == 0) {
+            return 1;
+        }
+        // a run repeats the last byte, there has to be one
+        if (out->len == 0 || !put_run(out, out->data[out->len-1], count)) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static char decode_konami(const uint8_t *ip, const uint8_t *end, output_t *out) {
+    while (ip < end) {
+        uint8_t n = *ip++;
+        if (n == KONAMI_END) {
+            return 1;
+        }
+        if (n <= KONAMI_MAX_RUN) {
+            if (ip >= end || !put_run(out, *ip++, n)) {
+                return 0;
+            }
+        } else {
+            size_t count = n-0x80;
+            if ((size_t)(end-ip) < count || !put_literals(out, ip, count)) {
+                return 0;
+            }
+            ip += count;
+        }
+    }
+    return 0;
+}
+
+typedef struct bit_reader {
+    const uint8_t *ip;
+    const uint8_t *end;
+    uint8_t byte; // the last byte read
+    int bits; // left in byte
+    char error; // read past the end
+} bit_reader_t;
+
+static inline unsigned int get_bit(bit_reader_t *r) {
+    if (r->bits == 0) {
+        if (r->ip >= r->end) {
+            r->error = 1;
+            return 0;
+        }
+        r->byte = *r->ip++;
+        r->bits = 8;
+    }
+    return (r->byte >> --r->bits) & 1;
+}
+
+static inline unsigned int get_bits(bit_reader_t *r, int count) {
+    unsigned int value = 0;
+    while (count--) {
+        value = value << 1 | get_bit(r);
+    }
+    return value;
+}
+
+static char read_table(bit_reader_t *r, predict_table_t *table) {
+    for (int p = 0; p < 4; p++) {
+        int n = get_bits(r, 2);
+        // colors used by p or its followers
+        int used = 1 << p;
+        for (int k = 0; k < n; k++) {
+            int q = 0;
+            if (k < 2) {
+                q = get_bits(r, 2);
+            } else {
+                // the third follower is the one color left
+                while (used & 1 << q) {
+                    q++;
+                }
+            }
+            if (used & 1 << q) {
+                return 0;
+            }
+            used |= 1 << q;
+            table->next[p][k] = q;
+        }
+        table->count[p] = n;
+    }
+    return !r->error;
+}
+
+static char decode_predict_block(bit_reader_t *r, output_t *out) {
+    size_t tiles = *r->ip++;
+    tiles = tiles ? tiles : PREDICT_BLOCK_TILES;
+    if (!reserve(out, tiles*FAMI_TILE_SIZE)) {
+        return 0;
+    }
+    uint8_t row[FAMI_TILE_LEN] = {0};
+    predict_table_t table;
+    for (size_t t = 0; t < tiles; t++) {
+        if ((t == 0 || get_bit(r)) && !read_table(r, &table)) {
+            return 0;
+        }
+        uint8_t *tile = out->data+out->len;
+        for (int y = 0; y < PREDICT_ROWS; y++) {
+            // a repeated row keeps the pixels of the one before
+            if ((t == 0 && y == 0) || !get_bit(r)) {
+                row[0] = get_bits(r, 2);
+                for (int x = 1; x < FAMI_TILE_LEN; x++) {
+                    int p = row[x-1];
+                    int n = table.count[p];
+                    int k = 0;
+                    if (n == 0 || !get_bit(r)) {
+                        row[x] = p;
+                        continue;
+                    }
+                    if (n >= 2 && get_bit(r)) {
+                        k = n == 2 ? 1 : 1+get_bit(r);
+                    }
+                    row[x] = table.next[p][k];
+                }
+            }
+            uint8_t lo = 0;
+            uint8_t hi = 0;
+            for (int x = 0; x < FAMI_TILE_LEN; x++) {
+                lo = lo << 1 | (row[x] & 1);
+                hi = hi << 1 | row[x] >> 1;
+            }
+            tile[y] = lo;
+            tile[y+FAMI_TILE_LEN] = hi;
+        }
+        if (r->error) {
+            return 0;
+        }
+        out->len += FAMI_TILE_SIZE;
+    }
+    // the next block starts on a byte
+    r->bits = 0;
+    return 1;
+}
+
+static char decode_predict(const uint8_t *ip, const uint8_t *end, output_t *out) {
+    bit_reader_t r = {ip, end, 0, 0, 0};
+    while (r.ip < end) {
+        if (!decode_predict_block(&r, out)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+char *fami_codec_decode(fami_codec_t codec, char *data, size_t length, size_t *decoded_length) {
+    output_t out;
+    out.len = 0;
+    out.cap = length*4+64;
+    out.data = my_malloc(out.cap);
+    if (!out.data) {
+        return NULL;
+    }
+
+    const uint8_t *ip = (uint8_t*)data;
+    char ok = 0;
+    switch (codec) {
+        case FAMI_CODEC_NESLIB_RLE:
+            ok = decode_neslib(ip, ip+length, &out);
+            break;
+        case FAMI_CODEC_KONAMI_RLE:
+            ok = decode_konami(ip, ip+length, &out);
+            break;
+        case FAMI_CODEC_PREDICT:
+            ok = decode_predict(ip, ip+length, &out);
+            break;
+        default:
+            break;
+    }
+    if (!ok) {
+        my_free(out.data);
+        return NULL;
+    }
+    *decoded_length = out.len;
+    return (char*)out.data;
+}
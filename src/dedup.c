@@ -0,0 +1,134 @@
+#include "include/dedup.h"
+#include "include/flip.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+// the remap table stores uint32_t indices
+#define MAX_DEDUP_TILES 0xFFFFFFFE
+
+static inline uint64_t load64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t fami_tile_hash(char *tile) {
+    // one multiply per half, then a murmur style finalizer
+    uint64_t a = load64(tile)*0x9E3779B97F4A7C15ull;
+    uint64_t b = load64(tile+8)*0xC2B2AE3D27D4EB4Full;
+    uint64_t h = a ^ (b << 31 | b >> 33);
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline char tile_equal(const char *a, const char *b) {
+    return load64(a) == load64(b) && load64(a+8) == load64(b+8);
+}
+
+long fami_dedup_find(fami_dedup_t *dedup, char *tile) {
+    char canonical[FAMI_TILE_SIZE];
+    if (dedup->flips) {
+        fami_tile_canonical(tile, canonical);
+        tile = canonical;
+    }
+    size_t slot = fami_tile_hash(tile) & dedup->slot_mask;
+    while (dedup->slots[slot]) {
+        uint32_t index = dedup->slots[slot]-1;
+        if (tile_equal(dedup->unique+(size_t)index*FAMI_TILE_SIZE, tile)) {
+            return index;
+        }
+        slot = (slot+1) & dedup->slot_mask;
+    }
+    return -1;
+}
+
+static char dedup_tiles(char *data, size_t length, fami_dedup_t *dedup, char flip_aware) {
+    memset(dedup, 0, sizeof(fami_dedup_t));
+
+    size_t tiles = length / FAMI_TILE_SIZE;
+    if (tiles > MAX_DEDUP_TILES) {
+        return 0;
+    }
+
+    // at most half full so probe chains stay short
+    size_t slot_count = 16;
+    while (slot_count < tiles*2) {
+        slot_count <<= 1;
+    }
+
+    dedup->tiles = tiles;
+    dedup->slot_mask = slot_count-1;
+    dedup->slots = calloc(slot_count, sizeof(uint32_t));
+    dedup->remap = my_malloc(tiles*sizeof(uint32_t)+1);
+    dedup->unique = my_malloc(tiles*FAMI_TILE_SIZE+1);
+    if (flip_aware) {
+        dedup->flips = my_malloc(tiles+1);
+    }
+    if (!dedup->slots || !dedup->remap || !dedup->unique || (flip_aware && !dedup->flips)) {
+        fami_dedup_free(dedup);
+        return 0;
+    }
+
+    char canonical[FAMI_TILE_SIZE];
+    for (size_t i = 0; i < tiles; i++) {
+        char *tile = data+i*FAMI_TILE_SIZE;
+        if ((load64(tile) | load64(tile+8)) == 0) {
+            dedup->blank_tiles++;
+        }
+        if (flip_aware) {
+            dedup->flips[i] = fami_tile_canonical(tile, canonical);
+            tile = canonical;
+        }
+
+        size_t slot = fami_tile_hash(tile) & dedup->slot_mask;
+        for (;;) {
+            uint32_t entry = dedup->slots[slot];
+            if (entry == 0) {
+                // first time this tile is seen
+                uint32_t index = dedup->unique_tiles++;
+                memcpy(dedup->unique+(size_t)index*FAMI_TILE_SIZE, tile, FAMI_TILE_SIZE);
+                dedup->slots[slot] = index+1;
+                dedup->remap[i] = index;
+                break;
+            }
+            if (tile_equal(dedup->unique+(size_t)(entry-1)*FAMI_TILE_SIZE, tile)) {
+                dedup->remap[i] = entry-1;
+                break;
+            }
+            slot = (slot+1) & dedup->slot_mask;
+        }
+    }
+
+    // give back what the unique bank did not need
+    char *shrunk = realloc(dedup->unique, dedup->unique_tiles*FAMI_TILE_SIZE+1);
+    if (shrunk) {
+        dedup->unique = shrunk;
+    }
+
+    return 1;
+}
+
+char fami_dedup(char *data, size_t length, fami_dedup_t *dedup) {
+    return dedup_tiles(data, length, dedup, 0);
+}
+
+char fami_dedup_flip(char *data, size_t length, fami_dedup_t *dedup) {
+    return dedup_tiles(data, length, dedup, 1);
+}
+
+void fami_dedup_free(fami_dedup_t *dedup) {
+    my_free(dedup->unique);
+    my_free(dedup->remap);
+    my_free(dedup->slots);
+    my_free(dedup->flips);
+    dedup->unique = NULL;
+    dedup->flips = NULL;
+    dedup->remap = NULL;
+    dedup->slots = NULL;
+}
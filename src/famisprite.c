@@ -1,4 +1,5 @@
 #include "include/famisprite.h"
+#include "include/simd.h"
 
 #include <stdlib.h>
 
@@ -11,9 +12,13 @@ char* fami_decode(char *data, unsigned int *length, char *decoded) {
     }
 
     // 8x8 sprite
-    // each tile must have at least 16 bytes
-    unsigned int total_length = 0;
-    for (int i = 0; i < *length; i+=FAMI_TILE_LEN*2) {
+    // full tiles go through the bulk kernel,
+    // a trailing partial tile still takes the per tile path
+    unsigned int tiles = *length / FAMI_TILE_SIZE;
+    fami_decode_tiles(data, tiles, decoded);
+
+    unsigned int total_length = tiles*FAMI_TILE_PIXELS;
+    for (int i = tiles*FAMI_TILE_SIZE; i < *length; i+=FAMI_TILE_LEN*2) {
         unsigned int len = 0;
         fami_decode_tile(data+i, decoded+i*4, &len);
         total_length += len;
@@ -50,8 +55,13 @@ char *fami_encode(char *data, unsigned int *length, char *encoded) {
         encoded = my_malloc((*length)/(FAMI_BPP*2));
     }
 
-    unsigned int total_length = 0;
-    for (int i = 0; i < *length; i+=FAMI_TILE_LEN*FAMI_TILE_LEN) {
+    // full tiles go through the bulk kernel,
+    // a trailing partial tile still takes the per tile path
+    unsigned int tiles = *length / FAMI_TILE_PIXELS;
+    fami_encode_tiles(data, tiles, encoded);
+
+    unsigned int total_length = tiles*FAMI_TILE_SIZE;
+    for (int i = tiles*FAMI_TILE_PIXELS; i < *length; i+=FAMI_TILE_LEN*FAMI_TILE_LEN) {
         unsigned int len = 0;
         fami_encode_tile(data+i, encoded+i/4, &len);
         total_length += len;
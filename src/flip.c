@@ -0,0 +1,44 @@
+#include "include/flip.h"
+
+#include <string.h>
+
+#define REV_BYTE(b) ( \
+    ((b) & 0x01) << 7 | ((b) & 0x02) << 5 | ((b) & 0x04) << 3 | ((b) & 0x08) << 1 | \
+    ((b) & 0x10) >> 1 | ((b) & 0x20) >> 3 | ((b) & 0x40) >> 5 | ((b) & 0x80) >> 7)
+#define REV_4(i) REV_BYTE(i), REV_BYTE(i+1), REV_BYTE(i+2), REV_BYTE(i+3)
+#define REV_16(i) REV_4(i), REV_4(i+4), REV_4(i+8), REV_4(i+12)
+#define REV_64(i) REV_16(i), REV_16(i+16), REV_16(i+32), REV_16(i+48)
+#define REV_256(i) REV_64(i), REV_64(i+64), REV_64(i+128), REV_64(i+192)
+
+static const uint8_t reverse_table[256] = {
+    REV_256(0)
+};
+
+void fami_tile_flip(char *in, char *out, uint8_t flip) {
+    uint8_t *src = (uint8_t*)in;
+    uint8_t tile[FAMI_TILE_SIZE];
+    for (int plane = 0; plane < FAMI_TILE_SIZE; plane += FAMI_TILE_LEN) {
+        for (int row = 0; row < FAMI_TILE_LEN; row++) {
+            int from = flip & FAMI_FLIP_V ? FAMI_TILE_LEN-1-row : row;
+            uint8_t b = src[plane+from];
+            tile[plane+row] = flip & FAMI_FLIP_H ? reverse_table[b] : b;
+        }
+    }
+    memcpy(out, tile, FAMI_TILE_SIZE);
+}
+
+uint8_t fami_tile_canonical(char *in, char *out) {
+    char best[FAMI_TILE_SIZE];
+    char variant[FAMI_TILE_SIZE];
+    uint8_t best_flip = FAMI_FLIP_NONE;
+    memcpy(best, in, FAMI_TILE_SIZE);
+    for (uint8_t flip = FAMI_FLIP_H; flip < FAMI_FLIPS; flip++) {
+        fami_tile_flip(in, variant, flip);
+        if (memcmp(variant, best, FAMI_TILE_SIZE) < 0) {
+            memcpy(best, variant, FAMI_TILE_SIZE);
+            best_flip = flip;
+        }
+    }
+    memcpy(out, best, FAMI_TILE_SIZE);
+    return best_flip;
+}
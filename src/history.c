@@ -0,0 +1,149 @@
+#include "include/history.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+#define HISTORY_MIN_ARENA 4096
+#define HISTORY_MIN_STEPS 256
+#define DELTA_HEADER 6
+
+void fami_history_init(fami_history_t *history) {
+    memset(history, 0, sizeof(fami_history_t));
+}
+
+static char reserve_arena(fami_history_t *history, size_t extra) {
+    if (history->arena_len+extra <= history->arena_cap) {
+        return 1;
+    }
+    size_t cap = history->arena_cap ? history->arena_cap*2 : HISTORY_MIN_ARENA;
+    while (cap < history->arena_len+extra) {
+        cap *= 2;
+    }
+    uint8_t *arena = realloc(history->arena, cap);
+    if (!arena) {
+        return 0;
+    }
+    history->arena = arena;
+    history->arena_cap = cap;
+    return 1;
+}
+
+char fami_history_begin(fami_history_t *history, uint32_t offset) {
+    if (history->steps_len == history->steps_cap) {
+        size_t cap = history->steps_cap ? history->steps_cap*2 : HISTORY_MIN_STEPS;
+        fami_history_step_t *steps = realloc(history->steps, cap*sizeof(fami_history_step_t));
+        if (!steps) {
+            return 0;
+        }
+        history->steps = steps;
+        history->steps_cap = cap;
+    }
+
+    fami_history_step_t *step = &history->pending;
+    step->start = history->arena_len;
+    step->deltas = 0;
+    step->offset_before = offset;
+    step->offset_after = offset;
+    history->open = 1;
+    return 1;
+}
+
+char fami_history_add_tile(fami_history_t *history, uint32_t offset, char *before, char *after) {
+    uint8_t delta[FAMI_TILE_SIZE];
+    uint16_t mask = 0;
+    int changed = 0;
+    for (int i = 0; i < FAMI_TILE_SIZE; i++) {
+        uint8_t x = before[i] ^ after[i];
+        if (x) {
+            mask |= 1 << i;
+            delta[changed++] = x;
+        }
+    }
+    if (!history->open || mask == 0) {
+        return 1;
+    }
+    if (!reserve_arena(history, DELTA_HEADER+changed)) {
+        return 0;
+    }
+
+    uint8_t *out = history->arena+history->arena_len;
+    out[0] = offset;
+    out[1] = offset >> 8;
+    out[2] = offset >> 16;
+    out[3] = offset >> 24;
+    out[4] = mask;
+    out[5] = mask >> 8;
+    memcpy(out+DELTA_HEADER, delta, changed);
+    history->arena_len += DELTA_HEADER+changed;
+    history->pending.deltas++;
+    return 1;
+}
+
+void fami_history_end(fami_history_t *history, uint32_t offset) {
+    if (!history->open) {
+        return;
+    }
+    history->open = 0;
+    fami_history_step_t *step = &history->pending;
+    step->offset_after = offset;
+    if (step->deltas == 0 && step->offset_before == offset) {
+        // leaves the steps that can be redone alone
+        return;
+    }
+
+    // the steps that could be redone are overwritten
+    if (history->position < history->steps_len) {
+        size_t len = history->arena_len-step->start;
+        size_t start = history->steps[history->position].start;
+        memmove(history->arena+start, history->arena+step->start, len);
+        step->start = start;
+        history->arena_len = start+len;
+    }
+    history->steps[history->position++] = *step;
+    history->steps_len = history->position;
+}
+
+fami_history_step_t *fami_history_undo(fami_history_t *history) {
+    if (history->open || history->position == 0) {
+        return NULL;
+    }
+    return &history->steps[--history->position];
+}
+
+fami_history_step_t *fami_history_redo(fami_history_t *history) {
+    if (history->open || history->position == history->steps_len) {
+        return NULL;
+    }
+    return &history->steps[history->position++];
+}
+
+void fami_history_apply(fami_history_t *history, fami_history_step_t *step,
+        char *data, uint32_t *changed) {
+    uint8_t *in = history->arena+step->start;
+    for (uint32_t i = 0; i < step->deltas; i++) {
+        uint32_t offset = in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+        uint16_t mask = in[4] | in[5] << 8;
+        in += DELTA_HEADER;
+        for (int j = 0; j < FAMI_TILE_SIZE; j++) {
+            if (mask & (1 << j)) {
+                data[offset+j] ^= *in++;
+            }
+        }
+        if (changed) {
+            changed[i] = offset;
+        }
+    }
+}
+
+size_t fami_history_size(fami_history_t *history) {
+    return history->arena_len+history->steps_len*sizeof(fami_history_step_t);
+}
+
+void fami_history_free(fami_history_t *history) {
+    my_free(history->arena);
+    my_free(history->steps);
+    fami_history_init(history);
+}
@@ -0,0 +1,961 @@
+#include "include/image.h"
+#include "include/simd.h"
+#include "include/packed.h"
+#include "include/palette.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+// tiles per sheet row are limited so a row of tiles stays small
+#define MAX_SHEET_WIDTH 4096
+// largest sheet dimension accepted when reading
+#define MAX_IMAGE_DIM 65536
+
+static const char *tiles_tag = "famisprite tiles";
+
+fami_image_format_t fami_image_format(const char *path) {
+    const char *ext = strrchr(path, '.');
+    if (!ext) {
+        return FAMI_IMAGE_NONE;
+    }
+    if (strcasecmp(ext, ".ppm") == 0) {
+        return FAMI_IMAGE_PPM;
+    }
+    if (strcasecmp(ext, ".png") == 0) {
+        return FAMI_IMAGE_PNG;
+    }
+    return FAMI_IMAGE_NONE;
+}
+
+void fami_image_init_state(fami_state_t *state) {
+    for (int i = 0; i < FAMI_MAX_COLORS; i++) {
+        char shade = i*0x55;
+        fami_color_t color = {shade, shade, shade};
+        state->colors[i] = color;
+    }
+}
+
+/**
+ * Checksums
+ */
+
+// built once, batch workers write images from several threads
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+    pthread_once(&crc_table_once, crc_table_init);
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t len) {
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (len) {
+        // 5552 is the most bytes that can be summed before b overflows
+        size_t n = len < 5552 ? len : 5552;
+        len -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return b << 16 | a;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/**
+ * Sheet writers
+ */
+
+static char write_png_chunk(FILE *f, const char *type, const uint8_t *data, size_t len) {
+    uint8_t head[8];
+    put_be32(head, len);
+    memcpy(head+4, type, 4);
+    uint32_t crc = crc32_update(crc32_update(0, head+4, 4), data, len);
+    uint8_t tail[4];
+    put_be32(tail, crc);
+    return fwrite(head, 1, 8, f) == 8
+        && (len == 0 || fwrite(data, 1, len, f) == len)
+        && fwrite(tail, 1, 4, f) == 4;
+}
+
+/**
+ * Appends uncompressed deflate blocks for data to out
+ * Returns:
+ *  bytes written to out, at most len + 5 per 65535 bytes of data
+ */
+static size_t deflate_stored(uint8_t *out, const uint8_t *data, size_t len) {
+    size_t pos = 0;
+    while (len) {
+        size_t n = len < 0xFFFF ? len : 0xFFFF;
+        out[pos++] = 0; // not final, stored
+        out[pos++] = n;
+        out[pos++] = n >> 8;
+        out[pos++] = ~n;
+        out[pos++] = ~n >> 8;
+        memcpy(out+pos, data, n);
+        pos += n;
+        data += n;
+        len -= n;
+    }
+    return pos;
+}
+
+static char write_sheet_ppm_header(FILE *f, size_t tiles, unsigned int width, unsigned int height) {
+    return fprintf(f, "P6\n# %s %zu\n%u %u\n255\n", tiles_tag, tiles, width, height) > 0;
+}
+
+static char write_sheet_png_header(FILE *f, size_t tiles, unsigned int width, unsigned int height,
+        fami_state_t *state) {
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    uint8_t ihdr[13];
+    put_be32(ihdr, width);
+    put_be32(ihdr+4, height);
+    ihdr[8] = FAMI_BPP; // bit depth
+    ihdr[9] = 3; // indexed color
+    ihdr[10] = 0; // deflate
+    ihdr[11] = 0; // adaptive filtering
+    ihdr[12] = 0; // no interlace
+
+    uint8_t plte[FAMI_MAX_COLORS*3];
+    for (int i = 0; i < FAMI_MAX_COLORS; i++) {
+        fami_color_t c = fami_get_color(state, i);
+        plte[i*3] = c.r;
+        plte[i*3+1] = c.g;
+        plte[i*3+2] = c.b;
+    }
+
+    char text[64];
+    int text_len = snprintf(text, sizeof(text), "%s%c%zu", tiles_tag, 0, tiles);
+
+    // zlib header, 32K window and no compression
+    static const uint8_t zlib_head[2] = {0x78, 0x01};
+
+    return fwrite(signature, 1, 8, f) == 8
+        && write_png_chunk(f, "IHDR", ihdr, sizeof(ihdr))
+        && write_png_chunk(f, "PLTE", plte, sizeof(plte))
+        && write_png_chunk(f, "tEXt", (uint8_t*)text, text_len)
+        && write_png_chunk(f, "IDAT", zlib_head, sizeof(zlib_head));
+}
+
+static char write_sheet_png_footer(FILE *f, uint32_t adler) {
+    // empty final stored block and the zlib checksum
+    uint8_t tail[9] = {1, 0, 0, 0xFF, 0xFF};
+    put_be32(tail+5, adler);
+    return write_png_chunk(f, "IDAT", tail, sizeof(tail))
+        && write_png_chunk(f, "IEND", NULL, 0);
+}
+
+// tiles_decoded holds every tile already decoded, NULL decodes row by row
+static char write_sheet(FILE *f, char *data, char *tiles_decoded, size_t length, fami_state_t *states,
+        unsigned int palette_count, const uint8_t *tile_palettes,
+        unsigned int tiles_w, fami_image_format_t format) {
+    if (tiles_w == 0 || tiles_w > MAX_SHEET_WIDTH || palette_count == 0
+            || (tile_palettes && format != FAMI_IMAGE_PPM)) {
+        return 0;
+    }
+
+    size_t tiles = length / FAMI_TILE_SIZE;
+    size_t tile_rows = (tiles+tiles_w-1) / tiles_w;
+    unsigned int width = tiles_w*FAMI_TILE_LEN;
+    if (tile_rows == 0 || tile_rows*FAMI_TILE_LEN > 0xFFFFFFFF) {
+        return 0;
+    }
+    unsigned int height = tile_rows*FAMI_TILE_LEN;
+
+    // ppm needs 3 bytes per pixel, png a filter byte plus 2 bytes per tile for every line
+    size_t line_len = format == FAMI_IMAGE_PPM ? width*3 : 1+tiles_w*2;
+    size_t row_len = line_len*FAMI_TILE_LEN;
+
+    char *decoded = my_malloc(tiles_w*FAMI_TILE_PIXELS);
+    fami_packed_row *packed = my_malloc(tiles_w*FAMI_PACKED_TILE_ROWS*sizeof(fami_packed_row));
+    uint8_t *lines = my_malloc(row_len);
+    uint8_t *block = my_malloc(row_len+(row_len/0xFFFF+1)*5);
+    uint32_t *palettes = my_malloc(palette_count*FAMI_MAX_COLORS*sizeof(uint32_t));
+    uint8_t *row_palettes = tile_palettes ? my_malloc(tiles_w) : NULL;
+    char ok = decoded && packed && lines && block && palettes && (!tile_palettes || row_palettes);
+
+    for (unsigned int p = 0; ok && p < palette_count; p++) {
+        fami_palette_pack(states+p, 0, palettes+p*FAMI_MAX_COLORS);
+    }
+    for (size_t t = 0; ok && tile_palettes && t < tiles; t++) {
+        ok = tile_palettes[t] < palette_count;
+    }
+
+    uint32_t adler = 1;
+    if (ok) {
+        if (format == FAMI_IMAGE_PPM) {
+            ok = write_sheet_ppm_header(f, tiles, width, height);
+        } else if (format == FAMI_IMAGE_PNG) {
+            ok = write_sheet_png_header(f, tiles, width, height, states);
+        } else {
+            ok = 0;
+        }
+    }
+
+    for (size_t r = 0; ok && r < tile_rows; r++) {
+        size_t first = r*tiles_w;
+        unsigned int count = tiles-first < tiles_w ? tiles-first : tiles_w;
+        char *src = data+first*FAMI_TILE_SIZE;
+
+        if (format == FAMI_IMAGE_PPM) {
+            char *row = decoded;
+            if (tiles_decoded && count == tiles_w) {
+                row = tiles_decoded+first*FAMI_TILE_PIXELS;
+            } else if (tiles_decoded) {
+                memset(decoded, 0, tiles_w*FAMI_TILE_PIXELS);
+                memcpy(decoded, tiles_decoded+first*FAMI_TILE_PIXELS, (size_t)count*FAMI_TILE_PIXELS);
+            } else {
+                memset(decoded, 0, tiles_w*FAMI_TILE_PIXELS);
+                fami_decode_tiles(src, count, decoded);
+            }
+            if (row_palettes) {
+                // padding tiles use the first sub-palette
+                memset(row_palettes, 0, tiles_w);
+                memcpy(row_palettes, tile_palettes+first, count);
+            }
+            fami_render_row(row, tiles_w, palettes, row_palettes, 0, lines);
+            ok = fwrite(lines, 1, row_len, f) == row_len;
+        } else {
+            // packed rows already are 2 bit png pixels, most significant first
+            memset(packed, 0, tiles_w*FAMI_PACKED_TILE_ROWS*sizeof(fami_packed_row));
+            unsigned int len = count*FAMI_TILE_SIZE;
+            fami_pack_chr(src, &len, packed);
+            uint8_t *out = lines;
+            for (int y = 0; y < FAMI_TILE_LEN; y++) {
+                *out++ = 0; // no filter
+                for (unsigned int t = 0; t < tiles_w; t++) {
+                    fami_packed_row row = packed[t*FAMI_PACKED_TILE_ROWS+y];
+                    *out++ = row >> 8;
+                    *out++ = row;
+                }
+            }
+            adler = adler32_update(adler, lines, row_len);
+            ok = write_png_chunk(f, "IDAT", block, deflate_stored(block, lines, row_len));
+        }
+    }
+
+    if (ok && format == FAMI_IMAGE_PNG) {
+        ok = write_sheet_png_footer(f, adler);
+    }
+
+    my_free(decoded);
+    my_free(packed);
+    my_free(lines);
+    my_free(block);
+    my_free(palettes);
+    my_free(row_palettes);
+    return ok;
+}
+
+char fami_write_sheet(FILE *f, char *data, size_t length, fami_state_t *state,
+        unsigned int tiles_w, fami_image_format_t format) {
+    return write_sheet(f, data, NULL, length, state, 1, NULL, tiles_w, format);
+}
+
+char fami_write_sheet_palettes(FILE *f, char *data, size_t length, fami_state_t *states,
+        unsigned int palette_count, const uint8_t *tile_palettes,
+        unsigned int tiles_w, fami_image_format_t format) {
+    return write_sheet(f, data, NULL, length, states, palette_count, tile_palettes, tiles_w, format);
+}
+
+char fami_write_sheet_decoded(FILE *f, char *data, char *decoded, size_t length, fami_state_t *state,
+        unsigned int tiles_w, fami_image_format_t format) {
+    return write_sheet(f, data, decoded, length, state, 1, NULL, tiles_w, format);
+}
+
+/**
+ * Inflate
+ * Decoder for zlib streams in png files, based on the canonical huffman
+ * decoding described in rfc 1951
+ */
+
+#define MAX_BITS 15
+#define MAX_LIT_CODES 288
+#define MAX_DIST_CODES 30
+
+typedef struct inflate_state {
+    const uint8_t *in;
+    size_t in_len;
+    size_t in_pos;
+    uint32_t bit_buf;
+    int bit_count;
+
+    uint8_t *out;
+    size_t out_len;
+    size_t out_pos;
+
+    char error;
+} inflate_state_t;
+
+typedef struct huffman {
+    uint16_t count[MAX_BITS+1]; // codes per length
+    uint16_t symbol[MAX_LIT_CODES]; // symbols ordered by code
+} huffman_t;
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static uint32_t inflate_bits(inflate_state_t *s, int need) {
+    while (s->bit_count < need) {
+        if (s->in_pos >= s->in_len) {
+            s->error = 1;
+            return 0;
+        }
+        s->bit_buf |= (uint32_t)s->in[s->in_pos++] << s->bit_count;
+        s->bit_count += 8;
+    }
+    uint32_t v = s->bit_buf & ((1u << need)-1);
+    s->bit_buf >>= need;
+    s->bit_count -= need;
+    return v;
+}
+
+// returns -1 for an over subscribed code, 0 for a complete one
+// and a positive number for an incomplete code
+static int huffman_build(huffman_t *h, const uint8_t *lengths, int n) {
+    uint16_t offsets[MAX_BITS+1];
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++) {
+        h->count[lengths[i]]++;
+    }
+    if (h->count[0] == n) {
+        return 0;
+    }
+
+    int left = 1;
+    for (int len = 1; len <= MAX_BITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) {
+            return -1;
+        }
+    }
+
+    offsets[1] = 0;
+    for (int len = 1; len < MAX_BITS; len++) {
+        offsets[len+1] = offsets[len]+h->count[len];
+    }
+    for (int i = 0; i < n; i++) {
+        if (lengths[i]) {
+            h->symbol[offsets[lengths[i]]++] = i;
+        }
+    }
+    return left;
+}
+
+static int huffman_decode(inflate_state_t *s, const huffman_t *h) {
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len <= MAX_BITS; len++) {
+        code |= inflate_bits(s, 1);
+        int count = h->count[len];
+        if (code-count < first) {
+            return h->symbol[index+(code-first)];
+        }
+        index += count;
+        first = (first+count) << 1;
+        code <<= 1;
+    }
+    s->error = 1;
+    return -1;
+}
+
+static void inflate_stored(inflate_state_t *s) {
+    // stored blocks start on a byte boundary
+    s->bit_buf = 0;
+    s->bit_count = 0;
+    if (s->in_pos+4 > s->in_len) {
+        s->error = 1;
+        return;
+    }
+    unsigned int len = s->in[s->in_pos] | s->in[s->in_pos+1] << 8;
+    unsigned int nlen = s->in[s->in_pos+2] | s->in[s->in_pos+3] << 8;
+    s->in_pos += 4;
+    if (len != (~nlen & 0xFFFF) || s->in_pos+len > s->in_len || s->out_pos+len > s->out_len) {
+        s->error = 1;
+        return;
+    }
+    memcpy(s->out+s->out_pos, s->in+s->in_pos, len);
+    s->in_pos += len;
+    s->out_pos += len;
+}
+
+static void inflate_codes(inflate_state_t *s, const huffman_t *lit, const huffman_t *dist) {
+    while (!s->error) {
+        int symbol = huffman_decode(s, lit);
+        if (symbol < 0) {
+            return;
+        }
+        if (symbol < 256) {
+            if (s->out_pos >= s->out_len) {
+                s->error = 1;
+                return;
+            }
+            s->out[s->out_pos++] = symbol;
+        } else if (symbol == 256) {
+            return;
+        } else {
+            symbol -= 257;
+            if (symbol >= 29) {
+                s->error = 1;
+                return;
+            }
+            size_t len = length_base[symbol]+inflate_bits(s, length_extra[symbol]);
+            int d = huffman_decode(s, dist);
+            if (d < 0 || d >= MAX_DIST_CODES) {
+                s->error = 1;
+                return;
+            }
+            size_t distance = dist_base[d]+inflate_bits(s, dist_extra[d]);
+            if (distance > s->out_pos || s->out_pos+len > s->out_len) {
+                s->error = 1;
+                return;
+            }
+            // copies may overlap their own output
+            uint8_t *to = s->out+s->out_pos;
+            for (size_t i = 0; i < len; i++) {
+                to[i] = to[(ptrdiff_t)i-distance];
+            }
+            s->out_pos += len;
+        }
+    }
+}
+
+// the fixed codes, built once like the crc table
+static huffman_t fixed_lit;
+static huffman_t fixed_dist;
+static pthread_once_t fixed_once = PTHREAD_ONCE_INIT;
+
+static void fixed_init(void) {
+    uint8_t lengths[MAX_LIT_CODES];
+    int i = 0;
+    for (; i < 144; i++) {
+        lengths[i] = 8;
+    }
+    for (; i < 256; i++) {
+        lengths[i] = 9;
+    }
+    for (; i < 280; i++) {
+        lengths[i] = 7;
+    }
+    for (; i < MAX_LIT_CODES; i++) {
+        lengths[i] = 8;
+    }
+    huffman_build(&fixed_lit, lengths, MAX_LIT_CODES);
+    for (i = 0; i < MAX_DIST_CODES; i++) {
+        lengths[i] = 5;
+    }
+    huffman_build(&fixed_dist, lengths, MAX_DIST_CODES);
+}
+
+static void inflate_fixed(inflate_state_t *s) {
+    pthread_once(&fixed_once, fixed_init);
+    inflate_codes(s, &fixed_lit, &fixed_dist);
+}
+
+static void inflate_dynamic(inflate_state_t *s) {
+    static const uint8_t order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+    uint8_t lengths[MAX_LIT_CODES+MAX_DIST_CODES];
+    huffman_t lit;
+    huffman_t dist;
+
+    int nlen = inflate_bits(s, 5)+257;
+    int ndist = inflate_bits(s, 5)+1;
+    int ncode = inflate_bits(s, 4)+4;
+    if (nlen > MAX_LIT_CODES || ndist > MAX_DIST_CODES) {
+        s->error = 1;
+        return;
+    }
+
+    memset(lengths, 0, sizeof(lengths));
+    for (int i = 0; i < ncode; i++) {
+        lengths[order[i]] = inflate_bits(s, 3);
+    }
+    if (huffman_build(&lit, lengths, 19) != 0) {
+        s->error = 1;
+        return;
+    }
+
+    for (int i = 0; i < nlen+ndist && !s->error;) {
+        int symbol = huffman_decode(s, &lit);
+        if (symbol < 0) {
+            return;
+        }
+        if (symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+        }
+
+        uint8_t len = 0;
+        int repeat = 0;
+        if (symbol == 16) {
+            if (i == 0) {
+                s->error = 1;
+                return;
+            }
+            len = lengths[i-1];
+            repeat = 3+inflate_bits(s, 2);
+        } else if (symbol == 17) {
+            repeat = 3+inflate_bits(s, 3);
+        } else {
+            repeat = 11+inflate_bits(s, 7);
+        }
+        if (i+repeat > nlen+ndist) {
+            s->error = 1;
+            return;
+        }
+        while (repeat--) {
+            lengths[i++] = len;
+        }
+    }
+
+    // incomplete codes are only allowed for a single length
+    int err = huffman_build(&lit, lengths, nlen);
+    if (err < 0 || (err > 0 && nlen-lit.count[0] != 1)) {
+        s->error = 1;
+        return;
+    }
+    err = huffman_build(&dist, lengths+nlen, ndist);
+    if (err < 0 || (err > 0 && ndist-dist.count[0] != 1)) {
+        s->error = 1;
+        return;
+    }
+    inflate_codes(s, &lit, &dist);
+}
+
+/**
+ * Inflates a zlib stream into out
+ * Returns:
+ *  1 if exactly out_len bytes were produced
+ */
+static char zlib_inflate(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len) {
+    if (in_len < 2 || (in[0] & 0x0F) != 8 || ((in[0] << 8) | in[1]) % 31 != 0 || in[1] & 0x20) {
+        return 0;
+    }
+
+    inflate_state_t s;
+    memset(&s, 0, sizeof(s));
+    s.in = in;
+    s.in_len = in_len;
+    s.in_pos = 2;
+    s.out = out;
+    s.out_len = out_len;
+
+    int last = 0;
+    while (!last && !s.error) {
+        last = inflate_bits(&s, 1);
+        int type = inflate_bits(&s, 2);
+        if (type == 0) {
+            inflate_stored(&s);
+        } else if (type == 1) {
+            inflate_fixed(&s);
+        } else if (type == 2) {
+            inflate_dynamic(&s);
+        } else {
+            s.error = 1;
+        }
+    }
+    return !s.error && s.out_pos == out_len;
+}
+
+/**
+ * Image readers
+ */
+
+static char alloc_image(fami_image_t *image, unsigned int width, unsigned int height, char indexed) {
+    if (width == 0 || height == 0 || width > MAX_IMAGE_DIM || height > MAX_IMAGE_DIM) {
+        return 0;
+    }
+    image->width = width;
+    image->height = height;
+    image->rgb = my_malloc((size_t)width*height*3);
+    image->index = indexed ? my_malloc((size_t)width*height) : NULL;
+    return image->rgb && (!indexed || image->index);
+}
+
+// reads a ppm header token, skipping comments but picking up the tile count
+static char read_ppm_token(FILE *f, fami_image_t *image, unsigned int *value) {
+    int c = fgetc(f);
+    for (;;) {
+        if (c == '#') {
+            char line[128];
+            if (!fgets(line, sizeof(line), f)) {
+                return 0;
+            }
+            size_t tag_len = strlen(tiles_tag);
+            char *p = line;
+            while (*p == ' ') {
+                p++;
+            }
+            if (strncmp(p, tiles_tag, tag_len) == 0) {
+                image->tiles = strtoull(p+tag_len, NULL, 10);
+            }
+            c = fgetc(f);
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            c = fgetc(f);
+        } else {
+            break;
+        }
+    }
+
+    if (c < '0' || c > '9') {
+        return 0;
+    }
+    unsigned long v = 0;
+    while (c >= '0' && c <= '9') {
+        v = v*10+(c-'0');
+        if (v > 0xFFFFFFFF) {
+            return 0;
+        }
+        c = fgetc(f);
+    }
+    // exactly one whitespace character ends the token
+    *value = v;
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static char read_ppm(FILE *f, fami_image_t *image) {
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int maxval = 0;
+    if (!read_ppm_token(f, image, &width)
+            || !read_ppm_token(f, image, &height)
+            || !read_ppm_token(f, image, &maxval)
+            || maxval != 255) {
+        return 0;
+    }
+    if (!alloc_image(image, width, height, 0)) {
+        return 0;
+    }
+    size_t len = (size_t)width*height*3;
+    return fread(image->rgb, 1, len, f) == len;
+}
+
+static uint8_t paeth(int a, int b, int c) {
+    int p = a+b-c;
+    int pa = abs(p-a);
+    int pb = abs(p-b);
+    int pc = abs(p-c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+static char png_unfilter(uint8_t *data, unsigned int height, size_t stride, size_t bpp) {
+    uint8_t *prev = NULL;
+    for (unsigned int y = 0; y < height; y++) {
+        uint8_t *line = data+y*(stride+1);
+        uint8_t filter = line[0];
+        uint8_t *cur = line+1;
+        for (size_t x = 0; x < stride; x++) {
+            int a = x >= bpp ? cur[x-bpp] : 0;
+            int b = prev ? prev[x] : 0;
+            int c = prev && x >= bpp ? prev[x-bpp] : 0;
+            switch (filter) {
+                case 0:
+                    break;
+                case 1:
+                    cur[x] += a;
+                    break;
+                case 2:
+                    cur[x] += b;
+                    break;
+                case 3:
+                    cur[x] += (a+b) >> 1;
+                    break;
+                case 4:
+                    cur[x] += paeth(a, b, c);
+                    break;
+                default:
+                    return 0;
+            }
+        }
+        prev = cur;
+    }
+    return 1;
+}
+
+static char read_png(FILE *f, fami_image_t *image) {
+    uint8_t sig[7];
+    // the first byte was consumed while detecting the format
+    if (fread(sig, 1, 7, f) != 7 || memcmp(sig, "PNG\r\n\x1A\n", 7) != 0) {
+        return 0;
+    }
+
+    unsigned int width = 0;
+    unsigned int height = 0;
+    int depth = 0;
+    int color_type = -1;
+    uint8_t palette[256][3];
+    int palette_len = 0;
+    uint8_t *idat = NULL;
+    size_t idat_len = 0;
+    char ok = 0;
+
+    for (;;) {
+        uint8_t head[8];
+        if (fread(head, 1, 8, f) != 8) {
+            break;
+        }
+        uint32_t len = get_be32(head);
+        if (len > 0x7FFFFFFF) {
+            break;
+        }
+        uint8_t *chunk = my_malloc(len+4);
+        if (!chunk || fread(chunk, 1, len+4, f) != len+4
+                || crc32_update(crc32_update(0, head+4, 4), chunk, len) != get_be32(chunk+len)) {
+            my_free(chunk);
+            break;
+        }
+
+        if (memcmp(head+4, "IHDR", 4) == 0 && len == 13) {
+            width = get_be32(chunk);
+            height = get_be32(chunk+4);
+            depth = chunk[8];
+            color_type = chunk[9];
+            // only deflate, standard filters and no interlacing
+            if (chunk[10] != 0 || chunk[11] != 0 || chunk[12] != 0) {
+                my_free(chunk);
+                break;
+            }
+        } else if (memcmp(head+4, "PLTE", 4) == 0 && len % 3 == 0 && len <= sizeof(palette)) {
+            palette_len = len/3;
+            memcpy(palette, chunk, len);
+        } else if (memcmp(head+4, "tEXt", 4) == 0) {
+            size_t tag_len = strlen(tiles_tag);
+            if (len > tag_len+1 && memcmp(chunk, tiles_tag, tag_len+1) == 0) {
+                char value[32];
+                size_t value_len = len-tag_len-1 < sizeof(value)-1 ? len-tag_len-1 : sizeof(value)-1;
+                memcpy(value, chunk+tag_len+1, value_len);
+                value[value_len] = '\0';
+                image->tiles = strtoull(value, NULL, 10);
+            }
+        } else if (memcmp(head+4, "IDAT", 4) == 0) {
+            uint8_t *grown = realloc(idat, idat_len+len);
+            if (!grown) {
+                my_free(chunk);
+                break;
+            }
+            idat = grown;
+            memcpy(idat+idat_len, chunk, len);
+            idat_len += len;
+        } else if (memcmp(head+4, "IEND", 4) == 0) {
+            ok = 1;
+            my_free(chunk);
+            break;
+        }
+        my_free(chunk);
+    }
+
+    // channels and the bit depths the spec allows, 16 bit samples are not supported
+    int channels = 0;
+    char depth_ok = 0;
+    switch (color_type) {
+        case 0:
+        case 3:
+            channels = 1;
+            depth_ok = depth == 1 || depth == 2 || depth == 4 || depth == 8;
+            break;
+        case 2:
+            channels = 3;
+            depth_ok = depth == 8;
+            break;
+        case 4:
+            channels = 2;
+            depth_ok = depth == 8;
+            break;
+        case 6:
+            channels = 4;
+            depth_ok = depth == 8;
+            break;
+    }
+    if (!ok || !depth_ok || (color_type == 3 && palette_len == 0)) {
+        my_free(idat);
+        return 0;
+    }
+
+    char indexed = color_type == 3 && palette_len <= FAMI_MAX_COLORS;
+    if (!alloc_image(image, width, height, indexed)) {
+        my_free(idat);
+        return 0;
+    }
+
+    size_t stride = ((size_t)width*channels*depth+7) / 8;
+    size_t bpp = (channels*depth+7) / 8;
+    uint8_t *raw = my_malloc((stride+1)*height);
+    ok = raw && zlib_inflate(idat, idat_len, raw, (stride+1)*height)
+        && png_unfilter(raw, height, stride, bpp);
+    my_free(idat);
+
+    for (unsigned int y = 0; ok && y < height; y++) {
+        uint8_t *line = raw+y*(stride+1)+1;
+        for (unsigned int x = 0; x < width; x++) {
+            size_t i = (size_t)y*width+x;
+            uint8_t *out = image->rgb+i*3;
+            int sample = 0;
+            if (depth < 8) {
+                int per_byte = 8/depth;
+                int shift = 8-depth*(x%per_byte+1);
+                sample = (line[x/per_byte] >> shift) & ((1 << depth)-1);
+            } else {
+                sample = line[x*channels];
+            }
+
+            if (color_type == 3) {
+                if (sample >= palette_len) {
+                    ok = 0;
+                    break;
+                }
+                memcpy(out, palette[sample], 3);
+                if (indexed) {
+                    image->index[i] = sample;
+                }
+            } else if (channels >= 3) {
+                memcpy(out, line+x*channels, 3);
+            } else {
+                // scale gray samples up to 8 bits
+                uint8_t gray = sample*255 / ((1 << depth)-1);
+                out[0] = out[1] = out[2] = gray;
+            }
+        }
+    }
+    my_free(raw);
+    return ok;
+}
+
+char fami_read_image(FILE *f, fami_image_t *image) {
+    memset(image, 0, sizeof(fami_image_t));
+
+    int c = fgetc(f);
+    char ok = 0;
+    if (c == 'P') {
+        ok = fgetc(f) == '6' && read_ppm(f, image);
+    } else if (c == 0x89) {
+        ok = read_png(f, image);
+    }
+
+    if (!ok) {
+        fami_free_image(image);
+    }
+    return ok;
+}
+
+void fami_free_image(fami_image_t *image) {
+    my_free(image->rgb);
+    my_free(image->index);
+    image->rgb = NULL;
+    image->index = NULL;
+}
+
+/**
+ * Sheet reader
+ */
+
+// returns the color index of an exact match or -1
+static int match_color(fami_state_t *state, const uint8_t *rgb) {
+    for (int i = 0; i < FAMI_MAX_COLORS; i++) {
+        fami_color_t c = fami_get_color(state, i);
+        if ((uint8_t)c.r == rgb[0] && (uint8_t)c.g == rgb[1] && (uint8_t)c.b == rgb[2]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+char* fami_image_to_chr(fami_image_t *image, fami_state_t *state, size_t *length) {
+    if (image->width % FAMI_TILE_LEN || image->height % FAMI_TILE_LEN) {
+        return NULL;
+    }
+
+    unsigned int tiles_w = image->width / FAMI_TILE_LEN;
+    size_t tiles = (size_t)tiles_w * (image->height / FAMI_TILE_LEN);
+    if (image->tiles && image->tiles <= tiles) {
+        tiles = image->tiles;
+    }
+
+    char *encoded = my_malloc(tiles*FAMI_TILE_SIZE);
+    char *decoded = my_malloc(tiles_w*FAMI_TILE_PIXELS);
+    if (!encoded || !decoded) {
+        my_free(encoded);
+        my_free(decoded);
+        return NULL;
+    }
+
+    for (size_t first = 0; first < tiles; first += tiles_w) {
+        unsigned int count = tiles-first < tiles_w ? tiles-first : tiles_w;
+        size_t top = first / tiles_w * FAMI_TILE_LEN;
+
+        // gather one row of tiles into decoded tile order
+        for (unsigned int t = 0; t < count; t++) {
+            for (int y = 0; y < FAMI_TILE_LEN; y++) {
+                size_t i = (top+y)*image->width + t*FAMI_TILE_LEN;
+                char *out = decoded+t*FAMI_TILE_PIXELS+y*FAMI_TILE_LEN;
+                for (int x = 0; x < FAMI_TILE_LEN; x++, i++) {
+                    int c = image->index ? image->index[i] : match_color(state, image->rgb+i*3);
+                    if (c < 0 || c > FAMI_MAX_COLOR_INDEX) {
+                        my_free(encoded);
+                        my_free(decoded);
+                        return NULL;
+                    }
+                    out[x] = c;
+                }
+            }
+        }
+        fami_encode_tiles(decoded, count, encoded+first*FAMI_TILE_SIZE);
+    }
+
+    my_free(decoded);
+    *length = tiles*FAMI_TILE_SIZE;
+    return encoded;
+}
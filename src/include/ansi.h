@@ -0,0 +1,67 @@
+#ifndef ANSI_H_
+#define ANSI_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * 24 bit color terminal output
+ * Framebuffers of packed colors, as fami_palette_pack makes them, are drawn with
+ * half block characters. Every character cell shows two pixels above each other,
+ * the upper half block takes the foreground color and the rest the background.
+ *
+ * Only cells that differ from the previous frame are sent, and colors and cursor
+ * moves are left out where the terminal already has them. A frame is wrapped in
+ * a cursor save and restore, so a curses library drawing the rest of the screen
+ * finds the cursor and attributes where it left them.
+ */
+
+// a packed color with an alpha of 0 uses the default background of the terminal
+#define FAMI_ANSI_DEFAULT 0
+
+typedef struct fami_ansi {
+    char *data; // pending escape sequences
+    size_t len;
+    size_t cap;
+    char error; // out of memory, the frame is dropped
+
+    // terminal state after data, row is -1 if the cursor is unknown
+    int row;
+    int col;
+    uint32_t fg;
+    uint32_t bg;
+    char colors_set;
+} fami_ansi_t;
+
+/**
+ * Returns:
+ *  1 on success
+ *  0 if memory could not be allocated
+ */
+char fami_ansi_init(fami_ansi_t *ansi);
+
+/**
+ * Adds the cells of a framebuffer that changed since the previous frame
+ * Inputs:
+ *  pixels = width by height packed colors, an odd last row gets a default bottom half
+ *  shown = previous frame of the same size, updated to pixels
+ *  row, col = zero based screen position of the top left cell
+ *  full = draws every cell regardless of shown
+ * Returns:
+ *  number of cells added
+ */
+size_t fami_ansi_frame(fami_ansi_t *ansi, const uint32_t *pixels, uint32_t *shown,
+        int width, int height, int row, int col, char full);
+
+/**
+ * Writes the pending frame
+ * Inputs:
+ *  fd = terminal file descriptor
+ * Returns:
+ *  bytes written
+ */
+size_t fami_ansi_flush(fami_ansi_t *ansi, int fd);
+
+void fami_ansi_free(fami_ansi_t *ansi);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef BITMAP_H_
+#define BITMAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "famisprite.h"
+
+/**
+ * Tile bitmaps
+ * Addresses decoded tiles by pixel across tile borders. Tiles keep the layout
+ * fami_decode returns, 64 pixels one after another, and a row of tiles starts
+ * stride tiles after the previous one, so a bitmap can cover a part of a wider
+ * block of tiles.
+ *
+ * Coordinates outside of the bitmap are clipped, nothing allocates memory.
+ */
+
+typedef struct fami_bitmap {
+    char *data;
+    unsigned int width; // pixels
+    unsigned int height;
+    unsigned int stride; // tiles from one row of tiles to the next
+} fami_bitmap_t;
+
+/**
+ * Inputs:
+ *  data = decoded tiles
+ *  tiles_w and tiles_h = size in tiles
+ *  stride = tiles per row of tiles in data, 0 for tiles_w
+ */
+void fami_bitmap_init(fami_bitmap_t *bitmap, char *data, unsigned int tiles_w,
+        unsigned int tiles_h, unsigned int stride);
+
+/**
+ * Returns:
+ *  decoded tile the pixel at x/y is in
+ */
+char *fami_bitmap_tile(fami_bitmap_t *bitmap, unsigned int x, unsigned int y);
+
+fami_color_index fami_bitmap_get(fami_bitmap_t *bitmap, unsigned int x, unsigned int y);
+
+void fami_bitmap_set(fami_bitmap_t *bitmap, int x, int y, fami_color_index index);
+
+// seed stack entries fami_bitmap_flood needs at most
+#define fami_bitmap_flood_stack(bitmap) (2*(size_t)(bitmap)->width*(bitmap)->height)
+
+/**
+ * Scanline flood fill of the area of one color around x/y
+ * Inputs:
+ *  stack = room for fami_bitmap_flood_stack seeds
+ * Returns:
+ *  number of pixels filled
+ */
+size_t fami_bitmap_flood(fami_bitmap_t *bitmap, int x, int y, fami_color_index index,
+        uint32_t *stack);
+
+/**
+ * Draws a line from x0/y0 to x1/y1 with bresenham's algorithm
+ */
+void fami_bitmap_line(fami_bitmap_t *bitmap, int x0, int y0, int x1, int y1,
+        fami_color_index index);
+
+/**
+ * Draws a rectangle between two corners
+ * Inputs:
+ *  filled = fills the inside too
+ */
+void fami_bitmap_rect(fami_bitmap_t *bitmap, int x0, int y0, int x1, int y1,
+        fami_color_index index, char filled);
+
+/**
+ * Copies a w by h area at sx/sy of src to dx/dy of dst
+ * Pixels outside of either bitmap are skipped, src and dst must not overlap
+ */
+void fami_bitmap_copy(fami_bitmap_t *dst, int dx, int dy, fami_bitmap_t *src,
+        int sx, int sy, int w, int h);
+
+#endif
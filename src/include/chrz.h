@@ -0,0 +1,94 @@
+#ifndef CHRZ_H_
+#define CHRZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "famisprite.h"
+
+/**
+ * Compressed chr-rom container (.fchr)
+ * The data is cut into blocks of FAMI_CHRZ_BLOCK_TILES tiles, each block is
+ * compressed on its own with a byte oriented lz77 so any tile range can be read
+ * by decompressing only the blocks that cover it.
+ *
+ * Layout, all numbers little endian:
+ *  0   "FCHR"
+ *  4   u8 version
+ *  5   u8 reserved
+ *  6   u16 tiles per block
+ *  8   u64 uncompressed length
+ *  16  u32 block count
+ *  20  u32 offsets[block count + 1] of every block, relative to the block data
+ *  ..  block data
+ * A block whose compressed size equals its uncompressed size is stored as is.
+ *
+ * Lz77 sequences are a token with the literal count in the high nibble and the
+ * match length - 4 in the low nibble, a nibble of 15 continues in extra bytes
+ * that are added up until one is below 255. Literals follow the token, then a
+ * u16 match offset. The last sequence of a block only has literals.
+ */
+
+#define FAMI_CHRZ_MAGIC "FCHR"
+#define FAMI_CHRZ_VERSION 1
+#define FAMI_CHRZ_BLOCK_TILES 256 // 4KiB of chr-rom per block
+#define FAMI_CHRZ_HEADER_SIZE 20
+
+/**
+ * Returns:
+ *  1 if data starts with a container header
+ *  0 otherwise
+ */
+char fami_chrz_check(char *data, size_t length);
+
+/**
+ * Returns:
+ *  uncompressed length of a container, 0 on error
+ */
+size_t fami_chrz_length(char *data, size_t length);
+
+/**
+ * Compresses chr-rom data into a container
+ * Inputs:
+ *  data and its lenght
+ *  compressed_length = returns the size of the container
+ * Returns:
+ *  malloced container
+ *  NULL on error
+ */
+char *fami_chrz_compress(char *data, size_t length, size_t *compressed_length);
+
+/**
+ * Decompresses a whole container
+ * Inputs:
+ *  container and its lenght
+ *  raw_length = returns the size of the chr-rom data
+ * Returns:
+ *  malloced chr-rom data
+ *  NULL on error
+ */
+char *fami_chrz_decompress(char *data, size_t length, size_t *raw_length);
+
+/**
+ * Copies a byte range of the uncompressed data to out
+ * Only the blocks covering the range are decompressed
+ * Returns:
+ *  1 on success
+ *  0 on error or if the range is past the end
+ */
+char fami_chrz_read(char *data, size_t length, size_t start, size_t count, char *out);
+
+/**
+ * Same as fami_decode for a range of a container
+ * A partial last tile is read whole, zero padded past the end of the data
+ * Inputs:
+ *  container and its lenght
+ *  first_tile = tile the range starts at
+ *  decoded_length = chr-rom bytes to decode, returns the decoded length
+ *  decoded = pre-allocated ptr to return array, if NULL it will be allocted using malloc
+ * Returns:
+ *  decoded
+ *  NULL on error
+ */
+char *fami_chrz_decode(char *data, size_t length, size_t first_tile, unsigned int *decoded_length, char *decoded);
+
+#endif
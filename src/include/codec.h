@@ -0,0 +1,87 @@
+#ifndef CODEC_H_
+#define CODEC_H_
+
+#include <stddef.h>
+
+/**
+ * NES compression codecs
+ * Compressors commonly used for chr-rom data in NES games.
+ * They work on encoded chr-rom data as laid out by fami_encode.
+ *
+ * neslib rle: the first byte is a tag that never occurs in the data.
+ *  Any other byte is copied to the output. The tag followed by n repeats the
+ *  last output byte n times, the tag followed by 0 ends the data.
+ * konami rle: a byte n of 0x01-0x80 repeats the next byte n times,
+ *  0x81-0xFE copies the next n-0x80 bytes, 0xFF ends the data.
+ * predict: the color prediction idea of tokumaru's tile compressor in a
+ *  format of famisprite's own, it does not read or write tokumaru data.
+ *  Whole tiles in blocks of up to 256. A block starts with a byte holding
+ *  its tile count, 0 for 256, followed by bits, most significant first,
+ *  padded to a byte at the end of the block. Every tile but the first of a
+ *  block starts with a bit, 1 if a new color table follows, the first always
+ *  has one. The table holds for colors 0 to 3 the number of colors that can
+ *  follow it in 2 bits and the first two of them in 2 bits each, a third one
+ *  is the color that is left. Then come the 8 rows, each with a bit that is
+ *  1 if it repeats the row before, which the first row of a block does not
+ *  have. A new row has its first pixel in 2 bits and every further pixel
+ *  coded by the color to its left: 0 keeps that color, 1 takes the first
+ *  follower, with two followers 10 and 11 select them and with three 10, 110
+ *  and 111. A color without followers is always repeated, its pixels take no
+ *  bits. The data ends with the input.
+ *
+ * The encoder finds the shortest output for every codec with a dynamic
+ * programming parse instead of a greedy one, for predict over where the
+ * color tables change.
+ */
+
+// a thread gets at least this many input bytes
+#define FAMI_CODEC_MIN_CHUNK (64*1024)
+
+typedef enum fami_codec {
+    FAMI_CODEC_NESLIB_RLE,
+    FAMI_CODEC_KONAMI_RLE,
+    FAMI_CODEC_PREDICT,
+    FAMI_CODECS
+} fami_codec_t;
+
+/**
+ * Returns:
+ *  printable name of a codec
+ */
+const char *fami_codec_name(fami_codec_t codec);
+
+/**
+ * Returns:
+ *  codec with the given name
+ *  FAMI_CODECS if there is none
+ */
+fami_codec_t fami_codec_from_name(const char *name);
+
+/**
+ * Compresses data with the shortest parse
+ * Large inputs are split into one chunk per thread, which are parsed on their
+ * own. A chunk border can cost a byte or two over the single threaded output.
+ * Inputs:
+ *  data and its lenght
+ *  encoded_length = returns the compressed size
+ *  threads = number of threads to use, 0 uses fami_default_threads
+ * Returns:
+ *  malloced compressed data
+ *  NULL on error, neslib rle fails if every byte value occurs in the data,
+ *  predict if the length is not a multiple of FAMI_TILE_SIZE
+ */
+char *fami_codec_encode(fami_codec_t codec, char *data, size_t length,
+        size_t *encoded_length, unsigned int threads);
+
+/**
+ * Decompresses data
+ * Inputs:
+ *  data and its lenght
+ *  decoded_length = returns the uncompressed size
+ * Returns:
+ *  malloced uncompressed data
+ *  NULL on error or if the data is truncated
+ */
+char *fami_codec_decode(fami_codec_t codec, char *data, size_t length, size_t *decoded_length);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef DEDUP_H_
+#define DEDUP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "famisprite.h"
+
+/**
+ * Tile deduplication
+ * Hashes the encoded 16 byte tiles directly, nothing is decoded.
+ * A single pass over the input builds a bank of unique tiles
+ * in order of first appearance and a remap table from every input tile
+ * to its unique tile.
+ */
+
+typedef struct fami_dedup {
+    char *unique; // unique tiles, 16 bytes each
+    size_t unique_tiles;
+    uint32_t *remap; // unique tile index for every input tile
+    size_t tiles; // input tiles
+    size_t blank_tiles; // input tiles that are all color 0
+    uint8_t *flips; // flip that turns the unique tile into every input tile, NULL unless flip aware
+
+    // open addressing index, unique tile index + 1 per slot, 0 for empty slots
+    uint32_t *slots;
+    size_t slot_mask; // slot count - 1, the count is a power of two
+} fami_dedup_t;
+
+/**
+ * Returns:
+ *  64 bit hash of an encoded tile
+ */
+uint64_t fami_tile_hash(char *tile);
+
+/**
+ * Deduplicates encoded tiles
+ * A trailing partial tile is ignored
+ * Inputs:
+ *  encoded chr-rom data and its lenght
+ *  dedup = result, free it with fami_dedup_free
+ * Returns:
+ *  1 on success
+ *  0 on error
+ */
+char fami_dedup(char *data, size_t length, fami_dedup_t *dedup);
+
+/**
+ * Same as fami_dedup but tiles that only differ by a flip are merged
+ * The unique bank holds canonical tiles, see fami_tile_canonical
+ */
+char fami_dedup_flip(char *data, size_t length, fami_dedup_t *dedup);
+
+/**
+ * Looks up a tile in a finished dedup index
+ * A flip aware index also finds flipped tiles
+ * Returns:
+ *  index of the matching unique tile
+ *  -1 if there is none
+ */
+long fami_dedup_find(fami_dedup_t *dedup, char *tile);
+
+void fami_dedup_free(fami_dedup_t *dedup);
+
+#endif
@@ -1,12 +1,16 @@
+#ifndef FAMISPRITE_H_
+#define FAMISPRITE_H_
+
 /**
  * Simple famicom chr-rom de/encoder
  */
 
 #define FAMI_MAX_COLOR_INDEX 3
-#define FAMI_MAX_COLORS FAMI_MAX_COLOR_INDEX+1
+#define FAMI_MAX_COLORS (FAMI_MAX_COLOR_INDEX+1)
 #define FAMI_BPP 2 // 2 bits per pixel
 #define FAMI_TILE_SIZE 16 // 16 bytes
 #define FAMI_TILE_LEN 8 // 8 pixels
+#define FAMI_TILE_PIXELS (FAMI_TILE_LEN*FAMI_TILE_LEN) // 64 pixels
 
 typedef unsigned char fami_color_index;
 
@@ -109,3 +113,5 @@ void fami_set_color(fami_state_t *state, fami_color_t color, fami_color_index in
  * Returns a color value for a given index
  */
 fami_color_t fami_get_color(fami_state_t *state, fami_color_index index);
+
+#endif
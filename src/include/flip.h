@@ -0,0 +1,39 @@
+#ifndef FLIP_H_
+#define FLIP_H_
+
+#include <stdint.h>
+#include "famisprite.h"
+
+/**
+ * Flipped tiles
+ * Works on encoded 16 byte tiles, nothing is decoded.
+ * A horizontal flip reverses the bits of every byte,
+ * a vertical flip reverses the 8 rows of each plane.
+ */
+
+#define FAMI_FLIP_NONE 0
+#define FAMI_FLIP_H 1
+#define FAMI_FLIP_V 2
+#define FAMI_FLIP_HV (FAMI_FLIP_H | FAMI_FLIP_V)
+#define FAMI_FLIPS 4 // number of variants
+
+// oam attribute bits of a flip
+#define fami_flip_to_oam(flip) ((flip) << 6)
+
+/**
+ * Writes the flipped tile to out
+ * in and out may be the same tile
+ */
+void fami_tile_flip(char *in, char *out, uint8_t flip);
+
+/**
+ * Writes the canonical form of a tile to out, which is the smallest of
+ * its 4 variants by memcmp. Tiles that differ only by a flip share
+ * the same canonical form.
+ * in and out may be the same tile
+ * Returns:
+ *  flip that turns the canonical form back into the input
+ */
+uint8_t fami_tile_canonical(char *in, char *out);
+
+#endif
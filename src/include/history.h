@@ -0,0 +1,103 @@
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "famisprite.h"
+
+/**
+ * Undo history
+ * Every step keeps the tiles it changed as the xor of their encoded bytes
+ * before and after, so undoing and redoing apply the same delta. A delta only
+ * keeps its non zero bytes behind a 16 bit mask, a single painted pixel costs
+ * 8 bytes.
+ *
+ * Deltas are appended to one arena. Recording a step after undoing drops the
+ * steps that could be redone and moves its deltas to where they started.
+ *
+ * Delta layout: u32 offset, u16 mask of the changed bytes, the changed bytes
+ */
+
+// a step with nothing but a move between offsets is kept too
+typedef struct fami_history_step {
+    size_t start; // first delta in the arena
+    uint32_t deltas;
+    uint32_t offset_before;
+    uint32_t offset_after;
+} fami_history_step_t;
+
+typedef struct fami_history {
+    uint8_t *arena;
+    size_t arena_len;
+    size_t arena_cap;
+
+    fami_history_step_t *steps;
+    size_t steps_len; // recorded steps, including the ones that can be redone
+    size_t steps_cap;
+    size_t position; // steps that are applied
+    char open; // pending is being recorded
+    fami_history_step_t pending;
+} fami_history_t;
+
+void fami_history_init(fami_history_t *history);
+
+/**
+ * Starts recording a step
+ * Inputs:
+ *  offset = where the step happens, an undo moves back there
+ * Returns:
+ *  1 on success
+ *  0 if memory could not be allocated
+ */
+char fami_history_begin(fami_history_t *history, uint32_t offset);
+
+/**
+ * Adds a changed tile to the open step
+ * Inputs:
+ *  offset = offset of the tile in the data the step is applied to
+ *  before and after = encoded tile, nothing is added if they are equal
+ * Returns:
+ *  1 on success
+ *  0 if memory could not be allocated
+ */
+char fami_history_add_tile(fami_history_t *history, uint32_t offset, char *before, char *after);
+
+/**
+ * Finishes the open step
+ * A step that changed nothing and stayed at its offset is dropped
+ * Inputs:
+ *  offset = where the step ends, a redo moves there
+ */
+void fami_history_end(fami_history_t *history, uint32_t offset);
+
+/**
+ * Returns:
+ *  step to undo and moves before it
+ *  NULL if there is none
+ */
+fami_history_step_t *fami_history_undo(fami_history_t *history);
+
+/**
+ * Returns:
+ *  step to redo and moves past it
+ *  NULL if there is none
+ */
+fami_history_step_t *fami_history_redo(fami_history_t *history);
+
+/**
+ * Applies the deltas of a step to data, it undoes a step that is applied
+ * and redoes one that is not
+ * Inputs:
+ *  data the step was recorded on
+ *  changed = returns the offset of every changed tile,
+ *   room for step->deltas entries or NULL
+ */
+void fami_history_apply(fami_history_t *history, fami_history_step_t *step,
+        char *data, uint32_t *changed);
+
+// bytes held by the history
+size_t fami_history_size(fami_history_t *history);
+
+void fami_history_free(fami_history_t *history);
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "famisprite.h"
+
+/**
+ * Tile sheet images
+ * A sheet lays out tiles left to right, top to bottom.
+ * Writing streams one row of tiles at a time, reading loads the whole image.
+ * Supported are binary ppm (P6) and png.
+ * Png is written as a 2 bit indexed image using the colors of fami_state_t.
+ */
+
+#define FAMI_SHEET_WIDTH 16 // default tiles per sheet row
+
+typedef enum fami_image_format {
+    FAMI_IMAGE_NONE,
+    FAMI_IMAGE_PPM,
+    FAMI_IMAGE_PNG
+} fami_image_format_t;
+
+/**
+ * Decoded image
+ */
+typedef struct fami_image {
+    unsigned int width;
+    unsigned int height;
+    uint8_t *rgb; // 3 bytes per pixel
+    uint8_t *index; // palette index per pixel, NULL unless the image has 4 colors or less
+    size_t tiles; // tile count stored by famisprite, 0 if unknown
+} fami_image_t;
+
+/**
+ * Returns:
+ *  image format based on the file extension
+ *  FAMI_IMAGE_NONE for anything else
+ */
+fami_image_format_t fami_image_format(const char *path);
+
+/**
+ * Inits fami_state with 4 shades of gray from black to white
+ */
+void fami_image_init_state(fami_state_t *state);
+
+/**
+ * Writes chr-rom data as a tile sheet
+ * A trailing partial tile is ignored, a partial row of tiles is padded with color 0
+ * Inputs:
+ *  f = output file
+ *  encoded chr-rom data and its lenght
+ *  state = colors used for the 4 color indices
+ *  tiles_w = tiles per sheet row
+ * Returns:
+ *  1 on success
+ *  0 on error
+ */
+char fami_write_sheet(FILE *f, char *data, size_t length, fami_state_t *state,
+        unsigned int tiles_w, fami_image_format_t format);
+
+/**
+ * Same as fami_write_sheet for tiles that are already decoded
+ * Inputs:
+ *  decoded = FAMI_TILE_PIXELS per tile of data, ppm is rendered from it without
+ *            decoding again, png is written from data
+ */
+char fami_write_sheet_decoded(FILE *f, char *data, char *decoded, size_t length, fami_state_t *state,
+        unsigned int tiles_w, fami_image_format_t format);
+
+/**
+ * Same as fami_write_sheet with a sub-palette per tile
+ * Inputs:
+ *  states = colors of every sub-palette, png uses the first one
+ *  palette_count = number of states
+ *  tile_palettes = index into states for every tile, NULL uses the first for all,
+ *                  only supported for ppm as png is written with a single palette
+ * Returns:
+ *  1 on success
+ *  0 on error or if a tile uses a sub-palette past palette_count
+ */
+char fami_write_sheet_palettes(FILE *f, char *data, size_t length, fami_state_t *states,
+        unsigned int palette_count, const uint8_t *tile_palettes,
+        unsigned int tiles_w, fami_image_format_t format);
+
+/**
+ * Reads a ppm or png image, the format is detected by its header
+ * Returns:
+ *  1 on success
+ *  0 on error
+ */
+char fami_read_image(FILE *f, fami_image_t *image);
+
+void fami_free_image(fami_image_t *image);
+
+/**
+ * Converts a tile sheet back into chr-rom data
+ * Indexed images with 4 colors or less use their palette index,
+ * every other pixel must match one of the colors in state exactly.
+ * Inputs:
+ *  image with a width and height divisible by 8
+ *  length = returns the size of the chr-rom data
+ * Returns:
+ *  malloced chr-rom data
+ *  NULL on error
+ */
+char* fami_image_to_chr(fami_image_t *image, fami_state_t *state, size_t *length);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef LUT_H_
+#define LUT_H_
+
+/**
+ * Table driven decoder
+ * Every row of a tile only depends on its two plane bytes,
+ * so a row can be looked up instead of decoded pixel by pixel.
+ *
+ * Building with -DFAMI_LUT_STATIC (make LUT=static) generates the full table
+ * at compile time instead of on first use. This costs a few seconds of
+ * compile time and 512KiB of binary size.
+ */
+
+typedef enum fami_lut_mode {
+    FAMI_LUT_FULL, // 65536 rows indexed by both planes, 512KiB
+    FAMI_LUT_SPLIT, // 256 rows indexed by one plane, 2KiB
+    FAMI_LUT_MODES
+} fami_lut_mode_t;
+
+/**
+ * Builds the full table if it was not generated at compile time
+ * Decoding calls this on demand, calling it early moves the cost out of the
+ * first decode
+ */
+void fami_lut_init();
+
+/**
+ * Returns:
+ *  printable name of a mode
+ */
+const char *fami_lut_mode_name(fami_lut_mode_t mode);
+
+/**
+ * Same as fami_decode_tile but reads rows from the table of the given mode
+ */
+char *fami_decode_tile_lut(char *data, char *decoded, unsigned int *length, fami_lut_mode_t mode);
+
+/**
+ * Same as fami_decode but reads rows from the table of the given mode
+ * decoded = pre-allocated ptr to return array, if NULL it will be allocted using malloc
+ */
+char *fami_decode_lut(char *data, unsigned int *length, char *decoded, fami_lut_mode_t mode);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef PACKED_H_
+#define PACKED_H_
+
+#include <stdint.h>
+#include "famisprite.h"
+
+/**
+ * Packed 2 bits per pixel sprite representation
+ * One row of 8 pixels is stored in a single 16 bit value,
+ * pixel 0 lives in the upper 2 bits. Rows are stored top to bottom,
+ * tiles follow each other just like in the decoded byte layout.
+ * This uses a quarter of the memory of the decoded byte layout.
+ */
+
+typedef uint16_t fami_packed_row;
+
+#define FAMI_PACKED_TILE_ROWS FAMI_TILE_LEN // 8 rows per tile
+
+// bit position of a pixel inside a row
+#define fami_packed_shift(x) ((FAMI_TILE_LEN-1-(x))*FAMI_BPP)
+
+/**
+ * Sets a pixel at x/y to the given value
+ * Pixel value cannot be greater than 3
+ */
+void fami_packed_set_pixel(fami_packed_row *rows, unsigned int x, unsigned int y, fami_color_index index);
+
+/**
+ * Returns:
+ *  pixel at x/y
+ */
+fami_color_index fami_packed_get_pixel(fami_packed_row *rows, unsigned int x, unsigned int y);
+
+/**
+ * Returns:
+ *  the packed row at y
+ */
+fami_packed_row fami_packed_get_row(fami_packed_row *rows, unsigned int y);
+
+/**
+ * Replaces the packed row at y
+ */
+void fami_packed_set_row(fami_packed_row *rows, unsigned int y, fami_packed_row row);
+
+/**
+ * Packs 8 pixels with values from 0-3
+ */
+fami_packed_row fami_packed_row_pack(char *pixels);
+
+/**
+ * Expands a row into 8 pixels with values from 0-3
+ */
+void fami_packed_row_unpack(fami_packed_row row, char *pixels);
+
+/**
+ * Converts chr-rom data into packed rows
+ * Only full tiles are converted
+ * Inputs:
+ *  encoded chr-rom data
+ *  lenght of data in bytes
+ *  packed = pre-allocated ptr to return array, if NULL it will be allocted using malloc
+ * Returns:
+ *  array of packed rows
+ *  modifies lenght to equal the row amount
+ *  NULL on error
+ */
+fami_packed_row* fami_pack_chr(char *data, unsigned int *length, fami_packed_row *packed);
+
+/**
+ * Converts packed rows back into chr-rom data
+ * Only full tiles are converted
+ * Inputs:
+ *  packed rows
+ *  lenght in rows
+ *  encoded = pre-allocated ptr to return array, if NULL it will be allocted using malloc
+ * Returns:
+ *  array of chr-rom data
+ *  modifies lenght to equal the total size of the resulting chr-rom
+ *  NULL on error
+ */
+char* fami_unpack_chr(fami_packed_row *packed, unsigned int *length, char *encoded);
+
+/**
+ * Converts decoded pixels (one pixel per byte) into packed rows
+ * Only full rows are converted
+ * Returns:
+ *  array of packed rows
+ *  modifies lenght to equal the row amount
+ *  NULL on error
+ */
+fami_packed_row* fami_pack(char *decoded, unsigned int *length, fami_packed_row *packed);
+
+/**
+ * Converts packed rows into decoded pixels (one pixel per byte)
+ * Returns:
+ *  array of pixels with values from 0-3
+ *  modifies lenght to equal the pixel amount
+ *  NULL on error
+ */
+char* fami_unpack(fami_packed_row *packed, unsigned int *length, char *decoded);
+
+#endif
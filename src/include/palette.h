@@ -0,0 +1,86 @@
+#ifndef PALETTE_H_
+#define PALETTE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "famisprite.h"
+
+/**
+ * Palettes and rgb rendering
+ * The nes picks the 4 colors of a tile from a sub-palette, which holds 4 of the
+ * 64 colors of the master palette. Background and sprites have 4 sub-palettes each.
+ *
+ * Rendering maps decoded color indices to packed colors, 4 bytes each with red,
+ * green, blue and alpha in memory order, see fami_render_rgba.
+ */
+
+#define FAMI_NES_COLORS 64
+#define FAMI_SUB_PALETTES 8 // 4 background and 4 sprite sub-palettes
+
+/**
+ * Returns:
+ *  color of the master palette, only the lower 6 bits of index are used
+ */
+fami_color_t fami_nes_color(uint8_t index);
+
+/**
+ * Sets the 4 colors of state to entries of the master palette
+ */
+void fami_palette_state(fami_state_t *state, const uint8_t *nes);
+
+/**
+ * Parses a sub-palette of 4 hex master palette indices like "0F,16,27,30"
+ * Inputs:
+ *  text = indices separated by commas
+ *  nes = returns the 4 indices
+ * Returns:
+ *  1 on success
+ *  0 on error
+ */
+char fami_palette_parse(const char *text, uint8_t *nes);
+
+/**
+ * Packs the colors of state for rendering
+ * Inputs:
+ *  transparent = color 0 gets an alpha of 0 if set
+ *  colors = returns 4 packed colors
+ */
+void fami_palette_pack(fami_state_t *state, char transparent, uint32_t *colors);
+
+/**
+ * Renders a row of decoded tiles into lines of packed pixels
+ * Inputs:
+ *  decoded = tiles as fami_decode_tiles returns them
+ *  tiles_w = tiles in the row
+ *  palettes = packed sub-palettes, 4 colors each
+ *  tile_palettes = sub-palette of every tile, NULL uses the first one for all
+ *  rgba = 4 bytes per pixel if set, 3 otherwise
+ *  out = room for 8 lines of tiles_w*8 pixels
+ */
+void fami_render_row(char *decoded, unsigned int tiles_w, const uint32_t *palettes,
+        const uint8_t *tile_palettes, char rgba, uint8_t *out);
+
+/**
+ * Returns:
+ *  bytes fami_render_sheet writes for a sheet
+ *  0 if tiles_w is 0 or there is no full tile
+ */
+size_t fami_render_size(size_t length, unsigned int tiles_w, char rgba);
+
+/**
+ * Renders chr-rom data as a tile sheet framebuffer
+ * A trailing partial tile is ignored, a partial row of tiles is padded with color 0
+ * of the first sub-palette
+ * Inputs:
+ *  encoded chr-rom data and its lenght
+ *  tiles_w = tiles per sheet row
+ *  palettes, tile_palettes and rgba as in fami_render_row
+ *  out = room for fami_render_size bytes
+ * Returns:
+ *  1 on success
+ *  0 on error
+ */
+char fami_render_sheet(char *data, size_t length, unsigned int tiles_w, const uint32_t *palettes,
+        const uint8_t *tile_palettes, char rgba, uint8_t *out);
+
+#endif
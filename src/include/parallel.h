@@ -0,0 +1,35 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+/**
+ * Multithreaded bulk de/encoder
+ * Tiles are independent, so the full tiles are split into one contiguous
+ * range per thread and each range runs through the active simd kernel.
+ * Output is byte identical to fami_decode and fami_encode.
+ */
+
+#define FAMI_MAX_THREADS 256
+// a thread gets at least this many tiles, below that starting it costs more than it saves
+#define FAMI_PARALLEL_MIN_TILES 2048
+
+/**
+ * Returns:
+ *  the thread count used when 0 threads are requested, the number of online cpus
+ */
+unsigned int fami_default_threads();
+
+/**
+ * Same as fami_decode but spread across threads
+ * Inputs:
+ *  threads = number of threads to use, 0 uses fami_default_threads
+ */
+char* fami_decode_mt(char *data, unsigned int *length, char *decoded, unsigned int threads);
+
+/**
+ * Same as fami_encode but spread across threads
+ * Inputs:
+ *  threads = number of threads to use, 0 uses fami_default_threads
+ */
+char* fami_encode_mt(char *data, unsigned int *length, char *encoded, unsigned int threads);
+
+#endif
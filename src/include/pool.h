@@ -0,0 +1,77 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stddef.h>
+
+/**
+ * Work-stealing thread pool
+ * Every worker owns a deque. Jobs spawned by a running job go onto the back of
+ * the deque of its worker and are taken from there first, newest first, so the
+ * data they share is still in cache. An idle worker steals the oldest job from
+ * the front of another deque.
+ *
+ * Jobs submitted from outside wait in a separate queue and carry a memory
+ * estimate. One is only started while the estimates of the started jobs that
+ * have not released theirs stay within the limit, so the pool never holds more
+ * than a bounded amount of input at once. A single job above the limit still
+ * runs, alone. Spawned jobs carry no estimate and never wait, which keeps a job
+ * holding memory from waiting on its own follow-up work.
+ */
+
+typedef struct fami_pool fami_pool_t;
+
+typedef void (*fami_job_fn)(fami_pool_t *pool, void *arg);
+
+typedef struct fami_pool_stats {
+    size_t jobs; // run so far, submitted and spawned
+    size_t steals; // jobs taken from the deque of another worker
+    size_t memory_peak; // largest sum of held estimates
+} fami_pool_stats_t;
+
+/**
+ * Starts the workers
+ * Inputs:
+ *  threads = number of workers, 0 uses fami_default_threads
+ *  memory_limit = bound on the held estimates of submitted jobs, 0 for none
+ * Returns:
+ *  the pool
+ *  NULL if memory or threads could not be allocated
+ */
+fami_pool_t *fami_pool_create(unsigned int threads, size_t memory_limit);
+
+/**
+ * Queues a job from outside the pool
+ * Inputs:
+ *  memory = estimate held from the start of the job until fami_pool_release
+ * Returns:
+ *  1 on success
+ *  0 if memory could not be allocated
+ */
+char fami_pool_submit(fami_pool_t *pool, fami_job_fn fn, void *arg, size_t memory);
+
+/**
+ * Queues follow-up work from inside a running job, onto the deque of its worker
+ * Returns:
+ *  1 on success
+ *  0 if memory could not be allocated, the caller has to run it itself
+ */
+char fami_pool_spawn(fami_pool_t *pool, fami_job_fn fn, void *arg);
+
+/**
+ * Gives back the estimate of a submitted job, from any job or thread
+ */
+void fami_pool_release(fami_pool_t *pool, size_t memory);
+
+/**
+ * Waits until every submitted and spawned job has finished
+ */
+void fami_pool_wait(fami_pool_t *pool);
+
+fami_pool_stats_t fami_pool_stats(fami_pool_t *pool);
+
+/**
+ * Waits for the jobs, then stops the workers
+ */
+void fami_pool_free(fami_pool_t *pool);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef QUANTIZE_H_
+#define QUANTIZE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "famisprite.h"
+#include "image.h"
+#include "palette.h"
+
+/**
+ * Rgb image import
+ * Every pixel becomes the index of the nearest color of a sub-palette, by the
+ * squared difference of red, green and blue. With several sub-palettes each tile
+ * can pick the one with the smallest total distance.
+ *
+ * Tiles with only a few distinct colors, the usual case for drawn sheets, are
+ * looked up in a color cache that holds the nearest index of every sub-palette.
+ * Other tiles go through the fami_nearest_tile kernel once per sub-palette.
+ *
+ * Ordered dithering adds an 8x8 bayer pattern to the pixels first, scaled to the
+ * distance between the closest two colors of the sub-palettes.
+ */
+
+typedef struct fami_quantize {
+    fami_state_t *states; // up to FAMI_SUB_PALETTES sub-palettes
+    unsigned int palette_count;
+    char dither;
+    char auto_palette; // picks a sub-palette per tile instead of using the first
+
+    // statistics of the last import
+    size_t cache_hits; // distinct tile colors found in the color cache
+    size_t cache_misses;
+    size_t kernel_tiles; // tiles with too many colors for the cache
+} fami_quantize_t;
+
+/**
+ * Converts an rgb tile sheet into chr-rom data
+ * Inputs:
+ *  image with a width and height divisible by 8
+ *  quantize = sub-palettes and options, returns the statistics
+ *  tile_palettes = returns the malloced sub-palette of every tile if not NULL
+ *  length = returns the size of the chr-rom data
+ * Returns:
+ *  malloced chr-rom data
+ *  NULL on error
+ */
+char *fami_quantize_image(fami_image_t *image, fami_quantize_t *quantize,
+        uint8_t **tile_palettes, size_t *length);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef RELAY_H_
+#define RELAY_H_
+
+#include <stddef.h>
+#include <pthread.h>
+#include <termios.h>
+
+/**
+ * Terminal relay
+ * Puts a pseudo terminal between a program and the real one to measure how
+ * much the program writes to its screen. The program draws on the slave side,
+ * a thread copies everything from the master side to the real terminal and
+ * counts it, another one copies the keys of the real terminal back. The real
+ * terminal is put into raw mode with signals kept, so the line discipline of
+ * the pseudo terminal alone decides about echo and line buffering, and its
+ * window size follows the real one.
+ */
+
+typedef struct fami_relay {
+    int master;
+    int slave; // what the program uses as its terminal
+    int in_fd; // real terminal
+    int out_fd;
+    int stop_pipe[2];
+
+    pthread_t output_thread;
+    pthread_t input_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t copied;
+    size_t bytes; // guarded by lock, counted as the chunks are read
+
+    char raw; // saved holds the mode to restore
+    struct termios saved;
+} fami_relay_t;
+
+/**
+ * Opens the pseudo terminal and starts copying
+ * Inputs:
+ *  in_fd, out_fd = the real terminal
+ * Returns:
+ *  1 on success
+ *  0 if the pseudo terminal or the threads could not be created
+ */
+char fami_relay_start(fami_relay_t *relay, int in_fd, int out_fd);
+
+/**
+ * Bytes relayed so far
+ * Waits until everything written to the slave before the call is counted.
+ */
+size_t fami_relay_bytes(fami_relay_t *relay);
+
+/**
+ * Relays what is left, stops the threads and restores the real terminal
+ * The slave is closed, the caller must be done with it.
+ */
+void fami_relay_stop(fami_relay_t *relay);
+
+#endif
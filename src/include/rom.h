@@ -0,0 +1,62 @@
+#ifndef ROM_H_
+#define ROM_H_
+
+#include <stddef.h>
+
+/**
+ * iNES and NES 2.0 roms
+ * Parses the 16 byte header and locates the prg-rom and chr-rom regions
+ * inside the file data. Nothing is copied, the regions point into the data.
+ *
+ * Layout: header, optional 512 byte trainer, prg-rom, chr-rom, anything else.
+ */
+
+#define FAMI_INES_MAGIC "NES\x1A"
+#define FAMI_INES_HEADER_SIZE 16
+#define FAMI_INES_TRAINER_SIZE 512
+#define FAMI_PRG_BANK_SIZE 0x4000 // 16KiB
+#define FAMI_CHR_BANK_SIZE 0x2000 // 8KiB, 512 tiles
+
+typedef struct fami_rom {
+    char nes2; // header is NES 2.0
+    unsigned int mapper;
+    unsigned int submapper; // NES 2.0 only
+    char trainer;
+
+    char *prg;
+    size_t prg_offset; // into the file
+    size_t prg_size;
+    unsigned int prg_banks; // 16KiB banks, rounded up
+
+    char *chr; // NULL for boards with chr-ram
+    size_t chr_offset;
+    size_t chr_size;
+    unsigned int chr_banks; // 8KiB banks, rounded up
+} fami_rom_t;
+
+/**
+ * Returns:
+ *  1 if data starts with an iNES header
+ *  0 otherwise
+ */
+char fami_rom_check(char *data, size_t length);
+
+/**
+ * Parses a rom
+ * Inputs:
+ *  data = whole file and its lenght
+ *  rom = result, its regions point into data
+ * Returns:
+ *  1 on success
+ *  0 if it is not a rom or the file is shorter than its header says
+ */
+char fami_rom_parse(char *data, size_t length, fami_rom_t *rom);
+
+/**
+ * Returns:
+ *  start of 8KiB chr-rom bank, the last bank may be shorter
+ *  NULL if there is no such bank
+ */
+char *fami_rom_chr_bank(fami_rom_t *rom, unsigned int bank);
+
+#endif
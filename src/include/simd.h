@@ -0,0 +1,90 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Vectorized bulk tile kernels
+ * The kernel is picked at runtime based on what the cpu supports,
+ * the scalar kernel is the reference all others must match byte for byte.
+ */
+
+typedef enum fami_simd_level {
+    FAMI_SIMD_SCALAR,
+    FAMI_SIMD_SSE2,
+    FAMI_SIMD_AVX2,
+    FAMI_SIMD_NEON,
+    FAMI_SIMD_LEVELS
+} fami_simd_level_t;
+
+/**
+ * Returns:
+ *  the best kernel level supported by the running cpu
+ */
+fami_simd_level_t fami_simd_detect();
+
+/**
+ * Returns:
+ *  1 if the level was compiled in and is supported by the running cpu
+ */
+char fami_simd_supported(fami_simd_level_t level);
+
+/**
+ * Returns:
+ *  the level currently used by the bulk kernels
+ */
+fami_simd_level_t fami_simd_get_level();
+
+/**
+ * Forces a kernel level, mostly useful for tests and benchmarks
+ * Returns:
+ *  1 on success
+ *  0 if the level is not supported, the active level is left unchanged
+ */
+char fami_simd_set_level(fami_simd_level_t level);
+
+/**
+ * Returns:
+ *  printable name of a level
+ */
+const char *fami_simd_level_name(fami_simd_level_t level);
+
+/**
+ * Decodes a number of full tiles using the active kernel
+ * data must hold tiles*16 bytes, decoded must hold tiles*64 bytes
+ */
+void fami_decode_tiles(char *data, unsigned int tiles, char *decoded);
+
+/**
+ * Encodes a number of full tiles using the active kernel
+ * data must hold tiles*64 pixels, encoded must hold tiles*16 bytes
+ * Only the lower 2 bits of each pixel are used, just like fami_encode_pixel
+ */
+void fami_encode_tiles(char *data, unsigned int tiles, char *encoded);
+
+/**
+ * Maps color indices to packed colors using the active kernel
+ * Only the lower 2 bits of each index are used
+ * Inputs:
+ *  indices = pixels as fami_decode returns them
+ *  colors = 4 colors of 4 bytes each, red green blue alpha in memory order
+ *  out = room for 4 bytes per pixel for rgba, 3 bytes for rgb
+ */
+void fami_render_rgba(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out);
+
+void fami_render_rgb(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out);
+
+/**
+ * Finds the nearest of 4 colors for every pixel of a tile using the active kernel
+ * The distance is the squared difference of red, green and blue, ties go to the lower index
+ * Inputs:
+ *  planes = 64 red, then 64 green, then 64 blue values of the tile pixels
+ *  colors = 4 packed colors as for fami_render_rgba
+ *  indices = returns 64 color indices
+ * Returns:
+ *  sum of the squared distances of all pixels
+ */
+uint32_t fami_nearest_tile(const uint8_t *planes, const uint32_t *colors, char *indices);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "famisprite.h"
+
+/**
+ * Streaming de/encoder
+ * Converts input of any size in constant memory. Input is fed in chunks of any
+ * size, a partial tile is carried over to the next feed, and the converted
+ * output is drained by the caller whenever it likes.
+ */
+
+#define FAMI_STREAM_TILES 64 // tiles of output buffered per stream
+
+typedef enum fami_stream_mode {
+    FAMI_STREAM_DECODE, // chr-rom data in, pixels out
+    FAMI_STREAM_ENCODE // pixels in, chr-rom data out
+} fami_stream_mode_t;
+
+typedef struct fami_stream {
+    fami_stream_mode_t mode;
+
+    // partial input tile carried between feeds
+    char partial[FAMI_TILE_PIXELS];
+    unsigned int partial_len;
+
+    // converted output waiting to be drained
+    char out[FAMI_STREAM_TILES*FAMI_TILE_PIXELS];
+    size_t out_start;
+    size_t out_len;
+
+    uint64_t total_in;
+    uint64_t total_out;
+    unsigned int padded; // zero bytes added to the last tile by finish
+    char finished;
+} fami_stream_t;
+
+void fami_stream_init(fami_stream_t *stream, fami_stream_mode_t mode);
+
+/**
+ * Feeds input into the stream
+ * Consumes as much as fits into the output buffer
+ * Returns:
+ *  number of bytes consumed, less than length when output has to be drained first
+ */
+size_t fami_stream_feed(fami_stream_t *stream, char *data, size_t length);
+
+/**
+ * Copies converted output
+ * Returns:
+ *  number of bytes copied to out
+ */
+size_t fami_stream_drain(fami_stream_t *stream, char *out, size_t length);
+
+/**
+ * Returns:
+ *  number of bytes waiting to be drained
+ */
+size_t fami_stream_pending(fami_stream_t *stream);
+
+/**
+ * Ends the input
+ * A partial last tile is padded with zeros and converted,
+ * the number of zero bytes added is stored in padded.
+ * The stream accepts no more input afterwards.
+ * Returns:
+ *  1 when done
+ *  0 if output has to be drained first
+ */
+char fami_stream_finish(fami_stream_t *stream);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef TILECACHE_H_
+#define TILECACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "famisprite.h"
+
+/**
+ * Decoded tile cache
+ * Keeps a fixed number of decoded tiles, the least recently used one is
+ * replaced when the cache is full. Tiles are looked up by a caller chosen key,
+ * usually the tile index inside a file, through a chained hash table.
+ */
+
+typedef struct fami_tile_cache {
+    uint32_t capacity;
+    uint32_t used;
+    char *pixels; // FAMI_TILE_PIXELS per slot
+    size_t *keys; // per slot
+
+    // lru list of slots, head is the most recently used
+    uint32_t *prev;
+    uint32_t *next;
+    uint32_t head;
+    uint32_t tail;
+
+    // hash buckets and chains hold slot + 1, 0 ends a chain
+    uint32_t *buckets;
+    uint32_t *chain;
+    size_t bucket_mask;
+
+    size_t hits;
+    size_t misses;
+} fami_tile_cache_t;
+
+/**
+ * Returns:
+ *  1 on success
+ *  0 if memory could not be allocated
+ */
+char fami_tile_cache_init(fami_tile_cache_t *cache, uint32_t capacity);
+
+/**
+ * Looks up a decoded tile, decoding it on a miss
+ * Inputs:
+ *  key = identifies the tile
+ *  tile = encoded 16 byte tile, only read on a miss
+ * Returns:
+ *  FAMI_TILE_PIXELS decoded pixels, valid until the next call
+ */
+char *fami_tile_cache_get(fami_tile_cache_t *cache, size_t key, char *tile);
+
+/**
+ * Drops a tile, call it whenever the encoded tile changes
+ */
+void fami_tile_cache_invalidate(fami_tile_cache_t *cache, size_t key);
+
+/**
+ * Drops every tile
+ */
+void fami_tile_cache_clear(fami_tile_cache_t *cache);
+
+void fami_tile_cache_free(fami_tile_cache_t *cache);
+
+#endif
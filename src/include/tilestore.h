@@ -0,0 +1,114 @@
+#ifndef TILESTORE_H_
+#define TILESTORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "famisprite.h"
+
+/**
+ * Persistent decoded tile cache
+ * A file mapped into memory that holds decoded tiles keyed by their encoded
+ * 16 bytes, so later runs over the same data copy tiles instead of decoding
+ * them. Every tile also gets an id, the same for equal tiles across all runs
+ * and files using the store, and the id and flip of its flip canonical form,
+ * see fami_tile_canonical. Tiles with the same canonical id differ only by a
+ * flip.
+ *
+ * The file is an open addressing hash table of fixed size. Entries are never
+ * changed or removed once written, an entry only becomes visible to lookups
+ * after it is complete. Lookups take no lock, so any number of processes and
+ * threads can read while one of them adds tiles. Writers are serialized with
+ * flock on the file across processes and a mutex inside one. A store stops
+ * taking tiles when it is three quarters full, lookups keep working.
+ *
+ * Layout: 64 byte header, then capacity entries of FAMI_TILE_ENTRY_SIZE.
+ */
+
+#define FAMI_TILE_STORE_MAGIC "FTST"
+#define FAMI_TILE_STORE_VERSION 1
+#define FAMI_TILE_STORE_HEADER_SIZE 64
+#define FAMI_TILE_ENTRY_SIZE 96
+#define FAMI_TILE_STORE_CAPACITY (1 << 18) // default entries, 24MiB
+#define FAMI_TILE_NO_ID UINT32_MAX
+
+// what the store knows about a tile
+typedef struct fami_tile_info {
+    uint32_t id; // FAMI_TILE_NO_ID if the tile is not in the store
+    uint32_t canonical_id;
+    uint8_t flip; // turns the canonical form into the tile
+} fami_tile_info_t;
+
+typedef struct fami_tile_store {
+    int fd;
+    char writable;
+    char *map;
+    size_t map_len;
+    uint32_t capacity; // entries, a power of two
+    pthread_mutex_t lock; // writers inside this process
+
+    // this handle only, updated atomically
+    size_t hits;
+    size_t misses;
+    size_t added; // tiles written to the store
+    size_t dropped; // misses that did not fit anymore
+} fami_tile_store_t;
+
+// totals over every writable handle closed so far
+typedef struct fami_tile_store_stats {
+    uint32_t capacity;
+    uint32_t tiles;
+    uint64_t hits;
+    uint64_t misses;
+} fami_tile_store_stats_t;
+
+/**
+ * Opens a store, creating it if writable and missing
+ * Inputs:
+ *  capacity = entries of a new store, rounded up to a power of two,
+ *             0 uses FAMI_TILE_STORE_CAPACITY, ignored for an existing store
+ *  writable = 0 only looks tiles up
+ * Returns:
+ *  1 on success
+ *  0 if the file could not be opened, created or is not a store
+ */
+char fami_tile_store_open(fami_tile_store_t *store, const char *path, uint32_t capacity, char writable);
+
+/**
+ * Decodes tiles through the store, adding the ones it does not have if writable
+ * Inputs:
+ *  data = encoded tiles
+ *  tiles = number of tiles
+ *  decoded = FAMI_TILE_PIXELS per tile
+ *  infos = per tile info, may be NULL
+ * Returns:
+ *  number of tiles found in the store
+ */
+size_t fami_tile_store_decode(fami_tile_store_t *store, char *data, size_t tiles,
+        char *decoded, fami_tile_info_t *infos);
+
+/**
+ * Finds the unique tiles of a decode from the ids it returned, the tiles are
+ * not looked at again
+ * Inputs:
+ *  infos = per tile info of fami_tile_store_decode
+ *  first = returns the index of the first tile of every id in order of
+ *          first appearance, room for tiles entries
+ *  unique = returns the number of distinct ids
+ *  canonical = returns the number of distinct canonical ids, tiles that are
+ *              unique up to a flip
+ * Returns:
+ *  1 on success
+ *  0 if a tile has no id or memory could not be allocated
+ */
+char fami_tile_store_unique(const fami_tile_info_t *infos, size_t tiles, size_t *first,
+        size_t *unique, size_t *canonical);
+
+fami_tile_store_stats_t fami_tile_store_stats(fami_tile_store_t *store);
+
+/**
+ * Adds the counters of this handle to the totals in the file and unmaps it
+ */
+void fami_tile_store_close(fami_tile_store_t *store);
+
+#endif
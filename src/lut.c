@@ -0,0 +1,134 @@
+#include "include/lut.h"
+#include "include/famisprite.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define my_malloc(x) malloc(x)
+
+// one table row holds the 8 pixels of a tile row
+#define LUT_ROW(p1, p2) { \
+    fami_decode_pixel((p1), (p2), 0), fami_decode_pixel((p1), (p2), 1), \
+    fami_decode_pixel((p1), (p2), 2), fami_decode_pixel((p1), (p2), 3), \
+    fami_decode_pixel((p1), (p2), 4), fami_decode_pixel((p1), (p2), 5), \
+    fami_decode_pixel((p1), (p2), 6), fami_decode_pixel((p1), (p2), 7) }
+
+// index is p1 | p2 << 8
+#define LUT_ENTRY(i) LUT_ROW((i) & 0xFF, (i) >> 8)
+#define LUT_4(i) LUT_ENTRY(i), LUT_ENTRY(i+1), LUT_ENTRY(i+2), LUT_ENTRY(i+3)
+#define LUT_16(i) LUT_4(i), LUT_4(i+4), LUT_4(i+8), LUT_4(i+12)
+#define LUT_64(i) LUT_16(i), LUT_16(i+16), LUT_16(i+32), LUT_16(i+48)
+#define LUT_256(i) LUT_64(i), LUT_64(i+64), LUT_64(i+128), LUT_64(i+192)
+#define LUT_1K(i) LUT_256(i), LUT_256(i+256), LUT_256(i+512), LUT_256(i+768)
+#define LUT_4K(i) LUT_1K(i), LUT_1K(i+1024), LUT_1K(i+2048), LUT_1K(i+3072)
+#define LUT_16K(i) LUT_4K(i), LUT_4K(i+4096), LUT_4K(i+8192), LUT_4K(i+12288)
+#define LUT_64K(i) LUT_16K(i), LUT_16K(i+16384), LUT_16K(i+32768), LUT_16K(i+49152)
+
+// split table only holds the first plane, values are 0 or 1
+// the second plane is the same row shifted left once
+static const uint8_t split_table[256][FAMI_TILE_LEN] __attribute__((aligned(8))) = {
+    LUT_256(0)
+};
+
+#ifdef FAMI_LUT_STATIC
+static const uint8_t full_table[65536][FAMI_TILE_LEN] __attribute__((aligned(8))) = {
+    LUT_64K(0)
+};
+
+void fami_lut_init() {
+}
+#else
+static uint8_t full_table[65536][FAMI_TILE_LEN] __attribute__((aligned(8)));
+static char full_table_ready = 0;
+
+void fami_lut_init() {
+    if (full_table_ready) {
+        return;
+    }
+    for (int p2 = 0; p2 < 256; p2++) {
+        for (int p1 = 0; p1 < 256; p1++) {
+            uint64_t lo;
+            uint64_t hi;
+            memcpy(&lo, split_table[p1], FAMI_TILE_LEN);
+            memcpy(&hi, split_table[p2], FAMI_TILE_LEN);
+            lo |= hi << 1;
+            memcpy(full_table[p1 | p2 << 8], &lo, FAMI_TILE_LEN);
+        }
+    }
+    full_table_ready = 1;
+}
+#endif
+
+const char *fami_lut_mode_name(fami_lut_mode_t mode) {
+    switch (mode) {
+        case FAMI_LUT_FULL:
+            return "full";
+        case FAMI_LUT_SPLIT:
+            return "split";
+        default:
+            return "unknown";
+    }
+}
+
+static void decode_tiles_full(char *data, unsigned int tiles, char *decoded) {
+    fami_lut_init();
+    for (unsigned int t = 0; t < tiles; t++) {
+        uint8_t *in = (uint8_t*)data+t*FAMI_TILE_SIZE;
+        char *out = decoded+t*FAMI_TILE_PIXELS;
+        for (int i = 0; i < FAMI_TILE_LEN; i++) {
+            memcpy(out+i*FAMI_TILE_LEN, full_table[in[i] | in[i+FAMI_TILE_LEN] << 8], FAMI_TILE_LEN);
+        }
+    }
+}
+
+static void decode_tiles_split(char *data, unsigned int tiles, char *decoded) {
+    for (unsigned int t = 0; t < tiles; t++) {
+        uint8_t *in = (uint8_t*)data+t*FAMI_TILE_SIZE;
+        char *out = decoded+t*FAMI_TILE_PIXELS;
+        for (int i = 0; i < FAMI_TILE_LEN; i++) {
+            uint64_t lo;
+            uint64_t hi;
+            memcpy(&lo, split_table[in[i]], FAMI_TILE_LEN);
+            memcpy(&hi, split_table[in[i+FAMI_TILE_LEN]], FAMI_TILE_LEN);
+            // every byte is 0 or 1 so the shift never crosses into a neighbour
+            lo |= hi << 1;
+            memcpy(out+i*FAMI_TILE_LEN, &lo, FAMI_TILE_LEN);
+        }
+    }
+}
+
+static void decode_tiles(char *data, unsigned int tiles, char *decoded, fami_lut_mode_t mode) {
+    if (mode == FAMI_LUT_SPLIT) {
+        decode_tiles_split(data, tiles, decoded);
+    } else {
+        decode_tiles_full(data, tiles, decoded);
+    }
+}
+
+char *fami_decode_tile_lut(char *data, char *decoded, unsigned int *length, fami_lut_mode_t mode) {
+    decode_tiles(data, 1, decoded, mode);
+    *length = FAMI_TILE_PIXELS;
+    return decoded;
+}
+
+char *fami_decode_lut(char *data, unsigned int *length, char *decoded, fami_lut_mode_t mode) {
+    if (!decoded) {
+        decoded = my_malloc(FAMI_BPP*2*(*length));
+    }
+
+    unsigned int tiles = *length / FAMI_TILE_SIZE;
+    decode_tiles(data, tiles, decoded, mode);
+
+    // a trailing partial tile takes the same path as fami_decode
+    unsigned int total_length = tiles*FAMI_TILE_PIXELS;
+    for (int i = tiles*FAMI_TILE_SIZE; i < *length; i+=FAMI_TILE_SIZE) {
+        unsigned int len = 0;
+        fami_decode_tile(data+i, decoded+i*4, &len);
+        total_length += len;
+    }
+
+    *length = total_length;
+
+    return decoded;
+}
@@ -7,16 +7,53 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ncurses.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <errno.h>
+#include <glob.h>
+#include <pthread.h>
 #include "include/famisprite.h"
 #include "include/utility.h"
+#include "include/simd.h"
+#include "include/image.h"
+#include "include/dedup.h"
+#include "include/flip.h"
+#include "include/chrz.h"
+#include "include/codec.h"
+#include "include/rom.h"
+#include "include/tilecache.h"
+#include "include/history.h"
+#include "include/bitmap.h"
+#include "include/palette.h"
+#include "include/ansi.h"
+#include "include/quantize.h"
+#include "include/pool.h"
+#include "include/tilestore.h"
+#include "include/relay.h"
 
 #define my_malloc(x) malloc(x)
 #define my_free(x) free(x)
 
-#define MAX_BUFFER_SIZE 128
+// metasprites are at most this many tiles wide and high
+#define MAX_SPRITE_TILES 8
 
-#define PIXEL_W 2
-#define PIXEL_H 1
+// characters per pixel on screen, halved when the sprite does not fit
+#define PIXEL_W 4
+#define PIXEL_H 2
+// truecolor pixels are square, this many columns by as many half rows
+#define HALF_BLOCK_PIXEL 2
+// cursor and selected sheet tile in truecolor, magenta like the cursor pair
+#define CURSOR_R 0xFF
+#define CURSOR_G 0x00
+#define CURSOR_B 0xFF
+
+// decoded tiles kept for the tile sheet, a few screens worth
+#define SHEET_CACHE_TILES 4096
+#define SHEET_STATUS_H 4
+#define STATUS_H 12
 
 enum FAMI_COLOR_PAIRS {
     DEFAULT,
@@ -31,61 +68,287 @@ enum FAMI_COLOR_PAIRS {
  * Application state
  */
 
+// everything the status window shows that can change
+typedef struct status_view {
+    fami_color_index color;
+    uint32_t offset;
+    size_t dirty_tiles;
+    size_t flushed_tiles;
+    size_t flushed_bytes;
+    long bank;
+    short mark_x;
+    short mark_y;
+    char sheet;
+    size_t sheet_tile;
+} status_view_t;
+
 typedef struct settings {
     uint8_t running; // boolean
 
     char *input_path;
     char *output_path;
 
-    char current[MAX_BUFFER_SIZE]; // current buffer on screen
+    // current buffer on screen, the pixels of one tile after another
+    // in the order of the sprite rows
+    char *current;
     char *buffer; // loaded file
     size_t buffer_len;
 
+    char use_mmap; // map the input file instead of reading it
+    char shared_map; // edits land in the input file itself
+    char compressed; // input is a .fchr container, buffer holds its uncompressed data
+
+    // ines roms are edited inside their chr-rom region
+    char is_rom;
+    fami_rom_t rom;
+    long bank; // chr-rom bank to start at, -1 if not given
+    char offset_set; // offset was given, it is a file offset even for roms
+    size_t region_start; // part of buffer that can be edited
+    size_t region_end;
+
+    // one bit per 16 byte block of buffer changed since the last write
+    uint8_t *dirty;
+    size_t dirty_tiles; // blocks set in dirty
+    // tiles on screen changed since they were loaded
+    char *current_dirty;
+    char output_synced; // output file matches buffer apart from dirty blocks
+
+    // write statistics
+    size_t flushed_tiles; // by the last write
+    size_t flushed_bytes;
+    size_t total_flushed_tiles;
+    size_t total_flushed_bytes;
+    size_t writes;
+    char show_stats;
+
     // cursor x and y location for editing
     short cursor_x;
     short cursor_y;
+    // other corner of lines, rectangles and copies
+    short mark_x;
+    short mark_y;
+
+    // copied pixels, room for a whole metasprite
+    char *clipboard_data;
+    fami_bitmap_t clipboard;
+    int clipboard_w;
+    int clipboard_h;
+    uint32_t *flood_stack; // seeds of a flood fill of the whole metasprite
 
     fami_color_index color; // current color
     uint32_t offset; // current buffer offset
-    char long_sprite;
-    uint32_t current_buffer;
+
+    // metasprite arrangement, the tile at x/y is stride*y+x tiles after offset
+    // the default is a 8x16 sprite
+    unsigned int meta_w;
+    unsigned int meta_h;
+    unsigned int stride;
+    char long_sprite; // shows the metasprite instead of a single tile
+    unsigned int sprite_w; // tiles on screen, set by init_windows
+    unsigned int sprite_h;
+    uint32_t current_buffer; // pixels on screen
+    int pixel_w; // characters per pixel
+    int pixel_h;
     char color_on;
     char show_cursor;
+
+    // pixels drawn as 24 bit half blocks instead of curses characters
+    char truecolor;
+    fami_state_t colors;
+    // packed colors, the plain sub-palette, the one of the cursor and a blank one
+    uint32_t palettes[3*FAMI_MAX_COLORS];
+    fami_ansi_t ansi;
+    uint32_t *frame; // pixel area of the main window, frame_w by frame_h
+    uint32_t *frame_shown;
+    int frame_w;
+    int frame_h;
+
+    // what is on screen, only the changes get repainted
+    char frame_valid; // main window matches shown, cleared when it is recreated
+    char *shown;
+    int shown_cursor; // pixel index under the cursor, -1 if hidden
+    char status_valid;
+    status_view_t shown_status;
+
+    // edits and bank jumps that can be undone, recorded on buffer
+    fami_history_t history;
+    char *edit_before; // encoded sprite tiles before the edit being recorded
+
+    // tile sheet of the whole region, shown instead of the sprite
+    char sheet;
+    fami_tile_cache_t sheet_cache; // decoded tiles keyed by their buffer offset
+    size_t sheet_tile; // selected tile, counted from region_start
+    size_t sheet_top; // first tile row on screen
+    int sheet_cols; // tiles per row and rows on screen, set by init_windows
+    int sheet_rows;
+    char sheet_valid; // sheet window matches shown_top and shown_tile
+    size_t sheet_shown_top;
+    size_t sheet_shown_tile;
+
+    // the terminal, a relay in front of it counts the output with -stats
+    int terminal_fd;
+    char relayed;
+    fami_relay_t relay;
+    SCREEN *screen;
+    FILE *screen_file;
+
+    // terminal output per frame after the first one
+    size_t frames;
+    size_t frame_bytes;
+    size_t max_frame_bytes;
 } settings_t;
 
 void init_settings(settings_t *settings) {
     settings->input_path = NULL;
     settings->output_path = "./out.bin";
 
-    memset(settings->current, 0, MAX_BUFFER_SIZE);
+    settings->current = NULL;
     settings->buffer = NULL;
+    settings->buffer_len = 0;
+
+    settings->use_mmap = 0;
+    settings->shared_map = 0;
+    settings->compressed = 0;
+
+    settings->is_rom = 0;
+    settings->bank = -1;
+    settings->offset_set = 0;
+    settings->region_start = 0;
+    settings->region_end = 0;
+
+    settings->dirty = NULL;
+    settings->dirty_tiles = 0;
+    settings->current_dirty = NULL;
+    settings->output_synced = 0;
+
+    settings->flushed_tiles = 0;
+    settings->flushed_bytes = 0;
+    settings->total_flushed_tiles = 0;
+    settings->total_flushed_bytes = 0;
+    settings->writes = 0;
+    settings->show_stats = 0;
 
     settings->color = 0;
     settings->cursor_x = 0;
     settings->cursor_y = 0;
+    settings->mark_x = 0;
+    settings->mark_y = 0;
+
+    settings->clipboard_data = NULL;
+    settings->clipboard_w = 0;
+    settings->clipboard_h = 0;
+    settings->flood_stack = NULL;
 
     settings->running = 1;
     settings->offset = 0;
+    settings->meta_w = 1;
+    settings->meta_h = 2;
+    settings->stride = 0;
     settings->long_sprite = 0;
-    settings->current_buffer = MAX_BUFFER_SIZE/2;
+    settings->sprite_w = 1;
+    settings->sprite_h = 1;
+    settings->current_buffer = FAMI_TILE_PIXELS;
+    settings->pixel_w = PIXEL_W;
+    settings->pixel_h = PIXEL_H;
     settings->color_on = 1;
     settings->show_cursor = 1;
+
+    settings->truecolor = 0;
+    fami_image_init_state(&settings->colors);
+    memset(&settings->ansi, 0, sizeof(settings->ansi));
+    settings->frame = NULL;
+    settings->frame_shown = NULL;
+    settings->frame_w = 0;
+    settings->frame_h = 0;
+
+    settings->frame_valid = 0;
+    settings->shown = NULL;
+    settings->shown_cursor = -1;
+    settings->status_valid = 0;
+
+    fami_history_init(&settings->history);
+    settings->edit_before = NULL;
+
+    settings->sheet = 0;
+    memset(&settings->sheet_cache, 0, sizeof(settings->sheet_cache));
+    settings->sheet_tile = 0;
+    settings->sheet_top = 0;
+    settings->sheet_cols = 1;
+    settings->sheet_rows = 1;
+    settings->sheet_valid = 0;
+
+    settings->terminal_fd = STDOUT_FILENO;
+    settings->relayed = 0;
+    settings->screen = NULL;
+    settings->screen_file = NULL;
+
+    settings->frames = 0;
+    settings->frame_bytes = 0;
+    settings->max_frame_bytes = 0;
 }
 
 
 void parse_arg_inputs(int argc, char **argv, settings_t *ps) {
     for (size_t i = 1; i < argc; i++) {
         if (is_arg(argv[i], "-h")) {
-            printf("Usage: famisprite <infile> <outfile>\n\n");
+            printf("Usage: famisprite <infile> <outfile>\n");
+            printf("       famisprite convert <infile> <outfile>\n");
+            printf("       famisprite dedup <infile> <outfile> [remapfile]\n");
+            printf("       famisprite compress <infile> <outfile>\n");
+            printf("       famisprite codec <infile> [outfile]\n");
+            printf("       famisprite rom <infile>\n");
+            printf("       famisprite batch [files or patterns...]\n\n");
             printf("Optional arguments:\n\n");
-            printf("-o<number>\tStarting offset.");
-            printf("-no-color\tDisables colors");
+            printf("-o<number>\tStarting offset.\n");
+            printf("-b<number>\tStarting chr-rom bank of a .nes rom.\n");
+            printf("-size<w>x<h>\tEdits metasprites of w by h tiles, (I) switches to single tiles.\n");
+            printf("-stride<number>\tTiles from one metasprite row to the next (default w).\n");
+            printf("-no-color\tDisables colors\n");
+            printf("-truecolor\tDraws two pixels per character in 24 bit color.\n");
+            printf("-p<colors>\tTruecolor sub-palette of 4 hex nes master palette colors,\n");
+            printf("\t\te.g. -p0F,16,27,30 (default grays).\n");
+            printf("-mmap\t\tMaps the input file instead of reading it.\n");
+            printf("\t\tWithout an outfile edits go straight into the infile.\n");
+            printf("-stats\t\tPrints write statistics on exit.\n");
             exit(0);
         } else if (is_arg(argv[i], "-o")) {
             arg a = parse_arg(argv[i], "-o");
             ps->offset = strtol(a.value, NULL, 0);
+            ps->offset_set = 1;
+        } else if (is_arg(argv[i], "-b")) {
+            arg a = parse_arg(argv[i], "-b");
+            ps->bank = strtol(a.value, NULL, 0);
+        } else if (is_arg(argv[i], "-size")) {
+            arg a = parse_arg(argv[i], "-size");
+            char *end = NULL;
+            ps->meta_w = strtoul(a.value, &end, 0);
+            ps->meta_h = *end == 'x' ? strtoul(end+1, NULL, 0) : 0;
+            if (ps->meta_w < 1 || ps->meta_w > MAX_SPRITE_TILES
+                    || ps->meta_h < 1 || ps->meta_h > MAX_SPRITE_TILES) {
+                printf("Metasprites are 1x1 to %dx%d tiles: %s\n",
+                        MAX_SPRITE_TILES, MAX_SPRITE_TILES, argv[i]);
+                exit(1);
+            }
+            ps->long_sprite = 1;
+        } else if (is_arg(argv[i], "-stride")) {
+            arg a = parse_arg(argv[i], "-stride");
+            ps->stride = strtoul(a.value, NULL, 0);
         } else if (is_arg(argv[i], "-no-color")) {
             ps->color_on = 0;
+        } else if (is_arg(argv[i], "-truecolor")) {
+            ps->truecolor = 1;
+        } else if (is_arg(argv[i], "-p")) {
+            arg a = parse_arg(argv[i], "-p");
+            uint8_t nes[FAMI_MAX_COLORS];
+            if (!fami_palette_parse(a.value, nes)) {
+                printf("Invalid sub-palette: %s\n", a.value);
+                exit(1);
+            }
+            fami_palette_state(&ps->colors, nes);
+        } else if (is_arg(argv[i], "-mmap")) {
+            ps->use_mmap = 1;
+        } else if (is_arg(argv[i], "-stats")) {
+            ps->show_stats = 1;
         } else {
             // first set input then output then error
             if (!ps->input_path) {
@@ -99,13 +362,66 @@ void parse_arg_inputs(int argc, char **argv, settings_t *ps) {
             }
         }
     }
+
+    if (!ps->color_on) {
+        ps->truecolor = 0;
+    }
+
+    if (ps->stride == 0) {
+        ps->stride = ps->meta_w;
+    } else if (ps->stride < ps->meta_w) {
+        printf("Stride is less than the metasprite width\n");
+        exit(1);
+    }
 }
 
-void end_curses() {
+void end_curses(settings_t *ps) {
     endwin();
+    if (ps->relayed) {
+        delscreen(ps->screen);
+        fclose(ps->screen_file);
+        fami_relay_stop(&ps->relay);
+        ps->relayed = 0;
+    }
 }
 
-void read_input_file(settings_t *ps) {
+/**
+ * Maps the input file
+ * When reading and writing the same file the mapping is shared
+ * and every encoded edit lands in the file directly,
+ * otherwise it is a private copy on write mapping that is written out as usual
+ */
+void map_input_file(settings_t *ps) {
+    ps->shared_map = strcmp(ps->input_path, ps->output_path) == 0;
+
+    int fd = open(ps->input_path, ps->shared_map ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open input file: %s\n", ps->input_path);
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Unable to map empty input file: %s\n", ps->input_path);
+        exit(1);
+    }
+
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = ps->shared_map ? MAP_SHARED : MAP_PRIVATE;
+    void *map = mmap(NULL, st.st_size, prot, flags, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map input file: %s\n", ps->input_path);
+        exit(1);
+    }
+
+    ps->buffer = map;
+    ps->buffer_len = st.st_size;
+}
+
+void read_file(settings_t *ps) {
+
     FILE *f = fopen(ps->input_path, "r");
 
     if (f == NULL) {
@@ -128,19 +444,514 @@ void read_input_file(settings_t *ps) {
     }
 }
 
-void write_output_file(settings_t *ps) {
+size_t buffer_tiles(settings_t *ps) {
+    return (ps->buffer_len+FAMI_TILE_SIZE-1) / FAMI_TILE_SIZE;
+}
+
+// replaces a compressed container in buffer by its uncompressed data
+void decompress_input_file(settings_t *ps) {
+    size_t len = 0;
+    char *raw = fami_chrz_decompress(ps->buffer, ps->buffer_len, &len);
+    if (!raw) {
+        fprintf(stderr, "Corrupt compressed input file: %s\n", ps->input_path);
+        exit(1);
+    }
+    if (ps->use_mmap) {
+        munmap(ps->buffer, ps->buffer_len);
+    } else {
+        my_free(ps->buffer);
+    }
+    // edits of the uncompressed data cannot go through the mapping
+    ps->use_mmap = 0;
+    ps->shared_map = 0;
+    ps->compressed = 1;
+    ps->buffer = raw;
+    ps->buffer_len = len;
+}
+
+/**
+ * Finds the editable region and the starting offset
+ * A rom without an offset starts at the first or the requested chr-rom bank,
+ * the region covers its chr-rom. Everything else covers the whole buffer.
+ */
+void locate_region(settings_t *ps) {
+    ps->region_start = 0;
+    ps->region_end = ps->buffer_len;
+
+    if (fami_rom_check(ps->buffer, ps->buffer_len)) {
+        if (!fami_rom_parse(ps->buffer, ps->buffer_len, &ps->rom)) {
+            fprintf(stderr, "Truncated or invalid rom: %s\n", ps->input_path);
+            exit(1);
+        }
+        ps->is_rom = 1;
+        if (ps->rom.chr_size) {
+            ps->region_start = ps->rom.chr_offset;
+            ps->region_end = ps->rom.chr_offset+ps->rom.chr_size;
+        }
+    }
+
+    if (ps->bank >= 0) {
+        char *bank = ps->is_rom ? fami_rom_chr_bank(&ps->rom, ps->bank) : NULL;
+        if (!bank) {
+            fprintf(stderr, "No chr-rom bank %ld in %s\n", ps->bank, ps->input_path);
+            exit(1);
+        }
+        ps->offset = bank-ps->buffer;
+    } else if (!ps->offset_set) {
+        ps->offset = ps->region_start;
+    }
+
+    // an explicit offset outside the chr-rom can still edit the whole file
+    if (ps->offset < ps->region_start || ps->offset >= ps->region_end) {
+        ps->region_start = 0;
+        ps->region_end = ps->buffer_len;
+    }
+}
+
+void read_input_file(settings_t *ps) {
+    if (ps->use_mmap) {
+        map_input_file(ps);
+    } else {
+        read_file(ps);
+    }
+    if (fami_chrz_check(ps->buffer, ps->buffer_len)) {
+        decompress_input_file(ps);
+    }
+    locate_region(ps);
+
+    ps->dirty = calloc((buffer_tiles(ps)+7)/8, 1);
+    // a file written in place already holds everything that is not dirty,
+    // unless it has to be compressed again
+    ps->output_synced = !ps->compressed && strcmp(ps->input_path, ps->output_path) == 0;
+}
+
+// marks the 16 byte blocks of buffer covering a byte range as changed
+void mark_dirty(settings_t *ps, size_t start, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    for (size_t i = start/FAMI_TILE_SIZE; i <= (start+len-1)/FAMI_TILE_SIZE; i++) {
+        if (!(ps->dirty[i/8] & (1 << (i%8)))) {
+            ps->dirty[i/8] |= 1 << (i%8);
+            ps->dirty_tiles++;
+        }
+    }
+
+    // sheet tiles are aligned to the region start
+    if (ps->sheet_cache.capacity && start+len > ps->region_start) {
+        size_t first = start > ps->region_start ? (start-ps->region_start)/FAMI_TILE_SIZE : 0;
+        size_t last = (start+len-1-ps->region_start)/FAMI_TILE_SIZE;
+        for (size_t i = first; i <= last; i++) {
+            fami_tile_cache_invalidate(&ps->sheet_cache, ps->region_start+i*FAMI_TILE_SIZE);
+        }
+    }
+}
+
+void clear_dirty(settings_t *ps) {
+    memset(ps->dirty, 0, (buffer_tiles(ps)+7)/8);
+    ps->dirty_tiles = 0;
+}
+
+/**
+ * Finds the next run of dirty blocks at or after from
+ * Returns:
+ *  first block of the run, or the block count if there is none
+ *  the run length in len
+ */
+size_t next_dirty_run(settings_t *ps, size_t from, size_t *len) {
+    size_t tiles = buffer_tiles(ps);
+    size_t i = from;
+    while (i < tiles && !(ps->dirty[i/8] & (1 << (i%8)))) {
+        // skip clean bytes of the bitmap at once
+        if (i%8 == 0 && ps->dirty[i/8] == 0) {
+            i += 8;
+        } else {
+            i++;
+        }
+    }
+    if (i >= tiles) {
+        *len = 0;
+        return tiles;
+    }
+    size_t end = i;
+    while (end < tiles && (ps->dirty[end/8] & (1 << (end%8)))) {
+        end++;
+    }
+    *len = end-i;
+    return i;
+}
+
+// byte range of a block run clamped to the buffer
+void run_to_bytes(settings_t *ps, size_t run, size_t run_len, size_t *start, size_t *len) {
+    *start = run*FAMI_TILE_SIZE;
+    *len = run_len*FAMI_TILE_SIZE;
+    if (*start+*len > ps->buffer_len) {
+        *len = ps->buffer_len-*start;
+    }
+}
+
+void output_error(settings_t *ps, const char *msg) {
+    end_curses(ps);
+    fprintf(stderr, "%s: %s\n", msg, ps->output_path);
+    exit(1);
+}
+
+// flushes the dirty blocks of a shared mapping
+void sync_output_map(settings_t *ps) {
+    // msync wants a page aligned start
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t run_len = 0;
+    for (size_t run = next_dirty_run(ps, 0, &run_len); run_len;
+            run = next_dirty_run(ps, run+run_len, &run_len)) {
+        size_t start = 0;
+        size_t len = 0;
+        run_to_bytes(ps, run, run_len, &start, &len);
+        size_t aligned = start & ~(page-1);
+        if (msync(ps->buffer+aligned, start+len-aligned, MS_SYNC) != 0) {
+            output_error(ps, "Unable to sync output file");
+        }
+        ps->flushed_tiles += run_len;
+        ps->flushed_bytes += len;
+    }
+}
+
+// writes the dirty blocks into an output file that is otherwise up to date
+void pwrite_output_file(settings_t *ps) {
+    int fd = open(ps->output_path, O_WRONLY);
+    if (fd < 0) {
+        output_error(ps, "Unable to open output file");
+    }
+
+    size_t run_len = 0;
+    for (size_t run = next_dirty_run(ps, 0, &run_len); run_len;
+            run = next_dirty_run(ps, run+run_len, &run_len)) {
+        size_t start = 0;
+        size_t len = 0;
+        run_to_bytes(ps, run, run_len, &start, &len);
+        for (size_t done = 0; done < len;) {
+            ssize_t written = pwrite(fd, ps->buffer+start+done, len-done, start+done);
+            if (written <= 0) {
+                close(fd);
+                output_error(ps, "Unable to write output file");
+            }
+            done += written;
+        }
+        ps->flushed_tiles += run_len;
+        ps->flushed_bytes += len;
+    }
+    close(fd);
+}
+
+// writes the whole buffer, compressed when it was read compressed
+void write_full_output_file(settings_t *ps) {
+    char *data = ps->buffer;
+    size_t len = ps->buffer_len;
+    if (ps->compressed && !(data = fami_chrz_compress(ps->buffer, ps->buffer_len, &len))) {
+        output_error(ps, "Unable to compress output file");
+    }
+
     FILE *f = fopen(ps->output_path, "w");
     if (f == NULL) {
-        end_curses();
-        fprintf(stderr, "Unable to open output file: %s\n", ps->output_path);
-        exit(1);
+        output_error(ps, "Unable to open output file");
     }
-    fwrite(ps->buffer, 1, ps->buffer_len, f);
+    fwrite(data, 1, len, f);
     fclose(f);
+    if (data != ps->buffer) {
+        my_free(data);
+    }
+    ps->flushed_tiles = buffer_tiles(ps);
+    ps->flushed_bytes = len;
+    // a compressed file is rewritten every time
+    ps->output_synced = !ps->compressed;
+}
+
+/**
+ * Saves buffer
+ * Only the dirty blocks are written once the output file holds the rest
+ */
+void write_output_file(settings_t *ps) {
+    ps->flushed_tiles = 0;
+    ps->flushed_bytes = 0;
+
+    if (!ps->output_synced) {
+        write_full_output_file(ps);
+    } else if (ps->shared_map) {
+        sync_output_map(ps);
+    } else {
+        pwrite_output_file(ps);
+    }
+    clear_dirty(ps);
+
+    ps->total_flushed_tiles += ps->flushed_tiles;
+    ps->total_flushed_bytes += ps->flushed_bytes;
+    ps->writes++;
+}
+
+void free_input_file(settings_t *ps) {
+    if (!ps->buffer) {
+        return;
+    }
+    if (ps->use_mmap) {
+        munmap(ps->buffer, ps->buffer_len);
+    } else {
+        my_free(ps->buffer);
+    }
+    ps->buffer = NULL;
+
+    my_free(ps->dirty);
+    ps->dirty = NULL;
+    fami_tile_cache_free(&ps->sheet_cache);
+    fami_history_free(&ps->history);
+}
+
+/**
+ * Buffer offset of a tile of the current sprite
+ * A sprite may hang over the end of the region, those tiles stay blank
+ * Returns:
+ *  1 and the offset of the tile in offset
+ *  0 if it is outside of the region
+ */
+char sprite_tile_offset(settings_t *ps, unsigned int tile, size_t *offset) {
+    size_t x = tile % ps->sprite_w;
+    size_t y = tile / ps->sprite_w;
+    *offset = ps->offset+(y*ps->stride+x)*FAMI_TILE_SIZE;
+    return *offset+FAMI_TILE_SIZE <= ps->region_end;
+}
+
+unsigned int sprite_tiles(settings_t *ps) {
+    return ps->sprite_w*ps->sprite_h;
+}
+
+// loads the tiles of the current sprite from the file buffer
+void load_current(settings_t *ps) {
+    for (unsigned int i = 0; i < sprite_tiles(ps); i++) {
+        size_t offset = 0;
+        char *pixels = ps->current+i*FAMI_TILE_PIXELS;
+        unsigned int len = 0;
+        if (sprite_tile_offset(ps, i, &offset)) {
+            fami_decode_tile(ps->buffer+offset, pixels, &len);
+        } else {
+            memset(pixels, 0, FAMI_TILE_PIXELS);
+        }
+        ps->current_dirty[i] = 0;
+    }
+}
+
+// puts the changed tiles of the current sprite back into the file buffer
+void store_current(settings_t *ps) {
+    for (unsigned int i = 0; i < sprite_tiles(ps); i++) {
+        if (!ps->current_dirty[i]) {
+            continue;
+        }
+        ps->current_dirty[i] = 0;
+        size_t offset = 0;
+        if (!sprite_tile_offset(ps, i, &offset)) {
+            continue;
+        }
+        unsigned int len = 0;
+        fami_encode_tile(ps->current+i*FAMI_TILE_PIXELS, ps->buffer+offset, &len);
+        mark_dirty(ps, offset, len);
+    }
+}
+
+// index into current of the pixel at x/y of the sprite
+int sprite_index(settings_t *ps, int x, int y) {
+    int tile = y/FAMI_TILE_LEN*ps->sprite_w + x/FAMI_TILE_LEN;
+    return tile*FAMI_TILE_PIXELS + y%FAMI_TILE_LEN*FAMI_TILE_LEN + x%FAMI_TILE_LEN;
+}
+
+// position in the sprite of the pixel at index of current
+void sprite_position(settings_t *ps, int i, int *x, int *y) {
+    int tile = i/FAMI_TILE_PIXELS;
+    *x = tile%ps->sprite_w*FAMI_TILE_LEN + i%FAMI_TILE_LEN;
+    *y = tile/ps->sprite_w*FAMI_TILE_LEN + i%FAMI_TILE_PIXELS/FAMI_TILE_LEN;
+}
+
+/**
+ * Moves to the next or previous sprite, wrapping around the region
+ * Metasprites laid out in rows of a wider stride move along their row
+ * and continue at the start of the next sprite row.
+ */
+void step_sprite(settings_t *ps, int direction) {
+    size_t step = sprite_tiles(ps)*FAMI_TILE_SIZE;
+
+    if (ps->sprite_h > 1 && ps->sprite_w < ps->stride) {
+        size_t w = ps->sprite_w*FAMI_TILE_SIZE;
+        size_t row = ps->stride*FAMI_TILE_SIZE;
+        size_t sprite_row = row*ps->sprite_h;
+        // bytes from the start of the tile row to the last sprite in it
+        size_t last = (ps->stride/ps->sprite_w-1)*w;
+        size_t col = (ps->offset-ps->region_start) % row;
+
+        if (direction > 0) {
+            ps->offset += col+2*w <= row ? w : sprite_row-col;
+            if (ps->offset > ps->region_end-FAMI_TILE_SIZE) {
+                ps->offset = ps->region_start;
+            }
+        } else if (col >= w) {
+            ps->offset -= w;
+        } else if (ps->offset-col >= ps->region_start+sprite_row) {
+            ps->offset = ps->offset-col-sprite_row+last;
+        } else {
+            size_t rows = (ps->region_end-ps->region_start) / sprite_row;
+            ps->offset = rows ? ps->region_start+(rows-1)*sprite_row+last
+                : ps->region_end-FAMI_TILE_SIZE;
+        }
+        return;
+    }
+
+    if (direction > 0) {
+        ps->offset += step;
+        if (ps->offset > ps->region_end-FAMI_TILE_SIZE) {
+            ps->offset = ps->region_start;
+        }
+    } else if (ps->offset < ps->region_start+step) {
+        ps->offset = ps->region_end-FAMI_TILE_SIZE;
+    } else {
+        ps->offset -= step;
+    }
+}
+
+/**
+ * Undo recording
+ * An edit of the current sprite is recorded as the change of its encoded
+ * tiles, which also marks the tiles that changed to be stored. The step
+ * applies to buffer once the edit is stored, which undo and redo do before
+ * applying it.
+ */
+
+void begin_edit(settings_t *ps) {
+    for (unsigned int i = 0; i < sprite_tiles(ps); i++) {
+        size_t offset = 0;
+        unsigned int len = 0;
+        if (sprite_tile_offset(ps, i, &offset)) {
+            fami_encode_tile(ps->current+i*FAMI_TILE_PIXELS, ps->edit_before+i*FAMI_TILE_SIZE, &len);
+        }
+    }
+    fami_history_begin(&ps->history, ps->offset);
+}
+
+// reloaded = current was loaded from buffer, there is nothing to store
+void end_edit(settings_t *ps, char reloaded) {
+    for (unsigned int i = 0; i < sprite_tiles(ps); i++) {
+        size_t offset = 0;
+        unsigned int len = 0;
+        char after[FAMI_TILE_SIZE];
+        char *before = ps->edit_before+i*FAMI_TILE_SIZE;
+        if (sprite_tile_offset(ps, i, &offset)) {
+            fami_encode_tile(ps->current+i*FAMI_TILE_PIXELS, after, &len);
+            fami_history_add_tile(&ps->history, offset, before, after);
+            if (!reloaded && memcmp(before, after, FAMI_TILE_SIZE) != 0) {
+                ps->current_dirty[i] = 1;
+            }
+        }
+    }
+    fami_history_end(&ps->history, ps->offset);
+}
+
+// undoes the last step or redoes the next one and moves to where it happened
+void undo(settings_t *ps, char redo) {
+    // the last step may still be in current
+    store_current(ps);
+    fami_history_step_t *step = redo ? fami_history_redo(&ps->history)
+        : fami_history_undo(&ps->history);
+    if (!step) {
+        return;
+    }
+
+    uint32_t changed[MAX_SPRITE_TILES*MAX_SPRITE_TILES];
+    fami_history_apply(&ps->history, step, ps->buffer, changed);
+    for (uint32_t i = 0; i < step->deltas; i++) {
+        mark_dirty(ps, changed[i], FAMI_TILE_SIZE);
+    }
+
+    ps->offset = redo ? step->offset_after : step->offset_before;
+    // undoing a bank jump can leave the chr-rom
+    if (ps->offset < ps->region_start || ps->offset >= ps->region_end) {
+        ps->region_start = 0;
+        ps->region_end = ps->buffer_len;
+    }
+    load_current(ps);
+}
+
+// chr-rom bank a buffer offset is in, -1 outside of it
+long bank_at(settings_t *ps, size_t offset) {
+    if (offset < ps->rom.chr_offset || offset >= ps->rom.chr_offset+ps->rom.chr_size) {
+        return -1;
+    }
+    return (offset-ps->rom.chr_offset) / FAMI_CHR_BANK_SIZE;
+}
+
+long current_bank(settings_t *ps) {
+    return bank_at(ps, ps->offset);
+}
+
+// moves to the start of a neighbouring bank, wrapping around
+void jump_bank(settings_t *ps, int direction) {
+    long bank = current_bank(ps)+direction;
+    if (bank < 0) {
+        bank = ps->rom.chr_banks-1;
+    } else if (bank >= ps->rom.chr_banks) {
+        bank = 0;
+    }
+    ps->offset = fami_rom_chr_bank(&ps->rom, bank)-ps->buffer;
+    // the bank table keeps the editor inside the chr-rom from now on
+    if (ps->region_start != ps->rom.chr_offset && ps->sheet_cache.capacity) {
+        // sheet tiles of the old region can be aligned differently
+        fami_tile_cache_clear(&ps->sheet_cache);
+    }
+    ps->region_start = ps->rom.chr_offset;
+    ps->region_end = ps->rom.chr_offset+ps->rom.chr_size;
+}
+
+/**
+ * Chr-rom data of the batch modes
+ * Covers the offset to the end of the region, a single bank if one was given
+ */
+char *input_data(settings_t *ps, size_t *len) {
+    if (ps->offset > ps->buffer_len) {
+        fprintf(stderr, "Offset is past the end of %s\n", ps->input_path);
+        exit(1);
+    }
+    size_t end = ps->region_end;
+    if (ps->bank >= 0 && ps->offset+FAMI_CHR_BANK_SIZE < end) {
+        end = ps->offset+FAMI_CHR_BANK_SIZE;
+    }
+    *len = end-ps->offset;
+    return ps->buffer+ps->offset;
+}
+
+/**
+ * Draws on a pseudo terminal relayed to the real one for -stats, so the editor
+ * sees every byte curses writes without getting between curses and libc
+ */
+char init_relayed_screen(settings_t *ps) {
+    if (!fami_relay_start(&ps->relay, STDIN_FILENO, STDOUT_FILENO)) {
+        return 0;
+    }
+    int fd = dup(ps->relay.slave);
+    ps->screen_file = fd >= 0 ? fdopen(fd, "r+") : NULL;
+    ps->screen = ps->screen_file ? newterm(NULL, ps->screen_file, ps->screen_file) : NULL;
+    if (!ps->screen) {
+        if (ps->screen_file) {
+            fclose(ps->screen_file);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        fami_relay_stop(&ps->relay);
+        return 0;
+    }
+    set_term(ps->screen);
+    ps->terminal_fd = ps->relay.slave;
+    ps->relayed = 1;
+    return 1;
 }
 
 void init_curses(settings_t *ps) {
-    initscr();
+    // without the relay the output is not measured
+    if (!ps->show_stats || !init_relayed_screen(ps)) {
+        initscr();
+    }
     cbreak();
     noecho();
     keypad(stdscr, TRUE);
@@ -156,35 +967,120 @@ void init_curses(settings_t *ps) {
     }
 }
 
+// packs the truecolor sub-palettes of the editor colors
+void init_palettes(settings_t *ps) {
+    uint32_t *colors = ps->palettes;
+    fami_palette_pack(&ps->colors, 0, colors);
+
+    // the cursor sub-palette only replaces color 0
+    fami_state_t cursor = ps->colors;
+    fami_color_t magenta = {CURSOR_R, CURSOR_G, CURSOR_B};
+    fami_set_color(&cursor, magenta, 0);
+    fami_palette_pack(&cursor, 0, colors+FAMI_MAX_COLORS);
+
+    for (int i = 0; i < FAMI_MAX_COLORS; i++) {
+        colors[2*FAMI_MAX_COLORS+i] = FAMI_ANSI_DEFAULT;
+    }
+}
+
+// sizes the truecolor framebuffers for a pixel area
+void init_frame(settings_t *ps, int width, int height) {
+    size_t len = (size_t)width*height;
+    uint32_t *frame = realloc(ps->frame, len*sizeof(uint32_t));
+    if (frame) {
+        ps->frame = frame;
+    }
+    uint32_t *shown = realloc(ps->frame_shown, len*sizeof(uint32_t));
+    if (shown) {
+        ps->frame_shown = shown;
+    }
+    if (!frame || !shown) {
+        ps->running = 0;
+        width = height = 0;
+    }
+    ps->frame_w = width;
+    ps->frame_h = height;
+}
+
 void init_windows(WINDOW **main_win, WINDOW **status_win, settings_t *ps) {
     if (*main_win) {
         delwin(*main_win);
+        // clears what the old windows left behind
+        erase();
+        if (ps->truecolor) {
+            // curses does not know about the half blocks, the whole screen has to go
+            clearok(curscr, TRUE);
+        }
+        wnoutrefresh(stdscr);
     }
     if (*status_win) {
         delwin(*status_win);
     }
+    ps->frame_valid = 0;
+    ps->status_valid = 0;
+    ps->sheet_valid = 0;
 
-    int height = FAMI_TILE_SIZE * PIXEL_H + 2;
-    int width = FAMI_TILE_SIZE * PIXEL_W + 2;
+    if (ps->sheet) {
+        // as many tiles as fit, in a power of two per row like a pattern table
+        // half blocks put two tile lines in a character
+        int tile_h = ps->truecolor ? FAMI_TILE_LEN/2 : FAMI_TILE_LEN;
+        int cols = FAMI_SHEET_WIDTH;
+        while (cols > 1 && cols*FAMI_TILE_LEN+2 > COLS) {
+            cols /= 2;
+        }
+        int rows = (LINES-2-SHEET_STATUS_H) / tile_h;
+        ps->sheet_cols = cols;
+        ps->sheet_rows = rows > 0 ? rows : 1;
 
-    if (ps->long_sprite) {
-        height = height * 2 - 2;
-        ps->current_buffer = MAX_BUFFER_SIZE;
-    } else {
-        ps->current_buffer = MAX_BUFFER_SIZE/2;
+        int height = ps->sheet_rows*tile_h + 2;
+        int width = cols*FAMI_TILE_LEN + 2;
+        if (ps->truecolor) {
+            init_frame(ps, cols*FAMI_TILE_LEN, ps->sheet_rows*FAMI_TILE_LEN);
+        }
+        *main_win = newwin(height, width, 0, 0);
+        *status_win = newwin(SHEET_STATUS_H, width, height, 0);
+        return;
+    }
+
+    ps->sprite_w = ps->long_sprite ? ps->meta_w : 1;
+    ps->sprite_h = ps->long_sprite ? ps->meta_h : 1;
+    ps->current_buffer = sprite_tiles(ps)*FAMI_TILE_PIXELS;
+
+    // large metasprites get smaller pixels to fit the terminal
+    int pixels_w = ps->sprite_w*FAMI_TILE_LEN;
+    int pixels_h = ps->sprite_h*FAMI_TILE_LEN;
+    ps->pixel_w = ps->truecolor ? HALF_BLOCK_PIXEL : PIXEL_W;
+    ps->pixel_h = ps->truecolor ? HALF_BLOCK_PIXEL : PIXEL_H;
+    // pixel_h counts half rows in truecolor
+    int halves = ps->truecolor ? 2 : 1;
+    while (ps->pixel_h > 1 && (pixels_w*ps->pixel_w+2 > COLS
+                || (pixels_h*ps->pixel_h+halves-1)/halves+2+STATUS_H > LINES)) {
+        ps->pixel_w /= 2;
+        ps->pixel_h /= 2;
+    }
+
+    int height = (pixels_h*ps->pixel_h+halves-1)/halves + 2;
+    int width = pixels_w*ps->pixel_w + 2;
+    if (ps->truecolor) {
+        init_frame(ps, pixels_w*ps->pixel_w, pixels_h*ps->pixel_h);
+    }
+    // the status window keeps the width of a single tile
+    int status_width = FAMI_TILE_LEN*PIXEL_W + 2;
+    if (width > status_width) {
+        status_width = width;
     }
 
     *main_win = newwin(height, width, 0, 0);
 
-    *status_win = newwin(7, width, height, 0);
+    *status_win = newwin(STATUS_H, status_width, height, 0);
 }
 
-int coordinate_to_render_w(int x) {
-    return x*PIXEL_W*2+1;
+int coordinate_to_render_w(settings_t *ps, int x) {
+    return x*ps->pixel_w+1;
 }
 
-int coordinate_to_render_h(int y) {
-    return y*PIXEL_H*2+1;
+int coordinate_to_render_h(settings_t *ps, int y) {
+    return y*ps->pixel_h+1;
 }
 
 int color_to_char(char c) {
@@ -201,90 +1097,503 @@ int color_to_char(char c) {
     return c;
 }
 
-void draw_pixel(WINDOW *win, int x, int y, int c) {
-    x = coordinate_to_render_w(x);
-    y = coordinate_to_render_h(y);
-    for (int i = 0; i < PIXEL_W*2; i++) {
-        for (int j = 0; j < PIXEL_H*2; j++) {
+void draw_pixel(WINDOW *win, settings_t *ps, int x, int y, int c) {
+    x = coordinate_to_render_w(ps, x);
+    y = coordinate_to_render_h(ps, y);
+    for (int i = 0; i < ps->pixel_w; i++) {
+        for (int j = 0; j < ps->pixel_h; j++) {
             mvwaddch(win, y+j, x+i, c);
         }
     }
 }
 
-void render_main(WINDOW *main_win, settings_t *ps) {
-    werase(main_win);
-
+void draw_color(WINDOW *win, settings_t *ps, int i) {
+    char c = ps->current[i];
     int x = 0;
     int y = 0;
-    for (int i = 0; i < ps->current_buffer; i++) {
-        wattron(main_win, COLOR_PAIR(ps->current[i]+1));
-        draw_pixel(main_win, x, y, color_to_char(ps->current[i]));
-        wattroff(main_win, COLOR_PAIR(ps->current[i]+1));
-        x++;
-        if (x >= FAMI_TILE_LEN) {
-            y++;
-            x = 0;
-        }
+    sprite_position(ps, i, &x, &y);
+    wattron(win, COLOR_PAIR(c+1));
+    draw_pixel(win, ps, x, y, color_to_char(c));
+    wattroff(win, COLOR_PAIR(c+1));
+    ps->shown[i] = c;
+}
+
+/**
+ * Adds the truecolor framebuffer to the pending terminal output
+ * The curses window keeps the border and a blank inside for the half blocks,
+ * a new window gets every cell sent again
+ * Returns:
+ *  1 if anything was drawn
+ */
+char render_frame(WINDOW *win, settings_t *ps, char full) {
+    char drawn = 0;
+    if (full) {
+        werase(win);
+        box(win, 0, 0);
+        wnoutrefresh(win);
+        drawn = 1;
     }
+    int row = 0;
+    int col = 0;
+    getbegyx(win, row, col);
+    return fami_ansi_frame(&ps->ansi, ps->frame, ps->frame_shown, ps->frame_w, ps->frame_h,
+            row+1, col+1, full) > 0 || drawn;
+}
 
-    if (ps->show_cursor) {
-        wattron(main_win, COLOR_PAIR(CURSORPAIR));
-        draw_pixel(main_win, ps->cursor_x, ps->cursor_y, '$');
-        wattroff(main_win, COLOR_PAIR(CURSORPAIR));
+// fills the truecolor framebuffer with the sprite at its pixel size
+char render_main_truecolor(WINDOW *main_win, settings_t *ps) {
+    int cursor = ps->show_cursor ? sprite_index(ps, ps->cursor_x, ps->cursor_y) : -1;
+    for (int i = 0; i < ps->current_buffer; i++) {
+        int x = 0;
+        int y = 0;
+        sprite_position(ps, i, &x, &y);
+        // color 0 of the cursor sub-palette is the cursor
+        uint32_t color = ps->palettes[i == cursor ? FAMI_MAX_COLORS : ps->current[i]];
+        uint32_t *out = ps->frame+(size_t)y*ps->pixel_h*ps->frame_w+x*ps->pixel_w;
+        for (int j = 0; j < ps->pixel_h; j++) {
+            for (int k = 0; k < ps->pixel_w; k++) {
+                out[k] = color;
+            }
+            out += ps->frame_w;
+        }
     }
 
-    box(main_win, 0 , 0);
+    char full = !ps->frame_valid;
+    ps->frame_valid = 1;
+    return render_frame(main_win, ps, full);
 }
 
-void render_status(WINDOW *status_win, settings_t *ps) {
-    werase(status_win);
-    box(status_win, 0, 0);
+/**
+ * Repaints the pixels that changed since the last frame
+ * Returns:
+ *  1 if anything was drawn
+ */
+char render_main(WINDOW *main_win, settings_t *ps) {
+    if (ps->truecolor) {
+        return render_main_truecolor(main_win, ps);
+    }
 
-    mvwprintw(status_win, 1, 1, "(Q)Quit ");
-    wprintw(status_win, "(W)Write ");
-    wprintw(status_win, "(1-4)Color");
+    int cursor = ps->show_cursor ? sprite_index(ps, ps->cursor_x, ps->cursor_y) : -1;
+    char drawn = 0;
 
-    mvwprintw(status_win, 2, 1, "(Space)Paint ");
-    wprintw(status_win, "(HJKL)Move ");
+    if (!ps->frame_valid) {
+        werase(main_win);
+        for (int i = 0; i < ps->current_buffer; i++) {
+            draw_color(main_win, ps, i);
+        }
+        box(main_win, 0 , 0);
+        ps->shown_cursor = -1;
+        ps->frame_valid = 1;
+        drawn = 1;
+    }
+
+    for (int i = 0; i < ps->current_buffer; i++) {
+        if (i == cursor) {
+            // stays covered, the cursor is drawn below
+            ps->shown[i] = ps->current[i];
+        } else if (ps->current[i] != ps->shown[i] || i == ps->shown_cursor) {
+            // includes the pixel the cursor just left
+            draw_color(main_win, ps, i);
+            drawn = 1;
+        }
+    }
+
+    if (cursor != ps->shown_cursor && cursor >= 0) {
+        wattron(main_win, COLOR_PAIR(CURSORPAIR));
+        draw_pixel(main_win, ps, ps->cursor_x, ps->cursor_y, '$');
+        wattroff(main_win, COLOR_PAIR(CURSORPAIR));
+        drawn = 1;
+    }
+    ps->shown_cursor = cursor;
+
+    if (drawn) {
+        wnoutrefresh(main_win);
+    }
+    return drawn;
+}
+
+size_t sheet_tiles(settings_t *ps) {
+    return (ps->region_end-ps->region_start) / FAMI_TILE_SIZE;
+}
+
+// draws one sheet tile at its place on screen, one character per pixel
+void draw_sheet_tile(WINDOW *win, settings_t *ps, size_t tile) {
+    size_t cell = tile-ps->sheet_top*ps->sheet_cols;
+    int x = cell%ps->sheet_cols*FAMI_TILE_LEN+1;
+    int y = cell/ps->sheet_cols*FAMI_TILE_LEN+1;
+
+    if (tile >= sheet_tiles(ps)) {
+        for (int j = 0; j < FAMI_TILE_LEN; j++) {
+            mvwhline(win, y+j, x, ' ', FAMI_TILE_LEN);
+        }
+        return;
+    }
+
+    size_t offset = ps->region_start+tile*FAMI_TILE_SIZE;
+    char *pixels = fami_tile_cache_get(&ps->sheet_cache, offset, ps->buffer+offset);
+    char selected = tile == ps->sheet_tile;
+    for (int i = 0; i < FAMI_TILE_PIXELS; i++) {
+        char c = pixels[i];
+        // the background of the selected tile takes the cursor color
+        int pair = selected && c == 0 ? CURSORPAIR : c+1;
+        chtype attrs = COLOR_PAIR(pair) | (selected ? A_REVERSE : 0);
+        mvwaddch(win, y+i/FAMI_TILE_LEN, x+i%FAMI_TILE_LEN, color_to_char(c) | attrs);
+    }
+}
+
+// renders the tiles on screen into the truecolor framebuffer
+void render_sheet_frame(settings_t *ps) {
+    char decoded[FAMI_SHEET_WIDTH*FAMI_TILE_PIXELS];
+    uint8_t row_palettes[FAMI_SHEET_WIDTH];
+    size_t count = sheet_tiles(ps);
+    size_t line_len = (size_t)ps->frame_w*FAMI_TILE_LEN*sizeof(uint32_t);
+
+    for (int r = 0; r < ps->sheet_rows; r++) {
+        size_t first = (ps->sheet_top+r)*ps->sheet_cols;
+        for (int c = 0; c < ps->sheet_cols; c++) {
+            size_t tile = first+c;
+            char *pixels = decoded+c*FAMI_TILE_PIXELS;
+            if (tile >= count) {
+                // past the end is blank
+                memset(pixels, 0, FAMI_TILE_PIXELS);
+                row_palettes[c] = 2;
+                continue;
+            }
+            size_t offset = ps->region_start+tile*FAMI_TILE_SIZE;
+            memcpy(pixels, fami_tile_cache_get(&ps->sheet_cache, offset, ps->buffer+offset),
+                    FAMI_TILE_PIXELS);
+            row_palettes[c] = tile == ps->sheet_tile;
+        }
+        fami_render_row(decoded, ps->sheet_cols, ps->palettes, row_palettes, 1,
+                (uint8_t*)ps->frame+r*line_len);
+    }
+}
+
+/**
+ * Repaints the tile sheet
+ * Only the tiles on screen are decoded, scrolling redraws them all and moving
+ * the selection redraws the two tiles involved
+ * Returns:
+ *  1 if anything was drawn
+ */
+char render_sheet(WINDOW *sheet_win, settings_t *ps) {
+    size_t first = ps->sheet_top*ps->sheet_cols;
+    size_t visible = (size_t)ps->sheet_rows*ps->sheet_cols;
+
+    if (ps->truecolor) {
+        if (ps->sheet_valid && ps->sheet_shown_top == ps->sheet_top
+                && ps->sheet_shown_tile == ps->sheet_tile) {
+            return 0;
+        }
+        // the framebuffer diff sends only the cells that changed
+        render_sheet_frame(ps);
+        char full = !ps->sheet_valid;
+        ps->sheet_valid = 1;
+        ps->sheet_shown_top = ps->sheet_top;
+        ps->sheet_shown_tile = ps->sheet_tile;
+        return render_frame(sheet_win, ps, full);
+    }
+
+    if (!ps->sheet_valid || ps->sheet_shown_top != ps->sheet_top) {
+        if (!ps->sheet_valid) {
+            werase(sheet_win);
+            box(sheet_win, 0, 0);
+        }
+        for (size_t i = first; i < first+visible; i++) {
+            draw_sheet_tile(sheet_win, ps, i);
+        }
+    } else if (ps->sheet_shown_tile != ps->sheet_tile) {
+        if (ps->sheet_shown_tile >= first && ps->sheet_shown_tile < first+visible) {
+            draw_sheet_tile(sheet_win, ps, ps->sheet_shown_tile);
+        }
+        draw_sheet_tile(sheet_win, ps, ps->sheet_tile);
+    } else {
+        return 0;
+    }
+
+    ps->sheet_valid = 1;
+    ps->sheet_shown_top = ps->sheet_top;
+    ps->sheet_shown_tile = ps->sheet_tile;
+    wnoutrefresh(sheet_win);
+    return 1;
+}
+
+// scrolls the sheet just enough to show the selected tile
+void sheet_follow(settings_t *ps) {
+    size_t row = ps->sheet_tile / ps->sheet_cols;
+    if (row < ps->sheet_top) {
+        ps->sheet_top = row;
+    } else if (row >= ps->sheet_top+ps->sheet_rows) {
+        ps->sheet_top = row-ps->sheet_rows+1;
+    }
+}
+
+// moves the selection by a number of tiles, stopping at either end
+void sheet_move(settings_t *ps, long tiles) {
+    size_t count = sheet_tiles(ps);
+    if (tiles < 0 && (size_t)-tiles > ps->sheet_tile) {
+        ps->sheet_tile = 0;
+    } else if (tiles > 0 && ps->sheet_tile+tiles >= count) {
+        ps->sheet_tile = count > 0 ? count-1 : 0;
+    } else {
+        ps->sheet_tile += tiles;
+    }
+    sheet_follow(ps);
+}
+
+// asks for a tile number in the status window and selects it
+void sheet_jump(WINDOW *status_win, settings_t *ps) {
+    char input[32];
+    mvwprintw(status_win, 2, 1, "Tile: ");
+    wclrtoeol(status_win);
+    echo();
+    wgetnstr(status_win, input, sizeof(input)-1);
+    noecho();
+    ps->status_valid = 0;
+
+    char *end = NULL;
+    unsigned long tile = strtoul(input, &end, 0);
+    if (end != input) {
+        ps->sheet_tile = 0;
+        sheet_move(ps, tile);
+    }
+}
+
+// selects the tile at the current sprite offset
+void open_sheet(settings_t *ps) {
+    ps->sheet_tile = (ps->offset-ps->region_start) / FAMI_TILE_SIZE;
+    ps->sheet_top = 0;
+    sheet_follow(ps);
+}
+
+// redraws the status window when something it shows changed
+char render_status(WINDOW *status_win, settings_t *ps) {
+    status_view_t view;
+    // padding has to compare equal too
+    memset(&view, 0, sizeof(view));
+    view.color = ps->color;
+    view.offset = ps->offset;
+    view.dirty_tiles = ps->dirty_tiles;
+    view.flushed_tiles = ps->flushed_tiles;
+    view.flushed_bytes = ps->flushed_bytes;
+    view.bank = ps->is_rom ? current_bank(ps) : -1;
+    view.mark_x = ps->mark_x;
+    view.mark_y = ps->mark_y;
+    view.sheet = ps->sheet;
+    view.sheet_tile = ps->sheet ? ps->sheet_tile : 0;
+    if (ps->status_valid && memcmp(&view, &ps->shown_status, sizeof(view)) == 0) {
+        return 0;
+    }
+    ps->shown_status = view;
+    ps->status_valid = 1;
+
+    werase(status_win);
+    box(status_win, 0, 0);
+
+    if (ps->sheet) {
+        mvwprintw(status_win, 1, 1, "(Q)Quit (G)Edit (HJKL)Move (<>)Page (:)Jump");
+        if (ps->is_rom && ps->rom.chr_banks) {
+            wprintw(status_win, " (bB)Bank");
+        }
+        mvwprintw(status_win, 2, 1, "Tile: %zu/%zu ", ps->sheet_tile, sheet_tiles(ps));
+        size_t offset = ps->region_start+ps->sheet_tile*FAMI_TILE_SIZE;
+        wprintw(status_win, "Offset: %zX", offset);
+        if (ps->is_rom && ps->rom.chr_banks) {
+            wprintw(status_win, " Bank: %ld", bank_at(ps, offset));
+        }
+        wnoutrefresh(status_win);
+        return 1;
+    }
+
+    mvwprintw(status_win, 1, 1, "(Q)Quit ");
+    wprintw(status_win, "(W)Write ");
+    wprintw(status_win, "(1-4)Color");
+
+    mvwprintw(status_win, 2, 1, "(Space)Paint ");
+    wprintw(status_win, "(HJKL)Move ");
     wprintw(status_win, "(I)Mode");
 
     mvwprintw(status_win, 3, 1, "(<>)+/- ");
     wprintw(status_win, "(R)Reload ");
     wprintw(status_win, "(F)Fill ");
 
-    mvwprintw(status_win, 4, 1, "(C)Hide Cursor");
+    mvwprintw(status_win, 4, 1, "(C)Hide Cursor ");
+    wprintw(status_win, "(G)Sheet ");
+    if (ps->is_rom && ps->rom.chr_banks) {
+        wprintw(status_win, "(bB)Bank");
+    }
+
+    mvwprintw(status_win, 5, 1, "(uU)Undo/Redo ");
+    wprintw(status_win, "(M)Mark ");
+    wprintw(status_win, "(E)Flood");
 
-    mvwprintw(status_win, 5, 1, "Color: %d ", ps->color);
+    mvwprintw(status_win, 6, 1, "(N)Line ");
+    wprintw(status_win, "(T)Rect ");
+    wprintw(status_win, "(Y)Copy ");
+    wprintw(status_win, "(P)Paste");
+
+    mvwprintw(status_win, 7, 1, "Color: %d ", ps->color);
     wprintw(status_win, "Offset: %X", ps->offset);
+
+    mvwprintw(status_win, 8, 1, "Dirty: %zu ", ps->dirty_tiles);
+    wprintw(status_win, "Saved: %zu/%zuB", ps->flushed_tiles, ps->flushed_bytes);
+
+    mvwprintw(status_win, 9, 1, "Mark: %d,%d", ps->mark_x, ps->mark_y);
+
+    if (ps->is_rom && ps->rom.chr_banks) {
+        mvwprintw(status_win, 10, 1, "Bank: %ld/%u Mapper: %u", view.bank,
+                ps->rom.chr_banks, ps->rom.mapper);
+    }
+    wnoutrefresh(status_win);
+    return 1;
+}
+
+// handles a key while the tile sheet is on screen
+void sheet_key(settings_t *ps, int ch, WINDOW **main_win, WINDOW **status_win) {
+    switch (ch) {
+        case 'q':
+            ps->running = 0;
+            break;
+        case 'g':
+        case '\n':
+        case KEY_ENTER:
+            // edit the selected tile
+            ps->sheet = 0;
+            ps->offset = ps->region_start+ps->sheet_tile*FAMI_TILE_SIZE;
+            init_windows(main_win, status_win, ps);
+            load_current(ps);
+            break;
+        case KEY_DOWN:
+        case 'j':
+            sheet_move(ps, ps->sheet_cols);
+            break;
+        case KEY_UP:
+        case 'k':
+            sheet_move(ps, -ps->sheet_cols);
+            break;
+        case KEY_LEFT:
+        case 'h':
+            sheet_move(ps, -1);
+            break;
+        case KEY_RIGHT:
+        case 'l':
+            sheet_move(ps, 1);
+            break;
+        case KEY_NPAGE:
+        case '.':
+        case '>':
+            sheet_move(ps, (long)ps->sheet_rows*ps->sheet_cols);
+            break;
+        case KEY_PPAGE:
+        case ',':
+        case '<':
+            sheet_move(ps, -(long)ps->sheet_rows*ps->sheet_cols);
+            break;
+        case KEY_HOME:
+            sheet_move(ps, -(long)ps->sheet_tile);
+            break;
+        case KEY_END:
+            sheet_move(ps, sheet_tiles(ps));
+            break;
+        case ':':
+            sheet_jump(*status_win, ps);
+            break;
+        case 'b':
+        case 'B':
+            if (ps->is_rom && ps->rom.chr_banks) {
+                ps->offset = ps->region_start+ps->sheet_tile*FAMI_TILE_SIZE;
+                jump_bank(ps, ch == 'b' ? 1 : -1);
+                open_sheet(ps);
+            }
+            break;
+    }
+}
+
+void free_sprite(settings_t *ps) {
+    my_free(ps->current);
+    my_free(ps->shown);
+    my_free(ps->current_dirty);
+    my_free(ps->edit_before);
+    my_free(ps->clipboard_data);
+    my_free(ps->flood_stack);
+    my_free(ps->frame);
+    my_free(ps->frame_shown);
+    fami_ansi_free(&ps->ansi);
 }
 
 void gui(settings_t *ps) {
     WINDOW *main_win = NULL;
     WINDOW *status_win = NULL;
+
+    // sized for the metasprite, a single tile uses the start of them
+    size_t tiles = ps->meta_w*ps->meta_h;
+    ps->current = my_malloc(tiles*FAMI_TILE_PIXELS);
+    ps->shown = my_malloc(tiles*FAMI_TILE_PIXELS);
+    ps->current_dirty = calloc(tiles, 1);
+    ps->edit_before = my_malloc(tiles*FAMI_TILE_SIZE);
+    ps->clipboard_data = calloc(tiles, FAMI_TILE_PIXELS);
+    fami_bitmap_init(&ps->clipboard, ps->clipboard_data, ps->meta_w, ps->meta_h, 0);
+    ps->flood_stack = my_malloc(fami_bitmap_flood_stack(&ps->clipboard)*sizeof(uint32_t));
+    if (!ps->current || !ps->shown || !ps->current_dirty || !ps->edit_before
+            || !ps->clipboard_data || !ps->flood_stack
+            || (ps->truecolor && !fami_ansi_init(&ps->ansi))) {
+        free_sprite(ps);
+        return;
+    }
+    init_palettes(ps);
+
     init_windows(&main_win, &status_win, ps);
 
     // sanity check on offset
-    if (ps->offset > ps->buffer_len-FAMI_TILE_SIZE) {
-        ps->offset = 0;
+    if (ps->offset > ps->region_end-FAMI_TILE_SIZE) {
+        ps->offset = ps->region_start;
     }
 
     // get first item
-    unsigned int len = ps->current_buffer/4;
-    fami_decode(ps->buffer+ps->offset, &len, (char*)ps->current);
+    load_current(ps);
+    // clears the screen once, getch would do it later on top of the windows
+    refresh();
+    if (!fami_tile_cache_init(&ps->sheet_cache, SHEET_CACHE_TILES)) {
+        ps->running = 0;
+    }
 
     while (ps->running) {
-        erase();
-        render_main(main_win, ps);
-        render_status(status_win, ps);
-
-        refresh();
-        wrefresh(main_win);
-        wrefresh(status_win);
+        size_t before = ps->relayed ? fami_relay_bytes(&ps->relay) : 0;
+        char drawn = ps->sheet ? render_sheet(main_win, ps) : render_main(main_win, ps);
+        drawn = render_status(status_win, ps) || drawn;
+        if (drawn) {
+            doupdate();
+        }
+        if (ps->truecolor) {
+            // after curses so the border and status are there first
+            fami_ansi_flush(&ps->ansi, ps->terminal_fd);
+        }
+        // the first frame paints everything, only count the ones after a key
+        if (ps->frames++ > 0 && ps->relayed) {
+            size_t bytes = fami_relay_bytes(&ps->relay)-before;
+            ps->frame_bytes += bytes;
+            if (bytes > ps->max_frame_bytes) {
+                ps->max_frame_bytes = bytes;
+            }
+        }
         int ch = getch();
+        if (ps->sheet) {
+            sheet_key(ps, ch, &main_win, &status_win);
+            continue;
+        }
+        fami_bitmap_t sprite;
+        fami_bitmap_init(&sprite, ps->current, ps->sprite_w, ps->sprite_h, 0);
         switch (ch) {
             case 'q':
                 ps->running = 0;
                 break;
+            case 'g':
+                // tile sheet of the whole region
+                store_current(ps);
+                ps->sheet = 1;
+                init_windows(&main_win, &status_win, ps);
+                open_sheet(ps);
+                break;
             case '1':
                 ps->color = 0;
                 break;
@@ -300,26 +1609,27 @@ void gui(settings_t *ps) {
             case ',':
             case '<':
                 // put current offset back into file
-                len = ps->current_buffer;
-                fami_encode((char*)ps->current, &len, ps->buffer+ps->offset);
-                ps->offset -= FAMI_TILE_SIZE * (ps->long_sprite+1);
-                if (ps->offset > ps->buffer_len) {
-                    ps->offset = ps->buffer_len-FAMI_TILE_SIZE;
-                }
-                len = ps->current_buffer/4;
-                fami_decode(ps->buffer+ps->offset, &len, (char*)ps->current);
+                store_current(ps);
+                step_sprite(ps, -1);
+                load_current(ps);
                 break;
             case '.':
             case '>':
                 // put current offset back into file
-                len = ps->current_buffer;
-                fami_encode((char*)ps->current, &len, ps->buffer+ps->offset);
-                ps->offset += FAMI_TILE_SIZE * (ps->long_sprite+1);
-                if (ps->offset > ps->buffer_len-FAMI_TILE_SIZE) {
-                    ps->offset = 0;
+                store_current(ps);
+                step_sprite(ps, 1);
+                load_current(ps);
+                break;
+            case 'b':
+            case 'B':
+                // next or previous chr-rom bank
+                if (ps->is_rom && ps->rom.chr_banks) {
+                    store_current(ps);
+                    fami_history_begin(&ps->history, ps->offset);
+                    jump_bank(ps, ch == 'b' ? 1 : -1);
+                    fami_history_end(&ps->history, ps->offset);
+                    load_current(ps);
                 }
-                len = ps->current_buffer/4;
-                fami_decode(ps->buffer+ps->offset, &len, (char*)ps->current);
                 break;
             case KEY_DOWN:
             case 'j':
@@ -338,30 +1648,82 @@ void gui(settings_t *ps) {
                 ps->cursor_x += 1;
                 break;
             case ' ':
-                fami_set_pixel(ps->current, ps->cursor_x, ps->cursor_y, ps->color);
+                begin_edit(ps);
+                fami_bitmap_set(&sprite, ps->cursor_x, ps->cursor_y, ps->color);
+                end_edit(ps, 0);
                 break;
             case 'f':
-                // fill
-                memset(ps->current, ps->color, MAX_BUFFER_SIZE);
+                // fill the sprite
+                begin_edit(ps);
+                fami_bitmap_rect(&sprite, 0, 0, sprite.width-1, sprite.height-1, ps->color, 1);
+                end_edit(ps, 0);
+                break;
+            case 'e':
+                // fill the area under the cursor
+                begin_edit(ps);
+                fami_bitmap_flood(&sprite, ps->cursor_x, ps->cursor_y, ps->color, ps->flood_stack);
+                end_edit(ps, 0);
+                break;
+            case 'm':
+                ps->mark_x = ps->cursor_x;
+                ps->mark_y = ps->cursor_y;
+                break;
+            case 'n':
+                // line from the mark to the cursor
+                begin_edit(ps);
+                fami_bitmap_line(&sprite, ps->mark_x, ps->mark_y,
+                        ps->cursor_x, ps->cursor_y, ps->color);
+                end_edit(ps, 0);
+                break;
+            case 't':
+                // rectangle between the mark and the cursor
+                begin_edit(ps);
+                fami_bitmap_rect(&sprite, ps->mark_x, ps->mark_y,
+                        ps->cursor_x, ps->cursor_y, ps->color, 0);
+                end_edit(ps, 0);
+                break;
+            case 'y': {
+                // copy the area between mark and cursor
+                int x = ps->mark_x < ps->cursor_x ? ps->mark_x : ps->cursor_x;
+                int y = ps->mark_y < ps->cursor_y ? ps->mark_y : ps->cursor_y;
+                ps->clipboard_w = abs(ps->cursor_x-ps->mark_x)+1;
+                ps->clipboard_h = abs(ps->cursor_y-ps->mark_y)+1;
+                fami_bitmap_copy(&ps->clipboard, 0, 0, &sprite, x, y,
+                        ps->clipboard_w, ps->clipboard_h);
+                break;
+            }
+            case 'p':
+                // paste with the top left corner at the cursor
+                begin_edit(ps);
+                fami_bitmap_copy(&sprite, ps->cursor_x, ps->cursor_y, &ps->clipboard, 0, 0,
+                        ps->clipboard_w, ps->clipboard_h);
+                end_edit(ps, 0);
                 break;
             case 'r':
-                // reload from memory
-                len = ps->current_buffer/4;
-                fami_decode(ps->buffer+ps->offset, &len, (char*)ps->current);
+                // reload from memory, undo brings the edits back
+                begin_edit(ps);
+                load_current(ps);
+                end_edit(ps, 1);
+                break;
+            case 'u':
+                undo(ps, 0);
+                break;
+            case 'U':
+                undo(ps, 1);
                 break;
             case 'w':
                 // write
                 // put current offset back into file
-                len = ps->current_buffer;
-                fami_encode((char*)ps->current, &len, ps->buffer+ps->offset);
+                store_current(ps);
                 write_output_file(ps);
                 break;
             case 'i':
+                // the tiles on screen change
+                store_current(ps);
                 ps->long_sprite = !ps->long_sprite;
                 init_windows(&main_win, &status_win, ps);
                 // reload from memory
-                len = ps->current_buffer/4;
-                fami_decode(ps->buffer+ps->offset, &len, (char*)ps->current);
+                load_current(ps);
                 break;
             case 'c':
                 ps->show_cursor = !ps->show_cursor;
@@ -369,24 +1731,1358 @@ void gui(settings_t *ps) {
         }
 
         // check cursor oob
-        if (ps->cursor_x >= FAMI_TILE_LEN) {
+        int width = FAMI_TILE_LEN * ps->sprite_w;
+        int height = FAMI_TILE_LEN * ps->sprite_h;
+        if (ps->cursor_x >= width) {
             ps->cursor_x = 0;
 
         } else if (ps->cursor_x < 0) {
-            ps->cursor_x = FAMI_TILE_LEN-1;
+            ps->cursor_x = width-1;
         }
-        if (ps->cursor_y >= FAMI_TILE_LEN * (ps->long_sprite+1)) {
+        if (ps->cursor_y >= height) {
             ps->cursor_y = 0;
 
         } else if (ps->cursor_y < 0) {
-            ps->cursor_y = FAMI_TILE_LEN-1;
+            ps->cursor_y = height-1;
         }
     }
     delwin(main_win);
     delwin(status_win);
+    free_sprite(ps);
+}
+
+/**
+ * Headless conversion between chr-rom data and tile sheet images
+ */
+
+typedef struct convert {
+    settings_t file; // chr-rom side of the conversion
+    char *image_path;
+    char to_image; // direction, chr-rom to image or back
+    fami_image_format_t format;
+    unsigned int sheet_width;
+    fami_state_t colors[FAMI_SUB_PALETTES];
+    unsigned int palette_count;
+    char *attribute_path; // sub-palette of every tile
+    char nearest; // images in other colors are quantized
+    char dither;
+    char auto_palette;
+} convert_t;
+
+void parse_convert_inputs(int argc, char **argv, convert_t *pc) {
+    char *paths[2] = {NULL, NULL};
+    int path_count = 0;
+
+    for (size_t i = 1; i < argc; i++) {
+        if (is_arg(argv[i], "-h")) {
+            printf("Usage: famisprite convert <infile> <outfile>\n\n");
+            printf("Converts chr-rom data to a tile sheet when outfile ends in .ppm or .png,\n");
+            printf("and a tile sheet back to chr-rom data when infile does.\n\n");
+            printf("Optional arguments:\n\n");
+            printf("-o<number>\tOffset into the chr-rom input.\n");
+            printf("-b<number>\tOnly converts this chr-rom bank of a .nes rom.\n");
+            printf("-w<number>\tTiles per sheet row (default %d).\n", FAMI_SHEET_WIDTH);
+            printf("-p<colors>\tSub-palette of 4 hex nes master palette colors, e.g. -p0F,16,27,30.\n");
+            printf("\t\tRepeat for up to %d sub-palettes, images are read with the first.\n",
+                    FAMI_SUB_PALETTES);
+            printf("-a<file>\tOne byte per tile selecting its sub-palette, only for .ppm output.\n");
+            printf("\t\tWith -auto the chosen sub-palettes are written to it instead.\n");
+            printf("-nearest\tReads images in any colors, every pixel takes the nearest one.\n");
+            printf("-dither\t\tOrdered dithering before taking the nearest color, implies -nearest.\n");
+            printf("-auto\t\tPicks the closest sub-palette for every tile, implies -nearest.\n");
+            printf("-mmap\t\tMaps the chr-rom input instead of reading it.\n");
+            printf("-stats\t\tPrints throughput statistics.\n");
+            exit(0);
+        } else if (is_arg(argv[i], "-o")) {
+            arg a = parse_arg(argv[i], "-o");
+            pc->file.offset = strtol(a.value, NULL, 0);
+            pc->file.offset_set = 1;
+        } else if (is_arg(argv[i], "-b")) {
+            arg a = parse_arg(argv[i], "-b");
+            pc->file.bank = strtol(a.value, NULL, 0);
+        } else if (is_arg(argv[i], "-w")) {
+            arg a = parse_arg(argv[i], "-w");
+            pc->sheet_width = strtol(a.value, NULL, 0);
+        } else if (is_arg(argv[i], "-p")) {
+            arg a = parse_arg(argv[i], "-p");
+            uint8_t nes[FAMI_MAX_COLORS];
+            if (pc->palette_count >= FAMI_SUB_PALETTES || !fami_palette_parse(a.value, nes)) {
+                fprintf(stderr, "Invalid sub-palette: %s\n", a.value);
+                exit(1);
+            }
+            fami_palette_state(&pc->colors[pc->palette_count++], nes);
+        } else if (is_arg(argv[i], "-auto")) {
+            pc->nearest = 1;
+            pc->auto_palette = 1;
+        } else if (is_arg(argv[i], "-a")) {
+            arg a = parse_arg(argv[i], "-a");
+            pc->attribute_path = (char*)a.value;
+        } else if (is_arg(argv[i], "-nearest")) {
+            pc->nearest = 1;
+        } else if (is_arg(argv[i], "-dither")) {
+            pc->nearest = 1;
+            pc->dither = 1;
+        } else if (is_arg(argv[i], "-mmap")) {
+            pc->file.use_mmap = 1;
+        } else if (is_arg(argv[i], "-stats")) {
+            pc->file.show_stats = 1;
+        } else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            printf("Unknown argument: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (path_count != 2) {
+        fprintf(stderr, "convert needs an input and an output file\n");
+        exit(1);
+    }
+
+    if ((pc->format = fami_image_format(paths[1])) != FAMI_IMAGE_NONE) {
+        pc->to_image = 1;
+        pc->file.input_path = paths[0];
+        pc->image_path = paths[1];
+    } else if ((pc->format = fami_image_format(paths[0])) != FAMI_IMAGE_NONE) {
+        pc->to_image = 0;
+        pc->image_path = paths[0];
+        pc->file.output_path = paths[1];
+    } else {
+        fprintf(stderr, "Either file has to be a .ppm or .png image\n");
+        exit(1);
+    }
+
+    if (pc->attribute_path && pc->to_image && pc->format != FAMI_IMAGE_PPM) {
+        fprintf(stderr, "Sub-palettes per tile need a .ppm output\n");
+        exit(1);
+    }
+    if (pc->attribute_path && !pc->to_image && !pc->auto_palette) {
+        fprintf(stderr, "Sub-palettes per tile are only written with -auto\n");
+        exit(1);
+    }
+    if (pc->nearest && pc->to_image) {
+        fprintf(stderr, "-nearest, -dither and -auto only apply to image input\n");
+        exit(1);
+    }
+    if (pc->palette_count == 0) {
+        fami_image_init_state(&pc->colors[0]);
+        pc->palette_count = 1;
+    }
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+void print_convert_stats(size_t chr_len, double seconds) {
+    printf("tiles: %zu\n", chr_len/FAMI_TILE_SIZE);
+    printf("chr bytes: %zu\n", chr_len);
+    printf("seconds: %f\n", seconds);
+    printf("chr MB/s: %f\n", seconds > 0 ? chr_len/seconds/1e6 : 0);
+}
+
+void convert_to_image(convert_t *pc) {
+    read_input_file(&pc->file);
+    size_t len = 0;
+    char *data = input_data(&pc->file, &len);
+
+    FILE *f = fopen(pc->image_path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Unable to open output file: %s\n", pc->image_path);
+        exit(1);
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    settings_t attributes;
+    init_settings(&attributes);
+    if (pc->attribute_path) {
+        attributes.input_path = pc->attribute_path;
+        read_file(&attributes);
+        if (attributes.buffer_len < len/FAMI_TILE_SIZE) {
+            fprintf(stderr, "Attribute file has less than one byte per tile: %s\n", pc->attribute_path);
+            exit(1);
+        }
+    }
+
+    double start = now_seconds();
+    char ok = fami_write_sheet_palettes(f, data, len, pc->colors, pc->palette_count,
+            (uint8_t*)attributes.buffer, pc->sheet_width, pc->format);
+    ok = fclose(f) == 0 && ok;
+    double seconds = now_seconds()-start;
+    my_free(attributes.buffer);
+
+    if (!ok) {
+        fprintf(stderr, "Unable to write image: %s\n", pc->image_path);
+        exit(1);
+    }
+    if (pc->file.show_stats) {
+        print_convert_stats(len, seconds);
+    }
+    free_input_file(&pc->file);
+}
+
+void convert_to_chr(convert_t *pc) {
+    FILE *f = fopen(pc->image_path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Unable to open input file: %s\n", pc->image_path);
+        exit(1);
+    }
+
+    double start = now_seconds();
+    fami_image_t image;
+    char ok = fami_read_image(f, &image);
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Unable to read image: %s\n", pc->image_path);
+        exit(1);
+    }
+
+    size_t len = 0;
+    char *chr = NULL;
+    uint8_t *tile_palettes = NULL;
+    fami_quantize_t quantize = {pc->colors, pc->palette_count, pc->dither, pc->auto_palette};
+    if (pc->nearest) {
+        chr = fami_quantize_image(&image, &quantize, pc->attribute_path ? &tile_palettes : NULL, &len);
+    } else {
+        chr = fami_image_to_chr(&image, &pc->colors[0], &len);
+    }
+    fami_free_image(&image);
+    if (!chr) {
+        if (pc->nearest) {
+            fprintf(stderr, "Image is not a tile sheet: %s\n", pc->image_path);
+        } else {
+            fprintf(stderr, "Image is not a tile sheet in the expected colors: %s\n", pc->image_path);
+        }
+        exit(1);
+    }
+
+    if (tile_palettes) {
+        FILE *af = fopen(pc->attribute_path, "wb");
+        size_t tiles = len/FAMI_TILE_SIZE;
+        ok = af && fwrite(tile_palettes, 1, tiles, af) == tiles;
+        ok = af && fclose(af) == 0 && ok;
+        my_free(tile_palettes);
+        if (!ok) {
+            fprintf(stderr, "Unable to write attribute file: %s\n", pc->attribute_path);
+            exit(1);
+        }
+    }
+
+    f = fopen(pc->file.output_path, "wb");
+    ok = f && fwrite(chr, 1, len, f) == len;
+    ok = f && fclose(f) == 0 && ok;
+    double seconds = now_seconds()-start;
+    my_free(chr);
+    if (!ok) {
+        fprintf(stderr, "Unable to write output file: %s\n", pc->file.output_path);
+        exit(1);
+    }
+    if (pc->file.show_stats) {
+        print_convert_stats(len, seconds);
+        if (pc->nearest) {
+            printf("color cache hits: %zu\n", quantize.cache_hits);
+            printf("color cache misses: %zu\n", quantize.cache_misses);
+            printf("kernel tiles: %zu\n", quantize.kernel_tiles);
+        }
+    }
+}
+
+int convert_main(int argc, char **argv) {
+    convert_t convert;
+    init_settings(&convert.file);
+    convert.image_path = NULL;
+    convert.sheet_width = FAMI_SHEET_WIDTH;
+    convert.palette_count = 0;
+    convert.attribute_path = NULL;
+    convert.nearest = 0;
+    convert.dither = 0;
+    convert.auto_palette = 0;
+    parse_convert_inputs(argc, argv, &convert);
+
+    if (convert.to_image) {
+        convert_to_image(&convert);
+    } else {
+        convert_to_chr(&convert);
+    }
+    return 0;
+}
+
+/**
+ * Headless tile deduplication
+ */
+
+typedef struct dedup_settings {
+    settings_t file; // input bank and unique tile output
+    char *remap_path;
+    char flip; // merge tiles that only differ by a flip
+} dedup_settings_t;
+
+void parse_dedup_inputs(int argc, char **argv, dedup_settings_t *pd) {
+    char *paths[3] = {NULL, NULL, NULL};
+    int path_count = 0;
+
+    for (size_t i = 1; i < argc; i++) {
+        if (is_arg(argv[i], "-h")) {
+            printf("Usage: famisprite dedup <infile> <outfile> [remapfile]\n\n");
+            printf("Writes every distinct tile of infile once to outfile.\n");
+            printf("remapfile receives a little endian 32 bit unique tile index per input tile.\n");
+            printf("With -flip the top byte of an entry holds the oam flip bits (0x40 h, 0x80 v).\n\n");
+            printf("Optional arguments:\n\n");
+            printf("-o<number>\tOffset into the input.\n");
+            printf("-b<number>\tOnly deduplicates this chr-rom bank of a .nes rom.\n");
+            printf("-mmap\t\tMaps the input instead of reading it.\n");
+            printf("-flip\t\tMerges tiles that only differ by a flip.\n");
+            printf("-stats\t\tPrints dedup statistics.\n");
+            exit(0);
+        } else if (is_arg(argv[i], "-o")) {
+            arg a = parse_arg(argv[i], "-o");
+            pd->file.offset = strtol(a.value, NULL, 0);
+            pd->file.offset_set = 1;
+        } else if (is_arg(argv[i], "-b")) {
+            arg a = parse_arg(argv[i], "-b");
+            pd->file.bank = strtol(a.value, NULL, 0);
+        } else if (is_arg(argv[i], "-mmap")) {
+            pd->file.use_mmap = 1;
+        } else if (is_arg(argv[i], "-flip")) {
+            pd->flip = 1;
+        } else if (is_arg(argv[i], "-stats")) {
+            pd->file.show_stats = 1;
+        } else if (path_count < 3) {
+            paths[path_count++] = argv[i];
+        } else {
+            printf("Unknown argument: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (path_count < 2) {
+        fprintf(stderr, "dedup needs an input and an output file\n");
+        exit(1);
+    }
+    pd->file.input_path = paths[0];
+    pd->file.output_path = paths[1];
+    pd->remap_path = paths[2];
+}
+
+// writes a whole buffer to a new file
+char write_file(const char *path, const void *data, size_t len) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return 0;
+    }
+    char ok = fwrite(data, 1, len, f) == len;
+    return fclose(f) == 0 && ok;
+}
+
+// flips are optional, they go into the top byte as oam attribute bits
+char write_remap_file(const char *path, uint32_t *remap, uint8_t *flips, size_t tiles) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return 0;
+    }
+    char ok = 1;
+    for (size_t i = 0; ok && i < tiles; i++) {
+        uint32_t entry = remap[i];
+        if (flips) {
+            entry |= (uint32_t)fami_flip_to_oam(flips[i]) << 24;
+        }
+        uint8_t le[4] = {entry, entry >> 8, entry >> 16, entry >> 24};
+        ok = fwrite(le, 1, 4, f) == 4;
+    }
+    return fclose(f) == 0 && ok;
+}
+
+int dedup_main(int argc, char **argv) {
+    dedup_settings_t pd;
+    init_settings(&pd.file);
+    pd.remap_path = NULL;
+    pd.flip = 0;
+    parse_dedup_inputs(argc, argv, &pd);
+
+    read_input_file(&pd.file);
+    size_t len = 0;
+    char *data = input_data(&pd.file, &len);
+
+    double start = now_seconds();
+    fami_dedup_t dedup;
+    char ok = pd.flip ? fami_dedup_flip(data, len, &dedup) : fami_dedup(data, len, &dedup);
+    if (!ok) {
+        fprintf(stderr, "Unable to deduplicate: %s\n", pd.file.input_path);
+        exit(1);
+    }
+    double seconds = now_seconds()-start;
+
+    // flip remap entries keep the tile index in 24 bits, checked before anything is written
+    if (pd.remap_path && pd.flip && dedup.unique_tiles >= 1 << 24) {
+        fprintf(stderr, "Too many unique tiles for a flip remap file\n");
+        exit(1);
+    }
+    if (!write_file(pd.file.output_path, dedup.unique, dedup.unique_tiles*FAMI_TILE_SIZE)) {
+        fprintf(stderr, "Unable to write output file: %s\n", pd.file.output_path);
+        exit(1);
+    }
+    if (pd.remap_path && !write_remap_file(pd.remap_path, dedup.remap, dedup.flips, dedup.tiles)) {
+        fprintf(stderr, "Unable to write remap file: %s\n", pd.remap_path);
+        exit(1);
+    }
+
+    if (pd.file.show_stats) {
+        printf("tiles: %zu\n", dedup.tiles);
+        printf("unique tiles: %zu\n", dedup.unique_tiles);
+        printf("blank tiles: %zu\n", dedup.blank_tiles);
+        printf("index bytes: %zu\n", (dedup.slot_mask+1)*sizeof(uint32_t));
+        printf("seconds: %f\n", seconds);
+        printf("chr MB/s: %f\n", seconds > 0 ? len/seconds/1e6 : 0);
+    }
+
+    fami_dedup_free(&dedup);
+    free_input_file(&pd.file);
+    return 0;
+}
+
+/**
+ * Headless compression into the .fchr container
+ */
+
+void parse_compress_inputs(int argc, char **argv, settings_t *ps, char *decompress) {
+    char *paths[2] = {NULL, NULL};
+    int path_count = 0;
+
+    for (size_t i = 1; i < argc; i++) {
+        if (is_arg(argv[i], "-h")) {
+            printf("Usage: famisprite compress <infile> <outfile>\n\n");
+            printf("Writes infile as a compressed chr-rom container.\n");
+            printf("Compressed files can be opened like any other input.\n\n");
+            printf("Optional arguments:\n\n");
+            printf("-d\t\tDecompresses infile instead.\n");
+            printf("-mmap\t\tMaps the input instead of reading it.\n");
+            printf("-stats\t\tPrints ratio and throughput statistics.\n");
+            exit(0);
+        } else if (is_arg(argv[i], "-d")) {
+            *decompress = 1;
+        } else if (is_arg(argv[i], "-mmap")) {
+            ps->use_mmap = 1;
+        } else if (is_arg(argv[i], "-stats")) {
+            ps->show_stats = 1;
+        } else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            printf("Unknown argument: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (path_count != 2) {
+        fprintf(stderr, "compress needs an input and an output file\n");
+        exit(1);
+    }
+    ps->input_path = paths[0];
+    ps->output_path = paths[1];
+}
+
+int compress_main(int argc, char **argv) {
+    settings_t file;
+    char decompress = 0;
+    init_settings(&file);
+    parse_compress_inputs(argc, argv, &file, &decompress);
+
+    double start = now_seconds();
+    // compressed inputs are unpacked while reading
+    read_input_file(&file);
+    double read_seconds = now_seconds()-start;
+
+    char *out = file.buffer;
+    size_t out_len = file.buffer_len;
+    start = now_seconds();
+    if (!decompress && !(out = fami_chrz_compress(file.buffer, file.buffer_len, &out_len))) {
+        fprintf(stderr, "Unable to compress: %s\n", file.input_path);
+        exit(1);
+    }
+    double seconds = now_seconds()-start;
+
+    if (!write_file(file.output_path, out, out_len)) {
+        fprintf(stderr, "Unable to write output file: %s\n", file.output_path);
+        exit(1);
+    }
+
+    if (file.show_stats) {
+        size_t packed_len = decompress ? 0 : out_len;
+        if (file.compressed) {
+            struct stat st;
+            packed_len = stat(file.input_path, &st) == 0 ? st.st_size : 0;
+        }
+        printf("chr bytes: %zu\n", file.buffer_len);
+        printf("compressed bytes: %zu\n", packed_len);
+        printf("ratio: %f\n", packed_len ? (double)file.buffer_len/packed_len : 0);
+        if (file.compressed) {
+            printf("decompress MB/s: %f\n", read_seconds > 0 ? file.buffer_len/read_seconds/1e6 : 0);
+        }
+        if (!decompress) {
+            printf("compress MB/s: %f\n", seconds > 0 ? file.buffer_len/seconds/1e6 : 0);
+        }
+    }
+
+    if (out != file.buffer) {
+        my_free(out);
+    }
+    free_input_file(&file);
+    return 0;
+}
+
+/**
+ * Headless nes compression codecs
+ */
+
+typedef struct codec_settings {
+    settings_t file; // input and output, the offset applies to the input
+    fami_codec_t codec;
+    char all; // compare every codec instead of writing a file
+    char decode;
+    unsigned int threads;
+} codec_settings_t;
+
+void parse_codec_inputs(int argc, char **argv, codec_settings_t *pc) {
+    char *paths[2] = {NULL, NULL};
+    int path_count = 0;
+
+    for (size_t i = 1; i < argc; i++) {
+        if (is_arg(argv[i], "-h")) {
+            printf("Usage: famisprite codec <infile> [outfile]\n\n");
+            printf("Compresses chr-rom data with a nes compression codec.\n\n");
+            printf("Optional arguments:\n\n");
+            printf("-c<name>\tCodec: neslib, konami or predict (default neslib).\n");
+            printf("-call\t\tCompares every codec, no outfile needed.\n");
+            printf("-d\t\tDecompresses infile instead.\n");
+            printf("-o<number>\tOffset into the input.\n");
+            printf("-b<number>\tOnly compresses this chr-rom bank of a .nes rom.\n");
+            printf("-j<number>\tThreads for compression (default all cpus).\n");
+            printf("-stats\t\tPrints ratio and throughput statistics.\n");
+            exit(0);
+        } else if (strcmp(argv[i], "-call") == 0) {
+            pc->all = 1;
+            pc->file.show_stats = 1;
+        } else if (is_arg(argv[i], "-c")) {
+            arg a = parse_arg(argv[i], "-c");
+            if ((pc->codec = fami_codec_from_name(a.value)) == FAMI_CODECS) {
+                fprintf(stderr, "Unknown codec: %s\n", a.value);
+                exit(1);
+            }
+        } else if (is_arg(argv[i], "-d")) {
+            pc->decode = 1;
+        } else if (is_arg(argv[i], "-o")) {
+            arg a = parse_arg(argv[i], "-o");
+            pc->file.offset = strtol(a.value, NULL, 0);
+            pc->file.offset_set = 1;
+        } else if (is_arg(argv[i], "-b")) {
+            arg a = parse_arg(argv[i], "-b");
+            pc->file.bank = strtol(a.value, NULL, 0);
+        } else if (is_arg(argv[i], "-j")) {
+            arg a = parse_arg(argv[i], "-j");
+            pc->threads = strtoul(a.value, NULL, 0);
+        } else if (is_arg(argv[i], "-stats")) {
+            pc->file.show_stats = 1;
+        } else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            printf("Unknown argument: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (path_count < 1 || (path_count < 2 && !pc->all)) {
+        fprintf(stderr, "codec needs an input and an output file\n");
+        exit(1);
+    }
+    pc->file.input_path = paths[0];
+    // -call writes nothing
+    pc->file.output_path = paths[1] ? paths[1] : paths[0];
+}
+
+/**
+ * Compresses with one codec and decompresses the result again
+ * Returns:
+ *  the compressed data, NULL if the codec cannot compress data
+ */
+char *run_codec(codec_settings_t *pc, fami_codec_t codec, char *data, size_t len, size_t *packed_len) {
+    double start = now_seconds();
+    char *packed = fami_codec_encode(codec, data, len, packed_len, pc->threads);
+    double encode_seconds = now_seconds()-start;
+    if (!packed) {
+        if (pc->file.show_stats) {
+            printf("%s: cannot compress this data\n", fami_codec_name(codec));
+        }
+        return NULL;
+    }
+
+    start = now_seconds();
+    size_t raw_len = 0;
+    char *raw = fami_codec_decode(codec, packed, *packed_len, &raw_len);
+    double decode_seconds = now_seconds()-start;
+    if (!raw || raw_len != len || memcmp(raw, data, len) != 0) {
+        fprintf(stderr, "%s: round trip failed\n", fami_codec_name(codec));
+        exit(1);
+    }
+    my_free(raw);
+
+    if (pc->file.show_stats) {
+        printf("%s: %zu -> %zu bytes, ratio %f, compress MB/s %f, decompress MB/s %f\n",
+                fami_codec_name(codec), len, *packed_len,
+                *packed_len ? (double)len/(*packed_len) : 0,
+                encode_seconds > 0 ? len/encode_seconds/1e6 : 0,
+                decode_seconds > 0 ? len/decode_seconds/1e6 : 0);
+    }
+    return packed;
+}
+
+int codec_main(int argc, char **argv) {
+    codec_settings_t pc;
+    init_settings(&pc.file);
+    pc.codec = FAMI_CODEC_NESLIB_RLE;
+    pc.all = 0;
+    pc.decode = 0;
+    pc.threads = 0;
+    parse_codec_inputs(argc, argv, &pc);
+
+    read_input_file(&pc.file);
+    size_t len = 0;
+    char *data = input_data(&pc.file, &len);
+
+    char *out = NULL;
+    size_t out_len = 0;
+    if (pc.all) {
+        for (int codec = 0; codec < FAMI_CODECS; codec++) {
+            my_free(run_codec(&pc, codec, data, len, &out_len));
+        }
+    } else if (pc.decode) {
+        double start = now_seconds();
+        out = fami_codec_decode(pc.codec, data, len, &out_len);
+        double seconds = now_seconds()-start;
+        if (!out) {
+            fprintf(stderr, "Not valid %s data: %s\n", fami_codec_name(pc.codec), pc.file.input_path);
+            exit(1);
+        }
+        if (pc.file.show_stats) {
+            printf("%s: %zu -> %zu bytes, decompress MB/s %f\n", fami_codec_name(pc.codec),
+                    len, out_len, seconds > 0 ? out_len/seconds/1e6 : 0);
+        }
+    } else if (!(out = run_codec(&pc, pc.codec, data, len, &out_len))) {
+        fprintf(stderr, "Unable to compress with %s: %s\n", fami_codec_name(pc.codec), pc.file.input_path);
+        exit(1);
+    }
+
+    if (out && !write_file(pc.file.output_path, out, out_len)) {
+        fprintf(stderr, "Unable to write output file: %s\n", pc.file.output_path);
+        exit(1);
+    }
+    my_free(out);
+    free_input_file(&pc.file);
+    return 0;
+}
+
+/**
+ * Rom information
+ */
+
+int rom_main(int argc, char **argv) {
+    if (argc != 2 || is_arg(argv[1], "-h")) {
+        printf("Usage: famisprite rom <infile>\n\n");
+        printf("Prints the header and the chr-rom bank table of a .nes rom.\n");
+        printf("Banks can be opened with -b<number> in every mode.\n");
+        exit(argc != 2);
+    }
+
+    settings_t file;
+    init_settings(&file);
+    file.input_path = argv[1];
+    file.output_path = argv[1];
+    read_input_file(&file);
+    if (!file.is_rom) {
+        fprintf(stderr, "Not an iNES rom: %s\n", file.input_path);
+        exit(1);
+    }
+
+    fami_rom_t *rom = &file.rom;
+    printf("format: %s\n", rom->nes2 ? "NES 2.0" : "iNES");
+    printf("mapper: %u", rom->mapper);
+    if (rom->nes2) {
+        printf(".%u", rom->submapper);
+    }
+    printf("\ntrainer: %s\n", rom->trainer ? "yes" : "no");
+    printf("prg-rom: offset 0x%zX, %zu bytes, %u banks\n", rom->prg_offset, rom->prg_size, rom->prg_banks);
+    if (!rom->chr) {
+        printf("chr-rom: none, the board uses chr-ram\n");
+    } else {
+        printf("chr-rom: offset 0x%zX, %zu bytes, %u banks\n", rom->chr_offset, rom->chr_size, rom->chr_banks);
+        for (unsigned int i = 0; i < rom->chr_banks; i++) {
+            size_t offset = fami_rom_chr_bank(rom, i)-file.buffer;
+            size_t size = rom->chr_offset+rom->chr_size-offset;
+            printf("  bank %u: offset 0x%zX, %zu tiles\n", i, offset,
+                    (size < FAMI_CHR_BANK_SIZE ? size : FAMI_CHR_BANK_SIZE) / FAMI_TILE_SIZE);
+        }
+    }
+
+    free_input_file(&file);
+    return 0;
+}
+
+/**
+ * Batch processing of many chr-rom, compressed and rom files in one process
+ * Every file gets a decode job that reads and decodes it, then spawns the other
+ * requested jobs on the pool, which share its buffers. The last of them frees
+ * the buffers and gives the file's memory estimate back to the pool.
+ */
+
+#define BATCH_DEFAULT_MEMORY (256*1024*1024)
+
+typedef enum batch_op {
+    BATCH_DECODE,
+    BATCH_CONVERT,
+    BATCH_DEDUP,
+    BATCH_ENCODE,
+    BATCH_OPS
+} batch_op_t;
+
+static const char *batch_op_names[BATCH_OPS] = {"decode", "convert", "dedup", "encode"};
+
+typedef struct batch_settings {
+    char **paths;
+    size_t path_count;
+    size_t path_cap;
+    char ops[BATCH_OPS]; // decode always runs
+    char *out_dir; // outputs are only written with a directory
+    fami_image_format_t format;
+    unsigned int threads;
+    size_t memory_limit;
+    char verbose;
+    char *cache_path;
+    fami_tile_store_t store; // decoded tiles shared with earlier runs, open if cache_path is set
+} batch_settings_t;
+
+typedef struct batch_result {
+    char ran;
+    char ok;
+    double seconds;
+    char message[128];
+} batch_result_t;
+
+typedef struct batch_file batch_file_t;
+
+typedef struct batch_job {
+    batch_file_t *file;
+    batch_op_t op;
+} batch_job_t;
+
+struct batch_file {
+    batch_settings_t *settings;
+    const char *path;
+    size_t memory; // estimate held in the pool
+    char *buffer; // whole file
+    char *chr; // chr-rom inside buffer
+    size_t chr_len; // full tiles only
+    char *decoded;
+    fami_tile_info_t *infos; // store ids of the tiles with -cache, NULL if one did not fit
+    unsigned int remaining; // jobs still using the buffers
+    double start;
+    double end;
+    batch_job_t jobs[BATCH_OPS];
+    batch_result_t results[BATCH_OPS];
+};
+
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void batch_add_path(batch_settings_t *pb, const char *path) {
+    if (pb->path_count == pb->path_cap) {
+        pb->path_cap = pb->path_cap ? pb->path_cap*2 : 64;
+        pb->paths = realloc(pb->paths, pb->path_cap*sizeof(char*));
+        if (!pb->paths) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    pb->paths[pb->path_count++] = strdup(path);
+}
+
+// a pattern without matches stays as it is and fails as a missing file
+void batch_add_glob(batch_settings_t *pb, const char *pattern) {
+    glob_t g;
+    if (glob(pattern, GLOB_NOCHECK, NULL, &g) != 0) {
+        batch_add_path(pb, pattern);
+        return;
+    }
+    for (size_t i = 0; i < g.gl_pathc; i++) {
+        batch_add_path(pb, g.gl_pathv[i]);
+    }
+    globfree(&g);
+}
+
+// one path per line, empty lines and lines starting with # are skipped
+void batch_read_manifest(batch_settings_t *pb, const char *path) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Unable to open manifest: %s\n", path);
+        exit(1);
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while ((n = getline(&line, &cap, f)) >= 0) {
+        while (n > 0 && (line[n-1] == '\n' || line[n-1] == '\r')) {
+            line[--n] = '\0';
+        }
+        if (n > 0 && line[0] != '#') {
+            batch_add_glob(pb, line);
+        }
+    }
+    free(line);
+    if (f != stdin) {
+        fclose(f);
+    }
+}
+
+char batch_parse_ops(batch_settings_t *pb, const char *list) {
+    const char *p = list;
+    while (*p) {
+        size_t n = strcspn(p, ",");
+        int op = 0;
+        for (; op < BATCH_OPS; op++) {
+            if (strlen(batch_op_names[op]) == n && strncmp(p, batch_op_names[op], n) == 0) {
+                break;
+            }
+        }
+        if (op == BATCH_OPS && !(n == 3 && strncmp(p, "all", 3) == 0)) {
+            return 0;
+        }
+        for (int i = 0; i < BATCH_OPS; i++) {
+            pb->ops[i] |= op == BATCH_OPS || i == op;
+        }
+        p += n+(p[n] == ',');
+    }
+    return 1;
+}
+
+void parse_batch_inputs(int argc, char **argv, batch_settings_t *pb) {
+    for (size_t i = 1; i < argc; i++) {
+        if (is_arg(argv[i], "-h")) {
+            printf("Usage: famisprite batch [files or patterns...]\n\n");
+            printf("Runs jobs over many chr-rom, compressed or rom files in one process.\n");
+            printf("Every file is read and decoded, then the other jobs run on its tiles.\n");
+            printf("Failed jobs are reported per file, followed by a summary.\n\n");
+            printf("Optional arguments:\n\n");
+            printf("-m<file>\tReads paths or patterns from a manifest, one per line, - for stdin.\n");
+            printf("-op<list>\tComma separated jobs besides decode: convert, dedup, encode or all.\n");
+            printf("-out<dir>\tWrites <name>.ppm for convert, <name>.dedup.chr for dedup\n");
+            printf("\t\tand <name>.chr for encode. Without it jobs only run in memory.\n");
+            printf("-png\t\tConvert writes .png instead.\n");
+            printf("-t<number>\tWorker threads (default one per cpu).\n");
+            printf("-mem<bytes>\tBound on the estimated memory of files in flight (default %d).\n",
+                    BATCH_DEFAULT_MEMORY);
+            printf("-cache<file>\tDecodes through a persistent tile cache shared by runs and processes,\n");
+            printf("\t\tcreated if missing. A lookup costs about 8-80 ns per tile against\n");
+            printf("\t\tabout 3 ns for decoding, only dedup gains, it uses the tile ids of\n");
+            printf("\t\tthe cache and also counts the tiles unique up to flips.\n");
+            printf("-v\t\tPrints every job, not only failed ones.\n");
+            exit(0);
+        } else if (is_arg(argv[i], "-mem")) {
+            arg a = parse_arg(argv[i], "-mem");
+            pb->memory_limit = strtoull(a.value, NULL, 0);
+        } else if (is_arg(argv[i], "-m")) {
+            arg a = parse_arg(argv[i], "-m");
+            batch_read_manifest(pb, a.value);
+        } else if (is_arg(argv[i], "-op")) {
+            arg a = parse_arg(argv[i], "-op");
+            if (!batch_parse_ops(pb, a.value)) {
+                fprintf(stderr, "Unknown job in: %s\n", a.value);
+                exit(1);
+            }
+        } else if (is_arg(argv[i], "-out")) {
+            arg a = parse_arg(argv[i], "-out");
+            pb->out_dir = (char*)a.value;
+        } else if (is_arg(argv[i], "-png")) {
+            pb->format = FAMI_IMAGE_PNG;
+        } else if (is_arg(argv[i], "-t")) {
+            arg a = parse_arg(argv[i], "-t");
+            pb->threads = strtol(a.value, NULL, 0);
+        } else if (is_arg(argv[i], "-cache")) {
+            arg a = parse_arg(argv[i], "-cache");
+            pb->cache_path = (char*)a.value;
+        } else if (is_arg(argv[i], "-v")) {
+            pb->verbose = 1;
+        } else if (argv[i][0] == '-') {
+            printf("Unknown argument: %s\n", argv[i]);
+            exit(1);
+        } else {
+            batch_add_glob(pb, argv[i]);
+        }
+    }
+
+    if (pb->path_count == 0) {
+        fprintf(stderr, "batch needs at least one input file\n");
+        exit(1);
+    }
+    if (pb->out_dir && mkdir(pb->out_dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Unable to create output directory: %s\n", pb->out_dir);
+        exit(1);
+    }
+}
+
+// bytes held while a file is in flight, compressed files are counted at their stored size
+size_t batch_memory_estimate(batch_settings_t *pb, const char *path) {
+    struct stat st;
+    size_t size = stat(path, &st) == 0 ? st.st_size : 0;
+    size_t factor = 1+FAMI_BPP*2;
+    if (pb->ops[BATCH_CONVERT]) {
+        factor += pb->out_dir ? 1 : FAMI_BPP*2*3;
+    }
+    if (pb->ops[BATCH_DEDUP]) {
+        factor += 2;
+    }
+    if (pb->ops[BATCH_ENCODE]) {
+        factor += 1;
+    }
+    return size*factor;
+}
+
+// <out_dir>/<file name without extension><suffix>
+char *batch_output_path(batch_file_t *file, const char *suffix) {
+    const char *name = strrchr(file->path, '/');
+    name = name ? name+1 : file->path;
+    const char *dot = strrchr(name, '.');
+    size_t name_len = dot && dot != name ? (size_t)(dot-name) : strlen(name);
+    size_t len = strlen(file->settings->out_dir)+1+name_len+strlen(suffix)+1;
+    char *path = my_malloc(len);
+    if (path) {
+        snprintf(path, len, "%s/%.*s%s", file->settings->out_dir, (int)name_len, name, suffix);
+    }
+    return path;
+}
+
+char batch_fail(batch_result_t *result, const char *message) {
+    snprintf(result->message, sizeof(result->message), "%s", message);
+    return 0;
+}
+
+/**
+ * Reads a file and finds its chr-rom, like read_input_file but reporting
+ * errors instead of exiting
+ */
+char batch_load(batch_file_t *file, batch_result_t *result) {
+    FILE *f = fopen(file->path, "rb");
+    if (f == NULL) {
+        return batch_fail(result, strerror(errno));
+    }
+    fseek(f, 0L, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+    file->buffer = size >= 0 ? my_malloc(size ? size : 1) : NULL;
+    char ok = file->buffer && fread(file->buffer, 1, size, f) == (size_t)size;
+    fclose(f);
+    if (!ok) {
+        return batch_fail(result, "read error");
+    }
+
+    size_t len = size;
+    if (fami_chrz_check(file->buffer, len)) {
+        char *raw = fami_chrz_decompress(file->buffer, len, &len);
+        if (!raw) {
+            return batch_fail(result, "corrupt compressed file");
+        }
+        my_free(file->buffer);
+        file->buffer = raw;
+    }
+
+    file->chr = file->buffer;
+    if (fami_rom_check(file->buffer, len)) {
+        fami_rom_t rom;
+        if (!fami_rom_parse(file->buffer, len, &rom)) {
+            return batch_fail(result, "truncated or invalid rom");
+        }
+        if (!rom.chr) {
+            return batch_fail(result, "rom has no chr-rom");
+        }
+        file->chr = rom.chr;
+        len = rom.chr_size;
+    }
+    file->chr_len = len / FAMI_TILE_SIZE * FAMI_TILE_SIZE;
+    if (file->chr_len == 0) {
+        return batch_fail(result, "no full tiles");
+    }
+    return 1;
+}
+
+char batch_convert(batch_file_t *file, batch_result_t *result) {
+    fami_state_t state;
+    fami_image_init_state(&state);
+    if (!file->settings->out_dir) {
+        // renders the decoded tiles into memory only
+        size_t tiles = file->chr_len/FAMI_TILE_SIZE;
+        size_t row_len = FAMI_SHEET_WIDTH*FAMI_TILE_PIXELS*3;
+        uint8_t *out = my_malloc(fami_render_size(file->chr_len, FAMI_SHEET_WIDTH, 0));
+        char *last_row = my_malloc(FAMI_SHEET_WIDTH*FAMI_TILE_PIXELS);
+        if (!out || !last_row) {
+            my_free(out);
+            my_free(last_row);
+            return batch_fail(result, "out of memory");
+        }
+        uint32_t colors[FAMI_MAX_COLORS];
+        fami_palette_pack(&state, 0, colors);
+        for (size_t first = 0; first < tiles; first += FAMI_SHEET_WIDTH) {
+            char *row = file->decoded+first*FAMI_TILE_PIXELS;
+            if (tiles-first < FAMI_SHEET_WIDTH) {
+                memset(last_row, 0, FAMI_SHEET_WIDTH*FAMI_TILE_PIXELS);
+                memcpy(last_row, row, (tiles-first)*FAMI_TILE_PIXELS);
+                row = last_row;
+            }
+            fami_render_row(row, FAMI_SHEET_WIDTH, colors, NULL, 0, out+first/FAMI_SHEET_WIDTH*row_len);
+        }
+        my_free(out);
+        my_free(last_row);
+        return 1;
+    }
+
+    char *path = batch_output_path(file, file->settings->format == FAMI_IMAGE_PNG ? ".png" : ".ppm");
+    FILE *f = path ? fopen(path, "wb") : NULL;
+    if (f == NULL) {
+        my_free(path);
+        return batch_fail(result, "unable to open output image");
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    char ok = fami_write_sheet_decoded(f, file->chr, file->decoded, file->chr_len, &state,
+            FAMI_SHEET_WIDTH, file->settings->format);
+    ok = fclose(f) == 0 && ok;
+    my_free(path);
+    return ok ? 1 : batch_fail(result, "unable to write image");
+}
+
+/**
+ * Dedup from the ids the tile cache gave the tiles, which also counts the
+ * tiles unique up to a flip
+ * Inputs:
+ *  ok = returns the result of the job
+ * Returns:
+ *  1 if the ids were used
+ *  0 if a tile has no id or memory could not be allocated, nothing is written then
+ */
+char batch_dedup_ids(batch_file_t *file, batch_result_t *result, char *ok) {
+    size_t tiles = file->chr_len/FAMI_TILE_SIZE;
+    size_t *first = my_malloc(tiles*sizeof(size_t));
+    size_t unique = 0;
+    size_t canonical = 0;
+    if (!first || !fami_tile_store_unique(file->infos, tiles, first, &unique, &canonical)) {
+        my_free(first);
+        return 0;
+    }
+    *ok = 1;
+    if (file->settings->out_dir) {
+        char *bank = my_malloc(unique*FAMI_TILE_SIZE);
+        for (size_t i = 0; bank && i < unique; i++) {
+            memcpy(bank+i*FAMI_TILE_SIZE, file->chr+first[i]*FAMI_TILE_SIZE, FAMI_TILE_SIZE);
+        }
+        char *path = batch_output_path(file, ".dedup.chr");
+        *ok = bank && path && write_file(path, bank, unique*FAMI_TILE_SIZE);
+        my_free(path);
+        my_free(bank);
+    }
+    my_free(first);
+    snprintf(result->message, sizeof(result->message), "%zu of %zu tiles unique, %zu up to flips",
+            unique, tiles, canonical);
+    if (!*ok) {
+        batch_fail(result, "unable to write unique tiles");
+    }
+    return 1;
+}
+
+char batch_dedup(batch_file_t *file, batch_result_t *result) {
+    // the ids make the hashing of fami_dedup unnecessary, it is the fallback
+    char ok = 1;
+    if (file->infos && batch_dedup_ids(file, result, &ok)) {
+        return ok;
+    }
+    fami_dedup_t dedup;
+    if (!fami_dedup(file->chr, file->chr_len, &dedup)) {
+        return batch_fail(result, "unable to deduplicate");
+    }
+    if (file->settings->out_dir) {
+        char *path = batch_output_path(file, ".dedup.chr");
+        ok = path && write_file(path, dedup.unique, dedup.unique_tiles*FAMI_TILE_SIZE);
+        my_free(path);
+    }
+    snprintf(result->message, sizeof(result->message), "%zu of %zu tiles unique",
+            dedup.unique_tiles, dedup.tiles);
+    fami_dedup_free(&dedup);
+    return ok ? 1 : batch_fail(result, "unable to write unique tiles");
+}
+
+// encodes the decoded tiles again, they have to give back the chr-rom
+char batch_encode(batch_file_t *file, batch_result_t *result) {
+    char *encoded = my_malloc(file->chr_len);
+    if (!encoded) {
+        return batch_fail(result, "out of memory");
+    }
+    fami_encode_tiles(file->decoded, file->chr_len/FAMI_TILE_SIZE, encoded);
+    char ok = memcmp(encoded, file->chr, file->chr_len) == 0;
+    if (!ok) {
+        batch_fail(result, "tiles do not encode back to the input");
+    } else if (file->settings->out_dir) {
+        char *path = batch_output_path(file, ".chr");
+        ok = path && write_file(path, encoded, file->chr_len);
+        my_free(path);
+        if (!ok) {
+            batch_fail(result, "unable to write chr-rom");
+        }
+    }
+    my_free(encoded);
+    return ok;
+}
+
+// the last job of a file frees its buffers
+void batch_finish(fami_pool_t *pool, batch_file_t *file) {
+    pthread_mutex_lock(&batch_lock);
+    char last = --file->remaining == 0;
+    pthread_mutex_unlock(&batch_lock);
+    if (!last) {
+        return;
+    }
+    my_free(file->buffer);
+    my_free(file->decoded);
+    my_free(file->infos);
+    file->buffer = NULL;
+    file->decoded = NULL;
+    file->infos = NULL;
+    file->end = now_seconds();
+    fami_pool_release(pool, file->memory);
+}
+
+void batch_run_op(fami_pool_t *pool, void *arg) {
+    batch_job_t *job = arg;
+    batch_file_t *file = job->file;
+    batch_result_t *result = file->results+job->op;
+
+    double start = now_seconds();
+    switch (job->op) {
+        case BATCH_CONVERT:
+            result->ok = batch_convert(file, result);
+            break;
+        case BATCH_DEDUP:
+            result->ok = batch_dedup(file, result);
+            break;
+        case BATCH_ENCODE:
+            result->ok = batch_encode(file, result);
+            break;
+        default:
+            break;
+    }
+    result->seconds = now_seconds()-start;
+    result->ran = 1;
+    batch_finish(pool, file);
+}
+
+void batch_run_decode(fami_pool_t *pool, void *arg) {
+    batch_file_t *file = arg;
+    batch_result_t *result = file->results+BATCH_DECODE;
+    file->start = now_seconds();
+
+    result->ok = batch_load(file, result);
+    if (result->ok) {
+        file->decoded = my_malloc(file->chr_len*FAMI_BPP*2);
+        size_t tiles = file->chr_len/FAMI_TILE_SIZE;
+        if (file->decoded && file->settings->cache_path) {
+            // the ids only go to dedup
+            if (file->settings->ops[BATCH_DEDUP]) {
+                file->infos = my_malloc(tiles*sizeof(fami_tile_info_t));
+            }
+            fami_tile_store_decode(&file->settings->store, file->chr, tiles, file->decoded, file->infos);
+        } else if (file->decoded) {
+            fami_decode_tiles(file->chr, tiles, file->decoded);
+        } else {
+            result->ok = batch_fail(result, "out of memory");
+        }
+    }
+    result->seconds = now_seconds()-file->start;
+    result->ran = 1;
+
+    // the decode job itself counts until its follow-ups are queued
+    file->remaining = 1;
+    for (int op = BATCH_DECODE+1; result->ok && op < BATCH_OPS; op++) {
+        if (!file->settings->ops[op]) {
+            continue;
+        }
+        file->jobs[op].file = file;
+        file->jobs[op].op = op;
+        pthread_mutex_lock(&batch_lock);
+        file->remaining++;
+        pthread_mutex_unlock(&batch_lock);
+        if (!fami_pool_spawn(pool, batch_run_op, file->jobs+op)) {
+            batch_run_op(pool, file->jobs+op);
+        }
+    }
+    batch_finish(pool, file);
+}
+
+int compare_seconds(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y)-(x < y);
+}
+
+// nearest rank of a sorted list
+double percentile(const double *sorted, size_t count, unsigned int p) {
+    size_t rank = (count*p+99)/100;
+    return sorted[rank > 0 ? rank-1 : 0];
+}
+
+void print_latencies(const char *name, double *seconds, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    qsort(seconds, count, sizeof(double), compare_seconds);
+    printf("%-8s %8zu  p50 %9.3f ms  p90 %9.3f ms  p99 %9.3f ms  max %9.3f ms\n", name, count,
+            percentile(seconds, count, 50)*1e3, percentile(seconds, count, 90)*1e3,
+            percentile(seconds, count, 99)*1e3, seconds[count-1]*1e3);
+}
+
+void batch_report(batch_settings_t *pb, batch_file_t *files, double seconds, fami_pool_stats_t *stats) {
+    size_t jobs = 0;
+    size_t failed = 0;
+    size_t failed_files = 0;
+    size_t chr_bytes = 0;
+    double *latencies = my_malloc((pb->path_count ? pb->path_count : 1)*sizeof(double));
+    if (!latencies) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < pb->path_count; i++) {
+        batch_file_t *file = files+i;
+        char file_ok = 1;
+        for (int op = 0; op < BATCH_OPS; op++) {
+            batch_result_t *r = file->results+op;
+            if (!r->ran) {
+                continue;
+            }
+            jobs++;
+            if (!r->ok) {
+                failed++;
+                file_ok = 0;
+                fprintf(stderr, "%s: %s: %s\n", file->path, batch_op_names[op], r->message);
+            } else if (pb->verbose) {
+                printf("%s: %s: %.3f ms%s%s\n", file->path, batch_op_names[op], r->seconds*1e3,
+                        r->message[0] ? ", " : "", r->message);
+            }
+        }
+        failed_files += !file_ok;
+        if (file->results[BATCH_DECODE].ok) {
+            chr_bytes += file->chr_len;
+        }
+    }
+
+    printf("files: %zu, %zu failed\n", pb->path_count, failed_files);
+    printf("jobs: %zu, %zu failed, %zu stolen\n", jobs, failed, stats->steals);
+    printf("chr bytes: %zu\n", chr_bytes);
+    printf("memory peak estimate: %zu\n", stats->memory_peak);
+    printf("seconds: %f\n", seconds);
+    printf("chr MB/s: %f\n", seconds > 0 ? chr_bytes/seconds/1e6 : 0);
+    printf("files/s: %f\n", seconds > 0 ? pb->path_count/seconds : 0);
+    if (pb->cache_path) {
+        fami_tile_store_t *store = &pb->store;
+        fami_tile_store_stats_t totals = fami_tile_store_stats(store);
+        printf("tile cache hits: %zu, misses: %zu, added: %zu, full: %zu\n",
+                store->hits, store->misses, store->added, store->dropped);
+        printf("tile cache tiles: %u of %u\n", totals.tiles, totals.capacity);
+    }
+
+    // time spent in each job, and from reading a file to its last job
+    for (int op = 0; op < BATCH_OPS; op++) {
+        size_t count = 0;
+        for (size_t i = 0; i < pb->path_count; i++) {
+            if (files[i].results[op].ran && files[i].results[op].ok) {
+                latencies[count++] = files[i].results[op].seconds;
+            }
+        }
+        print_latencies(batch_op_names[op], latencies, count);
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < pb->path_count; i++) {
+        if (files[i].results[BATCH_DECODE].ok) {
+            latencies[count++] = files[i].end-files[i].start;
+        }
+    }
+    print_latencies("file", latencies, count);
+    my_free(latencies);
+}
+
+int batch_main(int argc, char **argv) {
+    batch_settings_t batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.format = FAMI_IMAGE_PPM;
+    batch.memory_limit = BATCH_DEFAULT_MEMORY;
+    batch.ops[BATCH_DECODE] = 1;
+    parse_batch_inputs(argc, argv, &batch);
+
+    if (batch.cache_path && !fami_tile_store_open(&batch.store, batch.cache_path, 0, 1)) {
+        fprintf(stderr, "Unable to open tile cache: %s\n", batch.cache_path);
+        exit(1);
+    }
+    batch_file_t *files = calloc(batch.path_count, sizeof(batch_file_t));
+    fami_pool_t *pool = fami_pool_create(batch.threads, batch.memory_limit);
+    if (!files || !pool) {
+        fprintf(stderr, "Unable to start the batch workers\n");
+        exit(1);
+    }
+
+    double start = now_seconds();
+    for (size_t i = 0; i < batch.path_count; i++) {
+        files[i].settings = &batch;
+        files[i].path = batch.paths[i];
+        files[i].memory = batch_memory_estimate(&batch, batch.paths[i]);
+        if (!fami_pool_submit(pool, batch_run_decode, files+i, files[i].memory)) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    fami_pool_wait(pool);
+    double seconds = now_seconds()-start;
+
+    fami_pool_stats_t stats = fami_pool_stats(pool);
+    fami_pool_free(pool);
+    batch_report(&batch, files, seconds, &stats);
+    if (batch.cache_path) {
+        fami_tile_store_close(&batch.store);
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < batch.path_count; i++) {
+        for (int op = 0; op < BATCH_OPS; op++) {
+            status |= files[i].results[op].ran && !files[i].results[op].ok;
+        }
+        free(batch.paths[i]);
+    }
+    free(batch.paths);
+    free(files);
+    return status;
 }
 
 int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "convert") == 0) {
+        return convert_main(argc-1, argv+1);
+    }
+    if (argc > 1 && strcmp(argv[1], "dedup") == 0) {
+        return dedup_main(argc-1, argv+1);
+    }
+    if (argc > 1 && strcmp(argv[1], "compress") == 0) {
+        return compress_main(argc-1, argv+1);
+    }
+    if (argc > 1 && strcmp(argv[1], "codec") == 0) {
+        return codec_main(argc-1, argv+1);
+    }
+    if (argc > 1 && strcmp(argv[1], "rom") == 0) {
+        return rom_main(argc-1, argv+1);
+    }
+    if (argc > 1 && strcmp(argv[1], "batch") == 0) {
+        return batch_main(argc-1, argv+1);
+    }
+
     settings_t settings;
     init_settings(&settings);
     parse_arg_inputs(argc, argv, &settings);
@@ -395,12 +3091,29 @@ int main(int argc, char **argv) {
 
     init_curses(&settings);
     gui(&settings);
-    end_curses();
+    char measured = settings.relayed;
+    end_curses(&settings);
 
-    // if file was opened free it now
-    if (settings.buffer) {
-        my_free(settings.buffer);
+    if (settings.show_stats) {
+        printf("writes: %zu\n", settings.writes);
+        printf("tiles flushed: %zu\n", settings.total_flushed_tiles);
+        printf("bytes flushed: %zu\n", settings.total_flushed_bytes);
+        size_t keys = settings.frames > 0 ? settings.frames-1 : 0;
+        printf("keys: %zu\n", keys);
+        if (measured) {
+            printf("terminal bytes per key: %.1f avg, %zu max\n",
+                    keys ? (double)settings.frame_bytes/keys : 0, settings.max_frame_bytes);
+        } else {
+            printf("terminal bytes per key: not measured, no pseudo terminal\n");
+        }
+        printf("sheet tiles decoded: %zu, from cache: %zu\n",
+                settings.sheet_cache.misses, settings.sheet_cache.hits);
+        printf("undo steps: %zu, %zuB\n", settings.history.steps_len,
+                fami_history_size(&settings.history));
     }
 
+    // if file was opened free it now
+    free_input_file(&settings);
+
     return 0;
 }
@@ -0,0 +1,132 @@
+#include "include/packed.h"
+
+#include <stdlib.h>
+
+#define my_malloc(x) malloc(x)
+
+// moves bit n of a plane byte to bit 2n
+static inline uint16_t spread_plane(uint8_t p) {
+    uint16_t x = p;
+    x = (x | x << 4) & 0x0F0F;
+    x = (x | x << 2) & 0x3333;
+    x = (x | x << 1) & 0x5555;
+    return x;
+}
+
+// inverse of spread_plane, only looks at the even bits
+static inline uint8_t compact_plane(uint16_t x) {
+    x &= 0x5555;
+    x = (x | x >> 1) & 0x3333;
+    x = (x | x >> 2) & 0x0F0F;
+    x = (x | x >> 4) & 0x00FF;
+    return x;
+}
+
+void fami_packed_set_pixel(fami_packed_row *rows, unsigned int x, unsigned int y, fami_color_index index) {
+    index &= FAMI_MAX_COLOR_INDEX;
+    unsigned int shift = fami_packed_shift(x);
+    rows[y] = (rows[y] & ~(FAMI_MAX_COLOR_INDEX << shift)) | (index << shift);
+}
+
+fami_color_index fami_packed_get_pixel(fami_packed_row *rows, unsigned int x, unsigned int y) {
+    return (rows[y] >> fami_packed_shift(x)) & FAMI_MAX_COLOR_INDEX;
+}
+
+fami_packed_row fami_packed_get_row(fami_packed_row *rows, unsigned int y) {
+    return rows[y];
+}
+
+void fami_packed_set_row(fami_packed_row *rows, unsigned int y, fami_packed_row row) {
+    rows[y] = row;
+}
+
+fami_packed_row fami_packed_row_pack(char *pixels) {
+    fami_packed_row row = 0;
+    for (int i = 0; i < FAMI_TILE_LEN; i++) {
+        row = (row << FAMI_BPP) | (pixels[i] & FAMI_MAX_COLOR_INDEX);
+    }
+    return row;
+}
+
+void fami_packed_row_unpack(fami_packed_row row, char *pixels) {
+    for (int i = 0; i < FAMI_TILE_LEN; i++) {
+        pixels[i] = (row >> fami_packed_shift(i)) & FAMI_MAX_COLOR_INDEX;
+    }
+}
+
+fami_packed_row* fami_pack_chr(char *data, unsigned int *length, fami_packed_row *packed) {
+    unsigned int tiles = *length / FAMI_TILE_SIZE;
+    if (!packed) {
+        packed = my_malloc(tiles*FAMI_PACKED_TILE_ROWS*sizeof(fami_packed_row));
+        if (!packed) {
+            return NULL;
+        }
+    }
+
+    for (unsigned int t = 0; t < tiles; t++) {
+        uint8_t *tile = (uint8_t*)data+t*FAMI_TILE_SIZE;
+        fami_packed_row *out = packed+t*FAMI_PACKED_TILE_ROWS;
+        for (int i = 0; i < FAMI_TILE_LEN; i++) {
+            out[i] = spread_plane(tile[i]) | spread_plane(tile[i+FAMI_TILE_LEN]) << 1;
+        }
+    }
+    *length = tiles*FAMI_PACKED_TILE_ROWS;
+
+    return packed;
+}
+
+char* fami_unpack_chr(fami_packed_row *packed, unsigned int *length, char *encoded) {
+    unsigned int tiles = *length / FAMI_PACKED_TILE_ROWS;
+    if (!encoded) {
+        encoded = my_malloc(tiles*FAMI_TILE_SIZE);
+        if (!encoded) {
+            return NULL;
+        }
+    }
+
+    for (unsigned int t = 0; t < tiles; t++) {
+        fami_packed_row *in = packed+t*FAMI_PACKED_TILE_ROWS;
+        char *tile = encoded+t*FAMI_TILE_SIZE;
+        for (int i = 0; i < FAMI_TILE_LEN; i++) {
+            tile[i] = compact_plane(in[i]);
+            tile[i+FAMI_TILE_LEN] = compact_plane(in[i] >> 1);
+        }
+    }
+    *length = tiles*FAMI_TILE_SIZE;
+
+    return encoded;
+}
+
+fami_packed_row* fami_pack(char *decoded, unsigned int *length, fami_packed_row *packed) {
+    unsigned int rows = *length / FAMI_TILE_LEN;
+    if (!packed) {
+        packed = my_malloc(rows*sizeof(fami_packed_row));
+        if (!packed) {
+            return NULL;
+        }
+    }
+
+    for (unsigned int i = 0; i < rows; i++) {
+        packed[i] = fami_packed_row_pack(decoded+i*FAMI_TILE_LEN);
+    }
+    *length = rows;
+
+    return packed;
+}
+
+char* fami_unpack(fami_packed_row *packed, unsigned int *length, char *decoded) {
+    unsigned int rows = *length;
+    if (!decoded) {
+        decoded = my_malloc(rows*FAMI_TILE_LEN);
+        if (!decoded) {
+            return NULL;
+        }
+    }
+
+    for (unsigned int i = 0; i < rows; i++) {
+        fami_packed_row_unpack(packed[i], decoded+i*FAMI_TILE_LEN);
+    }
+    *length = rows*FAMI_TILE_LEN;
+
+    return decoded;
+}
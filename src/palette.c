@@ -0,0 +1,151 @@
+#include "include/palette.h"
+#include "include/simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+// pixels gathered into line order before rendering
+#define RENDER_CHUNK_TILES 64
+
+// 2C02 master palette
+static const uint8_t nes_colors[FAMI_NES_COLORS][3] = {
+    {0x54, 0x54, 0x54}, {0x00, 0x1E, 0x74}, {0x08, 0x10, 0x90}, {0x30, 0x00, 0x88},
+    {0x44, 0x00, 0x64}, {0x5C, 0x00, 0x30}, {0x54, 0x04, 0x00}, {0x3C, 0x18, 0x00},
+    {0x20, 0x2A, 0x00}, {0x08, 0x3A, 0x00}, {0x00, 0x40, 0x00}, {0x00, 0x3C, 0x00},
+    {0x00, 0x32, 0x3C}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00},
+    {0x98, 0x96, 0x98}, {0x08, 0x4C, 0xC4}, {0x30, 0x32, 0xEC}, {0x5C, 0x1E, 0xE4},
+    {0x88, 0x14, 0xB0}, {0xA0, 0x14, 0x64}, {0x98, 0x22, 0x20}, {0x78, 0x3C, 0x00},
+    {0x54, 0x5A, 0x00}, {0x28, 0x72, 0x00}, {0x08, 0x7C, 0x00}, {0x00, 0x76, 0x28},
+    {0x00, 0x66, 0x78}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00},
+    {0xEC, 0xEE, 0xEC}, {0x4C, 0x9A, 0xEC}, {0x78, 0x7C, 0xEC}, {0xB0, 0x62, 0xEC},
+    {0xE4, 0x54, 0xEC}, {0xEC, 0x58, 0xB4}, {0xEC, 0x6A, 0x64}, {0xD4, 0x88, 0x20},
+    {0xA0, 0xAA, 0x00}, {0x74, 0xC4, 0x00}, {0x4C, 0xD0, 0x20}, {0x38, 0xCC, 0x6C},
+    {0x38, 0xB4, 0xCC}, {0x3C, 0x3C, 0x3C}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00},
+    {0xEC, 0xEE, 0xEC}, {0xA8, 0xCC, 0xEC}, {0xBC, 0xBC, 0xEC}, {0xD4, 0xB2, 0xEC},
+    {0xEC, 0xAE, 0xEC}, {0xEC, 0xAE, 0xD4}, {0xEC, 0xB4, 0xB0}, {0xE4, 0xC4, 0x90},
+    {0xCC, 0xD2, 0x78}, {0xB4, 0xDE, 0x78}, {0xA8, 0xE2, 0x90}, {0x98, 0xE2, 0xB4},
+    {0xA0, 0xD6, 0xE4}, {0xA0, 0xA2, 0xA0}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}
+};
+
+fami_color_t fami_nes_color(uint8_t index) {
+    const uint8_t *rgb = nes_colors[index & (FAMI_NES_COLORS-1)];
+    fami_color_t color = {rgb[0], rgb[1], rgb[2]};
+    return color;
+}
+
+void fami_palette_state(fami_state_t *state, const uint8_t *nes) {
+    for (int i = 0; i < FAMI_MAX_COLORS; i++) {
+        fami_set_color(state, fami_nes_color(nes[i]), i);
+    }
+}
+
+char fami_palette_parse(const char *text, uint8_t *nes) {
+    const char *p = text;
+    for (int i = 0; i < FAMI_MAX_COLORS; i++) {
+        char *end = NULL;
+        unsigned long v = strtoul(p, &end, 16);
+        if (end == p || v >= FAMI_NES_COLORS) {
+            return 0;
+        }
+        nes[i] = v;
+        if (i < FAMI_MAX_COLOR_INDEX && *end != ',') {
+            return 0;
+        }
+        p = end+1;
+    }
+    return p[-1] == '\0';
+}
+
+void fami_palette_pack(fami_state_t *state, char transparent, uint32_t *colors) {
+    for (int i = 0; i < FAMI_MAX_COLORS; i++) {
+        fami_color_t c = fami_get_color(state, i);
+        uint8_t bytes[4] = {c.r, c.g, c.b, transparent && i == 0 ? 0 : 0xFF};
+        memcpy(colors+i, bytes, 4);
+    }
+}
+
+void fami_render_row(char *decoded, unsigned int tiles_w, const uint32_t *palettes,
+        const uint8_t *tile_palettes, char rgba, uint8_t *out) {
+    size_t bpp = rgba ? 4 : 3;
+    size_t line_len = (size_t)tiles_w*FAMI_TILE_LEN*bpp;
+    char line[RENDER_CHUNK_TILES*FAMI_TILE_LEN];
+
+    for (int y = 0; y < FAMI_TILE_LEN; y++) {
+        uint8_t *dst = out+y*line_len;
+        for (unsigned int first = 0; first < tiles_w; first += RENDER_CHUNK_TILES) {
+            unsigned int count = tiles_w-first < RENDER_CHUNK_TILES ? tiles_w-first : RENDER_CHUNK_TILES;
+            for (unsigned int t = 0; t < count; t++) {
+                memcpy(line+t*FAMI_TILE_LEN, decoded+(size_t)(first+t)*FAMI_TILE_PIXELS+y*FAMI_TILE_LEN,
+                        FAMI_TILE_LEN);
+            }
+
+            // neighbouring tiles with the same sub-palette are rendered in one go
+            for (unsigned int t = 0; t < count;) {
+                unsigned int run = count-t;
+                uint8_t pal = 0;
+                if (tile_palettes) {
+                    pal = tile_palettes[first+t];
+                    run = 1;
+                    while (t+run < count && tile_palettes[first+t+run] == pal) {
+                        run++;
+                    }
+                }
+                size_t pixels = run*FAMI_TILE_LEN;
+                const uint32_t *colors = palettes+pal*FAMI_MAX_COLORS;
+                if (rgba) {
+                    fami_render_rgba(line+t*FAMI_TILE_LEN, pixels, colors, dst);
+                } else {
+                    fami_render_rgb(line+t*FAMI_TILE_LEN, pixels, colors, dst);
+                }
+                dst += pixels*bpp;
+                t += run;
+            }
+        }
+    }
+}
+
+size_t fami_render_size(size_t length, unsigned int tiles_w, char rgba) {
+    size_t tiles = length / FAMI_TILE_SIZE;
+    if (tiles_w == 0 || tiles == 0) {
+        return 0;
+    }
+    size_t tile_rows = (tiles+tiles_w-1) / tiles_w;
+    return tile_rows*tiles_w*FAMI_TILE_PIXELS*(rgba ? 4 : 3);
+}
+
+char fami_render_sheet(char *data, size_t length, unsigned int tiles_w, const uint32_t *palettes,
+        const uint8_t *tile_palettes, char rgba, uint8_t *out) {
+    size_t tiles = length / FAMI_TILE_SIZE;
+    if (fami_render_size(length, tiles_w, rgba) == 0) {
+        return 0;
+    }
+
+    char *decoded = my_malloc((size_t)tiles_w*FAMI_TILE_PIXELS);
+    uint8_t *row_palettes = tile_palettes ? my_malloc(tiles_w) : NULL;
+    if (!decoded || (tile_palettes && !row_palettes)) {
+        my_free(decoded);
+        my_free(row_palettes);
+        return 0;
+    }
+
+    size_t row_len = (size_t)tiles_w*FAMI_TILE_PIXELS*(rgba ? 4 : 3);
+    for (size_t first = 0; first < tiles; first += tiles_w) {
+        unsigned int count = tiles-first < tiles_w ? tiles-first : tiles_w;
+        if (count < tiles_w) {
+            memset(decoded, 0, (size_t)tiles_w*FAMI_TILE_PIXELS);
+        }
+        fami_decode_tiles(data+first*FAMI_TILE_SIZE, count, decoded);
+        if (row_palettes) {
+            memset(row_palettes, 0, tiles_w);
+            memcpy(row_palettes, tile_palettes+first, count);
+        }
+        fami_render_row(decoded, tiles_w, palettes, row_palettes, rgba, out+first/tiles_w*row_len);
+    }
+
+    my_free(decoded);
+    my_free(row_palettes);
+    return 1;
+}
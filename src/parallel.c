@@ -0,0 +1,119 @@
+#include "include/parallel.h"
+#include "include/famisprite.h"
+#include "include/simd.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define my_malloc(x) malloc(x)
+
+typedef void (*tiles_kernel)(char *src, unsigned int tiles, char *dst);
+
+typedef struct tile_range {
+    tiles_kernel kernel;
+    char *src;
+    char *dst;
+    unsigned int tiles;
+} tile_range_t;
+
+static void *run_range(void *arg) {
+    tile_range_t *range = arg;
+    range->kernel(range->src, range->tiles, range->dst);
+    return NULL;
+}
+
+unsigned int fami_default_threads() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return 1;
+    }
+    return cpus > FAMI_MAX_THREADS ? FAMI_MAX_THREADS : cpus;
+}
+
+/**
+ * Runs a kernel over tiles split across threads
+ * src_size and dst_size are the sizes of one tile in src and dst
+ */
+static void run_tiles(tiles_kernel kernel, char *src, unsigned int src_size,
+        char *dst, unsigned int dst_size, unsigned int tiles, unsigned int threads) {
+    if (threads == 0) {
+        threads = fami_default_threads();
+    }
+    if (threads > FAMI_MAX_THREADS) {
+        threads = FAMI_MAX_THREADS;
+    }
+    if (threads > tiles/FAMI_PARALLEL_MIN_TILES) {
+        threads = tiles/FAMI_PARALLEL_MIN_TILES;
+    }
+    if (threads <= 1) {
+        kernel(src, tiles, dst);
+        return;
+    }
+
+    // resolve the kernel level once before threads race for it
+    fami_simd_get_level();
+
+    tile_range_t ranges[FAMI_MAX_THREADS];
+    pthread_t workers[FAMI_MAX_THREADS];
+    char started[FAMI_MAX_THREADS];
+
+    // the first tiles%threads ranges get one extra tile
+    unsigned int first = 0;
+    for (unsigned int i = 0; i < threads; i++) {
+        unsigned int count = tiles/threads + (i < tiles%threads);
+        ranges[i].kernel = kernel;
+        ranges[i].src = src+(size_t)first*src_size;
+        ranges[i].dst = dst+(size_t)first*dst_size;
+        ranges[i].tiles = count;
+        first += count;
+    }
+
+    // the calling thread takes range 0, a range whose thread fails to start runs here too
+    for (unsigned int i = 1; i < threads; i++) {
+        started[i] = pthread_create(&workers[i], NULL, run_range, &ranges[i]) == 0;
+    }
+    run_range(&ranges[0]);
+    for (unsigned int i = 1; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(workers[i], NULL);
+        } else {
+            run_range(&ranges[i]);
+        }
+    }
+}
+
+char* fami_decode_mt(char *data, unsigned int *length, char *decoded, unsigned int threads) {
+    if (!decoded) {
+        decoded = my_malloc(FAMI_BPP*2*(*length));
+    }
+
+    unsigned int tiles = *length / FAMI_TILE_SIZE;
+    run_tiles(fami_decode_tiles, data, FAMI_TILE_SIZE, decoded, FAMI_TILE_PIXELS, tiles, threads);
+
+    // a trailing partial tile takes the same path as in fami_decode
+    unsigned int tail = *length - tiles*FAMI_TILE_SIZE;
+    if (tail) {
+        fami_decode(data+tiles*FAMI_TILE_SIZE, &tail, decoded+tiles*FAMI_TILE_PIXELS);
+    }
+    *length = tiles*FAMI_TILE_PIXELS + tail;
+
+    return decoded;
+}
+
+char* fami_encode_mt(char *data, unsigned int *length, char *encoded, unsigned int threads) {
+    if (!encoded) {
+        encoded = my_malloc((*length)/(FAMI_BPP*2));
+    }
+
+    unsigned int tiles = *length / FAMI_TILE_PIXELS;
+    run_tiles(fami_encode_tiles, data, FAMI_TILE_PIXELS, encoded, FAMI_TILE_SIZE, tiles, threads);
+
+    unsigned int tail = *length - tiles*FAMI_TILE_PIXELS;
+    if (tail) {
+        fami_encode(data+tiles*FAMI_TILE_PIXELS, &tail, encoded+tiles*FAMI_TILE_SIZE);
+    }
+    *length = tiles*FAMI_TILE_SIZE + tail;
+
+    return encoded;
+}
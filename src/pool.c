@@ -0,0 +1,324 @@
+#include "include/pool.h"
+#include "include/parallel.h"
+#include "include/simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+#define DEQUE_INITIAL_CAP 64
+
+typedef struct job {
+    fami_job_fn fn;
+    void *arg;
+    size_t memory;
+} job_t;
+
+// ring buffer, the owner works at the back and thieves at the front
+typedef struct deque {
+    pthread_mutex_t lock;
+    job_t *jobs;
+    size_t cap;
+    size_t head;
+    size_t count;
+} deque_t;
+
+struct fami_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // a job was queued or memory released
+    pthread_cond_t done; // pending reached 0
+    pthread_t *workers;
+    unsigned int started;
+    unsigned int threads; // one deque each
+    deque_t *deques;
+
+    // everything below is guarded by lock
+    deque_t queue; // submitted jobs, in order
+    size_t memory_limit;
+    size_t memory_held;
+    size_t pending; // queued or running
+    size_t signals; // bumped with every change a sleeping worker has to look at
+    char stop;
+    fami_pool_stats_t stats;
+};
+
+// the pool and deque of the worker running on this thread
+static __thread fami_pool_t *current_pool = NULL;
+static __thread unsigned int current_worker = 0;
+
+static char deque_init(deque_t *d) {
+    d->jobs = my_malloc(DEQUE_INITIAL_CAP*sizeof(job_t));
+    d->cap = DEQUE_INITIAL_CAP;
+    d->head = 0;
+    d->count = 0;
+    if (!d->jobs) {
+        return 0;
+    }
+    pthread_mutex_init(&d->lock, NULL);
+    return 1;
+}
+
+static void deque_free(deque_t *d) {
+    pthread_mutex_destroy(&d->lock);
+    my_free(d->jobs);
+}
+
+static char push_back(deque_t *d, job_t job) {
+    if (d->count == d->cap) {
+        job_t *grown = my_malloc(2*d->cap*sizeof(job_t));
+        if (!grown) {
+            return 0;
+        }
+        // unwraps the ring
+        for (size_t i = 0; i < d->count; i++) {
+            grown[i] = d->jobs[(d->head+i) % d->cap];
+        }
+        my_free(d->jobs);
+        d->jobs = grown;
+        d->head = 0;
+        d->cap *= 2;
+    }
+    d->jobs[(d->head+d->count++) % d->cap] = job;
+    return 1;
+}
+
+static char pop_back(deque_t *d, job_t *job) {
+    if (d->count == 0) {
+        return 0;
+    }
+    *job = d->jobs[(d->head+--d->count) % d->cap];
+    return 1;
+}
+
+static char pop_front(deque_t *d, job_t *job) {
+    if (d->count == 0) {
+        return 0;
+    }
+    *job = d->jobs[d->head];
+    d->head = (d->head+1) % d->cap;
+    d->count--;
+    return 1;
+}
+
+static char locked_pop(deque_t *d, job_t *job, char front) {
+    pthread_mutex_lock(&d->lock);
+    char found = front ? pop_front(d, job) : pop_back(d, job);
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+/**
+ * Finds the next job for a worker, its own newest job first, then the oldest
+ * job of another worker, then a submitted job whose memory fits
+ */
+static char take_job(fami_pool_t *pool, unsigned int worker, job_t *job, char *stolen) {
+    *stolen = 0;
+    if (locked_pop(pool->deques+worker, job, 0)) {
+        return 1;
+    }
+    for (unsigned int i = 1; i < pool->threads; i++) {
+        if (locked_pop(pool->deques+(worker+i) % pool->threads, job, 1)) {
+            *stolen = 1;
+            return 1;
+        }
+    }
+
+    char found = 0;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->queue.count) {
+        size_t memory = pool->queue.jobs[pool->queue.head].memory;
+        if (pool->memory_limit == 0 || pool->memory_held == 0
+                || pool->memory_held+memory <= pool->memory_limit) {
+            found = pop_front(&pool->queue, job);
+            pool->memory_held += memory;
+            if (pool->memory_held > pool->stats.memory_peak) {
+                pool->stats.memory_peak = pool->memory_held;
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return found;
+}
+
+static void finish_job(fami_pool_t *pool, char stolen) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.jobs++;
+    pool->stats.steals += stolen;
+    if (--pool->pending == 0) {
+        pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+typedef struct worker_arg {
+    fami_pool_t *pool;
+    unsigned int worker;
+} worker_arg_t;
+
+static void *run_worker(void *arg) {
+    worker_arg_t *wa = arg;
+    fami_pool_t *pool = wa->pool;
+    unsigned int worker = wa->worker;
+    my_free(wa);
+    current_pool = pool;
+    current_worker = worker;
+
+    for (;;) {
+        // anything queued after this snapshot wakes the wait below
+        pthread_mutex_lock(&pool->lock);
+        size_t seen = pool->signals;
+        char stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) {
+            return NULL;
+        }
+
+        job_t job;
+        char stolen = 0;
+        if (take_job(pool, worker, &job, &stolen)) {
+            job.fn(pool, job.arg);
+            finish_job(pool, stolen);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->signals == seen && !pool->stop) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+fami_pool_t *fami_pool_create(unsigned int threads, size_t memory_limit) {
+    if (threads == 0) {
+        threads = fami_default_threads();
+    }
+    if (threads > FAMI_MAX_THREADS) {
+        threads = FAMI_MAX_THREADS;
+    }
+
+    fami_pool_t *pool = my_malloc(sizeof(fami_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    memset(pool, 0, sizeof(fami_pool_t));
+    pool->memory_limit = memory_limit;
+    pool->workers = my_malloc(threads*sizeof(pthread_t));
+    pool->deques = my_malloc(threads*sizeof(deque_t));
+    if (!pool->workers || !pool->deques || !deque_init(&pool->queue)) {
+        my_free(pool->workers);
+        my_free(pool->deques);
+        my_free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // resolve the kernel level once before workers race for it
+    fami_simd_get_level();
+
+    // every deque exists before a worker can steal from it
+    for (; pool->threads < threads; pool->threads++) {
+        if (!deque_init(pool->deques+pool->threads)) {
+            break;
+        }
+    }
+    // a worker that fails to start leaves its deque empty, the others still steal from it
+    for (unsigned int i = 0; i < pool->threads; i++) {
+        worker_arg_t *wa = my_malloc(sizeof(worker_arg_t));
+        if (wa) {
+            wa->pool = pool;
+            wa->worker = i;
+        }
+        if (!wa || pthread_create(pool->workers+pool->started, NULL, run_worker, wa) != 0) {
+            my_free(wa);
+            continue;
+        }
+        pool->started++;
+    }
+    if (pool->started == 0) {
+        fami_pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+char fami_pool_submit(fami_pool_t *pool, fami_job_fn fn, void *arg, size_t memory) {
+    job_t job = {fn, arg, memory};
+    pthread_mutex_lock(&pool->lock);
+    char ok = push_back(&pool->queue, job);
+    if (ok) {
+        pool->pending++;
+        pool->signals++;
+        pthread_cond_signal(&pool->work);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return ok;
+}
+
+char fami_pool_spawn(fami_pool_t *pool, fami_job_fn fn, void *arg) {
+    job_t job = {fn, arg, 0};
+    deque_t *d = pool->deques+(current_pool == pool ? current_worker : 0);
+
+    // pending goes up before the job can be taken and finished
+    pthread_mutex_lock(&pool->lock);
+    pthread_mutex_lock(&d->lock);
+    char ok = push_back(d, job);
+    pthread_mutex_unlock(&d->lock);
+    if (ok) {
+        pool->pending++;
+        pool->signals++;
+        pthread_cond_signal(&pool->work);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return ok;
+}
+
+void fami_pool_release(fami_pool_t *pool, size_t memory) {
+    pthread_mutex_lock(&pool->lock);
+    pool->memory_held -= memory < pool->memory_held ? memory : pool->memory_held;
+    pool->signals++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void fami_pool_wait(fami_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+fami_pool_stats_t fami_pool_stats(fami_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    fami_pool_stats_t stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+    return stats;
+}
+
+void fami_pool_free(fami_pool_t *pool) {
+    fami_pool_wait(pool);
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned int i = 0; i < pool->started; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    for (unsigned int i = 0; i < pool->threads; i++) {
+        deque_free(pool->deques+i);
+    }
+    deque_free(&pool->queue);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    my_free(pool->workers);
+    my_free(pool->deques);
+    my_free(pool);
+}
@@ -0,0 +1,255 @@
+#include "include/quantize.h"
+#include "include/simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+#define COLOR_CACHE_BITS 10
+#define COLOR_CACHE_SIZE (1 << COLOR_CACHE_BITS)
+// tiles with more distinct colors go through the kernel
+#define CACHE_MAX_COLORS 8
+
+static const uint8_t bayer[FAMI_TILE_PIXELS] = {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21
+};
+
+typedef struct color_entry {
+    uint32_t key; // rgb + 1, 0 for an empty entry
+    uint8_t index[FAMI_SUB_PALETTES];
+    uint32_t distance[FAMI_SUB_PALETTES];
+} color_entry_t;
+
+typedef struct quantizer {
+    uint32_t palettes[FAMI_SUB_PALETTES*FAMI_MAX_COLORS];
+    uint8_t channels[FAMI_SUB_PALETTES*FAMI_MAX_COLORS][4];
+    unsigned int candidates; // sub-palettes tried per tile
+    int dither[FAMI_TILE_PIXELS]; // added to every channel
+    color_entry_t *cache;
+} quantizer_t;
+
+static uint32_t isqrt(uint32_t v) {
+    uint32_t r = 0;
+    while ((r+1)*(r+1) <= v) {
+        r++;
+    }
+    return r;
+}
+
+static uint32_t color_distance(const uint8_t *a, const uint8_t *b) {
+    int dr = a[0]-b[0];
+    int dg = a[1]-b[1];
+    int db = a[2]-b[2];
+    return dr*dr+dg*dg+db*db;
+}
+
+// the pattern spans the step between the closest two colors along the gray axis
+static void init_dither(quantizer_t *qz) {
+    uint32_t closest = UINT32_MAX;
+    for (unsigned int p = 0; p < qz->candidates; p++) {
+        uint8_t (*colors)[4] = qz->channels+p*FAMI_MAX_COLORS;
+        for (int i = 0; i < FAMI_MAX_COLORS; i++) {
+            for (int j = i+1; j < FAMI_MAX_COLORS; j++) {
+                uint32_t d = color_distance(colors[i], colors[j]);
+                if (d > 0 && d < closest) {
+                    closest = d;
+                }
+            }
+        }
+    }
+    int spread = closest == UINT32_MAX ? 0 : isqrt(closest/3);
+    for (int i = 0; i < FAMI_TILE_PIXELS; i++) {
+        qz->dither[i] = (2*bayer[i]+1-FAMI_TILE_PIXELS)*spread / (2*FAMI_TILE_PIXELS);
+    }
+}
+
+static uint8_t clamp_channel(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// splits a tile of the image into color planes
+static void gather_tile(fami_image_t *image, size_t left, size_t top, quantizer_t *qz, uint8_t *planes) {
+    for (int y = 0; y < FAMI_TILE_LEN; y++) {
+        const uint8_t *rgb = image->rgb+((top+y)*image->width+left)*3;
+        for (int x = 0; x < FAMI_TILE_LEN; x++, rgb += 3) {
+            int i = y*FAMI_TILE_LEN+x;
+            int offset = qz->dither[i];
+            planes[i] = clamp_channel(rgb[0]+offset);
+            planes[FAMI_TILE_PIXELS+i] = clamp_channel(rgb[1]+offset);
+            planes[2*FAMI_TILE_PIXELS+i] = clamp_channel(rgb[2]+offset);
+        }
+    }
+}
+
+static color_entry_t *lookup_color(quantizer_t *qz, uint32_t rgb, fami_quantize_t *quantize) {
+    uint32_t key = rgb+1;
+    color_entry_t *entry = qz->cache+((key*2654435761u) >> (32-COLOR_CACHE_BITS));
+    if (entry->key == key) {
+        quantize->cache_hits++;
+        return entry;
+    }
+
+    // direct mapped, a miss replaces the entry
+    quantize->cache_misses++;
+    entry->key = key;
+    uint8_t color[3] = {rgb >> 16, rgb >> 8, rgb};
+    for (unsigned int p = 0; p < qz->candidates; p++) {
+        uint32_t best = UINT32_MAX;
+        for (int c = 0; c < FAMI_MAX_COLORS; c++) {
+            uint32_t d = color_distance(color, qz->channels[p*FAMI_MAX_COLORS+c]);
+            if (d < best) {
+                best = d;
+                entry->index[p] = c;
+            }
+        }
+        entry->distance[p] = best;
+    }
+    return entry;
+}
+
+/**
+ * Quantizes a tile through the color cache
+ * Returns:
+ *  1 on success
+ *  0 if the tile has too many distinct colors
+ */
+static char quantize_cached(quantizer_t *qz, const uint8_t *planes, fami_quantize_t *quantize,
+        char *indices, uint8_t *palette) {
+    uint32_t colors[CACHE_MAX_COLORS];
+    uint32_t counts[CACHE_MAX_COLORS];
+    uint8_t slots[FAMI_TILE_PIXELS];
+    int distinct = 0;
+    int s = 0;
+
+    for (int i = 0; i < FAMI_TILE_PIXELS; i++) {
+        uint32_t rgb = planes[i] << 16 | planes[FAMI_TILE_PIXELS+i] << 8 | planes[2*FAMI_TILE_PIXELS+i];
+        // neighbours mostly share a color, the slot of the previous pixel is checked first
+        if (distinct == 0 || colors[s] != rgb) {
+            for (s = 0; s < distinct && colors[s] != rgb; s++) {
+            }
+            if (s == distinct) {
+                if (distinct == CACHE_MAX_COLORS) {
+                    return 0;
+                }
+                colors[distinct] = rgb;
+                counts[distinct++] = 0;
+            }
+        }
+        counts[s]++;
+        slots[i] = s;
+    }
+
+    // copies, two colors of the tile can share a cache entry
+    color_entry_t entries[CACHE_MAX_COLORS];
+    for (s = 0; s < distinct; s++) {
+        entries[s] = *lookup_color(qz, colors[s], quantize);
+    }
+
+    uint32_t best_error = UINT32_MAX;
+    for (unsigned int p = 0; p < qz->candidates; p++) {
+        uint32_t error = 0;
+        for (s = 0; s < distinct; s++) {
+            error += counts[s]*entries[s].distance[p];
+        }
+        if (error < best_error) {
+            best_error = error;
+            *palette = p;
+        }
+    }
+    for (int i = 0; i < FAMI_TILE_PIXELS; i++) {
+        indices[i] = entries[slots[i]].index[*palette];
+    }
+    return 1;
+}
+
+// tries every candidate sub-palette with the kernel
+static void quantize_kernel(quantizer_t *qz, const uint8_t *planes, char *indices, uint8_t *palette) {
+    char trial[FAMI_TILE_PIXELS];
+    uint32_t best_error = UINT32_MAX;
+    for (unsigned int p = 0; p < qz->candidates; p++) {
+        uint32_t error = fami_nearest_tile(planes, qz->palettes+p*FAMI_MAX_COLORS, trial);
+        if (error < best_error) {
+            best_error = error;
+            *palette = p;
+            memcpy(indices, trial, FAMI_TILE_PIXELS);
+        }
+    }
+}
+
+char *fami_quantize_image(fami_image_t *image, fami_quantize_t *quantize,
+        uint8_t **tile_palettes, size_t *length) {
+    quantize->cache_hits = 0;
+    quantize->cache_misses = 0;
+    quantize->kernel_tiles = 0;
+    if (image->width % FAMI_TILE_LEN || image->height % FAMI_TILE_LEN
+            || quantize->palette_count == 0 || quantize->palette_count > FAMI_SUB_PALETTES) {
+        return NULL;
+    }
+
+    unsigned int tiles_w = image->width / FAMI_TILE_LEN;
+    size_t tiles = (size_t)tiles_w * (image->height / FAMI_TILE_LEN);
+    if (image->tiles && image->tiles <= tiles) {
+        tiles = image->tiles;
+    }
+
+    quantizer_t qz;
+    memset(&qz, 0, sizeof(qz));
+    qz.candidates = quantize->auto_palette ? quantize->palette_count : 1;
+    for (unsigned int p = 0; p < qz.candidates; p++) {
+        fami_palette_pack(quantize->states+p, 0, qz.palettes+p*FAMI_MAX_COLORS);
+    }
+    memcpy(qz.channels, qz.palettes, sizeof(qz.channels));
+    if (quantize->dither) {
+        init_dither(&qz);
+    }
+
+    char *encoded = my_malloc(tiles*FAMI_TILE_SIZE);
+    char *decoded = my_malloc(tiles_w*FAMI_TILE_PIXELS);
+    uint8_t *palettes = tile_palettes ? my_malloc(tiles ? tiles : 1) : NULL;
+    qz.cache = my_malloc(COLOR_CACHE_SIZE*sizeof(color_entry_t));
+    if (!encoded || !decoded || (tile_palettes && !palettes) || !qz.cache) {
+        my_free(encoded);
+        my_free(decoded);
+        my_free(palettes);
+        my_free(qz.cache);
+        return NULL;
+    }
+    memset(qz.cache, 0, COLOR_CACHE_SIZE*sizeof(color_entry_t));
+
+    uint8_t planes[3*FAMI_TILE_PIXELS];
+    for (size_t first = 0; first < tiles; first += tiles_w) {
+        unsigned int count = tiles-first < tiles_w ? tiles-first : tiles_w;
+        size_t top = first / tiles_w * FAMI_TILE_LEN;
+
+        for (unsigned int t = 0; t < count; t++) {
+            char *indices = decoded+t*FAMI_TILE_PIXELS;
+            uint8_t palette = 0;
+            gather_tile(image, t*FAMI_TILE_LEN, top, &qz, planes);
+            if (!quantize_cached(&qz, planes, quantize, indices, &palette)) {
+                quantize->kernel_tiles++;
+                quantize_kernel(&qz, planes, indices, &palette);
+            }
+            if (palettes) {
+                palettes[first+t] = palette;
+            }
+        }
+        fami_encode_tiles(decoded, count, encoded+first*FAMI_TILE_SIZE);
+    }
+
+    my_free(decoded);
+    my_free(qz.cache);
+    if (tile_palettes) {
+        *tile_palettes = palettes;
+    }
+    *length = tiles*FAMI_TILE_SIZE;
+    return encoded;
+}
@@ -0,0 +1,191 @@
+// posix_openpt and friends
+#define _GNU_SOURCE
+
+#include "include/relay.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define RELAY_CHUNK 4096
+#define SYNC_WAIT_NS 2000000
+
+static char write_all(int fd, const char *data, size_t len) {
+    while (len) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return 0;
+        }
+        data += written;
+        len -= written;
+    }
+    return 1;
+}
+
+static void signal_stop(fami_relay_t *relay) {
+    char c = 0;
+    write_all(relay->stop_pipe[1], &c, 1);
+}
+
+// master to the real terminal until the slave is closed
+static void *relay_output(void *arg) {
+    fami_relay_t *relay = arg;
+    char buf[RELAY_CHUNK];
+    for (;;) {
+        struct pollfd p = {relay->master, POLLIN, 0};
+        if (poll(&p, 1, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        // read and counted under the lock, so fami_relay_bytes sees either both or neither
+        pthread_mutex_lock(&relay->lock);
+        ssize_t n = read(relay->master, buf, RELAY_CHUNK);
+        if (n > 0) {
+            relay->bytes += n;
+        }
+        pthread_cond_broadcast(&relay->copied);
+        pthread_mutex_unlock(&relay->lock);
+
+        if (n > 0) {
+            write_all(relay->out_fd, buf, n);
+        } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            // EIO once the slave is closed and everything was read
+            break;
+        }
+    }
+    return NULL;
+}
+
+// real terminal to the master until stopped
+static void *relay_input(void *arg) {
+    fami_relay_t *relay = arg;
+    char buf[RELAY_CHUNK];
+    for (;;) {
+        struct pollfd p[2] = {{relay->in_fd, POLLIN, 0}, {relay->stop_pipe[0], POLLIN, 0}};
+        if (poll(p, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (p[1].revents) {
+            break;
+        }
+        ssize_t n = read(relay->in_fd, buf, RELAY_CHUNK);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || !write_all(relay->master, buf, n)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int open_slave(int master) {
+    if (grantpt(master) != 0 || unlockpt(master) != 0) {
+        return -1;
+    }
+    char *name = ptsname(master);
+    return name ? open(name, O_RDWR | O_NOCTTY) : -1;
+}
+
+char fami_relay_start(fami_relay_t *relay, int in_fd, int out_fd) {
+    memset(relay, 0, sizeof(fami_relay_t));
+    relay->in_fd = in_fd;
+    relay->out_fd = out_fd;
+    relay->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (relay->master < 0) {
+        return 0;
+    }
+    relay->slave = open_slave(relay->master);
+    if (relay->slave < 0 || pipe(relay->stop_pipe) != 0) {
+        if (relay->slave >= 0) {
+            close(relay->slave);
+        }
+        close(relay->master);
+        return 0;
+    }
+    fcntl(relay->master, F_SETFL, fcntl(relay->master, F_GETFL) | O_NONBLOCK);
+
+    // the slave starts out like the real terminal, which then only passes bytes
+    if (tcgetattr(in_fd, &relay->saved) == 0) {
+        tcsetattr(relay->slave, TCSANOW, &relay->saved);
+        struct termios raw = relay->saved;
+        cfmakeraw(&raw);
+        raw.c_lflag |= ISIG;
+        relay->raw = tcsetattr(in_fd, TCSANOW, &raw) == 0;
+    }
+    struct winsize ws;
+    if (ioctl(out_fd, TIOCGWINSZ, &ws) == 0) {
+        ioctl(relay->slave, TIOCSWINSZ, &ws);
+    }
+
+    pthread_mutex_init(&relay->lock, NULL);
+    pthread_cond_init(&relay->copied, NULL);
+    char output = pthread_create(&relay->output_thread, NULL, relay_output, relay) == 0;
+    char input = pthread_create(&relay->input_thread, NULL, relay_input, relay) == 0;
+    if (!output || !input) {
+        // unwinds whichever one started
+        close(relay->slave);
+        signal_stop(relay);
+        if (output) {
+            pthread_join(relay->output_thread, NULL);
+        }
+        if (input) {
+            pthread_join(relay->input_thread, NULL);
+        }
+        if (relay->raw) {
+            tcsetattr(in_fd, TCSANOW, &relay->saved);
+        }
+        pthread_mutex_destroy(&relay->lock);
+        pthread_cond_destroy(&relay->copied);
+        close(relay->stop_pipe[0]);
+        close(relay->stop_pipe[1]);
+        close(relay->master);
+        return 0;
+    }
+    return 1;
+}
+
+size_t fami_relay_bytes(fami_relay_t *relay) {
+    pthread_mutex_lock(&relay->lock);
+    int pending = 0;
+    while (ioctl(relay->master, FIONREAD, &pending) == 0 && pending > 0) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += SYNC_WAIT_NS;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&relay->copied, &relay->lock, &until);
+    }
+    size_t bytes = relay->bytes;
+    pthread_mutex_unlock(&relay->lock);
+    return bytes;
+}
+
+void fami_relay_stop(fami_relay_t *relay) {
+    // the master reads what is left, then fails
+    close(relay->slave);
+    pthread_join(relay->output_thread, NULL);
+    signal_stop(relay);
+    pthread_join(relay->input_thread, NULL);
+
+    if (relay->raw) {
+        tcsetattr(relay->in_fd, TCSADRAIN, &relay->saved);
+    }
+    pthread_mutex_destroy(&relay->lock);
+    pthread_cond_destroy(&relay->copied);
+    close(relay->stop_pipe[0]);
+    close(relay->stop_pipe[1]);
+    close(relay->master);
+}
@@ -0,0 +1,77 @@
+#include "include/rom.h"
+
+#include <stdint.h>
+#include <string.h>
+
+char fami_rom_check(char *data, size_t length) {
+    return length >= FAMI_INES_HEADER_SIZE && memcmp(data, FAMI_INES_MAGIC, 4) == 0;
+}
+
+/**
+ * NES 2.0 rom size
+ * An msb nibble of 0xF switches lsb to an exponent-multiplier form,
+ * 2^E * (MM*2+1) bytes with lsb = EEEEEEMM
+ * Returns:
+ *  0 if the size does not fit
+ */
+static char nes2_size(uint8_t lsb, uint8_t msb, size_t unit, size_t *size) {
+    if (msb != 0xF) {
+        *size = ((size_t)msb << 8 | lsb) * unit;
+        return 1;
+    }
+    unsigned int exponent = lsb >> 2;
+    if (exponent >= sizeof(size_t)*8-3) {
+        return 0;
+    }
+    *size = ((size_t)1 << exponent) * ((lsb & 3)*2+1);
+    return 1;
+}
+
+char fami_rom_parse(char *data, size_t length, fami_rom_t *rom) {
+    if (!fami_rom_check(data, length)) {
+        return 0;
+    }
+    uint8_t *h = (uint8_t*)data;
+    memset(rom, 0, sizeof(fami_rom_t));
+
+    rom->nes2 = (h[7] & 0x0C) == 0x08;
+    rom->trainer = (h[6] & 0x04) != 0;
+    rom->mapper = h[6] >> 4;
+    if (rom->nes2) {
+        rom->mapper |= (h[7] & 0xF0) | (h[8] & 0x0F) << 8;
+        rom->submapper = h[8] >> 4;
+        if (!nes2_size(h[4], h[9] & 0x0F, FAMI_PRG_BANK_SIZE, &rom->prg_size)
+                || !nes2_size(h[5], h[9] >> 4, FAMI_CHR_BANK_SIZE, &rom->chr_size)) {
+            return 0;
+        }
+    } else {
+        // old dumps carry text like "DiskDude!" in bytes 7-15, their upper mapper nibble is garbage
+        if (h[12] == 0 && h[13] == 0 && h[14] == 0 && h[15] == 0) {
+            rom->mapper |= h[7] & 0xF0;
+        }
+        rom->prg_size = (size_t)h[4]*FAMI_PRG_BANK_SIZE;
+        rom->chr_size = (size_t)h[5]*FAMI_CHR_BANK_SIZE;
+    }
+
+    rom->prg_offset = FAMI_INES_HEADER_SIZE + (rom->trainer ? FAMI_INES_TRAINER_SIZE : 0);
+    if (rom->prg_offset > length || rom->prg_size > length-rom->prg_offset) {
+        return 0;
+    }
+    rom->chr_offset = rom->prg_offset+rom->prg_size;
+    if (rom->chr_size > length-rom->chr_offset) {
+        return 0;
+    }
+
+    rom->prg = data+rom->prg_offset;
+    rom->prg_banks = (rom->prg_size+FAMI_PRG_BANK_SIZE-1) / FAMI_PRG_BANK_SIZE;
+    rom->chr = rom->chr_size ? data+rom->chr_offset : NULL;
+    rom->chr_banks = (rom->chr_size+FAMI_CHR_BANK_SIZE-1) / FAMI_CHR_BANK_SIZE;
+    return 1;
+}
+
+char *fami_rom_chr_bank(fami_rom_t *rom, unsigned int bank) {
+    if (bank >= rom->chr_banks) {
+        return NULL;
+    }
+    return rom->chr+(size_t)bank*FAMI_CHR_BANK_SIZE;
+}
@@ -0,0 +1,640 @@
+#include "include/simd.h"
+#include "include/famisprite.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FAMI_SIMD_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define FAMI_SIMD_ARM
+#include <arm_neon.h>
+#endif
+
+typedef void (*tiles_kernel)(char *src, unsigned int tiles, char *dst);
+typedef void (*render_kernel)(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out);
+typedef uint32_t (*nearest_kernel)(const uint8_t *planes, const uint32_t *colors, char *indices);
+
+static void decode_tiles_scalar(char *data, unsigned int tiles, char *decoded) {
+    for (unsigned int i = 0; i < tiles; i++) {
+        unsigned int len = 0;
+        fami_decode_tile(data+i*FAMI_TILE_SIZE, decoded+i*FAMI_TILE_PIXELS, &len);
+    }
+}
+
+static void encode_tiles_scalar(char *data, unsigned int tiles, char *encoded) {
+    for (unsigned int i = 0; i < tiles; i++) {
+        unsigned int len = 0;
+        fami_encode_tile(data+i*FAMI_TILE_PIXELS, encoded+i*FAMI_TILE_SIZE, &len);
+    }
+}
+
+static void render_rgba_scalar(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out) {
+    for (size_t i = 0; i < pixels; i++) {
+        memcpy(out+i*4, colors+(indices[i] & FAMI_MAX_COLOR_INDEX), 4);
+    }
+}
+
+static void render_rgb_scalar(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out) {
+    if (pixels == 0) {
+        return;
+    }
+    // the fourth byte is overwritten by the next pixel
+    for (size_t i = 0; i < pixels-1; i++) {
+        memcpy(out+i*3, colors+(indices[i] & FAMI_MAX_COLOR_INDEX), 4);
+    }
+    memcpy(out+(pixels-1)*3, colors+(indices[pixels-1] & FAMI_MAX_COLOR_INDEX), 3);
+}
+
+// unpacks packed colors into their channels
+static void color_channels(const uint32_t *colors, uint8_t channels[FAMI_MAX_COLORS][4]) {
+    for (int c = 0; c < FAMI_MAX_COLORS; c++) {
+        memcpy(channels[c], colors+c, 4);
+    }
+}
+
+static uint32_t nearest_tile_scalar(const uint8_t *planes, const uint32_t *colors, char *indices) {
+    uint8_t channels[FAMI_MAX_COLORS][4];
+    color_channels(colors, channels);
+    const uint8_t *r = planes;
+    const uint8_t *g = planes+FAMI_TILE_PIXELS;
+    const uint8_t *b = planes+2*FAMI_TILE_PIXELS;
+
+    uint32_t error = 0;
+    for (int i = 0; i < FAMI_TILE_PIXELS; i++) {
+        uint32_t best = UINT32_MAX;
+        for (int c = 0; c < FAMI_MAX_COLORS; c++) {
+            int dr = r[i]-channels[c][0];
+            int dg = g[i]-channels[c][1];
+            int db = b[i]-channels[c][2];
+            uint32_t d = dr*dr+dg*dg+db*db;
+            // ties go to the lower index
+            if (d < best) {
+                best = d;
+                indices[i] = c;
+            }
+        }
+        error += best;
+    }
+    return error;
+}
+
+#ifdef FAMI_SIMD_X86
+
+// turns two broadcast plane vectors into 16 pixels
+// each byte of mask selects the bit of its pixel column
+__attribute__((target("sse2")))
+static inline __m128i sse2_pixels(__m128i p1, __m128i p2, __m128i mask, __m128i one) {
+    __m128i b1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p1, mask), mask), one);
+    __m128i b2 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p2, mask), mask), one);
+    return _mm_or_si128(b1, _mm_add_epi8(b2, b2));
+}
+
+__attribute__((target("sse2")))
+static void decode_tiles_sse2(char *data, unsigned int tiles, char *decoded) {
+    const __m128i mask = _mm_setr_epi8(
+            (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+            (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m128i one = _mm_set1_epi8(1);
+
+    for (unsigned int i = 0; i < tiles; i++) {
+        __m128i tile = _mm_loadu_si128((__m128i*)(data+i*FAMI_TILE_SIZE));
+        __m128i *out = (__m128i*)(decoded+i*FAMI_TILE_PIXELS);
+
+        // sse2 has no byte shuffle, so broadcast every row byte
+        // to 8 lanes by unpacking the tile with itself
+        __m128i p1 = _mm_unpacklo_epi8(tile, tile);
+        __m128i p2 = _mm_unpackhi_epi8(tile, tile);
+        __m128i p1_03 = _mm_unpacklo_epi16(p1, p1);
+        __m128i p1_47 = _mm_unpackhi_epi16(p1, p1);
+        __m128i p2_03 = _mm_unpacklo_epi16(p2, p2);
+        __m128i p2_47 = _mm_unpackhi_epi16(p2, p2);
+
+        _mm_storeu_si128(out+0, sse2_pixels(_mm_unpacklo_epi32(p1_03, p1_03),
+                    _mm_unpacklo_epi32(p2_03, p2_03), mask, one));
+        _mm_storeu_si128(out+1, sse2_pixels(_mm_unpackhi_epi32(p1_03, p1_03),
+                    _mm_unpackhi_epi32(p2_03, p2_03), mask, one));
+        _mm_storeu_si128(out+2, sse2_pixels(_mm_unpacklo_epi32(p1_47, p1_47),
+                    _mm_unpacklo_epi32(p2_47, p2_47), mask, one));
+        _mm_storeu_si128(out+3, sse2_pixels(_mm_unpackhi_epi32(p1_47, p1_47),
+                    _mm_unpackhi_epi32(p2_47, p2_47), mask, one));
+    }
+}
+
+__attribute__((target("sse2")))
+static void encode_tiles_sse2(char *data, unsigned int tiles, char *encoded) {
+    for (unsigned int i = 0; i < tiles; i++) {
+        char *in = data+i*FAMI_TILE_PIXELS;
+        char *out = encoded+i*FAMI_TILE_SIZE;
+
+        // two rows per step
+        for (int r = 0; r < FAMI_TILE_LEN; r += 2) {
+            __m128i v = _mm_loadu_si128((__m128i*)(in+r*FAMI_TILE_LEN));
+            // reverse the pixels of each row so pixel 0 ends up in bit 7
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            // move color bit 0 and 1 into the sign bit of each byte
+            int p1 = _mm_movemask_epi8(_mm_slli_epi16(v, 7));
+            int p2 = _mm_movemask_epi8(_mm_slli_epi16(v, 6));
+            out[r] = p1;
+            out[r+1] = p1 >> 8;
+            out[r+FAMI_TILE_LEN] = p2;
+            out[r+1+FAMI_TILE_LEN] = p2 >> 8;
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_pixels(__m256i p1, __m256i p2, __m256i mask, __m256i one) {
+    __m256i b1 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(p1, mask), mask), one);
+    __m256i b2 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(p2, mask), mask), one);
+    return _mm256_or_si256(b1, _mm256_add_epi8(b2, b2));
+}
+
+__attribute__((target("avx2")))
+static void decode_tiles_avx2(char *data, unsigned int tiles, char *decoded) {
+    const __m256i mask = _mm256_setr_epi8(
+            (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+            (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+            (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+            (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m256i one = _mm256_set1_epi8(1);
+    // the shuffle works per 128 bit lane and both lanes hold the whole tile,
+    // lane 0 produces the first two rows and lane 1 the next two
+    const __m256i rows03 = _mm256_setr_epi8(
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i rows47 = _mm256_add_epi8(rows03, _mm256_set1_epi8(4));
+    const __m256i plane2 = _mm256_set1_epi8(FAMI_TILE_LEN);
+    const __m256i rows03_p2 = _mm256_add_epi8(rows03, plane2);
+    const __m256i rows47_p2 = _mm256_add_epi8(rows47, plane2);
+
+    for (unsigned int i = 0; i < tiles; i++) {
+        __m256i tile = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((__m128i*)(data+i*FAMI_TILE_SIZE)));
+        __m256i *out = (__m256i*)(decoded+i*FAMI_TILE_PIXELS);
+
+        _mm256_storeu_si256(out+0, avx2_pixels(_mm256_shuffle_epi8(tile, rows03),
+                    _mm256_shuffle_epi8(tile, rows03_p2), mask, one));
+        _mm256_storeu_si256(out+1, avx2_pixels(_mm256_shuffle_epi8(tile, rows47),
+                    _mm256_shuffle_epi8(tile, rows47_p2), mask, one));
+    }
+}
+
+__attribute__((target("avx2")))
+static void encode_tiles_avx2(char *data, unsigned int tiles, char *encoded) {
+    // reverses each 8 pixel row inside both lanes
+    const __m256i reverse = _mm256_setr_epi8(
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+    for (unsigned int i = 0; i < tiles; i++) {
+        char *in = data+i*FAMI_TILE_PIXELS;
+        char *out = encoded+i*FAMI_TILE_SIZE;
+
+        // 4 rows per register, one movemask yields 4 plane bytes
+        __m256i r03 = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i*)in), reverse);
+        __m256i r47 = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i*)(in+32)), reverse);
+        uint32_t planes[4] = {
+            _mm256_movemask_epi8(_mm256_slli_epi16(r03, 7)),
+            _mm256_movemask_epi8(_mm256_slli_epi16(r47, 7)),
+            _mm256_movemask_epi8(_mm256_slli_epi16(r03, 6)),
+            _mm256_movemask_epi8(_mm256_slli_epi16(r47, 6))
+        };
+        // movemask bit order is little endian, as is every x86 host
+        memcpy(out, planes, FAMI_TILE_SIZE);
+    }
+}
+
+// sse2 has no byte shuffle, the two index bits select between color pairs
+__attribute__((target("sse2")))
+static inline __m128i sse2_colors(__m128i bit0, __m128i bit1, const __m128i *pairs) {
+    // pairs holds colors 0, 2, 0^1 and 2^3
+    __m128i low = _mm_xor_si128(pairs[0], _mm_and_si128(bit0, pairs[2]));
+    __m128i high = _mm_xor_si128(pairs[1], _mm_and_si128(bit0, pairs[3]));
+    return _mm_xor_si128(low, _mm_and_si128(bit1, _mm_xor_si128(low, high)));
+}
+
+__attribute__((target("sse2")))
+static void render_rgba_sse2(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out) {
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    __m128i pairs[FAMI_MAX_COLORS] = {
+        _mm_set1_epi32(colors[0]), _mm_set1_epi32(colors[2]),
+        _mm_set1_epi32(colors[0] ^ colors[1]), _mm_set1_epi32(colors[2] ^ colors[3])
+    };
+
+    size_t i = 0;
+    for (; i+16 <= pixels; i += 16) {
+        __m128i index = _mm_loadu_si128((__m128i*)(indices+i));
+        // byte masks of the index bits, widened to one 32 bit mask per pixel
+        __m128i bit0 = _mm_cmpeq_epi8(_mm_and_si128(index, one), one);
+        __m128i bit1 = _mm_cmpeq_epi8(_mm_and_si128(index, two), two);
+        __m128i bit0_lo = _mm_unpacklo_epi8(bit0, bit0);
+        __m128i bit0_hi = _mm_unpackhi_epi8(bit0, bit0);
+        __m128i bit1_lo = _mm_unpacklo_epi8(bit1, bit1);
+        __m128i bit1_hi = _mm_unpackhi_epi8(bit1, bit1);
+        __m128i *dst = (__m128i*)(out+i*4);
+        _mm_storeu_si128(dst+0, sse2_colors(_mm_unpacklo_epi16(bit0_lo, bit0_lo),
+                    _mm_unpacklo_epi16(bit1_lo, bit1_lo), pairs));
+        _mm_storeu_si128(dst+1, sse2_colors(_mm_unpackhi_epi16(bit0_lo, bit0_lo),
+                    _mm_unpackhi_epi16(bit1_lo, bit1_lo), pairs));
+        _mm_storeu_si128(dst+2, sse2_colors(_mm_unpacklo_epi16(bit0_hi, bit0_hi),
+                    _mm_unpacklo_epi16(bit1_hi, bit1_hi), pairs));
+        _mm_storeu_si128(dst+3, sse2_colors(_mm_unpackhi_epi16(bit0_hi, bit0_hi),
+                    _mm_unpackhi_epi16(bit1_hi, bit1_hi), pairs));
+    }
+    render_rgba_scalar(indices+i, pixels-i, colors, out+i*4);
+}
+
+// 8 colors at once, the four colors are a register that the indices permute
+__attribute__((target("avx2")))
+static inline __m256i avx2_colors(char *indices, __m256i table, __m256i mask) {
+    __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)indices));
+    return _mm256_permutevar8x32_epi32(table, _mm256_and_si256(index, mask));
+}
+
+__attribute__((target("avx2")))
+static void render_rgba_avx2(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out) {
+    const __m256i table = _mm256_setr_epi32(colors[0], colors[1], colors[2], colors[3],
+            colors[0], colors[1], colors[2], colors[3]);
+    const __m256i mask = _mm256_set1_epi32(FAMI_MAX_COLOR_INDEX);
+
+    size_t i = 0;
+    for (; i+8 <= pixels; i += 8) {
+        _mm256_storeu_si256((__m256i*)(out+i*4), avx2_colors(indices+i, table, mask));
+    }
+    render_rgba_scalar(indices+i, pixels-i, colors, out+i*4);
+}
+
+__attribute__((target("avx2")))
+static void render_rgb_avx2(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out) {
+    const __m256i table = _mm256_setr_epi32(colors[0], colors[1], colors[2], colors[3],
+            colors[0], colors[1], colors[2], colors[3]);
+    const __m256i mask = _mm256_set1_epi32(FAMI_MAX_COLOR_INDEX);
+    // drops every alpha byte, 4 pixels end up in the low 12 bytes of each lane
+    const __m256i pack = _mm256_setr_epi8(
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    // every store writes 4 bytes past its 12, which the pixels after it cover
+    size_t i = 0;
+    for (; i+10 <= pixels; i += 8) {
+        __m256i rgb = _mm256_shuffle_epi8(avx2_colors(indices+i, table, mask), pack);
+        _mm_storeu_si128((__m128i*)(out+i*3), _mm256_castsi256_si128(rgb));
+        _mm_storeu_si128((__m128i*)(out+i*3+12), _mm256_extracti128_si256(rgb, 1));
+    }
+    render_rgb_scalar(indices+i, pixels-i, colors, out+i*3);
+}
+
+// squared distances of 4 pixels as 32 bit lanes, rg holds 16 bit red and green pairs,
+// b 32 bit blue, madd squares and adds the pairs
+__attribute__((target("sse2")))
+static inline __m128i sse2_distance(__m128i rg, __m128i b, __m128i color_rg, __m128i color_b) {
+    __m128i d1 = _mm_sub_epi16(rg, color_rg);
+    __m128i d2 = _mm_sub_epi16(b, color_b);
+    return _mm_add_epi32(_mm_madd_epi16(d1, d1), _mm_madd_epi16(d2, d2));
+}
+
+__attribute__((target("sse2")))
+static uint32_t nearest_tile_sse2(const uint8_t *planes, const uint32_t *colors, char *indices) {
+    uint8_t channels[FAMI_MAX_COLORS][4];
+    color_channels(colors, channels);
+    __m128i color_rg[FAMI_MAX_COLORS];
+    __m128i color_b[FAMI_MAX_COLORS];
+    for (int c = 0; c < FAMI_MAX_COLORS; c++) {
+        color_rg[c] = _mm_set1_epi32(channels[c][0] | channels[c][1] << 16);
+        color_b[c] = _mm_set1_epi32(channels[c][2]);
+    }
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero;
+
+    for (int i = 0; i < FAMI_TILE_PIXELS; i += 4) {
+        int32_t r4, g4, b4;
+        memcpy(&r4, planes+i, 4);
+        memcpy(&g4, planes+FAMI_TILE_PIXELS+i, 4);
+        memcpy(&b4, planes+2*FAMI_TILE_PIXELS+i, 4);
+        __m128i rg = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(r4), _mm_cvtsi32_si128(g4)), zero);
+        __m128i b = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(b4), zero), zero);
+
+        __m128i best = sse2_distance(rg, b, color_rg[0], color_b[0]);
+        __m128i index = zero;
+        for (int c = 1; c < FAMI_MAX_COLORS; c++) {
+            __m128i d = sse2_distance(rg, b, color_rg[c], color_b[c]);
+            __m128i closer = _mm_cmpgt_epi32(best, d);
+            best = _mm_or_si128(_mm_and_si128(closer, d), _mm_andnot_si128(closer, best));
+            index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(c)), _mm_andnot_si128(closer, index));
+        }
+        sum = _mm_add_epi32(sum, best);
+        index = _mm_packs_epi32(index, index);
+        int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(index, index));
+        memcpy(indices+i, &packed, 4);
+    }
+
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, sum);
+    return lanes[0]+lanes[1]+lanes[2]+lanes[3];
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_distance(__m256i rg, __m256i b, __m256i color_rg, __m256i color_b) {
+    __m256i d1 = _mm256_sub_epi16(rg, color_rg);
+    __m256i d2 = _mm256_sub_epi16(b, color_b);
+    return _mm256_add_epi32(_mm256_madd_epi16(d1, d1), _mm256_madd_epi16(d2, d2));
+}
+
+__attribute__((target("avx2")))
+static uint32_t nearest_tile_avx2(const uint8_t *planes, const uint32_t *colors, char *indices) {
+    uint8_t channels[FAMI_MAX_COLORS][4];
+    color_channels(colors, channels);
+    __m256i color_rg[FAMI_MAX_COLORS];
+    __m256i color_b[FAMI_MAX_COLORS];
+    for (int c = 0; c < FAMI_MAX_COLORS; c++) {
+        color_rg[c] = _mm256_set1_epi32(channels[c][0] | channels[c][1] << 16);
+        color_b[c] = _mm256_set1_epi32(channels[c][2]);
+    }
+    __m256i sum = _mm256_setzero_si256();
+
+    // a tile row of 8 pixels per step
+    for (int i = 0; i < FAMI_TILE_PIXELS; i += 8) {
+        __m128i r8 = _mm_loadl_epi64((__m128i*)(planes+i));
+        __m128i g8 = _mm_loadl_epi64((__m128i*)(planes+FAMI_TILE_PIXELS+i));
+        __m128i b8 = _mm_loadl_epi64((__m128i*)(planes+2*FAMI_TILE_PIXELS+i));
+        __m256i rg = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(r8, g8));
+        __m256i b = _mm256_cvtepu8_epi32(b8);
+
+        __m256i best = avx2_distance(rg, b, color_rg[0], color_b[0]);
+        __m256i index = _mm256_setzero_si256();
+        for (int c = 1; c < FAMI_MAX_COLORS; c++) {
+            __m256i d = avx2_distance(rg, b, color_rg[c], color_b[c]);
+            __m256i closer = _mm256_cmpgt_epi32(best, d);
+            best = _mm256_min_epi32(best, d);
+            index = _mm256_blendv_epi8(index, _mm256_set1_epi32(c), closer);
+        }
+        sum = _mm256_add_epi32(sum, best);
+        // 8 lanes down to 8 bytes
+        __m128i index16 = _mm_packs_epi32(_mm256_castsi256_si128(index), _mm256_extracti128_si256(index, 1));
+        _mm_storel_epi64((__m128i*)(indices+i), _mm_packus_epi16(index16, index16));
+    }
+
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, half);
+    return lanes[0]+lanes[1]+lanes[2]+lanes[3];
+}
+
+#endif
+
+#ifdef FAMI_SIMD_ARM
+
+static void decode_tiles_neon(char *data, unsigned int tiles, char *decoded) {
+    static const uint8_t mask_bytes[16] = {
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+    };
+    static const uint8_t row_index[4][16] = {
+        {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1},
+        {2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3},
+        {4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5},
+        {6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7}
+    };
+    const uint8x16_t mask = vld1q_u8(mask_bytes);
+    const uint8x16_t one = vdupq_n_u8(1);
+    const uint8x16_t plane2 = vdupq_n_u8(FAMI_TILE_LEN);
+
+    for (unsigned int i = 0; i < tiles; i++) {
+        uint8x16_t tile = vld1q_u8((uint8_t*)data+i*FAMI_TILE_SIZE);
+        uint8_t *out = (uint8_t*)decoded+i*FAMI_TILE_PIXELS;
+
+        for (int r = 0; r < 4; r++) {
+            uint8x16_t index = vld1q_u8(row_index[r]);
+            uint8x16_t p1 = vqtbl1q_u8(tile, index);
+            uint8x16_t p2 = vqtbl1q_u8(tile, vaddq_u8(index, plane2));
+            uint8x16_t b1 = vandq_u8(vtstq_u8(p1, mask), one);
+            uint8x16_t b2 = vandq_u8(vtstq_u8(p2, mask), one);
+            vst1q_u8(out+r*16, vorrq_u8(b1, vshlq_n_u8(b2, 1)));
+        }
+    }
+}
+
+static void encode_tiles_neon(char *data, unsigned int tiles, char *encoded) {
+    static const uint8_t weight_bytes[8] = {
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+    };
+    const uint8x8_t weights = vld1_u8(weight_bytes);
+    const uint8x8_t bit0 = vdup_n_u8(1);
+    const uint8x8_t bit1 = vdup_n_u8(2);
+
+    for (unsigned int i = 0; i < tiles; i++) {
+        uint8_t *in = (uint8_t*)data+i*FAMI_TILE_PIXELS;
+        char *out = encoded+i*FAMI_TILE_SIZE;
+
+        for (int r = 0; r < FAMI_TILE_LEN; r++) {
+            uint8x8_t row = vld1_u8(in+r*FAMI_TILE_LEN);
+            out[r] = vaddv_u8(vand_u8(vtst_u8(row, bit0), weights));
+            out[r+FAMI_TILE_LEN] = vaddv_u8(vand_u8(vtst_u8(row, bit1), weights));
+        }
+    }
+}
+
+// one table lookup per channel, the interleaving stores put the channels together
+static inline uint8x16x4_t neon_colors(char *indices, const uint32_t *colors) {
+    uint8_t channels[4][16];
+    memset(channels, 0, sizeof(channels));
+    for (int c = 0; c < FAMI_MAX_COLORS; c++) {
+        uint8_t bytes[4];
+        memcpy(bytes, colors+c, 4);
+        for (int k = 0; k < 4; k++) {
+            channels[k][c] = bytes[k];
+        }
+    }
+    uint8x16_t index = vandq_u8(vld1q_u8((uint8_t*)indices), vdupq_n_u8(FAMI_MAX_COLOR_INDEX));
+    uint8x16x4_t out;
+    out.val[0] = vqtbl1q_u8(vld1q_u8(channels[0]), index);
+    out.val[1] = vqtbl1q_u8(vld1q_u8(channels[1]), index);
+    out.val[2] = vqtbl1q_u8(vld1q_u8(channels[2]), index);
+    out.val[3] = vqtbl1q_u8(vld1q_u8(channels[3]), index);
+    return out;
+}
+
+static void render_rgba_neon(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out) {
+    size_t i = 0;
+    for (; i+16 <= pixels; i += 16) {
+        vst4q_u8(out+i*4, neon_colors(indices+i, colors));
+    }
+    render_rgba_scalar(indices+i, pixels-i, colors, out+i*4);
+}
+
+static void render_rgb_neon(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out) {
+    size_t i = 0;
+    for (; i+16 <= pixels; i += 16) {
+        uint8x16x4_t rgba = neon_colors(indices+i, colors);
+        uint8x16x3_t rgb = {{rgba.val[0], rgba.val[1], rgba.val[2]}};
+        vst3q_u8(out+i*3, rgb);
+    }
+    render_rgb_scalar(indices+i, pixels-i, colors, out+i*3);
+}
+
+// squared distances of 4 pixels, a sum of three squared bytes needs 32 bits
+static inline uint32x4_t neon_distance(uint16x4_t r, uint16x4_t g, uint16x4_t b) {
+    return vaddw_u16(vaddl_u16(r, g), b);
+}
+
+static uint32_t nearest_tile_neon(const uint8_t *planes, const uint32_t *colors, char *indices) {
+    uint8_t channels[FAMI_MAX_COLORS][4];
+    color_channels(colors, channels);
+    uint32x4_t sum = vdupq_n_u32(0);
+
+    for (int i = 0; i < FAMI_TILE_PIXELS; i += 16) {
+        uint8x16_t r = vld1q_u8(planes+i);
+        uint8x16_t g = vld1q_u8(planes+FAMI_TILE_PIXELS+i);
+        uint8x16_t b = vld1q_u8(planes+2*FAMI_TILE_PIXELS+i);
+
+        uint32x4_t best[4];
+        uint32x4_t index[4];
+        for (int c = 0; c < FAMI_MAX_COLORS; c++) {
+            uint8x16_t dr = vabdq_u8(r, vdupq_n_u8(channels[c][0]));
+            uint8x16_t dg = vabdq_u8(g, vdupq_n_u8(channels[c][1]));
+            uint8x16_t db = vabdq_u8(b, vdupq_n_u8(channels[c][2]));
+            // squares of a byte still fit 16 bits
+            uint16x8_t r_lo = vmull_u8(vget_low_u8(dr), vget_low_u8(dr));
+            uint16x8_t r_hi = vmull_high_u8(dr, dr);
+            uint16x8_t g_lo = vmull_u8(vget_low_u8(dg), vget_low_u8(dg));
+            uint16x8_t g_hi = vmull_high_u8(dg, dg);
+            uint16x8_t b_lo = vmull_u8(vget_low_u8(db), vget_low_u8(db));
+            uint16x8_t b_hi = vmull_high_u8(db, db);
+            uint32x4_t d[4] = {
+                neon_distance(vget_low_u16(r_lo), vget_low_u16(g_lo), vget_low_u16(b_lo)),
+                neon_distance(vget_high_u16(r_lo), vget_high_u16(g_lo), vget_high_u16(b_lo)),
+                neon_distance(vget_low_u16(r_hi), vget_low_u16(g_hi), vget_low_u16(b_hi)),
+                neon_distance(vget_high_u16(r_hi), vget_high_u16(g_hi), vget_high_u16(b_hi))
+            };
+            for (int k = 0; k < 4; k++) {
+                if (c == 0) {
+                    best[k] = d[k];
+                    index[k] = vdupq_n_u32(0);
+                } else {
+                    uint32x4_t closer = vcltq_u32(d[k], best[k]);
+                    best[k] = vminq_u32(best[k], d[k]);
+                    index[k] = vbslq_u32(closer, vdupq_n_u32(c), index[k]);
+                }
+            }
+        }
+        for (int k = 0; k < 4; k++) {
+            sum = vaddq_u32(sum, best[k]);
+        }
+        uint16x8_t lo = vcombine_u16(vmovn_u32(index[0]), vmovn_u32(index[1]));
+        uint16x8_t hi = vcombine_u16(vmovn_u32(index[2]), vmovn_u32(index[3]));
+        vst1q_u8((uint8_t*)indices+i, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+    }
+    return vaddvq_u32(sum);
+}
+
+#endif
+
+typedef struct simd_kernels {
+    tiles_kernel decode;
+    tiles_kernel encode;
+    render_kernel rgba;
+    render_kernel rgb;
+    nearest_kernel nearest;
+} simd_kernels_t;
+
+static const simd_kernels_t kernels[FAMI_SIMD_LEVELS] = {
+    [FAMI_SIMD_SCALAR] = {decode_tiles_scalar, encode_tiles_scalar,
+        render_rgba_scalar, render_rgb_scalar, nearest_tile_scalar},
+#ifdef FAMI_SIMD_X86
+    // the 3 byte stores of rgb gain nothing from sse2
+    [FAMI_SIMD_SSE2] = {decode_tiles_sse2, encode_tiles_sse2,
+        render_rgba_sse2, render_rgb_scalar, nearest_tile_sse2},
+    [FAMI_SIMD_AVX2] = {decode_tiles_avx2, encode_tiles_avx2,
+        render_rgba_avx2, render_rgb_avx2, nearest_tile_avx2},
+#endif
+#ifdef FAMI_SIMD_ARM
+    [FAMI_SIMD_NEON] = {decode_tiles_neon, encode_tiles_neon,
+        render_rgba_neon, render_rgb_neon, nearest_tile_neon},
+#endif
+};
+
+// -1 until the first call resolves it
+static int active_level = -1;
+
+char fami_simd_supported(fami_simd_level_t level) {
+    switch (level) {
+        case FAMI_SIMD_SCALAR:
+            return 1;
+#ifdef FAMI_SIMD_X86
+        case FAMI_SIMD_SSE2:
+            return __builtin_cpu_supports("sse2") != 0;
+        case FAMI_SIMD_AVX2:
+            return __builtin_cpu_supports("avx2") != 0;
+#endif
+#ifdef FAMI_SIMD_ARM
+        case FAMI_SIMD_NEON:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+fami_simd_level_t fami_simd_detect() {
+    for (int level = FAMI_SIMD_LEVELS-1; level > FAMI_SIMD_SCALAR; level--) {
+        if (fami_simd_supported(level)) {
+            return level;
+        }
+    }
+    return FAMI_SIMD_SCALAR;
+}
+
+fami_simd_level_t fami_simd_get_level() {
+    if (active_level < 0) {
+        active_level = fami_simd_detect();
+    }
+    return active_level;
+}
+
+char fami_simd_set_level(fami_simd_level_t level) {
+    if (level >= FAMI_SIMD_LEVELS || !fami_simd_supported(level)) {
+        return 0;
+    }
+    active_level = level;
+    return 1;
+}
+
+const char *fami_simd_level_name(fami_simd_level_t level) {
+    switch (level) {
+        case FAMI_SIMD_SCALAR:
+            return "scalar";
+        case FAMI_SIMD_SSE2:
+            return "sse2";
+        case FAMI_SIMD_AVX2:
+            return "avx2";
+        case FAMI_SIMD_NEON:
+            return "neon";
+        default:
+            return "unknown";
+    }
+}
+
+void fami_decode_tiles(char *data, unsigned int tiles, char *decoded) {
+    kernels[fami_simd_get_level()].decode(data, tiles, decoded);
+}
+
+void fami_encode_tiles(char *data, unsigned int tiles, char *encoded) {
+    kernels[fami_simd_get_level()].encode(data, tiles, encoded);
+}
+
+void fami_render_rgba(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out) {
+    kernels[fami_simd_get_level()].rgba(indices, pixels, colors, out);
+}
+
+void fami_render_rgb(char *indices, size_t pixels, const uint32_t *colors, uint8_t *out) {
+    kernels[fami_simd_get_level()].rgb(indices, pixels, colors, out);
+}
+
+uint32_t fami_nearest_tile(const uint8_t *planes, const uint32_t *colors, char *indices) {
+    return kernels[fami_simd_get_level()].nearest(planes, colors, indices);
+}
@@ -0,0 +1,116 @@
+#include "include/stream.h"
+#include "include/simd.h"
+
+#include <string.h>
+
+void fami_stream_init(fami_stream_t *stream, fami_stream_mode_t mode) {
+    stream->mode = mode;
+    stream->partial_len = 0;
+    stream->out_start = 0;
+    stream->out_len = 0;
+    stream->total_in = 0;
+    stream->total_out = 0;
+    stream->padded = 0;
+    stream->finished = 0;
+}
+
+static unsigned int in_tile_size(fami_stream_t *stream) {
+    return stream->mode == FAMI_STREAM_DECODE ? FAMI_TILE_SIZE : FAMI_TILE_PIXELS;
+}
+
+static unsigned int out_tile_size(fami_stream_t *stream) {
+    return stream->mode == FAMI_STREAM_DECODE ? FAMI_TILE_PIXELS : FAMI_TILE_SIZE;
+}
+
+// tiles that fit behind the pending output, moving it to the front if needed
+static size_t free_tiles(fami_stream_t *stream) {
+    size_t out_tile = out_tile_size(stream);
+    size_t end = stream->out_start+stream->out_len;
+    if (sizeof(stream->out)-end < out_tile && stream->out_start) {
+        memmove(stream->out, stream->out+stream->out_start, stream->out_len);
+        stream->out_start = 0;
+        end = stream->out_len;
+    }
+    return (sizeof(stream->out)-end) / out_tile;
+}
+
+static void convert_tiles(fami_stream_t *stream, char *data, size_t tiles) {
+    char *out = stream->out+stream->out_start+stream->out_len;
+    if (stream->mode == FAMI_STREAM_DECODE) {
+        fami_decode_tiles(data, tiles, out);
+    } else {
+        fami_encode_tiles(data, tiles, out);
+    }
+    stream->out_len += tiles*out_tile_size(stream);
+    stream->total_out += tiles*out_tile_size(stream);
+}
+
+size_t fami_stream_feed(fami_stream_t *stream, char *data, size_t length) {
+    if (stream->finished) {
+        return 0;
+    }
+
+    size_t in_tile = in_tile_size(stream);
+    size_t consumed = 0;
+    while (consumed < length) {
+        size_t room = free_tiles(stream);
+        if (room == 0) {
+            break;
+        }
+
+        size_t left = length-consumed;
+        if (stream->partial_len || left < in_tile) {
+            // top up the carried tile
+            size_t n = in_tile-stream->partial_len;
+            n = n < left ? n : left;
+            memcpy(stream->partial+stream->partial_len, data+consumed, n);
+            stream->partial_len += n;
+            consumed += n;
+            if (stream->partial_len == in_tile) {
+                convert_tiles(stream, stream->partial, 1);
+                stream->partial_len = 0;
+            }
+        } else {
+            // whole tiles straight from the input
+            size_t tiles = left/in_tile;
+            tiles = tiles < room ? tiles : room;
+            convert_tiles(stream, data+consumed, tiles);
+            consumed += tiles*in_tile;
+        }
+    }
+    stream->total_in += consumed;
+
+    return consumed;
+}
+
+size_t fami_stream_drain(fami_stream_t *stream, char *out, size_t length) {
+    size_t n = length < stream->out_len ? length : stream->out_len;
+    memcpy(out, stream->out+stream->out_start, n);
+    stream->out_start += n;
+    stream->out_len -= n;
+    if (stream->out_len == 0) {
+        stream->out_start = 0;
+    }
+    return n;
+}
+
+size_t fami_stream_pending(fami_stream_t *stream) {
+    return stream->out_len;
+}
+
+char fami_stream_finish(fami_stream_t *stream) {
+    if (stream->finished) {
+        return 1;
+    }
+    if (stream->partial_len) {
+        if (free_tiles(stream) == 0) {
+            return 0;
+        }
+        stream->padded = in_tile_size(stream)-stream->partial_len;
+        memset(stream->partial+stream->partial_len, 0, stream->padded);
+        convert_tiles(stream, stream->partial, 1);
+        stream->partial_len = 0;
+    }
+    stream->finished = 1;
+    return 1;
+}
@@ -3,11 +3,42 @@
 #include <setjmp.h>
 #include <cmocka.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <errno.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "include/famisprite.h"
 #include "include/utility.h"
+#include "include/simd.h"
+#include "include/lut.h"
+#include "include/packed.h"
+#include "include/image.h"
+#include "include/parallel.h"
+#include "include/stream.h"
+#include "include/dedup.h"
+#include "include/flip.h"
+#include "include/chrz.h"
+#include "include/codec.h"
+#include "include/rom.h"
+#include "include/tilecache.h"
+#include "include/history.h"
+#include "include/bitmap.h"
+#include "include/palette.h"
+#include "include/ansi.h"
+#include "include/quantize.h"
+#include "include/pool.h"
+#include "include/tilestore.h"
+
+// fills a buffer with reproducible noise
+void fill_noise(char *data, unsigned int len, unsigned int seed) {
+    for (unsigned int i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+}
 
 char assert_color_equal(fami_color_t c1, fami_color_t c2) {
     return ((c1.r & 0xFF) == (c2.r & 0xFF)) &&
@@ -121,6 +152,54 @@ static void test_fami_decode(void **state) {
     }
 }
 
+static void test_fami_decode_tiles_levels(void **state) {
+    char data[16*37];
+    char expected[64*37];
+    char decoded[64*37];
+    fill_noise(data, sizeof(data), 1);
+
+    // scalar per tile path is the reference
+    for (int i = 0; i < 37; i++) {
+        unsigned int len = 0;
+        fami_decode_tile(data+i*16, expected+i*64, &len);
+    }
+
+    fami_simd_level_t prev = fami_simd_get_level();
+    for (int level = 0; level < FAMI_SIMD_LEVELS; level++) {
+        if (!fami_simd_set_level(level)) {
+            continue;
+        }
+        memset(decoded, 0x7F, sizeof(decoded));
+        fami_decode_tiles(data, 37, decoded);
+        assert_memory_equal(expected, decoded, sizeof(decoded));
+    }
+    assert_true(fami_simd_set_level(prev));
+    assert_false(fami_simd_set_level(FAMI_SIMD_LEVELS));
+}
+
+static void test_fami_decode_lut(void **state) {
+    char data[16*37];
+    char expected[64*37];
+    char decoded[64*37];
+    fill_noise(data, sizeof(data), 3);
+
+    unsigned int len = sizeof(data);
+    fami_decode(data, &len, expected);
+
+    for (int mode = 0; mode < FAMI_LUT_MODES; mode++) {
+        memset(decoded, 0x7F, sizeof(decoded));
+        len = sizeof(data);
+        assert_ptr_equal(fami_decode_lut(data, &len, decoded, mode), decoded);
+        assert_int_equal(len, sizeof(decoded));
+        assert_memory_equal(expected, decoded, sizeof(decoded));
+
+        len = 0;
+        fami_decode_tile_lut((char*)test_sprite, decoded, &len, mode);
+        assert_int_equal(len, 64);
+        assert_memory_equal(test_sprite_decoded, decoded, 64);
+    }
+}
+
 static void test_fami_encode_pixel(void **state) {
     for (int i = 0; i < FAMI_TILE_LEN*FAMI_TILE_LEN; i+=FAMI_TILE_LEN) {
         char p1 = 0;
@@ -159,6 +238,121 @@ static void test_fami_encode(void **state) {
     }
 }
 
+static void test_fami_encode_tiles_levels(void **state) {
+    char data[64*37];
+    char expected[16*37];
+    char encoded[16*37];
+    // upper bits are noise too, only the lower 2 bits may matter
+    fill_noise(data, sizeof(data), 2);
+
+    for (int i = 0; i < 37; i++) {
+        unsigned int len = 0;
+        fami_encode_tile(data+i*64, expected+i*16, &len);
+    }
+
+    fami_simd_level_t prev = fami_simd_get_level();
+    for (int level = 0; level < FAMI_SIMD_LEVELS; level++) {
+        if (!fami_simd_set_level(level)) {
+            continue;
+        }
+        memset(encoded, 0x7F, sizeof(encoded));
+        fami_encode_tiles(data, 37, encoded);
+        assert_memory_equal(expected, encoded, sizeof(encoded));
+    }
+    assert_true(fami_simd_set_level(prev));
+}
+
+static void test_fami_mt(void **state) {
+    // enough tiles for several threads plus a partial tail tile,
+    // the tail tile is always read and written in full
+    unsigned int tiles = FAMI_PARALLEL_MIN_TILES*5+3;
+    unsigned int chr_len = tiles*16+5;
+    char *data = calloc(chr_len+16, 1);
+    char *expected = calloc((tiles+1)*64, 1);
+    char *decoded = calloc((tiles+1)*64, 1);
+    char *encoded = calloc(chr_len+16, 1);
+    fill_noise(data, chr_len, 5);
+
+    unsigned int expected_len = chr_len;
+    fami_decode(data, &expected_len, expected);
+
+    unsigned int counts[4] = {1, 3, 16, 0};
+    for (int i = 0; i < 4; i++) {
+        memset(decoded, 0x7F, (tiles+1)*64);
+        unsigned int len = chr_len;
+        assert_ptr_equal(fami_decode_mt(data, &len, decoded, counts[i]), decoded);
+        assert_int_equal(len, expected_len);
+        assert_memory_equal(expected, decoded, len);
+
+        len = tiles*64;
+        assert_ptr_equal(fami_encode_mt(decoded, &len, encoded, counts[i]), encoded);
+        assert_int_equal(len, tiles*16);
+        assert_memory_equal(data, encoded, len);
+    }
+
+    free(data);
+    free(expected);
+    free(decoded);
+    free(encoded);
+}
+
+static void test_fami_stream(void **state) {
+    // a bit more than two stream buffers and a partial tile
+    unsigned int tiles = FAMI_STREAM_TILES*2+9;
+    unsigned int chr_len = tiles*16+5;
+    char *data = calloc(tiles*16+16, 1);
+    char *expected = calloc((tiles+1)*64, 1);
+    char *decoded = calloc((tiles+1)*64, 1);
+    char *encoded = calloc((tiles+1)*16, 1);
+    fill_noise(data, chr_len, 6);
+
+    // the tail tile is zero padded
+    unsigned int len = tiles*16+16;
+    fami_decode(data, &len, expected);
+
+    fami_stream_t stream;
+    fami_stream_init(&stream, FAMI_STREAM_DECODE);
+    size_t in = 0;
+    size_t out = 0;
+    unsigned int chunk = 1;
+    while (in < chr_len) {
+        // odd chunk sizes on both ends
+        size_t n = chr_len-in < chunk ? chr_len-in : chunk;
+        in += fami_stream_feed(&stream, data+in, n);
+        out += fami_stream_drain(&stream, decoded+out, chunk*3);
+        chunk = chunk*7 % 251 + 1;
+    }
+    while (!fami_stream_finish(&stream)) {
+        out += fami_stream_drain(&stream, decoded+out, 100);
+    }
+    out += fami_stream_drain(&stream, decoded+out, (tiles+1)*64);
+    assert_int_equal(out, (tiles+1)*64);
+    assert_int_equal(stream.padded, 11);
+    assert_int_equal(stream.total_in, chr_len);
+    assert_int_equal(stream.total_out, out);
+    assert_memory_equal(expected, decoded, out);
+    assert_int_equal(fami_stream_feed(&stream, data, 16), 0);
+
+    fami_stream_init(&stream, FAMI_STREAM_ENCODE);
+    in = 0;
+    out = 0;
+    while (in < (tiles+1)*64) {
+        size_t n = (tiles+1)*64-in < 1000 ? (tiles+1)*64-in : 1000;
+        in += fami_stream_feed(&stream, decoded+in, n);
+        out += fami_stream_drain(&stream, encoded+out, 77);
+    }
+    assert_true(fami_stream_finish(&stream));
+    assert_int_equal(stream.padded, 0);
+    out += fami_stream_drain(&stream, encoded+out, (tiles+1)*16);
+    assert_int_equal(out, (tiles+1)*16);
+    assert_memory_equal(data, encoded, tiles*16+16);
+
+    free(data);
+    free(expected);
+    free(decoded);
+    free(encoded);
+}
+
 static void test_fami_set_pixel(void **state) {
     char decoded[128];
     unsigned int len = 32;
@@ -170,6 +364,1076 @@ static void test_fami_set_pixel(void **state) {
     assert_int_equal(fami_get_pixel(decoded, 5, 10), 1);
 }
 
+static void test_fami_packed(void **state) {
+    fami_packed_row packed[8*3];
+    unsigned int len = 16*3;
+    assert_ptr_equal(fami_pack_chr((char*)test_sprite, &len, packed), packed);
+    assert_int_equal(len, 8*3);
+
+    for (int y = 0; y < 8*3; y++) {
+        for (int x = 0; x < 8; x++) {
+            assert_int_equal(fami_packed_get_pixel(packed, x, y), test_sprite_decoded[x+y*8]);
+        }
+    }
+
+    // byte layout packs to the same rows
+    fami_packed_row from_bytes[8*3];
+    len = 64*3;
+    fami_pack((char*)test_sprite_decoded, &len, from_bytes);
+    assert_int_equal(len, 8*3);
+    assert_memory_equal(packed, from_bytes, sizeof(packed));
+
+    char encoded[16*3];
+    len = 8*3;
+    assert_ptr_equal(fami_unpack_chr(packed, &len, encoded), encoded);
+    assert_int_equal(len, 16*3);
+    assert_memory_equal(test_sprite, encoded, sizeof(encoded));
+
+    char decoded[64*3];
+    len = 8*3;
+    assert_ptr_equal(fami_unpack(packed, &len, decoded), decoded);
+    assert_int_equal(len, 64*3);
+    assert_memory_equal(test_sprite_decoded, decoded, sizeof(decoded));
+
+    // set only touches one pixel
+    assert_int_equal(fami_packed_get_pixel(packed, 5, 10), 3);
+    fami_packed_set_pixel(packed, 5, 10, 1);
+    assert_int_equal(fami_packed_get_pixel(packed, 5, 10), 1);
+    assert_int_equal(fami_packed_get_pixel(packed, 4, 10), 0);
+    assert_int_equal(fami_packed_get_pixel(packed, 6, 10), 0);
+    fami_packed_set_pixel(packed, 0, 0, 7); // wraps to 3
+    assert_int_equal(fami_packed_get_pixel(packed, 0, 0), 3);
+
+    char row[8];
+    fami_packed_row_unpack(fami_packed_get_row(packed, 3), row);
+    assert_memory_equal(test_sprite_decoded+3*8, row, 8);
+    fami_packed_set_row(packed, 2, fami_packed_row_pack(row));
+    assert_int_equal(fami_packed_get_row(packed, 2), fami_packed_get_row(packed, 3));
+}
+
+static void test_fami_sheet_roundtrip(void **state) {
+    char data[16*37];
+    fill_noise(data, sizeof(data), 4);
+
+    fami_state_t colors;
+    fami_image_init_state(&colors);
+
+    fami_image_format_t formats[2] = {FAMI_IMAGE_PPM, FAMI_IMAGE_PNG};
+    for (int i = 0; i < 2; i++) {
+        FILE *f = tmpfile();
+        assert_non_null(f);
+        assert_true(fami_write_sheet(f, data, sizeof(data), &colors, 5, formats[i]));
+        rewind(f);
+
+        fami_image_t image;
+        assert_true(fami_read_image(f, &image));
+        fclose(f);
+        assert_int_equal(image.width, 5*8);
+        assert_int_equal(image.height, 8*8);
+        assert_int_equal(image.tiles, 37);
+
+        size_t len = 0;
+        char *chr = fami_image_to_chr(&image, &colors, &len);
+        fami_free_image(&image);
+        assert_non_null(chr);
+        assert_int_equal(len, sizeof(data));
+        assert_memory_equal(data, chr, len);
+        free(chr);
+    }
+
+    assert_int_equal(fami_image_format("bank.PNG"), FAMI_IMAGE_PNG);
+    assert_int_equal(fami_image_format("bank.ppm"), FAMI_IMAGE_PPM);
+    assert_int_equal(fami_image_format("bank.chr"), FAMI_IMAGE_NONE);
+}
+
+static void put_png_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len) {
+    uint8_t head[8] = {len >> 24, len >> 16, len >> 8, len};
+    memcpy(head+4, type, 4);
+    fwrite(head, 1, 8, f);
+    fwrite(data, 1, len, f);
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < len+4; i++) {
+        crc ^= i < 4 ? (uint8_t)type[i] : data[i-4];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+    crc ^= 0xFFFFFFFF;
+    uint8_t tail[4] = {crc >> 24, crc >> 16, crc >> 8, crc};
+    fwrite(tail, 1, 4, f);
+}
+
+// reads a 1x1 image with the first pixel bit set, -1 if the file could not be made
+static int read_png_with_depth(uint8_t depth, uint8_t color_type) {
+    FILE *f = tmpfile();
+    if (!f) {
+        return -1;
+    }
+    fwrite("\x89PNG\r\n\x1a\n", 1, 8, f);
+    uint8_t ihdr[13] = {0, 0, 0, 1, 0, 0, 0, 1, depth, color_type, 0, 0, 0};
+    put_png_chunk(f, "IHDR", ihdr, 13);
+    uint8_t plte[6] = {0, 0, 0, 255, 255, 255};
+    put_png_chunk(f, "PLTE", plte, 6);
+    // stored deflate block of the filter byte and 0x80
+    uint8_t idat[13] = {0x78, 0x01, 0x01, 0x02, 0x00, 0xFD, 0xFF, 0x00, 0x80, 0x00, 0x82, 0x00, 0x81};
+    put_png_chunk(f, "IDAT", idat, 13);
+    put_png_chunk(f, "IEND", NULL, 0);
+    rewind(f);
+
+    fami_image_t image;
+    char ok = fami_read_image(f, &image);
+    fclose(f);
+    if (ok) {
+        fami_free_image(&image);
+    }
+    return ok;
+}
+
+static void test_fami_png_bad_depth(void **state) {
+    assert_int_equal(read_png_with_depth(1, 0), 1);
+    assert_int_equal(read_png_with_depth(1, 3), 1);
+    assert_int_equal(read_png_with_depth(8, 0), 1);
+
+    uint8_t gray[] = {0, 3, 5, 6, 7, 16};
+    for (size_t i = 0; i < sizeof(gray); i++) {
+        assert_int_equal(read_png_with_depth(gray[i], 0), 0);
+        assert_int_equal(read_png_with_depth(gray[i], 3), 0);
+    }
+    // color types with more than one channel only take 8 bits
+    uint8_t types[] = {2, 4, 6};
+    uint8_t depths[] = {0, 1, 2, 4, 16};
+    for (size_t t = 0; t < sizeof(types); t++) {
+        for (size_t i = 0; i < sizeof(depths); i++) {
+            assert_int_equal(read_png_with_depth(depths[i], types[t]), 0);
+        }
+    }
+}
+
+static void test_fami_dedup(void **state) {
+    // 7 distinct tiles, tile 0 is blank
+    char distinct[16*7];
+    fill_noise(distinct, sizeof(distinct), 7);
+    memset(distinct, 0, 16);
+
+    char data[16*100+3];
+    unsigned int order = 1;
+    for (int i = 0; i < 100; i++) {
+        order = order * 1103515245 + 12345;
+        memcpy(data+i*16, distinct+((order >> 16) % 7)*16, 16);
+    }
+
+    fami_dedup_t dedup;
+    assert_true(fami_dedup(data, sizeof(data), &dedup));
+    assert_int_equal(dedup.tiles, 100);
+    assert_int_equal(dedup.unique_tiles, 7);
+
+    size_t next = 0;
+    for (int i = 0; i < 100; i++) {
+        // remap rebuilds the input
+        assert_memory_equal(data+i*16, dedup.unique+dedup.remap[i]*16, 16);
+        // unique tiles are numbered in order of first appearance
+        assert_true(dedup.remap[i] <= next);
+        if (dedup.remap[i] == next) {
+            next++;
+        }
+    }
+    for (int i = 0; i < 7; i++) {
+        assert_int_not_equal(fami_dedup_find(&dedup, distinct+i*16), -1);
+    }
+    char other[16] = {1};
+    assert_int_equal(fami_dedup_find(&dedup, other), -1);
+
+    size_t blanks = 0;
+    for (int i = 0; i < 100; i++) {
+        blanks += memcmp(data+i*16, distinct, 16) == 0;
+    }
+    assert_int_equal(dedup.blank_tiles, blanks);
+
+    fami_dedup_free(&dedup);
+}
+
+static void test_fami_tile_flip(void **state) {
+    char tile[16];
+    fill_noise(tile, sizeof(tile), 12);
+    unsigned int len = 0;
+    char pixels[64];
+    fami_decode_tile(tile, pixels, &len);
+
+    for (uint8_t flip = 0; flip < FAMI_FLIPS; flip++) {
+        char flipped[16];
+        char flipped_pixels[64];
+        fami_tile_flip(tile, flipped, flip);
+        fami_decode_tile(flipped, flipped_pixels, &len);
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+                int fx = flip & FAMI_FLIP_H ? 7-x : x;
+                int fy = flip & FAMI_FLIP_V ? 7-y : y;
+                assert_int_equal(flipped_pixels[y*8+x], pixels[fy*8+fx]);
+            }
+        }
+
+        // every variant shares one canonical form
+        char canonical[16];
+        char back[16];
+        uint8_t to_input = fami_tile_canonical(flipped, canonical);
+        fami_tile_flip(canonical, back, to_input);
+        assert_memory_equal(back, flipped, 16);
+        char first[16];
+        fami_tile_canonical(tile, first);
+        assert_memory_equal(canonical, first, 16);
+    }
+}
+
+static void test_fami_dedup_flip(void **state) {
+    char data[16*40];
+    fill_noise(data, 16*10, 13);
+    for (int i = 10; i < 40; i++) {
+        fami_tile_flip(data+(i%10)*16, data+i*16, i/10);
+    }
+
+    fami_dedup_t dedup;
+    assert_true(fami_dedup_flip(data, sizeof(data), &dedup));
+    assert_int_equal(dedup.unique_tiles, 10);
+    for (int i = 0; i < 40; i++) {
+        char tile[16];
+        fami_tile_flip(dedup.unique+dedup.remap[i]*16, tile, dedup.flips[i]);
+        assert_memory_equal(tile, data+i*16, 16);
+        assert_int_equal(fami_dedup_find(&dedup, data+i*16), dedup.remap[i]);
+    }
+    fami_dedup_free(&dedup);
+
+    // without flips every variant is its own tile
+    assert_true(fami_dedup(data, sizeof(data), &dedup));
+    assert_int_equal(dedup.unique_tiles, 40);
+    assert_null(dedup.flips);
+    fami_dedup_free(&dedup);
+}
+
+static void test_fami_chrz(void **state) {
+    // noise blocks are stored, repeated and blank ones compressed
+    size_t len = 16*1000+5;
+    char *data = malloc(len);
+    fill_noise(data, len, 14);
+    memset(data+16*300, 0, 16*400);
+    for (int i = 700; i < 1000; i++) {
+        memcpy(data+i*16, data+(i%3)*16, 16);
+    }
+
+    size_t packed_len = 0;
+    char *packed = fami_chrz_compress(data, len, &packed_len);
+    assert_non_null(packed);
+    assert_true(fami_chrz_check(packed, packed_len));
+    assert_true(packed_len < len);
+    assert_int_equal(fami_chrz_length(packed, packed_len), len);
+
+    size_t raw_len = 0;
+    char *raw = fami_chrz_decompress(packed, packed_len, &raw_len);
+    assert_non_null(raw);
+    assert_int_equal(raw_len, len);
+    assert_memory_equal(raw, data, len);
+    free(raw);
+
+    // ranges inside one block, across blocks and up to the end
+    char range[16*600];
+    assert_true(fami_chrz_read(packed, packed_len, 100, 50, range));
+    assert_memory_equal(range, data+100, 50);
+    assert_true(fami_chrz_read(packed, packed_len, 16*200, 16*600, range));
+    assert_memory_equal(range, data+16*200, 16*600);
+    assert_true(fami_chrz_read(packed, packed_len, len-37, 37, range));
+    assert_memory_equal(range, data+len-37, 37);
+    assert_false(fami_chrz_read(packed, packed_len, len-37, 38, range));
+
+    char expected[64*10];
+    char decoded[64*10];
+    unsigned int expected_len = 16*10;
+    unsigned int decoded_len = 16*10;
+    fami_decode(data+16*250, &expected_len, expected);
+    assert_non_null(fami_chrz_decode(packed, packed_len, 250, &decoded_len, decoded));
+    assert_int_equal(decoded_len, expected_len);
+    assert_memory_equal(decoded, expected, expected_len);
+
+    // an odd length decodes its partial tile whole, zero padded at the end of the data
+    size_t firsts[2] = {250, 999};
+    for (int i = 0; i < 2; i++) {
+        char tiles[16*2] = {0};
+        size_t left = len-16*firsts[i];
+        memcpy(tiles, data+16*firsts[i], left < sizeof(tiles) ? left : sizeof(tiles));
+        expected_len = 21;
+        decoded_len = 21;
+        fami_decode(tiles, &expected_len, expected);
+        assert_non_null(fami_chrz_decode(packed, packed_len, firsts[i], &decoded_len, decoded));
+        assert_int_equal(decoded_len, expected_len);
+        assert_memory_equal(decoded, expected, expected_len);
+    }
+    decoded_len = 22;
+    assert_null(fami_chrz_decode(packed, packed_len, 999, &decoded_len, decoded));
+
+    // truncated and damaged containers are rejected
+    assert_null(fami_chrz_decompress(packed, 30, &raw_len));
+    packed[packed_len-1] ^= 0xFF;
+    packed[packed_len-2] ^= 0xFF;
+    raw = fami_chrz_decompress(packed, packed_len-1, &raw_len);
+    assert_null(raw);
+
+    size_t empty_len = 0;
+    char *empty = fami_chrz_compress(data, 0, &empty_len);
+    assert_non_null(empty);
+    assert_int_equal(fami_chrz_length(empty, empty_len), 0);
+
+    free(empty);
+    free(packed);
+    free(data);
+}
+
+static void test_fami_codec_decode(void **state) {
+    size_t len = 0;
+
+    char neslib[] = {0x05, 0x10, 0x05, 0x03, 0x20, 0x05, 0x00};
+    char neslib_out[] = {0x10, 0x10, 0x10, 0x10, 0x20};
+    char *out = fami_codec_decode(FAMI_CODEC_NESLIB_RLE, neslib, sizeof(neslib), &len);
+    assert_int_equal(len, sizeof(neslib_out));
+    assert_memory_equal(out, neslib_out, len);
+    free(out);
+    // missing terminator
+    assert_null(fami_codec_decode(FAMI_CODEC_NESLIB_RLE, neslib, sizeof(neslib)-2, &len));
+
+    char konami[] = {0x03, 0x11, 0x82, 0x01, 0x02, 0xFF};
+    char konami_out[] = {0x11, 0x11, 0x11, 0x01, 0x02};
+    out = fami_codec_decode(FAMI_CODEC_KONAMI_RLE, konami, sizeof(konami), &len);
+    assert_int_equal(len, sizeof(konami_out));
+    assert_memory_equal(out, konami_out, len);
+    free(out);
+    assert_null(fami_codec_decode(FAMI_CODEC_KONAMI_RLE, konami, 4, &len));
+
+    // one tile of 4 pixels of color 0 and 4 of color 1 in every row
+    unsigned char predict[] = {0x01, 0x50, 0x01, 0xFE};
+    unsigned char predict_out[] = {0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    out = fami_codec_decode(FAMI_CODEC_PREDICT, (char*)predict, sizeof(predict), &len);
+    assert_int_equal(len, sizeof(predict_out));
+    assert_memory_equal(out, predict_out, len);
+    free(out);
+    assert_null(fami_codec_decode(FAMI_CODEC_PREDICT, (char*)predict, 3, &len));
+
+    out = fami_codec_encode(FAMI_CODEC_PREDICT, (char*)predict_out, sizeof(predict_out), &len, 1);
+    assert_non_null(out);
+    assert_int_equal(len, sizeof(predict));
+    assert_memory_equal(out, predict, len);
+    free(out);
+    // whole tiles only
+    assert_null(fami_codec_encode(FAMI_CODEC_PREDICT, (char*)predict_out, 8, &len, 1));
+}
+
+static void test_fami_codec_roundtrip(void **state) {
+    // runs of every length around the token limits, noise and blank tiles
+    size_t len = 3*FAMI_CODEC_MIN_CHUNK+77;
+    char *data = malloc(len);
+    fill_noise(data, len, 15);
+    size_t pos = 0;
+    for (int run = 1; run < 300 && pos < len/2; run++) {
+        memset(data+pos, data[pos] & 0x7F, run);
+        pos += run+run%5;
+    }
+    memset(data+len/2, 0, 4096);
+    // neslib rle needs one byte value that is never used
+    for (size_t i = 0; i < len; i++) {
+        data[i] = (uint8_t)data[i] == 0xFF ? 0xFE : data[i];
+    }
+
+    for (int codec = 0; codec < FAMI_CODECS; codec++) {
+        // predict takes whole tiles and has no literals, noise tiles grow
+        char predict = codec == FAMI_CODEC_PREDICT;
+        size_t n = predict ? len-len%FAMI_TILE_SIZE : len;
+        size_t single_len = 0;
+        char *single = fami_codec_encode(codec, data, n, &single_len, 1);
+        assert_non_null(single);
+        assert_true(single_len < (predict ? n*2 : n+n/64));
+
+        size_t threaded_len = 0;
+        char *threaded = fami_codec_encode(codec, data, n, &threaded_len, 3);
+        assert_non_null(threaded);
+        assert_true(threaded_len <= single_len+3*2);
+        if (predict) {
+            // chunks hold whole blocks
+            assert_int_equal(threaded_len, single_len);
+            assert_memory_equal(threaded, single, single_len);
+        }
+
+        char *encoded[] = {single, threaded};
+        size_t encoded_len[] = {single_len, threaded_len};
+        for (int i = 0; i < 2; i++) {
+            size_t raw_len = 0;
+            char *raw = fami_codec_decode(codec, encoded[i], encoded_len[i], &raw_len);
+            assert_non_null(raw);
+            assert_int_equal(raw_len, n);
+            assert_memory_equal(raw, data, n);
+            free(raw);
+        }
+        free(single);
+        free(threaded);
+
+        char *empty = fami_codec_encode(codec, data, 0, &single_len, 1);
+        assert_non_null(empty);
+        size_t raw_len = 1;
+        char *raw = fami_codec_decode(codec, empty, single_len, &raw_len);
+        assert_non_null(raw);
+        assert_int_equal(raw_len, 0);
+        free(raw);
+        free(empty);
+    }
+
+    // a block of blank tiles is mostly repeated rows
+    memset(data, 0, 4096);
+    size_t blank_len = 0;
+    char *blank = fami_codec_encode(FAMI_CODEC_PREDICT, data, 4096, &blank_len, 1);
+    assert_non_null(blank);
+    assert_true(blank_len < 4096/8);
+    free(blank);
+    free(data);
+}
+
+static void test_fami_rom(void **state) {
+    // ines, mapper 4, trainer, 2 prg banks and 3 chr banks
+    size_t len = 16+512+2*0x4000+3*0x2000;
+    char *data = calloc(len, 1);
+    memcpy(data, "NES\x1A", 4);
+    data[4] = 2;
+    data[5] = 3;
+    data[6] = 0x44;
+    fami_rom_t rom;
+    assert_true(fami_rom_parse(data, len, &rom));
+    assert_false(rom.nes2);
+    assert_int_equal(rom.mapper, 4);
+    assert_true(rom.trainer);
+    assert_int_equal(rom.prg_offset, 16+512);
+    assert_int_equal(rom.prg_size, 2*0x4000);
+    assert_int_equal(rom.chr_offset, 16+512+2*0x4000);
+    assert_int_equal(rom.chr_banks, 3);
+    assert_ptr_equal(fami_rom_chr_bank(&rom, 2), data+rom.chr_offset+2*0x2000);
+    assert_null(fami_rom_chr_bank(&rom, 3));
+
+    // truncated files are rejected
+    assert_false(fami_rom_parse(data, len-1, &rom));
+
+    // nes 2.0, mapper 0x1A5 submapper 2, chr size in exponent form 2^13*3
+    data[6] = 0x50;
+    data[7] = 0xA8;
+    data[8] = 0x21;
+    data[9] = 0xF0;
+    data[5] = 13 << 2 | 1;
+    assert_true(fami_rom_parse(data, len, &rom));
+    assert_true(rom.nes2);
+    assert_int_equal(rom.mapper, 0x1A5);
+    assert_int_equal(rom.submapper, 2);
+    assert_false(rom.trainer);
+    assert_int_equal(rom.chr_offset, 16+2*0x4000);
+    assert_int_equal(rom.chr_size, 3*0x2000);
+
+    // chr-ram boards have no banks
+    data[5] = 0;
+    data[9] = 0;
+    assert_true(fami_rom_parse(data, len, &rom));
+    assert_null(rom.chr);
+    assert_null(fami_rom_chr_bank(&rom, 0));
+
+    assert_false(fami_rom_check(data+1, len-1));
+    free(data);
+}
+
+static void test_fami_tile_cache(void **state) {
+    char tiles[8*FAMI_TILE_SIZE];
+    for (int i = 0; i < sizeof(tiles); i++) {
+        tiles[i] = rand();
+    }
+    char expected[FAMI_TILE_PIXELS];
+    unsigned int len = 0;
+
+    fami_tile_cache_t cache;
+    assert_false(fami_tile_cache_init(&cache, 0));
+    assert_true(fami_tile_cache_init(&cache, 3));
+
+    // misses decode, hits return the same pixels
+    for (int i = 0; i < 3; i++) {
+        char *pixels = fami_tile_cache_get(&cache, i, tiles+i*FAMI_TILE_SIZE);
+        fami_decode_tile(tiles+i*FAMI_TILE_SIZE, expected, &len);
+        assert_memory_equal(pixels, expected, FAMI_TILE_PIXELS);
+    }
+    assert_int_equal(cache.misses, 3);
+    fami_tile_cache_get(&cache, 0, tiles);
+    assert_int_equal(cache.hits, 1);
+
+    // tile 1 is now the least recently used and gets replaced
+    fami_tile_cache_get(&cache, 3, tiles+3*FAMI_TILE_SIZE);
+    fami_tile_cache_get(&cache, 0, tiles);
+    fami_tile_cache_get(&cache, 2, tiles+2*FAMI_TILE_SIZE);
+    assert_int_equal(cache.hits, 3);
+    fami_tile_cache_get(&cache, 1, tiles+FAMI_TILE_SIZE);
+    assert_int_equal(cache.misses, 5);
+
+    // an invalidated tile is decoded again from the new data
+    fami_tile_cache_invalidate(&cache, 2);
+    fami_tile_cache_invalidate(&cache, 7);
+    char *pixels = fami_tile_cache_get(&cache, 2, tiles+5*FAMI_TILE_SIZE);
+    fami_decode_tile(tiles+5*FAMI_TILE_SIZE, expected, &len);
+    assert_memory_equal(pixels, expected, FAMI_TILE_PIXELS);
+    assert_int_equal(cache.misses, 6);
+    // and took the invalidated slot, so the others stay cached
+    fami_tile_cache_get(&cache, 0, tiles);
+    fami_tile_cache_get(&cache, 1, tiles+FAMI_TILE_SIZE);
+    assert_int_equal(cache.misses, 6);
+
+    fami_tile_cache_clear(&cache);
+    fami_tile_cache_get(&cache, 0, tiles);
+    assert_int_equal(cache.misses, 7);
+    fami_tile_cache_free(&cache);
+}
+
+static void test_fami_history(void **state) {
+    char data[4*FAMI_TILE_SIZE];
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = rand();
+    }
+    char original[sizeof(data)];
+    memcpy(original, data, sizeof(data));
+    char after[FAMI_TILE_SIZE];
+    uint32_t changed[2];
+
+    fami_history_t history;
+    fami_history_init(&history);
+    assert_null(fami_history_undo(&history));
+
+    // one step changing two tiles, recorded before they are written
+    assert_true(fami_history_begin(&history, 16));
+    memcpy(after, data+16, FAMI_TILE_SIZE);
+    after[3] ^= 0x81;
+    assert_true(fami_history_add_tile(&history, 16, data+16, after));
+    memcpy(data+16, after, FAMI_TILE_SIZE);
+    memcpy(after, data+48, FAMI_TILE_SIZE);
+    after[15] = ~after[15];
+    assert_true(fami_history_add_tile(&history, 48, data+48, after));
+    memcpy(data+48, after, FAMI_TILE_SIZE);
+    // unchanged tiles are not kept
+    assert_true(fami_history_add_tile(&history, 0, data, data));
+    fami_history_end(&history, 32);
+    assert_int_equal(history.steps_len, 1);
+    // two deltas of one changed byte each
+    assert_int_equal(history.arena_len, 2*(6+1));
+    char edited[sizeof(data)];
+    memcpy(edited, data, sizeof(data));
+
+    // a step that changes nothing is dropped
+    fami_history_begin(&history, 32);
+    fami_history_end(&history, 32);
+    assert_int_equal(history.steps_len, 1);
+
+    fami_history_step_t *step = fami_history_undo(&history);
+    assert_non_null(step);
+    assert_int_equal(step->offset_before, 16);
+    assert_int_equal(step->offset_after, 32);
+    fami_history_apply(&history, step, data, changed);
+    assert_memory_equal(data, original, sizeof(data));
+    assert_int_equal(changed[0], 16);
+    assert_int_equal(changed[1], 48);
+    assert_null(fami_history_undo(&history));
+
+    step = fami_history_redo(&history);
+    assert_non_null(step);
+    fami_history_apply(&history, step, data, NULL);
+    assert_memory_equal(data, edited, sizeof(data));
+    assert_null(fami_history_redo(&history));
+
+    // recording after an undo drops the redo
+    fami_history_apply(&history, fami_history_undo(&history), data, NULL);
+    fami_history_begin(&history, 0);
+    memcpy(after, data, FAMI_TILE_SIZE);
+    after[0] ^= 1;
+    fami_history_add_tile(&history, 0, data, after);
+    memcpy(data, after, FAMI_TILE_SIZE);
+    fami_history_end(&history, 0);
+    assert_int_equal(history.steps_len, 1);
+    assert_int_equal(history.arena_len, 6+1);
+    assert_null(fami_history_redo(&history));
+    fami_history_apply(&history, fami_history_undo(&history), data, NULL);
+    assert_memory_equal(data, original, sizeof(data));
+
+    fami_history_free(&history);
+}
+
+static void test_fami_bitmap(void **state) {
+    // 2x2 tiles inside a row of 3
+    char data[6*FAMI_TILE_PIXELS];
+    memset(data, 0, sizeof(data));
+    fami_bitmap_t bitmap;
+    fami_bitmap_init(&bitmap, data, 2, 2, 3);
+    assert_int_equal(bitmap.width, 16);
+    assert_int_equal(bitmap.height, 16);
+
+    // pixels past a tile border land in the next tile, rows skip the stride
+    fami_bitmap_set(&bitmap, 9, 2, 3);
+    assert_int_equal(data[FAMI_TILE_PIXELS+2*FAMI_TILE_LEN+1], 3);
+    fami_bitmap_set(&bitmap, 1, 8, 2);
+    assert_int_equal(data[3*FAMI_TILE_PIXELS+1], 2);
+    assert_int_equal(fami_bitmap_get(&bitmap, 1, 8), 2);
+    // clipped
+    fami_bitmap_set(&bitmap, 16, 0, 1);
+    fami_bitmap_set(&bitmap, -1, 0, 1);
+    assert_int_equal(data[2*FAMI_TILE_PIXELS], 0);
+
+    // a rectangle outline splits the bitmap, the flood stays on one side
+    memset(data, 0, sizeof(data));
+    fami_bitmap_rect(&bitmap, 2, 2, 12, 12, 1, 0);
+    assert_int_equal(fami_bitmap_get(&bitmap, 12, 7), 1);
+    assert_int_equal(fami_bitmap_get(&bitmap, 7, 7), 0);
+    uint32_t stack[fami_bitmap_flood_stack(&bitmap)];
+    assert_int_equal(fami_bitmap_flood(&bitmap, 7, 7, 2, stack), 9*9);
+    assert_int_equal(fami_bitmap_get(&bitmap, 3, 3), 2);
+    assert_int_equal(fami_bitmap_get(&bitmap, 0, 0), 0);
+    assert_int_equal(fami_bitmap_flood(&bitmap, 0, 0, 3, stack), 16*16-11*11);
+    assert_int_equal(fami_bitmap_flood(&bitmap, 0, 0, 3, stack), 0);
+    // the third tile of every row is not part of the bitmap
+    assert_int_equal(data[2*FAMI_TILE_PIXELS], 0);
+
+    // a diagonal line and a clipped one
+    memset(data, 0, sizeof(data));
+    fami_bitmap_line(&bitmap, 0, 0, 15, 15, 1);
+    for (int i = 0; i < 16; i++) {
+        assert_int_equal(fami_bitmap_get(&bitmap, i, i), 1);
+    }
+    fami_bitmap_line(&bitmap, 15, 0, 20, 3, 2);
+    assert_int_equal(fami_bitmap_get(&bitmap, 15, 0), 2);
+    fami_bitmap_line(&bitmap, 3, 10, 3, 5, 3);
+    assert_int_equal(fami_bitmap_get(&bitmap, 3, 5), 3);
+    assert_int_equal(fami_bitmap_get(&bitmap, 3, 10), 3);
+
+    // copies across tile borders
+    char clip_data[FAMI_TILE_PIXELS];
+    fami_bitmap_t clip;
+    fami_bitmap_init(&clip, clip_data, 1, 1, 0);
+    memset(clip_data, 0, sizeof(clip_data));
+    fami_bitmap_copy(&clip, 0, 0, &bitmap, 6, 6, 4, 4);
+    assert_int_equal(fami_bitmap_get(&clip, 0, 0), 1);
+    assert_int_equal(fami_bitmap_get(&clip, 3, 3), 1);
+    assert_int_equal(fami_bitmap_get(&clip, 1, 0), 0);
+    fami_bitmap_copy(&bitmap, 13, 0, &clip, 0, 0, 4, 4);
+    assert_int_equal(fami_bitmap_get(&bitmap, 13, 0), 1);
+    assert_int_equal(fami_bitmap_get(&bitmap, 15, 2), 1);
+}
+
+static void test_fami_render_levels(void **state) {
+    // odd lengths reach the scalar tails of every kernel
+    char indices[203];
+    uint8_t expected[203*4];
+    uint8_t out[203*4+1];
+    fill_noise(indices, sizeof(indices), 9);
+    const uint32_t colors[4] = {0x11223344, 0x55667788, 0x99AABBCC, 0xDDEEFF00};
+
+    for (int i = 0; i < 203; i++) {
+        memcpy(expected+i*4, colors+(indices[i] & 3), 4);
+    }
+
+    fami_simd_level_t prev = fami_simd_get_level();
+    for (int level = 0; level < FAMI_SIMD_LEVELS; level++) {
+        if (!fami_simd_set_level(level)) {
+            continue;
+        }
+        for (size_t len = 0; len <= 203; len += 29) {
+            memset(out, 0x5A, sizeof(out));
+            fami_render_rgba(indices, len, colors, out);
+            assert_memory_equal(expected, out, len*4);
+            assert_int_equal(out[len*4], 0x5A);
+
+            memset(out, 0x5A, sizeof(out));
+            fami_render_rgb(indices, len, colors, out);
+            for (size_t i = 0; i < len; i++) {
+                assert_memory_equal(expected+i*4, out+i*3, 3);
+            }
+            assert_int_equal(out[len*3], 0x5A);
+        }
+    }
+    assert_true(fami_simd_set_level(prev));
+}
+
+static void test_fami_palette(void **state) {
+    uint8_t nes[4];
+    assert_true(fami_palette_parse("0F,16,27,30", nes));
+    assert_int_equal(nes[0], 0x0F);
+    assert_int_equal(nes[3], 0x30);
+    assert_false(fami_palette_parse("0F,16,27", nes));
+    assert_false(fami_palette_parse("0F,16,27,40", nes));
+    assert_false(fami_palette_parse("0F,16,27,30,", nes));
+
+    fami_state_t colors;
+    fami_palette_state(&colors, nes);
+    fami_color_t white = {0xEC, 0xEE, 0xEC};
+    assert_true(assert_color_equal(fami_get_color(&colors, 3), white));
+
+    uint32_t packed[8];
+    fami_palette_pack(&colors, 1, packed);
+    uint8_t bytes[4];
+    memcpy(bytes, packed+3, 4);
+    assert_int_equal(bytes[0], 0xEC);
+    assert_int_equal(bytes[3], 0xFF);
+    memcpy(bytes, packed, 4);
+    assert_int_equal(bytes[3], 0);
+    fami_image_init_state(&colors);
+    fami_palette_pack(&colors, 0, packed+4);
+
+    // 5 tiles per row with a partial second row, each tile picks a sub-palette
+    char data[16*7];
+    fill_noise(data, sizeof(data), 10);
+    uint8_t tile_palettes[7] = {0, 1, 1, 0, 1, 1, 0};
+    size_t size = fami_render_size(sizeof(data), 5, 0);
+    assert_int_equal(size, 2*5*64*3);
+    uint8_t *out = malloc(size);
+    assert_non_null(out);
+    assert_true(fami_render_sheet(data, sizeof(data), 5, packed, tile_palettes, 0, out));
+
+    char decoded[64];
+    for (int t = 0; t < 10; t++) {
+        unsigned int len = 0;
+        memset(decoded, 0, sizeof(decoded));
+        if (t < 7) {
+            fami_decode_tile(data+t*16, decoded, &len);
+        }
+        const uint32_t *colors = packed+(t < 7 ? tile_palettes[t] : 0)*4;
+        for (int p = 0; p < 64; p++) {
+            size_t x = t%5*8+p%8;
+            size_t y = t/5*8+p/8;
+            assert_memory_equal(out+(y*40+x)*3, colors+decoded[p], 3);
+        }
+    }
+    free(out);
+    assert_false(fami_render_sheet(data, 8, 5, packed, NULL, 0, NULL));
+}
+
+static void test_fami_ansi(void **state) {
+    fami_ansi_t ansi;
+    assert_true(fami_ansi_init(&ansi));
+
+    uint8_t bytes[2][4] = {{10, 20, 30, 0xFF}, {1, 2, 3, 0xFF}};
+    uint32_t a = 0;
+    uint32_t b = 0;
+    memcpy(&a, bytes[0], 4);
+    memcpy(&b, bytes[1], 4);
+
+    // one cell with two colors
+    uint32_t pixels[6] = {a, b};
+    uint32_t shown[6];
+    assert_int_equal(fami_ansi_frame(&ansi, pixels, shown, 1, 2, 4, 2, 1), 1);
+    const char *expected = "\x1B" "7\x1B[5;3H\x1B[38;2;10;20;30;48;2;1;2;3m\xE2\x96\x80";
+    assert_int_equal(ansi.len, strlen(expected));
+    assert_memory_equal(ansi.data, expected, ansi.len);
+
+    // the colors are already set, the next cell follows without a move
+    uint32_t next[2] = {a, b};
+    uint32_t next_shown[2] = {0, 0};
+    assert_int_equal(fami_ansi_frame(&ansi, next, next_shown, 1, 2, 4, 3, 0), 1);
+    assert_int_equal(ansi.len, strlen(expected)+3);
+
+    FILE *f = tmpfile();
+    assert_non_null(f);
+    size_t len = ansi.len;
+    assert_int_equal(fami_ansi_flush(&ansi, fileno(f)), len+6);
+    assert_int_equal(ansi.len, 0);
+    char out[128];
+    rewind(f);
+    assert_int_equal(fread(out, 1, sizeof(out), f), len+6);
+    assert_memory_equal(out+len, "\x1B[0m\x1B" "8", 6);
+    fclose(f);
+
+    // 2x3 pixels are two rows of cells, only changed cells are sent
+    uint32_t frame[6] = {a, a, b, a, b, b};
+    assert_int_equal(fami_ansi_frame(&ansi, frame, shown, 2, 3, 0, 0, 1), 4);
+    assert_int_equal(fami_ansi_frame(&ansi, frame, shown, 2, 3, 0, 0, 0), 0);
+    frame[5] = a;
+    assert_int_equal(fami_ansi_frame(&ansi, frame, shown, 2, 3, 0, 0, 0), 1);
+    // the bottom half of the last row is the default background
+    assert_memory_equal(ansi.data+ansi.len-3, "\xE2\x96\x80", 3);
+
+    // nothing changed, nothing to write
+    ansi.len = 0;
+    assert_int_equal(fami_ansi_frame(&ansi, frame, shown, 2, 3, 0, 0, 0), 0);
+    assert_int_equal(ansi.len, 0);
+    assert_int_equal(fami_ansi_flush(&ansi, -1), 0);
+    fami_ansi_free(&ansi);
+}
+
+static void test_fami_nearest_levels(void **state) {
+    uint8_t planes[3*64];
+    fill_noise((char*)planes, sizeof(planes), 11);
+    // a repeated color makes ties that have to resolve to the lower index
+    const uint32_t colors[4] = {0xFF102030, 0xFF807060, 0xFF102030, 0xFFF0E0D0};
+    char expected[64];
+    char indices[64];
+
+    fami_simd_level_t prev = fami_simd_get_level();
+    assert_true(fami_simd_set_level(FAMI_SIMD_SCALAR));
+    uint32_t expected_error = fami_nearest_tile(planes, colors, expected);
+    for (int i = 0; i < 64; i++) {
+        assert_int_not_equal(expected[i], 2);
+    }
+    for (int level = 0; level < FAMI_SIMD_LEVELS; level++) {
+        if (!fami_simd_set_level(level)) {
+            continue;
+        }
+        memset(indices, 0x5A, sizeof(indices));
+        assert_int_equal(fami_nearest_tile(planes, colors, indices), expected_error);
+        assert_memory_equal(expected, indices, sizeof(indices));
+    }
+    assert_true(fami_simd_set_level(prev));
+}
+
+static void test_fami_quantize(void **state) {
+    // three sub-palettes in shades of red, green and blue
+    fami_state_t colors[3];
+    for (int p = 0; p < 3; p++) {
+        for (int c = 0; c < 4; c++) {
+            uint8_t rgb[3] = {0, 0, 0};
+            rgb[p] = 40+c*60;
+            fami_color_t color = {rgb[0], rgb[1], rgb[2]};
+            fami_set_color(colors+p, color, c);
+        }
+    }
+    uint32_t packed[3*4];
+    for (int p = 0; p < 3; p++) {
+        fami_palette_pack(colors+p, 0, packed+p*4);
+    }
+
+    char data[16*24];
+    fill_noise(data, sizeof(data), 12);
+    uint8_t tile_palettes[24];
+    for (int t = 0; t < 24; t++) {
+        tile_palettes[t] = t*7 % 3;
+    }
+    uint8_t rgba[64*24*4];
+    assert_true(fami_render_sheet(data, sizeof(data), 8, packed, tile_palettes, 1, rgba));
+
+    // odd tiles get slight noise so they go through the kernel instead of the cache
+    char noise[64*24];
+    fill_noise(noise, sizeof(noise), 13);
+    uint8_t rgb[64*24*3];
+    for (int i = 0; i < 64*24; i++) {
+        int tile = i/64/8*8 + i%64/8;
+        for (int ch = 0; ch < 3; ch++) {
+            rgb[i*3+ch] = rgba[i*4+ch]+(tile & 1 ? (uint8_t)noise[i] % 4 : 0);
+        }
+    }
+    fami_image_t image = {64, 24, rgb, NULL, 0};
+
+    fami_quantize_t quantize = {colors, 3, 0, 1};
+    uint8_t *chosen = NULL;
+    size_t len = 0;
+    char *chr = fami_quantize_image(&image, &quantize, &chosen, &len);
+    assert_non_null(chr);
+    assert_non_null(chosen);
+    assert_int_equal(len, sizeof(data));
+    assert_memory_equal(data, chr, sizeof(data));
+    assert_memory_equal(tile_palettes, chosen, sizeof(tile_palettes));
+    assert_true(quantize.cache_hits > 0);
+    assert_true(quantize.kernel_tiles > 0);
+    free(chr);
+    free(chosen);
+
+    // flat color halfway between two colors, ties take the lower index
+    uint8_t flat[64*3];
+    for (int i = 0; i < 64; i++) {
+        flat[i*3] = 70;
+        flat[i*3+1] = 0;
+        flat[i*3+2] = 0;
+    }
+    fami_image_t flat_image = {8, 8, flat, NULL, 0};
+    char decoded[64];
+    unsigned int decoded_len = 0;
+    quantize.auto_palette = 0;
+    chr = fami_quantize_image(&flat_image, &quantize, NULL, &len);
+    assert_non_null(chr);
+    fami_decode_tile(chr, decoded, &decoded_len);
+    for (int i = 0; i < 64; i++) {
+        assert_int_equal(decoded[i], 0);
+    }
+    free(chr);
+
+    // dithering mixes both colors
+    quantize.dither = 1;
+    chr = fami_quantize_image(&flat_image, &quantize, NULL, &len);
+    assert_non_null(chr);
+    fami_decode_tile(chr, decoded, &decoded_len);
+    int ones = 0;
+    for (int i = 0; i < 64; i++) {
+        assert_true(decoded[i] == 0 || decoded[i] == 1);
+        ones += decoded[i];
+    }
+    assert_true(ones >= 16 && ones <= 48);
+    free(chr);
+
+    flat_image.width = 7;
+    assert_null(fami_quantize_image(&flat_image, &quantize, NULL, &len));
+}
+
+#define POOL_TEST_ROOTS 40
+#define POOL_TEST_CHILDREN 16
+#define POOL_TEST_MEMORY 10
+
+typedef struct pool_test {
+    pthread_mutex_t lock;
+    size_t children_run;
+    size_t held; // memory of roots that have not released yet
+    size_t held_peak;
+} pool_test_t;
+
+typedef struct pool_test_root {
+    pool_test_t *shared;
+    size_t memory;
+    unsigned int remaining;
+} pool_test_root_t;
+
+static void pool_test_child(fami_pool_t *pool, void *arg) {
+    pool_test_root_t *root = arg;
+    pthread_mutex_lock(&root->shared->lock);
+    root->shared->children_run++;
+    char last = --root->remaining == 0;
+    if (last) {
+        root->shared->held -= root->memory;
+    }
+    pthread_mutex_unlock(&root->shared->lock);
+    if (last) {
+        fami_pool_release(pool, root->memory);
+    }
+}
+
+static void pool_test_root(fami_pool_t *pool, void *arg) {
+    pool_test_root_t *root = arg;
+    pthread_mutex_lock(&root->shared->lock);
+    root->shared->held += root->memory;
+    if (root->shared->held > root->shared->held_peak) {
+        root->shared->held_peak = root->shared->held;
+    }
+    root->remaining = POOL_TEST_CHILDREN;
+    pthread_mutex_unlock(&root->shared->lock);
+    for (int i = 0; i < POOL_TEST_CHILDREN; i++) {
+        assert_true(fami_pool_spawn(pool, pool_test_child, root));
+    }
+}
+
+static void test_fami_pool(void **state) {
+    pool_test_t shared;
+    memset(&shared, 0, sizeof(shared));
+    pthread_mutex_init(&shared.lock, NULL);
+    pool_test_root_t roots[POOL_TEST_ROOTS];
+
+    // room for two roots at a time
+    fami_pool_t *pool = fami_pool_create(4, 2*POOL_TEST_MEMORY+5);
+    assert_non_null(pool);
+    for (int i = 0; i < POOL_TEST_ROOTS; i++) {
+        roots[i].shared = &shared;
+        roots[i].memory = POOL_TEST_MEMORY;
+        assert_true(fami_pool_submit(pool, pool_test_root, roots+i, POOL_TEST_MEMORY));
+    }
+    fami_pool_wait(pool);
+    assert_int_equal(shared.children_run, POOL_TEST_ROOTS*POOL_TEST_CHILDREN);
+    assert_int_equal(shared.held, 0);
+    assert_true(shared.held_peak <= 2*POOL_TEST_MEMORY);
+
+    fami_pool_stats_t stats = fami_pool_stats(pool);
+    assert_int_equal(stats.jobs, POOL_TEST_ROOTS*(1+POOL_TEST_CHILDREN));
+    assert_true(stats.memory_peak <= 2*POOL_TEST_MEMORY);
+
+    // a job above the limit still runs alone, and the pool can be reused
+    roots[0].memory = 100*POOL_TEST_MEMORY;
+    assert_true(fami_pool_submit(pool, pool_test_root, roots, roots[0].memory));
+    fami_pool_wait(pool);
+    assert_int_equal(shared.children_run, (POOL_TEST_ROOTS+1)*POOL_TEST_CHILDREN);
+    assert_int_equal(fami_pool_stats(pool).memory_peak, 100*POOL_TEST_MEMORY);
+    fami_pool_free(pool);
+    pthread_mutex_destroy(&shared.lock);
+}
+
+static void test_fami_tile_store(void **state) {
+    char path[] = "/tmp/famisprite_storeXXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+
+    // 8 tiles, a repeat and a flip of the first
+    char data[16*10];
+    fill_noise(data, 16*8, 14);
+    memcpy(data+16*8, data+16*3, 16);
+    fami_tile_flip(data, data+16*9, FAMI_FLIP_H);
+    char expected[64*10];
+    fami_decode_tiles(data, 10, expected);
+
+    fami_tile_store_t store;
+    assert_true(fami_tile_store_open(&store, path, 64, 1));
+    char decoded[64*10];
+    fami_tile_info_t infos[10];
+    assert_int_equal(fami_tile_store_decode(&store, data, 10, decoded, infos), 0);
+    assert_memory_equal(expected, decoded, sizeof(decoded));
+    assert_int_equal(infos[3].id, infos[8].id);
+    assert_int_equal(infos[0].canonical_id, infos[9].canonical_id);
+    assert_true(store.added >= 9);
+
+    // the ids give the unique tiles, the flipped one is unique up to flips only
+    size_t first[10];
+    size_t unique = 0;
+    size_t canonicals = 0;
+    assert_true(fami_tile_store_unique(infos, 10, first, &unique, &canonicals));
+    assert_int_equal(unique, 9);
+    assert_int_equal(canonicals, 8);
+    // tile 8 repeats tile 3
+    for (size_t i = 0; i < 8; i++) {
+        assert_int_equal(first[i], i);
+    }
+    assert_int_equal(first[8], 9);
+
+    // a second handle, read only, finds everything without decoding
+    fami_tile_store_t reader;
+    assert_true(fami_tile_store_open(&reader, path, 0, 0));
+    memset(decoded, 0, sizeof(decoded));
+    fami_tile_info_t again[10];
+    assert_int_equal(fami_tile_store_decode(&reader, data, 10, decoded, again), 10);
+    assert_memory_equal(expected, decoded, sizeof(decoded));
+    for (int i = 0; i < 10; i++) {
+        assert_int_equal(again[i].id, infos[i].id);
+        assert_int_equal(again[i].canonical_id, infos[i].canonical_id);
+        assert_int_equal(again[i].flip, infos[i].flip);
+    }
+    char canonical[16];
+    char flipped[16];
+    fami_tile_canonical(data+16*9, canonical);
+    fami_tile_flip(canonical, flipped, again[9].flip);
+    assert_memory_equal(flipped, data+16*9, 16);
+    fami_tile_store_close(&reader);
+
+    // the store takes tiles up to three quarters of its 64 entries
+    char more[16*80];
+    fill_noise(more, sizeof(more), 15);
+    char more_decoded[64*80];
+    char more_expected[64*80];
+    fami_decode_tiles(more, 80, more_expected);
+    fami_tile_info_t more_infos[80];
+    fami_tile_store_decode(&store, more, 80, more_decoded, more_infos);
+    assert_memory_equal(more_expected, more_decoded, sizeof(more_decoded));
+    assert_true(store.dropped > 0);
+    // tiles that did not fit have no id
+    size_t more_first[80];
+    assert_false(fami_tile_store_unique(more_infos, 80, more_first, &unique, &canonicals));
+    assert_int_equal(fami_tile_store_stats(&store).tiles, 48);
+    size_t hits = store.hits;
+    fami_tile_store_close(&store);
+
+    // totals survive the handle, a non store file is refused
+    assert_true(fami_tile_store_open(&store, path, 0, 0));
+    assert_int_equal(fami_tile_store_stats(&store).hits, hits);
+    fami_tile_store_close(&store);
+    FILE *f = fopen(path, "wb");
+    assert_non_null(f);
+    fwrite(data, 1, sizeof(data), f);
+    fclose(f);
+    assert_false(fami_tile_store_open(&store, path, 0, 1));
+    unlink(path);
+}
+
 static void test_parse_arg(void **state) {
     arg a1 = parse_arg("testargument", "test");
 
@@ -205,10 +1469,35 @@ int main() {
         cmocka_unit_test(test_fami_decode_pixel),
         cmocka_unit_test(test_fami_decode_tile),
         cmocka_unit_test(test_fami_decode),
+        cmocka_unit_test(test_fami_decode_tiles_levels),
+        cmocka_unit_test(test_fami_decode_lut),
         cmocka_unit_test(test_fami_encode_pixel),
         cmocka_unit_test(test_fami_encode_tile),
         cmocka_unit_test(test_fami_encode),
+        cmocka_unit_test(test_fami_encode_tiles_levels),
+        cmocka_unit_test(test_fami_mt),
+        cmocka_unit_test(test_fami_stream),
         cmocka_unit_test(test_fami_set_pixel),
+        cmocka_unit_test(test_fami_packed),
+        cmocka_unit_test(test_fami_sheet_roundtrip),
+        cmocka_unit_test(test_fami_png_bad_depth),
+        cmocka_unit_test(test_fami_dedup),
+        cmocka_unit_test(test_fami_tile_flip),
+        cmocka_unit_test(test_fami_dedup_flip),
+        cmocka_unit_test(test_fami_chrz),
+        cmocka_unit_test(test_fami_codec_decode),
+        cmocka_unit_test(test_fami_codec_roundtrip),
+        cmocka_unit_test(test_fami_rom),
+        cmocka_unit_test(test_fami_tile_cache),
+        cmocka_unit_test(test_fami_history),
+        cmocka_unit_test(test_fami_bitmap),
+        cmocka_unit_test(test_fami_render_levels),
+        cmocka_unit_test(test_fami_palette),
+        cmocka_unit_test(test_fami_ansi),
+        cmocka_unit_test(test_fami_nearest_levels),
+        cmocka_unit_test(test_fami_quantize),
+        cmocka_unit_test(test_fami_pool),
+        cmocka_unit_test(test_fami_tile_store),
         cmocka_unit_test(test_parse_arg),
         cmocka_unit_test(test_is_arg)
     };
@@ -0,0 +1,160 @@
+#include "include/tilecache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+#define NO_SLOT UINT32_MAX
+
+static inline size_t bucket_of(fami_tile_cache_t *cache, size_t key) {
+    return (key*0x9E3779B97F4A7C15ull >> 17) & cache->bucket_mask;
+}
+
+static void lru_unlink(fami_tile_cache_t *cache, uint32_t slot) {
+    if (cache->prev[slot] != NO_SLOT) {
+        cache->next[cache->prev[slot]] = cache->next[slot];
+    } else {
+        cache->head = cache->next[slot];
+    }
+    if (cache->next[slot] != NO_SLOT) {
+        cache->prev[cache->next[slot]] = cache->prev[slot];
+    } else {
+        cache->tail = cache->prev[slot];
+    }
+}
+
+static void lru_push_front(fami_tile_cache_t *cache, uint32_t slot) {
+    cache->prev[slot] = NO_SLOT;
+    cache->next[slot] = cache->head;
+    if (cache->head != NO_SLOT) {
+        cache->prev[cache->head] = slot;
+    }
+    cache->head = slot;
+    if (cache->tail == NO_SLOT) {
+        cache->tail = slot;
+    }
+}
+
+static void lru_push_back(fami_tile_cache_t *cache, uint32_t slot) {
+    cache->next[slot] = NO_SLOT;
+    cache->prev[slot] = cache->tail;
+    if (cache->tail != NO_SLOT) {
+        cache->next[cache->tail] = slot;
+    }
+    cache->tail = slot;
+    if (cache->head == NO_SLOT) {
+        cache->head = slot;
+    }
+}
+
+// returns the slot holding key, NO_SLOT if there is none
+static uint32_t find(fami_tile_cache_t *cache, size_t key) {
+    for (uint32_t s = cache->buckets[bucket_of(cache, key)]; s; s = cache->chain[s-1]) {
+        if (cache->keys[s-1] == key) {
+            return s-1;
+        }
+    }
+    return NO_SLOT;
+}
+
+static void unhash(fami_tile_cache_t *cache, uint32_t slot) {
+    uint32_t *link = &cache->buckets[bucket_of(cache, cache->keys[slot])];
+    while (*link && *link != slot+1) {
+        link = &cache->chain[*link-1];
+    }
+    if (*link) {
+        *link = cache->chain[slot];
+    }
+}
+
+char fami_tile_cache_init(fami_tile_cache_t *cache, uint32_t capacity) {
+    memset(cache, 0, sizeof(fami_tile_cache_t));
+    if (capacity == 0 || capacity >= NO_SLOT) {
+        return 0;
+    }
+    size_t buckets = 16;
+    while (buckets < capacity) {
+        buckets <<= 1;
+    }
+
+    cache->capacity = capacity;
+    cache->bucket_mask = buckets-1;
+    cache->pixels = my_malloc((size_t)capacity*FAMI_TILE_PIXELS);
+    cache->keys = my_malloc(capacity*sizeof(size_t));
+    cache->prev = my_malloc(capacity*sizeof(uint32_t));
+    cache->next = my_malloc(capacity*sizeof(uint32_t));
+    cache->chain = my_malloc(capacity*sizeof(uint32_t));
+    cache->buckets = calloc(buckets, sizeof(uint32_t));
+    if (!cache->pixels || !cache->keys || !cache->prev || !cache->next
+            || !cache->chain || !cache->buckets) {
+        fami_tile_cache_free(cache);
+        return 0;
+    }
+    cache->head = NO_SLOT;
+    cache->tail = NO_SLOT;
+    return 1;
+}
+
+char *fami_tile_cache_get(fami_tile_cache_t *cache, size_t key, char *tile) {
+    uint32_t slot = find(cache, key);
+    if (slot != NO_SLOT) {
+        cache->hits++;
+        if (cache->head != slot) {
+            lru_unlink(cache, slot);
+            lru_push_front(cache, slot);
+        }
+        return cache->pixels+(size_t)slot*FAMI_TILE_PIXELS;
+    }
+
+    cache->misses++;
+    if (cache->used < cache->capacity) {
+        slot = cache->used++;
+    } else {
+        // the tail is the least recently used or an invalidated slot
+        slot = cache->tail;
+        lru_unlink(cache, slot);
+        unhash(cache, slot);
+    }
+
+    char *pixels = cache->pixels+(size_t)slot*FAMI_TILE_PIXELS;
+    unsigned int len = 0;
+    fami_decode_tile(tile, pixels, &len);
+
+    cache->keys[slot] = key;
+    size_t bucket = bucket_of(cache, key);
+    cache->chain[slot] = cache->buckets[bucket];
+    cache->buckets[bucket] = slot+1;
+    lru_push_front(cache, slot);
+    return pixels;
+}
+
+void fami_tile_cache_invalidate(fami_tile_cache_t *cache, size_t key) {
+    uint32_t slot = find(cache, key);
+    if (slot == NO_SLOT) {
+        return;
+    }
+    unhash(cache, slot);
+    // an unhashed slot at the tail is reused first
+    cache->chain[slot] = 0;
+    lru_unlink(cache, slot);
+    lru_push_back(cache, slot);
+}
+
+void fami_tile_cache_clear(fami_tile_cache_t *cache) {
+    memset(cache->buckets, 0, (cache->bucket_mask+1)*sizeof(uint32_t));
+    cache->used = 0;
+    cache->head = NO_SLOT;
+    cache->tail = NO_SLOT;
+}
+
+void fami_tile_cache_free(fami_tile_cache_t *cache) {
+    my_free(cache->pixels);
+    my_free(cache->keys);
+    my_free(cache->prev);
+    my_free(cache->next);
+    my_free(cache->chain);
+    my_free(cache->buckets);
+    memset(cache, 0, sizeof(fami_tile_cache_t));
+}
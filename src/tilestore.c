@@ -0,0 +1,327 @@
+#include "include/tilestore.h"
+#include "include/simd.h"
+#include "include/dedup.h"
+#include "include/flip.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define my_malloc(x) malloc(x)
+#define my_free(x) free(x)
+
+#define MAX_CAPACITY (1u << 30)
+
+#define ENTRY_EMPTY 0
+#define ENTRY_WRITING 1 // left behind by a writer that died, skipped by everyone
+#define ENTRY_READY 2
+
+typedef struct store_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t entry_size;
+    uint32_t tiles; // entries written, also the next id
+    uint32_t reserved;
+    uint64_t hits;
+    uint64_t misses;
+} store_header_t;
+
+typedef struct tile_entry {
+    uint32_t state; // published last, the fields below never change once ready
+    uint32_t id;
+    uint32_t canonical_id;
+    uint8_t flip;
+    uint8_t reserved[3];
+    char tile[FAMI_TILE_SIZE];
+    char decoded[FAMI_TILE_PIXELS];
+} tile_entry_t;
+
+static inline store_header_t *header_of(fami_tile_store_t *store) {
+    return (store_header_t*)store->map;
+}
+
+static inline tile_entry_t *entries_of(fami_tile_store_t *store) {
+    return (tile_entry_t*)(store->map+FAMI_TILE_STORE_HEADER_SIZE);
+}
+
+static size_t store_size(uint32_t capacity) {
+    return FAMI_TILE_STORE_HEADER_SIZE+(size_t)capacity*FAMI_TILE_ENTRY_SIZE;
+}
+
+// linear probing until the tile or an empty entry
+static tile_entry_t *find(fami_tile_store_t *store, char *tile) {
+    tile_entry_t *entries = entries_of(store);
+    uint32_t mask = store->capacity-1;
+    uint32_t slot = fami_tile_hash(tile) & mask;
+    for (uint32_t probe = 0; probe < store->capacity; probe++, slot = (slot+1) & mask) {
+        tile_entry_t *e = entries+slot;
+        uint32_t state = __atomic_load_n(&e->state, __ATOMIC_ACQUIRE);
+        if (state == ENTRY_EMPTY) {
+            return NULL;
+        }
+        if (state == ENTRY_READY && memcmp(e->tile, tile, FAMI_TILE_SIZE) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Writes a new entry, the caller holds both locks and checked that the tile is missing
+ * canonical_id = FAMI_TILE_NO_ID makes the tile its own canonical form
+ */
+static char store_full(fami_tile_store_t *store) {
+    return __atomic_load_n(&header_of(store)->tiles, __ATOMIC_RELAXED) >= store->capacity/4*3;
+}
+
+static tile_entry_t *add(fami_tile_store_t *store, char *tile, uint32_t canonical_id, uint8_t flip) {
+    if (store_full(store)) {
+        return NULL;
+    }
+    store_header_t *header = header_of(store);
+    uint32_t tiles = __atomic_load_n(&header->tiles, __ATOMIC_RELAXED);
+
+    tile_entry_t *entries = entries_of(store);
+    uint32_t mask = store->capacity-1;
+    uint32_t slot = fami_tile_hash(tile) & mask;
+    while (__atomic_load_n(&entries[slot].state, __ATOMIC_RELAXED) != ENTRY_EMPTY) {
+        slot = (slot+1) & mask;
+    }
+
+    tile_entry_t *e = entries+slot;
+    __atomic_store_n(&e->state, ENTRY_WRITING, __ATOMIC_RELAXED);
+    e->id = tiles;
+    e->canonical_id = canonical_id == FAMI_TILE_NO_ID ? tiles : canonical_id;
+    e->flip = flip;
+    memcpy(e->tile, tile, FAMI_TILE_SIZE);
+    fami_decode_tiles(tile, 1, e->decoded);
+    __atomic_store_n(&header->tiles, tiles+1, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->state, ENTRY_READY, __ATOMIC_RELEASE);
+    store->added++;
+    return e;
+}
+
+// adds a tile and its canonical form, another writer may have added either since the lookup
+static tile_entry_t *add_with_canonical(fami_tile_store_t *store, char *tile) {
+    tile_entry_t *e = find(store, tile);
+    if (e) {
+        return e;
+    }
+    char canonical[FAMI_TILE_SIZE];
+    uint8_t flip = fami_tile_canonical(tile, canonical);
+    if (memcmp(canonical, tile, FAMI_TILE_SIZE) == 0) {
+        return add(store, tile, FAMI_TILE_NO_ID, FAMI_FLIP_NONE);
+    }
+    tile_entry_t *c = find(store, canonical);
+    if (!c) {
+        c = add(store, canonical, FAMI_TILE_NO_ID, FAMI_FLIP_NONE);
+    }
+    return c ? add(store, tile, c->id, flip) : NULL;
+}
+
+static void set_info(fami_tile_info_t *info, tile_entry_t *e) {
+    if (e) {
+        info->id = e->id;
+        info->canonical_id = e->canonical_id;
+        info->flip = e->flip;
+    } else {
+        info->id = FAMI_TILE_NO_ID;
+        info->canonical_id = FAMI_TILE_NO_ID;
+        info->flip = FAMI_FLIP_NONE;
+    }
+}
+
+char fami_tile_store_open(fami_tile_store_t *store, const char *path, uint32_t capacity, char writable) {
+    memset(store, 0, sizeof(fami_tile_store_t));
+    store->fd = -1;
+    if (sizeof(store_header_t) > FAMI_TILE_STORE_HEADER_SIZE || sizeof(tile_entry_t) != FAMI_TILE_ENTRY_SIZE) {
+        return 0;
+    }
+
+    int fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0666);
+    if (fd < 0) {
+        return 0;
+    }
+    // creation happens under the exclusive lock, so nobody maps a store before its header exists
+    if (flock(fd, writable ? LOCK_EX : LOCK_SH) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    struct stat st;
+    char ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size == 0 && writable) {
+        uint32_t entries = 16;
+        capacity = capacity ? capacity : FAMI_TILE_STORE_CAPACITY;
+        while (entries < capacity && entries < MAX_CAPACITY) {
+            entries <<= 1;
+        }
+        store_header_t header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, FAMI_TILE_STORE_MAGIC, 4);
+        header.version = FAMI_TILE_STORE_VERSION;
+        header.capacity = entries;
+        header.entry_size = FAMI_TILE_ENTRY_SIZE;
+        // the entries are a hole in the file until tiles are written
+        ok = ftruncate(fd, store_size(entries)) == 0
+            && pwrite(fd, &header, sizeof(header), 0) == sizeof(header)
+            && fstat(fd, &st) == 0;
+    }
+
+    store_header_t header;
+    ok = ok && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+        && memcmp(header.magic, FAMI_TILE_STORE_MAGIC, 4) == 0
+        && header.version == FAMI_TILE_STORE_VERSION
+        && header.entry_size == FAMI_TILE_ENTRY_SIZE
+        && header.capacity >= 16 && header.capacity <= MAX_CAPACITY
+        && (header.capacity & (header.capacity-1)) == 0
+        && (size_t)st.st_size >= store_size(header.capacity);
+
+    if (ok) {
+        store->map_len = store_size(header.capacity);
+        store->map = mmap(NULL, store->map_len, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_SHARED, fd, 0);
+        ok = store->map != MAP_FAILED;
+    }
+    flock(fd, LOCK_UN);
+    if (!ok) {
+        close(fd);
+        store->map = NULL;
+        return 0;
+    }
+
+    store->fd = fd;
+    store->writable = writable;
+    store->capacity = header.capacity;
+    pthread_mutex_init(&store->lock, NULL);
+    return 1;
+}
+
+size_t fami_tile_store_decode(fami_tile_store_t *store, char *data, size_t tiles,
+        char *decoded, fami_tile_info_t *infos) {
+    size_t found = 0;
+    size_t *missing = NULL;
+    size_t missing_count = 0;
+    char adding = store->writable && !store_full(store);
+
+    for (size_t t = 0; t < tiles; t++) {
+        char *tile = data+t*FAMI_TILE_SIZE;
+        tile_entry_t *e = find(store, tile);
+        if (e) {
+            memcpy(decoded+t*FAMI_TILE_PIXELS, e->decoded, FAMI_TILE_PIXELS);
+            found++;
+        } else {
+            fami_decode_tiles(tile, 1, decoded+t*FAMI_TILE_PIXELS);
+            // remembered for adding, a failed allocation only means they are not added
+            if (adding && !missing && missing_count == 0) {
+                missing = my_malloc((tiles-t)*sizeof(size_t));
+            }
+            if (missing) {
+                missing[missing_count] = t;
+            }
+            missing_count++;
+        }
+        if (infos) {
+            set_info(infos+t, e);
+        }
+    }
+
+    size_t dropped = 0;
+    if (missing) {
+        // one lock for all misses of the call
+        pthread_mutex_lock(&store->lock);
+        flock(store->fd, LOCK_EX);
+        for (size_t i = 0; i < missing_count; i++) {
+            tile_entry_t *e = add_with_canonical(store, data+missing[i]*FAMI_TILE_SIZE);
+            dropped += e == NULL;
+            if (infos) {
+                set_info(infos+missing[i], e);
+            }
+        }
+        flock(store->fd, LOCK_UN);
+        pthread_mutex_unlock(&store->lock);
+        my_free(missing);
+    } else if (store->writable) {
+        // full, or the allocation failed
+        dropped = missing_count;
+    }
+
+    __atomic_fetch_add(&store->hits, found, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&store->misses, tiles-found, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&store->dropped, dropped, __ATOMIC_RELAXED);
+    return found;
+}
+
+// adds an id to a set of ids, returns 1 if it was not in there
+static char id_set_add(uint32_t *slots, size_t mask, uint32_t id) {
+    size_t slot = (id*2654435761u) & mask;
+    while (slots[slot] != FAMI_TILE_NO_ID) {
+        if (slots[slot] == id) {
+            return 0;
+        }
+        slot = (slot+1) & mask;
+    }
+    slots[slot] = id;
+    return 1;
+}
+
+char fami_tile_store_unique(const fami_tile_info_t *infos, size_t tiles, size_t *first,
+        size_t *unique, size_t *canonical) {
+    size_t slot_count = 16;
+    while (slot_count < tiles*2) {
+        slot_count <<= 1;
+    }
+    // one set for the ids and one for the canonical ids
+    uint32_t *ids = my_malloc(2*slot_count*sizeof(uint32_t));
+    if (!ids) {
+        return 0;
+    }
+    uint32_t *canonical_ids = ids+slot_count;
+    memset(ids, 0xFF, 2*slot_count*sizeof(uint32_t));
+
+    *unique = 0;
+    *canonical = 0;
+    for (size_t t = 0; t < tiles; t++) {
+        if (infos[t].id == FAMI_TILE_NO_ID) {
+            my_free(ids);
+            return 0;
+        }
+        if (id_set_add(ids, slot_count-1, infos[t].id)) {
+            first[(*unique)++] = t;
+            *canonical += id_set_add(canonical_ids, slot_count-1, infos[t].canonical_id);
+        }
+    }
+    my_free(ids);
+    return 1;
+}
+
+fami_tile_store_stats_t fami_tile_store_stats(fami_tile_store_t *store) {
+    store_header_t *header = header_of(store);
+    fami_tile_store_stats_t stats;
+    stats.capacity = store->capacity;
+    stats.tiles = __atomic_load_n(&header->tiles, __ATOMIC_RELAXED);
+    stats.hits = __atomic_load_n(&header->hits, __ATOMIC_RELAXED);
+    stats.misses = __atomic_load_n(&header->misses, __ATOMIC_RELAXED);
+    return stats;
+}
+
+void fami_tile_store_close(fami_tile_store_t *store) {
+    if (!store->map) {
+        return;
+    }
+    if (store->writable) {
+        store_header_t *header = header_of(store);
+        __atomic_fetch_add(&header->hits, store->hits, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&header->misses, store->misses, __ATOMIC_RELAXED);
+    }
+    munmap(store->map, store->map_len);
+    close(store->fd);
+    pthread_mutex_destroy(&store->lock);
+    store->map = NULL;
+    store->fd = -1;
+}